@@ -0,0 +1,20 @@
+#pragma once
+#include "Platform.h"
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+// Monotonic wall clock time in seconds
+static inline double GetSeconds(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+#endif
+}
@@ -0,0 +1,184 @@
+// Scans a synthetic code-like buffer for many wildcarded patterns at once, for growing pattern counts, so the cost
+// per byte can be compared across set sizes. A sample of the patterns is checked against the single pattern scanner.
+// The same is then done for a buffer of functions with common prologues and patterns taken at function starts, the
+// case where many patterns share their leading bytes.
+//
+// Usage: MultiScanBench [bufferMB=50] [patterns=10000] [threads=0]
+#include "MultiScan.h"
+#include "Scan.h"
+#include "BenchTimer.h"
+
+static ULONGLONG g_RandomState = 0x9E3779B97F4A7C15ull;
+
+static DWORD NextRandom(void)
+{
+    g_RandomState ^= g_RandomState << 13;
+    g_RandomState ^= g_RandomState >> 7;
+    g_RandomState ^= g_RandomState << 17;
+    return (DWORD)(g_RandomState >> 32);
+}
+
+// Roughly the byte mix of x64 code: plenty of padding, REX prefixes and mov opcodes between arbitrary bytes
+static void FillCodeLike(BYTE* data, size_t length)
+{
+    static const BYTE common[] = { 0x00, 0x00, 0x00, 0xCC, 0xCC, 0xFF, 0x48, 0x48, 0x8B, 0x89, 0x24, 0x4C, 0x90, 0xE8 };
+    for (size_t i = 0; i < length; i++) {
+        DWORD r = NextRandom();
+        data[i] = (r & 3) == 0 ? common[(r >> 8) % sizeof(common)] : (BYTE)(r >> 16);
+    }
+}
+
+// Frequent x64 prologues: mov [rsp+8], rbx / push rbx; sub rsp / mov [rsp+10h], rdx ...
+static const BYTE g_Prologues[][8] = {
+    { 0x48, 0x89, 0x5C, 0x24, 0x08, 0x57, 0x48, 0x83 },
+    { 0x40, 0x53, 0x48, 0x83, 0xEC, 0x20, 0x48, 0x8B },
+    { 0x48, 0x83, 0xEC, 0x28, 0x48, 0x8B, 0x05, 0x00 },
+    { 0x48, 0x89, 0x54, 0x24, 0x10, 0x48, 0x89, 0x4C },
+};
+
+// Code-like functions of 64 to 319 bytes, each starting with one of the prologues, like an x64 .text section
+static void FillPrologueHeavy(BYTE* data, size_t length, size_t* starts, size_t* numStarts)
+{
+    FillCodeLike(data, length);
+    *numStarts = 0;
+    for (size_t offset = 0; offset + sizeof(g_Prologues[0]) <= length; offset += 64 + NextRandom() % 256) {
+        memcpy(data + offset, g_Prologues[NextRandom() % (sizeof(g_Prologues) / sizeof(g_Prologues[0]))], sizeof(g_Prologues[0]));
+        starts[(*numStarts)++] = offset;
+    }
+}
+
+typedef struct BenchPattern {
+    BYTE bytes[32];
+    BYTE mask[32];
+    DWORD length;
+} BenchPattern;
+
+// Most patterns are taken from the buffer, so they match at least once, and a third of those have a rel32 sized
+// wildcard like a masked call target
+static void MakePatterns(const BYTE* data, size_t length, struct BenchPattern* patterns, DWORD count)
+{
+    for (DWORD i = 0; i < count; i++) {
+        struct BenchPattern* p = &patterns[i];
+        p->length = 12 + NextRandom() % 21;
+        if (i % 5 == 4) {
+            for (DWORD j = 0; j < p->length; j++) p->bytes[j] = (BYTE)NextRandom();
+        }
+        else {
+            size_t offset = ((size_t)NextRandom() << 16 ^ NextRandom()) % (length - p->length);
+            memcpy(p->bytes, data + offset, p->length);
+        }
+        memset(p->mask, 0xFF, p->length);
+        if (i % 3 == 0) memset(p->mask + 1 + NextRandom() % (p->length - 5), 0x00, 4);
+    }
+}
+
+// Signatures of functions: patterns start at a function, so the first eight bytes are one of the few prologues
+static void MakeFunctionPatterns(const BYTE* data, size_t length, const size_t* starts, size_t numStarts, struct BenchPattern* patterns, DWORD count)
+{
+    for (DWORD i = 0; i < count; i++) {
+        struct BenchPattern* p = &patterns[i];
+        p->length = 16 + NextRandom() % 17;
+        size_t offset;
+        do offset = starts[((size_t)NextRandom() << 16 ^ NextRandom()) % numStarts];
+        while (offset + p->length > length);
+        memcpy(p->bytes, data + offset, p->length);
+        memset(p->mask, 0xFF, p->length);
+        // the wildcards leave at least four compared bytes after the prologue
+        if (i % 3 == 0) memset(p->mask + 8 + NextRandom() % (p->length - 15), 0x00, 4);
+    }
+}
+
+static BOOL RunPass(const struct BenchPattern* patterns, DWORD count, struct ThreadPool* pPool, const BYTE* data, size_t length, BOOL verify)
+{
+    struct MultiScanner scanner = { 0 };
+    double start = GetSeconds();
+    Error e = NewNoError();
+    for (DWORD i = 0; i < count && !e.ContainsError; i++) {
+        DWORD index;
+        e = AddMultiScanPattern(&scanner, patterns[i].bytes, patterns[i].mask, patterns[i].length, &index);
+    }
+    if (!e.ContainsError) e = CompileMultiScanner(&scanner);
+    double compiled = GetSeconds();
+
+    struct MultiScanMatch* matches = NULL;
+    size_t numMatches = 0;
+    if (!e.ContainsError) e = FindMultiScanMatches(&scanner, pPool, data, length, &matches, &numMatches);
+    double scanned = GetSeconds();
+    if (e.ContainsError) {
+        fwprintf(stderr, L"[-] Multi-pattern scan failed: %ls\n", e.Format(&e));
+        Error_Free(&e);
+        FreeMultiScanner(&scanner);
+        return FALSE;
+    }
+
+    wprintf(L"%6lu patterns: compile %7.2f ms, scan %8.2f ms, %7.1f MB/s, %zu matches\n", count,
+        (compiled - start) * 1000.0, (scanned - compiled) * 1000.0, length / (scanned - compiled) / (1024.0 * 1024.0), numMatches);
+
+    BOOL ok = TRUE;
+    if (verify) {
+        // every 50th pattern against the single pattern scanner
+        size_t* counts = (size_t*)calloc(count, sizeof(size_t));
+        for (size_t i = 0; counts && i < numMatches; i++) counts[matches[i].pattern]++;
+        for (DWORD i = 0; counts && i < count; i += 50) {
+            size_t expected = ScanCountMatchesMasked(data, length, patterns[i].bytes, patterns[i].mask, patterns[i].length, (size_t)-1);
+            if (expected != counts[i]) {
+                fwprintf(stderr, L"[-] Pattern %lu: %zu matches, single pattern scan found %zu\n", i, counts[i], expected);
+                ok = FALSE;
+            }
+        }
+        if (ok && counts) wprintf(L"        verified %lu patterns against the single pattern scanner\n", (count + 49) / 50);
+        free(counts);
+    }
+
+    free(matches);
+    FreeMultiScanner(&scanner);
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t length = (size_t)(argc > 1 ? atoi(argv[1]) : 50) * 1024 * 1024;
+    DWORD maxPatterns = argc > 2 ? (DWORD)atoi(argv[2]) : 10000;
+    DWORD threads = argc > 3 ? (DWORD)atoi(argv[3]) : 0;
+    if (length < 1024 || maxPatterns == 0) {
+        fwprintf(stderr, L"Usage: MultiScanBench [bufferMB=50] [patterns=10000] [threads=0]\n");
+        return 1;
+    }
+
+    BYTE* data = (BYTE*)malloc(length);
+    struct BenchPattern* patterns = (struct BenchPattern*)malloc(maxPatterns * sizeof(struct BenchPattern));
+    size_t* starts = (size_t*)malloc((length / 64 + 1) * sizeof(size_t));
+    if (!data || !patterns || !starts) {
+        fwprintf(stderr, L"[-] malloc failed, out of memory\n");
+        return 1;
+    }
+    FillCodeLike(data, length);
+    MakePatterns(data, length, patterns, maxPatterns);
+
+    struct ThreadPool pool;
+    Error e = CreateThreadPool(threads, &pool);
+    if (e.ContainsError) {
+        fwprintf(stderr, L"[-] Failed to start scan threads: %ls\n", e.Format(&e));
+        return 1;
+    }
+    wprintf(L"%zu MB buffer, %lu thread(s)\n", length / (1024 * 1024), pool.numThreads);
+
+    BOOL ok = TRUE;
+    for (DWORD count = 10; count < maxPatterns; count *= 10)
+        ok &= RunPass(patterns, count, &pool, data, length, FALSE);
+    ok &= RunPass(patterns, maxPatterns, &pool, data, length, TRUE);
+
+    size_t numStarts;
+    FillPrologueHeavy(data, length, starts, &numStarts);
+    MakeFunctionPatterns(data, length, starts, numStarts, patterns, maxPatterns);
+    wprintf(L"%zu functions with common prologues, patterns at function starts\n", numStarts);
+    for (DWORD count = 10; count < maxPatterns; count *= 10)
+        ok &= RunPass(patterns, count, &pool, data, length, FALSE);
+    ok &= RunPass(patterns, maxPatterns, &pool, data, length, TRUE);
+
+    FreeThreadPool(&pool);
+    free(starts);
+    free(patterns);
+    free(data);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,212 @@
+// Runs every scan kernel the CPU supports on the same synthetic buffers and checks each against a plain byte by byte
+// search: data and pattern lengths around the 16 and 32 byte vector widths, matches at every offset so some straddle
+// a vector boundary, wildcard masks and match limits. Then times each kernel on a code-like buffer. Exits with 1 if
+// any kernel disagrees, so it can gate CI.
+//
+// Usage: ScanKernelBench [bufferMB=64]
+#include "Scan.h"
+#include "BenchTimer.h"
+
+static const ScanKernel g_Kernels[] = { SCAN_KERNEL_SCALAR, SCAN_KERNEL_SSE2, SCAN_KERNEL_AVX2 };
+#define NUM_KERNELS (sizeof(g_Kernels) / sizeof(g_Kernels[0]))
+
+// Lengths on both sides of the vector widths, and a few that span several vectors
+static const size_t g_DataLengths[] = { 0, 1, 2, 15, 16, 17, 31, 32, 33, 47, 48, 49, 63, 64, 65, 100, 257 };
+static const size_t g_PatternLengths[] = { 0, 1, 2, 3, 15, 16, 17, 31, 32, 33 };
+static const size_t g_Limits[] = { 0, 1, 2, 3, (size_t)-1 };
+
+static ULONGLONG g_RandomState = 0x2545F4914F6CDD1Dull;
+static ULONGLONG g_NumChecks = 0;
+static BOOL g_Failed = FALSE;
+
+static DWORD NextRandom(void)
+{
+    g_RandomState ^= g_RandomState << 13;
+    g_RandomState ^= g_RandomState >> 7;
+    g_RandomState ^= g_RandomState << 17;
+    return (DWORD)(g_RandomState >> 32);
+}
+
+// The reference every kernel is compared with. A NULL mask compares every byte.
+static size_t FindNextReference(const BYTE* data, size_t dataLength, const BYTE* pattern, const BYTE* mask, size_t patternLength, size_t start)
+{
+    if (patternLength == 0 || patternLength > dataLength || start > dataLength - patternLength) return SCAN_NOT_FOUND;
+    for (size_t i = start; i + patternLength <= dataLength; i++) {
+        size_t j = 0;
+        while (j < patternLength && ((data[i + j] ^ pattern[j]) & (mask ? mask[j] : 0xFF)) == 0) j++;
+        if (j == patternLength) return i;
+    }
+    return SCAN_NOT_FOUND;
+}
+
+static size_t CountMatchesReference(const BYTE* data, size_t dataLength, const BYTE* pattern, const BYTE* mask, size_t patternLength, size_t maxMatches)
+{
+    size_t count = 0;
+    size_t position = FindNextReference(data, dataLength, pattern, mask, patternLength, 0);
+    while (count < maxMatches && position != SCAN_NOT_FOUND) {
+        count++;
+        position = FindNextReference(data, dataLength, pattern, mask, patternLength, position + 1);
+    }
+    return count;
+}
+
+static void Mismatch(const char* function, size_t dataLength, size_t patternLength, size_t argument, size_t result, size_t expected)
+{
+    fprintf(stderr, "[-] %s kernel: %s with data length %zu, pattern length %zu, argument %zu returned %td, expected %td\n",
+        GetScanKernelName(GetScanKernel()), function, dataLength, patternLength, argument, (ptrdiff_t)result, (ptrdiff_t)expected);
+    g_Failed = TRUE;
+}
+
+// Every start position and every limit, exact and masked. The data is copied to a buffer of exactly its length so
+// a kernel reading past the end shows up under a sanitizer.
+static void CheckCase(const BYTE* source, size_t dataLength, const BYTE* pattern, const BYTE* mask, size_t patternLength)
+{
+    BYTE* data = (BYTE*)malloc(dataLength ? dataLength : 1);
+    if (!data) {
+        fprintf(stderr, "[-] malloc failed, out of memory\n");
+        exit(1);
+    }
+    memcpy(data, source, dataLength);
+
+    for (size_t start = 0; start <= dataLength + 1; start++) {
+        size_t expected = FindNextReference(data, dataLength, pattern, NULL, patternLength, start);
+        size_t result = ScanFindNext(data, dataLength, pattern, patternLength, start);
+        if (result != expected) Mismatch("ScanFindNext", dataLength, patternLength, start, result, expected);
+
+        expected = FindNextReference(data, dataLength, pattern, mask, patternLength, start);
+        result = ScanFindNextMasked(data, dataLength, pattern, mask, patternLength, start);
+        if (result != expected) Mismatch("ScanFindNextMasked", dataLength, patternLength, start, result, expected);
+        g_NumChecks += 2;
+    }
+    for (size_t i = 0; i < sizeof(g_Limits) / sizeof(g_Limits[0]); i++) {
+        size_t expected = CountMatchesReference(data, dataLength, pattern, NULL, patternLength, g_Limits[i]);
+        size_t result = ScanCountMatches(data, dataLength, pattern, patternLength, g_Limits[i]);
+        if (result != expected) Mismatch("ScanCountMatches", dataLength, patternLength, g_Limits[i], result, expected);
+
+        expected = CountMatchesReference(data, dataLength, pattern, mask, patternLength, g_Limits[i]);
+        result = ScanCountMatchesMasked(data, dataLength, pattern, mask, patternLength, g_Limits[i]);
+        if (result != expected) Mismatch("ScanCountMatchesMasked", dataLength, patternLength, g_Limits[i], result, expected);
+        g_NumChecks += 2;
+    }
+    free(data);
+}
+
+// Wildcards on about a quarter of the bytes, or on all but one or all of them
+static void MakeMask(BYTE* mask, size_t length, DWORD variant)
+{
+    for (size_t i = 0; i < length; i++) {
+        switch (variant % 4) {
+        case 0: mask[i] = 0xFF; break;
+        case 1: mask[i] = (NextRandom() & 3) == 0 ? 0x00 : 0xFF; break;
+        case 2: mask[i] = i == length / 2 ? 0xFF : 0x00; break;
+        default: mask[i] = 0x00; break;
+        }
+    }
+}
+
+// Data from two byte values, so short patterns match often and longer ones now and then
+static void CheckDenseMatches(void)
+{
+    BYTE data[257], pattern[33], mask[33];
+    for (size_t d = 0; d < sizeof(g_DataLengths) / sizeof(g_DataLengths[0]); d++) {
+        size_t dataLength = g_DataLengths[d];
+        for (size_t p = 0; p < sizeof(g_PatternLengths) / sizeof(g_PatternLengths[0]); p++) {
+            size_t patternLength = g_PatternLengths[p];
+            for (DWORD variant = 0; variant < 8; variant++) {
+                for (size_t i = 0; i < dataLength; i++) data[i] = (NextRandom() & 1) ? 0x48 : 0x8B;
+                for (size_t i = 0; i < patternLength; i++) pattern[i] = (NextRandom() & 1) ? 0x48 : 0x8B;
+                // half of the patterns are cut from the data, so they match at least once
+                if (variant >= 4 && patternLength && patternLength <= dataLength)
+                    memcpy(pattern, data + NextRandom() % (dataLength - patternLength + 1), patternLength);
+                MakeMask(mask, patternLength, variant);
+                CheckCase(data, dataLength, pattern, mask, patternLength);
+            }
+        }
+    }
+}
+
+// One pattern in filler it does not occur in, at every offset, so its first and last bytes land in every lane and
+// on both sides of each vector boundary
+static void CheckEveryOffset(void)
+{
+    BYTE data[128], pattern[33], mask[33];
+    for (size_t p = 0; p < sizeof(g_PatternLengths) / sizeof(g_PatternLengths[0]); p++) {
+        size_t patternLength = g_PatternLengths[p];
+        for (size_t i = 0; i < patternLength; i++) pattern[i] = (BYTE)(0x10 + NextRandom() % 0x80);
+        MakeMask(mask, patternLength, 1);
+        for (size_t offset = 0; offset + patternLength <= sizeof(data); offset++) {
+            memset(data, 0xCC, sizeof(data));
+            memcpy(data + offset, pattern, patternLength);
+            CheckCase(data, sizeof(data), pattern, mask, patternLength);
+            // and ending exactly at the end of the data
+            CheckCase(data, offset + patternLength, pattern, mask, patternLength);
+        }
+    }
+}
+
+// Roughly the byte mix of x64 code, like MultiScanBench
+static void FillCodeLike(BYTE* data, size_t length)
+{
+    static const BYTE common[] = { 0x00, 0x00, 0x00, 0xCC, 0xCC, 0xFF, 0x48, 0x48, 0x8B, 0x89, 0x24, 0x4C, 0x90, 0xE8 };
+    for (size_t i = 0; i < length; i++) {
+        DWORD r = NextRandom();
+        data[i] = (r & 3) == 0 ? common[(r >> 8) % sizeof(common)] : (BYTE)(r >> 16);
+    }
+}
+
+// Best of three full scans for a pattern that starts and ends with common code bytes, the usual signature shape
+static void TimeKernel(const BYTE* data, size_t length)
+{
+    static const BYTE pattern[16] = { 0x48, 0x8B, 0x05, 0x11, 0x22, 0x33, 0x44, 0x48, 0x85, 0xC0, 0x74, 0x55, 0x66, 0x77, 0x88, 0x48 };
+    BYTE mask[16];
+    memset(mask, 0xFF, sizeof(mask));
+    memset(mask + 3, 0x00, 4);
+
+    double exact = 1e30, masked = 1e30;
+    size_t exactMatches = 0, maskedMatches = 0;
+    for (int run = 0; run < 3; run++) {
+        double start = GetSeconds();
+        exactMatches = ScanCountMatches(data, length, pattern, sizeof(pattern), (size_t)-1);
+        double middle = GetSeconds();
+        maskedMatches = ScanCountMatchesMasked(data, length, pattern, mask, sizeof(pattern), (size_t)-1);
+        double end = GetSeconds();
+        if (middle - start < exact) exact = middle - start;
+        if (end - middle < masked) masked = end - middle;
+    }
+    printf("%-8s exact %8.2f GB/s (%zu matches), masked %8.2f GB/s (%zu matches)\n", GetScanKernelName(GetScanKernel()),
+        (double)length / exact / 1e9, exactMatches, (double)length / masked / 1e9, maskedMatches);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t length = (size_t)(argc > 1 ? atoi(argv[1]) : 64) * 1024 * 1024;
+    if (length == 0) {
+        fprintf(stderr, "Usage: ScanKernelBench [bufferMB=64]\n");
+        return 1;
+    }
+    BYTE* data = (BYTE*)malloc(length);
+    if (!data) {
+        fprintf(stderr, "[-] malloc failed, out of memory\n");
+        return 1;
+    }
+    FillCodeLike(data, length);
+
+    for (size_t k = 0; k < NUM_KERNELS; k++) {
+        if (!SetScanKernel(g_Kernels[k])) {
+            printf("%-8s not supported by this CPU\n", GetScanKernelName(g_Kernels[k]));
+            continue;
+        }
+        g_NumChecks = 0;
+        CheckDenseMatches();
+        CheckEveryOffset();
+        printf("%-8s %llu results checked against the reference search\n", GetScanKernelName(g_Kernels[k]), (unsigned long long)g_NumChecks);
+    }
+    for (size_t k = 0; k < NUM_KERNELS; k++) {
+        if (SetScanKernel(g_Kernels[k])) TimeKernel(data, length);
+    }
+    SetScanKernel(SCAN_KERNEL_AUTO);
+
+    free(data);
+    if (g_Failed) fprintf(stderr, "[-] Scan kernels disagree\n");
+    return g_Failed ? 1 : 0;
+}
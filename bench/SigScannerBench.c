@@ -0,0 +1,427 @@
+// Generates a synthetic PE64 image and PDB, then times the hot paths of SigScanner on them: header parsing,
+// RVA to offset translation, uniqueness scans, minimal unique signature searches and symbol lookups. Runs anywhere
+// the portable modules build, without real Windows binaries. Exits with 1 if any result is wrong, so it can gate CI.
+//
+// Usage: SigScannerBench [--code-mb <n>] [--sections <n>] [--data-mb <n>] [--duplicates <percent>] [--seed <n>]
+//                        [--threads <n>] [--dir <path>] [--keep]
+#include "BenchTimer.h"
+#include "SyntheticImage.h"
+#include "Signature.h"
+#include "SymbolIndex.h"
+
+#define SIGNATURE_LENGTH 16
+
+typedef struct BenchOptions {
+    struct SyntheticImageOptions image;
+    DWORD threads;
+    const char* directory;
+    BOOL keepFiles;
+} BenchOptions;
+
+static BOOL g_Failed = FALSE;
+
+static void Report(const char* name, ULONGLONG operations, double seconds, ULONGLONG bytes)
+{
+    printf("%-30s %10llu ops %12.1f ns/op", name, (unsigned long long)operations, seconds * 1e9 / (double)(operations ? operations : 1));
+    if (bytes) printf(" %8.2f GB/s", (double)bytes / seconds / 1e9);
+    printf("\n");
+}
+
+static void Fail(const char* what, Error* e)
+{
+    char* message = NULL;
+    if (e && e->ContainsError) {
+        wchar_t* formatted = e->Format(e);
+        message = formatted ? WideToUtf8(formatted) : NULL;
+        free(formatted);
+        Error_Free(e);
+    }
+    fprintf(stderr, "[-] %s%s%s\n", what, message ? ": " : "", message ? message : "");
+    free(message);
+    g_Failed = TRUE;
+}
+
+// Paths are ASCII here, so widening byte by byte is enough
+static WCHAR* MakePath(const char* directory, const char* fileName)
+{
+    size_t length = strlen(directory) + 1 + strlen(fileName) + 1;
+    WCHAR* path = (WCHAR*)malloc(length * sizeof(WCHAR));
+    if (!path) return NULL;
+    size_t n = 0;
+    for (const char* p = directory; *p; p++) path[n++] = (WCHAR)(unsigned char)*p;
+    path[n++] = L'/';
+    for (const char* p = fileName; *p; p++) path[n++] = (WCHAR)(unsigned char)*p;
+    path[n] = L'\0';
+    return path;
+}
+
+static BOOL ParseOptions(int argc, char* argv[], struct BenchOptions* options)
+{
+    memset(options, 0, sizeof(struct BenchOptions));
+    options->image.codeSize = 4 * 1024 * 1024;
+    options->image.numCodeSections = 2;
+    options->image.dataSize = 1024 * 1024;
+    options->image.duplicatePercent = 30;
+    options->image.seed = 1;
+    options->directory = ".";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--code-mb") == 0 && i + 1 < argc) options->image.codeSize = (DWORD)atoi(argv[++i]) * 1024 * 1024;
+        else if (strcmp(argv[i], "--sections") == 0 && i + 1 < argc) options->image.numCodeSections = (DWORD)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--data-mb") == 0 && i + 1 < argc) options->image.dataSize = (DWORD)atoi(argv[++i]) * 1024 * 1024;
+        else if (strcmp(argv[i], "--duplicates") == 0 && i + 1 < argc) options->image.duplicatePercent = (DWORD)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) options->image.seed = (DWORD)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) options->threads = (DWORD)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) options->directory = argv[++i];
+        else if (strcmp(argv[i], "--keep") == 0) options->keepFiles = TRUE;
+        else return FALSE;
+    }
+    return TRUE;
+}
+
+static void BenchHeaders(LPCWSTR imagePath)
+{
+    const DWORD iterations = 2000;
+    double start = GetSeconds();
+    for (DWORD i = 0; i < iterations; i++) {
+        struct ImageView image;
+        Error e = MapImageView(imagePath, &image);
+        if (e.ContainsError) {
+            Fail("MapImageView failed", &e);
+            return;
+        }
+        UnmapImageView(&image);
+    }
+    Report("map + parse headers", iterations, GetSeconds() - start, 0);
+}
+
+static void BenchRvaToOffset(const struct ImageView* pImage, const struct SyntheticImage* pSynthetic)
+{
+    const DWORD iterations = 10000000;
+    ULONGLONG checksum = 0;
+    double start = GetSeconds();
+    for (DWORD i = 0; i < iterations; i++) {
+        DWORD rva = pSynthetic->functions[(i * 2654435761u) % pSynthetic->numFunctions].rva;
+        checksum += RvaToOffset(rva, pImage->sections, pImage->numSections);
+    }
+    double seconds = GetSeconds() - start;
+    if (checksum == 0) Fail("RvaToOffset returned no offsets", NULL);
+    Report("rva -> offset", iterations, seconds, 0);
+}
+
+static ULONGLONG GetScannedBytes(const struct ScanScope* pScope)
+{
+    ULONGLONG bytes = 0;
+    for (DWORD r = 0; r < pScope->numRegions; r++) bytes += pScope->regions[r].bytesScanned;
+    return bytes;
+}
+
+// Spreads the picks over the image, choosing either original functions or near duplicates
+static DWORD PickFunction(const struct SyntheticImage* pSynthetic, DWORD i, BOOL duplicate)
+{
+    for (DWORD attempt = 0; attempt < pSynthetic->numFunctions; attempt++) {
+        DWORD index = (i * 2654435761u + attempt) % pSynthetic->numFunctions;
+        const struct SyntheticFunction* function = &pSynthetic->functions[index];
+        if ((function->duplicateOf != index) == duplicate && function->size >= SIGNATURE_LENGTH) return index;
+    }
+    return i % pSynthetic->numFunctions;
+}
+
+static void BenchUniquenessScan(const struct ImageView* pImage, struct ScanScope* pScope, const struct SyntheticImage* pSynthetic)
+{
+    const DWORD iterations = 200;
+    ULONGLONG bytesBefore = GetScannedBytes(pScope);
+    double start = GetSeconds();
+    for (DWORD i = 0; i < iterations; i++) {
+        const struct SyntheticFunction* function = &pSynthetic->functions[PickFunction(pSynthetic, i, FALSE)];
+        const BYTE* signature = GetSpanByRva(pImage, function->rva, SIGNATURE_LENGTH);
+        BOOL unique;
+        Error e = CheckForUniqueSignature(pScope, signature, SIGNATURE_LENGTH, &unique);
+        if (e.ContainsError) {
+            Fail("CheckForUniqueSignature failed", &e);
+            return;
+        }
+    }
+    double seconds = GetSeconds() - start;
+    Report("uniqueness scan (16 bytes)", iterations, seconds, GetScannedBytes(pScope) - bytesBefore);
+}
+
+static void BenchMinimalUnique(const struct ImageView* pImage, struct ScanScope* pScope, const struct SuffixIndex* pIndex, const struct SyntheticImage* pSynthetic, BOOL masked)
+{
+    const DWORD iterations = 100;
+    ULONGLONG bytesBefore = GetScannedBytes(pScope);
+    DWORD totalLength = 0;
+    double start = GetSeconds();
+    for (DWORD i = 0; i < iterations; i++) {
+        // near duplicates, which need the longest signatures
+        const struct SyntheticFunction* function = &pSynthetic->functions[PickFunction(pSynthetic, i, TRUE)];
+        BYTE* signature = NULL, * mask = NULL, * uniqueSignature = NULL, * uniqueMask = NULL;
+        DWORD uniqueLength = 0;
+        BOOL isUnique = FALSE;
+        Error e = GetFunctionSignatureFromPE(pImage, 8, (int)function->rva, &signature);
+        if (!e.ContainsError && masked) e = GetFunctionSignatureMask(pImage, 8, (int)function->rva, &mask);
+        if (!e.ContainsError) {
+            if (masked) e = FindUniqueMaskedSignature(pImage, pScope, signature, mask, 8, (int)function->rva, &isUnique, &uniqueSignature, &uniqueMask, &uniqueLength);
+            else e = FindUniqueSignature(pImage, pScope, pIndex, signature, 8, (int)function->rva, &isUnique, &uniqueSignature, &uniqueLength);
+        }
+        // a copy with its only difference past the end of the section has no unique signature, which is expected
+        if (e.ContainsError && e.ErrorCode == -2) {
+            Error_Free(&e);
+            e = NewNoError();
+        }
+        if (e.ContainsError) {
+            Fail(masked ? "FindUniqueMaskedSignature failed" : "FindUniqueSignature failed", &e);
+            free(signature);
+            free(mask);
+            return;
+        }
+        totalLength += isUnique ? 8 : uniqueLength;
+        free(signature);
+        free(mask);
+        free(uniqueSignature);
+        free(uniqueMask);
+    }
+    double seconds = GetSeconds() - start;
+
+    char name[64];
+    snprintf(name, sizeof(name), "minimal unique (%s)", masked ? "masked scan" : pIndex ? "index" : "scan");
+    Report(name, iterations, seconds, GetScannedBytes(pScope) - bytesBefore);
+    printf("%-30s %10.1f bytes on average\n", "", (double)totalLength / iterations);
+}
+
+// Scans for the benchmark's signatures once on the calling thread and once on a pool of several threads, and
+// fails on any difference: the RVA of every match, including the many matches of short prefixes that cross chunk
+// boundaries, and the minimal unique signatures, exact and masked
+static void CheckThreadedScans(const struct ImageView* pImage, struct ScanScope* pScope, const struct SyntheticImage* pSynthetic)
+{
+    // the check needs real workers even when the benchmark itself runs on one thread
+    struct ThreadPool localPool;
+    struct ThreadPool* pPool = pScope->pThreadPool;
+    memset(&localPool, 0, sizeof(localPool));
+    if (!pPool || pPool->numThreads < 2) {
+        DWORD numThreads = GetProcessorCount() < 4 ? 4 : GetProcessorCount();
+        Error e = CreateThreadPool(numThreads, &localPool);
+        if (e.ContainsError) {
+            Fail("CreateThreadPool failed", &e);
+            return;
+        }
+        pPool = &localPool;
+    }
+
+    static const DWORD lengths[] = { 3, 8, SIGNATURE_LENGTH };
+    const DWORD numFunctions = 40;
+    struct ThreadPool* scopePool = pScope->pThreadPool;
+    ULONGLONG comparedMatches = 0;
+    DWORD mismatches = 0;
+    double start = GetSeconds();
+    for (DWORD i = 0; i < numFunctions && !g_Failed; i++) {
+        const struct SyntheticFunction* function = &pSynthetic->functions[PickFunction(pSynthetic, i, i % 2 == 1)];
+        for (DWORD l = 0; l < _countof(lengths) && !g_Failed; l++) {
+            for (int masked = 0; masked < 2 && !g_Failed; masked++) {
+                BYTE* signature = NULL, * mask = NULL;
+                Error e = GetFunctionSignatureFromPE(pImage, lengths[l], (int)function->rva, &signature);
+                if (!e.ContainsError && masked) e = GetFunctionSignatureMask(pImage, lengths[l], (int)function->rva, &mask);
+
+                DWORD* rvas[2] = { NULL, NULL };
+                size_t counts[2] = { 0, 0 };
+                BYTE* unique[2] = { NULL, NULL }, * uniqueMask[2] = { NULL, NULL };
+                DWORD uniqueLength[2] = { 0, 0 };
+                BOOL isUnique[2] = { FALSE, FALSE };
+                Error uniqueError[2] = { NewNoError(), NewNoError() };
+                for (int run = 0; run < 2 && !e.ContainsError; run++) {
+                    pScope->pThreadPool = run ? pPool : NULL;
+                    e = FindSignatureRvas(pScope, signature, mask, lengths[l], &rvas[run], &counts[run]);
+                    if (e.ContainsError) break;
+                    uniqueError[run] = masked
+                        ? FindUniqueMaskedSignature(pImage, pScope, signature, mask, lengths[l], (int)function->rva, &isUnique[run], &unique[run], &uniqueMask[run], &uniqueLength[run])
+                        : FindUniqueSignature(pImage, pScope, NULL, signature, lengths[l], (int)function->rva, &isUnique[run], &unique[run], &uniqueLength[run]);
+                }
+                pScope->pThreadPool = scopePool;
+                if (e.ContainsError) {
+                    Fail("Scanning for the thread check failed", &e);
+                } else {
+                    comparedMatches += counts[0];
+                    BOOL same = counts[0] == counts[1] && memcmp(rvas[0], rvas[1], counts[0] * sizeof(DWORD)) == 0;
+                    // a near duplicate may have no unique signature before the end of its section, on any thread count
+                    same = same && uniqueError[0].ContainsError == uniqueError[1].ContainsError;
+                    if (same && !uniqueError[0].ContainsError) {
+                        same = isUnique[0] == isUnique[1];
+                        if (same && !isUnique[0]) same = uniqueLength[0] == uniqueLength[1] && memcmp(unique[0], unique[1], uniqueLength[0]) == 0;
+                    }
+                    if (!same) {
+                        fprintf(stderr, "[-] %lu-byte %s signature of %s: %zu match(es) and length %lu on one thread, %zu and %lu on %lu\n",
+                            (unsigned long)lengths[l], masked ? "masked" : "exact", function->name, counts[0], (unsigned long)uniqueLength[0],
+                            counts[1], (unsigned long)uniqueLength[1], (unsigned long)pPool->numThreads);
+                        mismatches++;
+                    }
+                }
+                for (int run = 0; run < 2; run++) {
+                    Error_Free(&uniqueError[run]);
+                    free(rvas[run]);
+                    free(unique[run]);
+                    free(uniqueMask[run]);
+                }
+                free(signature);
+                free(mask);
+            }
+        }
+    }
+    Report("1 vs n thread scan check", numFunctions * _countof(lengths) * 2, GetSeconds() - start, 0);
+    printf("%-30s %10llu match(es) compared, %lu mismatch(es) on %lu threads\n", "", (unsigned long long)comparedMatches,
+        (unsigned long)mismatches, (unsigned long)pPool->numThreads);
+    if (mismatches) g_Failed = TRUE;
+    if (pPool == &localPool) FreeThreadPool(&localPool);
+}
+
+static void BenchSuffixIndex(const struct ImageView* pImage, const struct SyntheticImage* pSynthetic, struct SuffixIndex* pIndex)
+{
+    double start = GetSeconds();
+    Error e = BuildSuffixIndex(pImage, &pSynthetic->guid, pSynthetic->age, pIndex);
+    double seconds = GetSeconds() - start;
+    if (e.ContainsError) {
+        Fail("BuildSuffixIndex failed", &e);
+        return;
+    }
+    Report("suffix index build", 1, seconds, pIndex->header->textLength);
+
+    start = GetSeconds();
+    if (!VerifySuffixIndex(pIndex)) Fail("The built suffix index is inconsistent", NULL);
+    Report("suffix index verify", 1, GetSeconds() - start, pIndex->header->textLength);
+
+    start = GetSeconds();
+    DWORD unresolved = 0;
+    for (DWORD i = 0; i < pSynthetic->numFunctions; i++)
+        unresolved += GetMinimalUniqueLength(pIndex, pSynthetic->functions[i].rva) == 0;
+    Report("minimal unique length (index)", pSynthetic->numFunctions, GetSeconds() - start, 0);
+    printf("%-30s %10lu function(s) without a unique signature\n", "", (unsigned long)unresolved);
+}
+
+static void BenchSymbols(LPCWSTR pdbPath, const struct SyntheticImage* pSynthetic)
+{
+    const DWORD opens = 200;
+    double start = GetSeconds();
+    for (DWORD i = 0; i < opens; i++) {
+        struct PdbFile pdb;
+        Error e = OpenPdbFile(pdbPath, &pdb);
+        if (e.ContainsError) {
+            Fail("OpenPdbFile failed", &e);
+            return;
+        }
+        ClosePdbFile(&pdb);
+    }
+    Report("pdb open", opens, GetSeconds() - start, 0);
+
+    struct PdbFile pdb;
+    Error e = OpenPdbFile(pdbPath, &pdb);
+    if (e.ContainsError) {
+        Fail("OpenPdbFile failed", &e);
+        return;
+    }
+
+    const DWORD lookups = 200000;
+    DWORD wrong = 0;
+    start = GetSeconds();
+    for (DWORD i = 0; i < lookups; i++) {
+        const struct SyntheticFunction* function = &pSynthetic->functions[(i * 2654435761u) % pSynthetic->numFunctions];
+        struct PdbSymbol symbol;
+        if (!PdbFindSymbol(&pdb, function->name, &symbol) || symbol.rva != function->rva || symbol.size != function->size) wrong++;
+    }
+    Report("symbol lookup (pdb)", lookups, GetSeconds() - start, 0);
+
+    struct SymbolIndex index;
+    start = GetSeconds();
+    e = BuildSymbolIndex(&pdb, &pSynthetic->guid, pSynthetic->age, &index);
+    double seconds = GetSeconds() - start;
+    ClosePdbFile(&pdb);
+    if (e.ContainsError) {
+        Fail("BuildSymbolIndex failed", &e);
+        return;
+    }
+    Report("symbol index build", 1, seconds, 0);
+
+    start = GetSeconds();
+    for (DWORD i = 0; i < lookups; i++) {
+        const struct SyntheticFunction* function = &pSynthetic->functions[(i * 2654435761u) % pSynthetic->numFunctions];
+        struct PdbSymbol symbol;
+        if (!FindIndexedSymbol(&index, function->name, &symbol) || symbol.rva != function->rva) wrong++;
+    }
+    Report("symbol lookup (index)", lookups, GetSeconds() - start, 0);
+    FreeSymbolIndex(&index);
+
+    if (wrong) {
+        fprintf(stderr, "[-] %lu symbol lookup(s) returned a wrong RVA or size\n", (unsigned long)wrong);
+        g_Failed = TRUE;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    struct BenchOptions options;
+    if (!ParseOptions(argc, argv, &options)) {
+        fprintf(stderr, "Usage: SigScannerBench [--code-mb <n>] [--sections <n>] [--data-mb <n>] [--duplicates <percent>] [--seed <n>] [--threads <n>] [--dir <path>] [--keep]\n");
+        return 1;
+    }
+
+    struct SyntheticImage synthetic;
+    double start = GetSeconds();
+    Error e = GenerateSyntheticImage(&options.image, &synthetic);
+    if (e.ContainsError) {
+        Fail("Generating the synthetic image failed", &e);
+        return 1;
+    }
+    printf("Synthetic image: %lu functions, %.1f MB image, %.1f MB PDB, generated in %.0f ms\n", (unsigned long)synthetic.numFunctions,
+        synthetic.imageSize / 1048576.0, synthetic.pdbSize / 1048576.0, (GetSeconds() - start) * 1000.0);
+
+    WCHAR* imagePath = MakePath(options.directory, "synthetic.exe");
+    WCHAR* pdbPath = MakePath(options.directory, "synthetic.pdb");
+    if (!imagePath || !pdbPath) {
+        Fail("malloc failed, out of memory", NULL);
+        return 1;
+    }
+    e = WriteSyntheticImage(&synthetic, imagePath, pdbPath);
+    if (e.ContainsError) {
+        Fail("Writing the synthetic image failed", &e);
+        return 1;
+    }
+
+    struct ImageView image;
+    struct ScanScope scope;
+    struct ThreadPool pool;
+    struct SuffixIndex index;
+    memset(&index, 0, sizeof(index));
+    e = MapImageView(imagePath, &image);
+    if (e.ContainsError) {
+        Fail("MapImageView failed", &e);
+        return 1;
+    }
+    e = CreateScanScope(&image, NULL, SCAN_LAYOUT_FILE, &scope);
+    if (!e.ContainsError) e = CreateThreadPool(options.threads, &pool);
+    if (e.ContainsError) {
+        Fail("Preparing the scan failed", &e);
+        return 1;
+    }
+    scope.pThreadPool = &pool;
+    printf("Scan scope: %lu section(s), %lu thread(s)\n\n", (unsigned long)scope.numRegions, (unsigned long)pool.numThreads);
+
+    BenchHeaders(imagePath);
+    BenchRvaToOffset(&image, &synthetic);
+    BenchUniquenessScan(&image, &scope, &synthetic);
+    BenchMinimalUnique(&image, &scope, NULL, &synthetic, FALSE);
+    BenchMinimalUnique(&image, &scope, NULL, &synthetic, TRUE);
+    CheckThreadedScans(&image, &scope, &synthetic);
+    BenchSuffixIndex(&image, &synthetic, &index);
+    if (index.header) BenchMinimalUnique(&image, &scope, &index, &synthetic, FALSE);
+    BenchSymbols(pdbPath, &synthetic);
+
+    FreeSuffixIndex(&index);
+    FreeThreadPool(&pool);
+    FreeScanScope(&scope);
+    UnmapImageView(&image);
+    if (!options.keepFiles) {
+        RemoveFileW(imagePath);
+        RemoveFileW(pdbPath);
+    }
+    free(imagePath);
+    free(pdbPath);
+    FreeSyntheticImage(&synthetic);
+    return g_Failed ? 1 : 0;
+}
@@ -0,0 +1,911 @@
+#include "SyntheticImage.h"
+#include "PdbFile.h"
+
+#define FILE_ALIGNMENT 0x200
+#define SECTION_ALIGNMENT 0x1000
+#define HEADERS_SIZE 0x400
+#define IMAGE_BASE 0x140000000ull
+#define FUNCTION_ALIGNMENT 16
+#define RDATA_SIZE 0x1000
+#define MAX_CODE_SECTIONS 12
+#define PDB_NAME "synthetic.pdb"
+
+#define MSF_BLOCK_SIZE 4096
+#define GSI_HASH_BUCKETS 4096
+#define GSI_BITMAP_BYTES (((GSI_HASH_BUCKETS + 1 + 31) / 32) * 4)
+
+// CodeView records written to the PDB
+#define S_END 0x0006
+#define S_PUB32 0x110E
+#define S_GPROC32 0x1110
+#define S_PROCREF 0x1125
+#define LF_STRUCTURE 0x1505
+#define LF_ULONG 0x8004
+
+// Streams of the generated PDB, in directory order
+enum {
+    STREAM_OLD_DIRECTORY,
+    STREAM_INFO,
+    STREAM_TPI,
+    STREAM_DBI,
+    STREAM_GLOBALS,
+    STREAM_PUBLICS,
+    STREAM_SYMBOL_RECORDS,
+    STREAM_SECTION_HEADERS,
+    STREAM_MODULE,
+    NUM_STREAMS
+};
+
+// A growable output buffer. Allocation failures are remembered and checked once at the end.
+typedef struct ByteBuffer {
+    BYTE* data;
+    size_t size;
+    size_t capacity;
+    BOOL failed;
+} ByteBuffer;
+
+static BYTE* Extend(struct ByteBuffer* pBuffer, size_t length)
+{
+    if (pBuffer->failed) return NULL;
+    if (pBuffer->size + length > pBuffer->capacity) {
+        size_t capacity = pBuffer->capacity ? pBuffer->capacity * 2 : 4096;
+        while (capacity < pBuffer->size + length) capacity *= 2;
+        BYTE* data = (BYTE*)realloc(pBuffer->data, capacity);
+        if (!data) {
+            pBuffer->failed = TRUE;
+            return NULL;
+        }
+        pBuffer->data = data;
+        pBuffer->capacity = capacity;
+    }
+    BYTE* p = pBuffer->data + pBuffer->size;
+    pBuffer->size += length;
+    return p;
+}
+
+static void Append(struct ByteBuffer* pBuffer, const void* data, size_t length)
+{
+    // empty tables are appended from NULL pointers, which memcpy does not accept even for no bytes
+    if (length == 0) return;
+    BYTE* p = Extend(pBuffer, length);
+    if (p) memcpy(p, data, length);
+}
+
+static void AppendFill(struct ByteBuffer* pBuffer, BYTE value, size_t length)
+{
+    BYTE* p = Extend(pBuffer, length);
+    if (p) memset(p, value, length);
+}
+
+static void AppendU8(struct ByteBuffer* pBuffer, BYTE value) { Append(pBuffer, &value, sizeof(value)); }
+static void AppendU16(struct ByteBuffer* pBuffer, WORD value) { Append(pBuffer, &value, sizeof(value)); }
+static void AppendU32(struct ByteBuffer* pBuffer, DWORD value) { Append(pBuffer, &value, sizeof(value)); }
+static void AppendU64(struct ByteBuffer* pBuffer, ULONGLONG value) { Append(pBuffer, &value, sizeof(value)); }
+
+static void AlignBuffer(struct ByteBuffer* pBuffer, size_t alignment, BYTE fill)
+{
+    size_t padding = (alignment - pBuffer->size % alignment) % alignment;
+    AppendFill(pBuffer, fill, padding);
+}
+
+static void PatchU16(struct ByteBuffer* pBuffer, size_t offset, WORD value) { if (!pBuffer->failed) memcpy(pBuffer->data + offset, &value, sizeof(value)); }
+static void PatchU32(struct ByteBuffer* pBuffer, size_t offset, DWORD value) { if (!pBuffer->failed) memcpy(pBuffer->data + offset, &value, sizeof(value)); }
+
+static void FreeByteBuffer(struct ByteBuffer* pBuffer)
+{
+    free(pBuffer->data);
+    memset(pBuffer, 0, sizeof(struct ByteBuffer));
+}
+
+static DWORD AlignUp(DWORD value, DWORD alignment) { return (value + alignment - 1) & ~(alignment - 1); }
+
+// xorshift64*, seeded per function so that a near duplicate can replay the function it copies
+static DWORD NextRandom(ULONGLONG* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (DWORD)((*state * 0x2545F4914F6CDD1Dull) >> 32);
+}
+
+static ULONGLONG MakeSeed(DWORD seed, DWORD index)
+{
+    ULONGLONG state = ((ULONGLONG)seed << 32 | index) * 0x9E3779B97F4A7C15ull + 1;
+    NextRandom(&state);
+    return state ? state : 1;
+}
+
+// Where generated code can point to
+typedef struct SyntheticLayout {
+    DWORD codeRva;
+    DWORD codeSpan;             // from the first to the end of the last code section
+    DWORD rdataRva;
+    DWORD dataRva;
+    DWORD dataSize;
+} SyntheticLayout;
+
+// Matching prologue and epilogue pairs, as emitted by MSVC for small, medium and frame pointer omitted functions
+typedef struct PrologueTemplate {
+    BYTE prologue[24];
+    BYTE prologueLength;
+    BYTE epilogue[24];
+    BYTE epilogueLength;
+} PrologueTemplate;
+
+static const struct PrologueTemplate g_Prologues[] = {
+    { { 0x48, 0x89, 0x5C, 0x24, 0x08, 0x57, 0x48, 0x83, 0xEC, 0x20 }, 10,
+      { 0x48, 0x8B, 0x5C, 0x24, 0x30, 0x48, 0x83, 0xC4, 0x20, 0x5F, 0xC3 }, 11 },
+    { { 0x48, 0x89, 0x5C, 0x24, 0x08, 0x48, 0x89, 0x74, 0x24, 0x10, 0x57, 0x48, 0x83, 0xEC, 0x30 }, 15,
+      { 0x48, 0x8B, 0x5C, 0x24, 0x40, 0x48, 0x8B, 0x74, 0x24, 0x48, 0x48, 0x83, 0xC4, 0x30, 0x5F, 0xC3 }, 16 },
+    { { 0x40, 0x53, 0x48, 0x83, 0xEC, 0x20 }, 6,
+      { 0x48, 0x83, 0xC4, 0x20, 0x5B, 0xC3 }, 6 },
+    { { 0x48, 0x83, 0xEC, 0x28 }, 4,
+      { 0x48, 0x83, 0xC4, 0x28, 0xC3 }, 5 },
+    { { 0x48, 0x8B, 0xC4, 0x48, 0x89, 0x58, 0x08, 0x48, 0x89, 0x68, 0x10, 0x48, 0x89, 0x70, 0x18, 0x57, 0x48, 0x83, 0xEC, 0x40 }, 20,
+      { 0x48, 0x8B, 0x5C, 0x24, 0x50, 0x48, 0x8B, 0x6C, 0x24, 0x58, 0x48, 0x8B, 0x74, 0x24, 0x60, 0x48, 0x83, 0xC4, 0x40, 0x5F, 0xC3 }, 21 },
+};
+
+typedef enum InstructionTemplate {
+    INSTRUCTION_MOV_RIP,        // mov r64, [rip+disp32]
+    INSTRUCTION_LEA_RIP,        // lea r64, [rip+disp32]
+    INSTRUCTION_CALL,           // call rel32
+    INSTRUCTION_CALL_IMPORT,    // call [rip+disp32]
+    INSTRUCTION_STACK_STORE,    // mov [rsp+disp8], r64
+    INSTRUCTION_STACK_LOAD,     // mov r64, [rsp+disp8]
+    INSTRUCTION_TEST,           // test r64, r64
+    INSTRUCTION_JCC,            // je/jne rel8
+    INSTRUCTION_XOR,            // xor r32, r32
+    INSTRUCTION_ADD,            // add r64, imm8
+    INSTRUCTION_MOV_IMM,        // mov r32, imm32
+    INSTRUCTION_MOV_REG,        // mov r64, r64
+    INSTRUCTION_MOV_ABS,        // mov r64, imm64 with a base relocation
+    INSTRUCTION_CMP,            // cmp r32, imm8
+    NUM_INSTRUCTION_TEMPLATES
+} InstructionTemplate;
+
+// Relative frequencies, roughly those of compiler output
+static const BYTE g_TemplateWeights[NUM_INSTRUCTION_TEMPLATES] = { 3, 2, 3, 1, 2, 2, 1, 2, 1, 1, 1, 2, 1, 1 };
+
+static InstructionTemplate PickTemplate(DWORD value)
+{
+    DWORD total = 0;
+    for (int i = 0; i < NUM_INSTRUCTION_TEMPLATES; i++) total += g_TemplateWeights[i];
+    value %= total;
+    for (int i = 0; i < NUM_INSTRUCTION_TEMPLATES; i++) {
+        if (value < g_TemplateWeights[i]) return (InstructionTemplate)i;
+        value -= g_TemplateWeights[i];
+    }
+    return INSTRUCTION_MOV_REG;
+}
+
+// rel32 operands are relative to the end of the instruction, and always come last in it
+static void AppendRel32(struct ByteBuffer* pCode, DWORD codeRva, DWORD target)
+{
+    DWORD next = codeRva + (DWORD)pCode->size + 4;
+    AppendU32(pCode, target - next);
+}
+
+// Emits one instruction. All random values are drawn before anything is emitted, so a replayed function stays in
+// step with the original whether or not an instruction gets replaced.
+static void EmitInstruction(struct ByteBuffer* pCode, DWORD codeRva, ULONGLONG* state, const struct SyntheticLayout* pLayout, struct ByteBuffer* pRelocations, BOOL replace, DWORD replacement)
+{
+    InstructionTemplate kind = PickTemplate(NextRandom(state));
+    BYTE reg = (BYTE)(NextRandom(state) & 7);
+    BYTE reg2 = (BYTE)(NextRandom(state) & 7);
+    DWORD value = NextRandom(state);
+    DWORD codeTarget = pLayout->codeRva + (NextRandom(state) % pLayout->codeSpan & ~(DWORD)(FUNCTION_ALIGNMENT - 1));
+    DWORD dataTarget = pLayout->dataRva + (NextRandom(state) % pLayout->dataSize & ~7u);
+    DWORD importTarget = pLayout->rdataRva + RDATA_SIZE / 2 + (NextRandom(state) % (RDATA_SIZE / 2) & ~7u);
+
+    if (replace) {
+        // the one difference of a near duplicate: a constant no other copy has
+        AppendU8(pCode, 0xB8 + reg);
+        AppendU32(pCode, replacement);
+        return;
+    }
+
+    switch (kind) {
+    case INSTRUCTION_MOV_RIP:
+    case INSTRUCTION_LEA_RIP:
+        AppendU8(pCode, 0x48);
+        AppendU8(pCode, kind == INSTRUCTION_MOV_RIP ? 0x8B : 0x8D);
+        AppendU8(pCode, 0x05 | reg << 3);
+        AppendRel32(pCode, codeRva, dataTarget);
+        break;
+    case INSTRUCTION_CALL:
+        AppendU8(pCode, 0xE8);
+        AppendRel32(pCode, codeRva, codeTarget);
+        break;
+    case INSTRUCTION_CALL_IMPORT:
+        AppendU8(pCode, 0xFF);
+        AppendU8(pCode, 0x15);
+        AppendRel32(pCode, codeRva, importTarget);
+        break;
+    case INSTRUCTION_STACK_STORE:
+    case INSTRUCTION_STACK_LOAD:
+        AppendU8(pCode, 0x48);
+        AppendU8(pCode, kind == INSTRUCTION_STACK_STORE ? 0x89 : 0x8B);
+        AppendU8(pCode, 0x44 | reg << 3);
+        AppendU8(pCode, 0x24);
+        AppendU8(pCode, (BYTE)(0x20 + (value & 0x18)));
+        break;
+    case INSTRUCTION_TEST:
+        AppendU8(pCode, 0x48);
+        AppendU8(pCode, 0x85);
+        AppendU8(pCode, 0xC0 | reg << 3 | reg);
+        break;
+    case INSTRUCTION_JCC:
+        AppendU8(pCode, value & 1 ? 0x75 : 0x74);
+        AppendU8(pCode, (BYTE)(2 + (value >> 8) % 0x30));
+        break;
+    case INSTRUCTION_XOR:
+        AppendU8(pCode, 0x33);
+        AppendU8(pCode, 0xC0 | reg << 3 | reg);
+        break;
+    case INSTRUCTION_ADD:
+        AppendU8(pCode, 0x48);
+        AppendU8(pCode, 0x83);
+        AppendU8(pCode, 0xC0 | reg);
+        AppendU8(pCode, (BYTE)(value & 0x78));
+        break;
+    case INSTRUCTION_MOV_IMM:
+        AppendU8(pCode, 0xB8 + reg);
+        AppendU32(pCode, value & 0xFFFF);
+        break;
+    case INSTRUCTION_MOV_REG:
+        AppendU8(pCode, 0x48);
+        AppendU8(pCode, 0x8B);
+        AppendU8(pCode, 0xC0 | reg << 3 | reg2);
+        break;
+    case INSTRUCTION_MOV_ABS:
+        AppendU8(pCode, 0x48);
+        AppendU8(pCode, 0xB8 + reg);
+        AppendU32(pRelocations, codeRva + (DWORD)pCode->size);
+        AppendU64(pCode, IMAGE_BASE + dataTarget);
+        break;
+    default:
+        AppendU8(pCode, 0x83);
+        AppendU8(pCode, 0xF8 | reg);
+        AppendU8(pCode, (BYTE)value);
+        break;
+    }
+}
+
+// Emits a function at `codeRva`. A near duplicate replays `seed` and replaces one instruction of the second half,
+// chosen by `mutationSeed`.
+static void EmitFunction(struct ByteBuffer* pCode, DWORD codeRva, ULONGLONG seed, ULONGLONG mutationSeed, const struct SyntheticLayout* pLayout, struct ByteBuffer* pRelocations)
+{
+    ULONGLONG state = seed;
+    const struct PrologueTemplate* frame = &g_Prologues[NextRandom(&state) % _countof(g_Prologues)];
+    DWORD numInstructions = NextRandom(&state) % 8 == 0 ? 16 + NextRandom(&state) % 160 : 2 + NextRandom(&state) % 12;
+
+    DWORD replaced = (DWORD)-1, replacement = 0;
+    if (mutationSeed) {
+        ULONGLONG mutation = mutationSeed;
+        replaced = numInstructions / 2 + NextRandom(&mutation) % (numInstructions - numInstructions / 2);
+        replacement = NextRandom(&mutation);
+    }
+
+    Append(pCode, frame->prologue, frame->prologueLength);
+    for (DWORD i = 0; i < numInstructions; i++)
+        EmitInstruction(pCode, codeRva, &state, pLayout, pRelocations, i == replaced, replacement);
+    Append(pCode, frame->epilogue, frame->epilogueLength);
+}
+
+typedef struct CodeSection {
+    DWORD rva;
+    DWORD capacity;
+    struct ByteBuffer code;
+} CodeSection;
+
+typedef struct FunctionList {
+    struct SyntheticFunction* items;
+    ULONGLONG* seeds;
+    DWORD count;
+    DWORD capacity;
+} FunctionList;
+
+static BOOL AddFunction(struct FunctionList* pList, DWORD rva, DWORD size, DWORD duplicateOf, ULONGLONG seed)
+{
+    if (pList->count == pList->capacity) {
+        DWORD capacity = pList->capacity ? pList->capacity * 2 : 1024;
+        struct SyntheticFunction* items = (struct SyntheticFunction*)realloc(pList->items, capacity * sizeof(struct SyntheticFunction));
+        if (!items) return FALSE;
+        pList->items = items;
+        ULONGLONG* seeds = (ULONGLONG*)realloc(pList->seeds, capacity * sizeof(ULONGLONG));
+        if (!seeds) return FALSE;
+        pList->seeds = seeds;
+        pList->capacity = capacity;
+    }
+    struct SyntheticFunction* function = &pList->items[pList->count];
+    snprintf(function->name, sizeof(function->name), "SynthFunction%u", (unsigned)pList->count);
+    function->rva = rva;
+    function->size = size;
+    function->duplicateOf = duplicateOf;
+    pList->seeds[pList->count++] = seed;
+    return TRUE;
+}
+
+// Fills the code sections one after another with functions until each is full
+static Error GenerateCode(const struct SyntheticImageOptions* pOptions, const struct SyntheticLayout* pLayout, struct CodeSection* sections, struct FunctionList* pFunctions, struct ByteBuffer* pRelocations)
+{
+    struct ByteBuffer scratch = { 0 };
+    struct ByteBuffer scratchRelocations = { 0 };
+    ULONGLONG choices = MakeSeed(pOptions->seed, 0xFFFFFFFF);
+    DWORD section = 0;
+    Error e = NewNoError();
+
+    while (section < pOptions->numCodeSections) {
+        DWORD index = pFunctions->count;
+        DWORD duplicateOf = index;
+        ULONGLONG seed = MakeSeed(pOptions->seed, index);
+        ULONGLONG mutationSeed = 0;
+        if (index > 0 && NextRandom(&choices) % 100 < pOptions->duplicatePercent) {
+            duplicateOf = NextRandom(&choices) % index;
+            seed = pFunctions->seeds[duplicateOf];
+            mutationSeed = MakeSeed(~pOptions->seed, index);
+        }
+
+        struct CodeSection* pSection = &sections[section];
+        DWORD rva = pSection->rva + (DWORD)pSection->code.size;
+        scratch.size = 0;
+        scratchRelocations.size = 0;
+        EmitFunction(&scratch, rva, seed, mutationSeed, pLayout, &scratchRelocations);
+        if (scratch.failed || scratchRelocations.failed) {
+            e = NewError(__FUNCTION__, -1, L"realloc failed; out of memory", 0);
+            break;
+        }
+
+        if (pSection->code.size + scratch.size > pSection->capacity) {
+            // the function is generated again at the start of the next section, where its rel32 operands differ
+            AppendFill(&pSection->code, 0xCC, pSection->capacity - pSection->code.size);
+            section++;
+            continue;
+        }
+
+        Append(&pSection->code, scratch.data, scratch.size);
+        AlignBuffer(&pSection->code, FUNCTION_ALIGNMENT, 0xCC);
+        Append(pRelocations, scratchRelocations.data, scratchRelocations.size);
+        if (!AddFunction(pFunctions, rva, (DWORD)scratch.size, duplicateOf, seed) || pSection->code.failed || pRelocations->failed) {
+            e = NewError(__FUNCTION__, -1, L"realloc failed; out of memory", 0);
+            break;
+        }
+    }
+
+    FreeByteBuffer(&scratch);
+    FreeByteBuffer(&scratchRelocations);
+    return e;
+}
+
+// Groups the relocated RVAs, which are generated in ascending order, into one block per 4 KB page
+static void BuildRelocationSection(const struct ByteBuffer* pRelocations, struct ByteBuffer* pSection)
+{
+    const DWORD* rvas = (const DWORD*)pRelocations->data;
+    size_t count = pRelocations->size / sizeof(DWORD);
+    for (size_t i = 0; i < count;) {
+        DWORD page = rvas[i] & ~(DWORD)0xFFF;
+        size_t blockStart = pSection->size;
+        AppendU32(pSection, page);
+        AppendU32(pSection, 0);
+        for (; i < count && (rvas[i] & ~(DWORD)0xFFF) == page; i++)
+            AppendU16(pSection, (WORD)(IMAGE_REL_BASED_DIR64 << 12 | (rvas[i] & 0xFFF)));
+        if ((pSection->size - blockStart) % 4) AppendU16(pSection, IMAGE_REL_BASED_ABSOLUTE << 12);
+        PatchU32(pSection, blockStart + 4, (DWORD)(pSection->size - blockStart));
+    }
+}
+
+typedef struct SectionData {
+    char name[IMAGE_SIZEOF_SHORT_NAME + 1];
+    DWORD rva;
+    DWORD characteristics;
+    const struct ByteBuffer* contents;
+} SectionData;
+
+static void AppendSectionHeader(struct ByteBuffer* pOut, const struct SectionData* pSection, DWORD rawOffset)
+{
+    IMAGE_SECTION_HEADER header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.Name, pSection->name, strlen(pSection->name));
+    header.Misc.VirtualSize = (DWORD)pSection->contents->size;
+    header.VirtualAddress = pSection->rva;
+    header.SizeOfRawData = AlignUp((DWORD)pSection->contents->size, FILE_ALIGNMENT);
+    header.PointerToRawData = rawOffset;
+    header.Characteristics = pSection->characteristics;
+    Append(pOut, &header, sizeof(header));
+}
+
+static void BuildPeFile(const struct SectionData* sections, WORD numSections, DWORD entryPoint, const IMAGE_DATA_DIRECTORY* relocations,
+    const IMAGE_DATA_DIRECTORY* debug, struct ByteBuffer* pOut)
+{
+    IMAGE_DOS_HEADER dos;
+    memset(&dos, 0, sizeof(dos));
+    dos.e_magic = IMAGE_DOS_SIGNATURE;
+    dos.e_lfanew = sizeof(dos);
+    Append(pOut, &dos, sizeof(dos));
+
+    const struct SectionData* last = &sections[numSections - 1];
+    IMAGE_NT_HEADERS64 nt;
+    memset(&nt, 0, sizeof(nt));
+    nt.Signature = IMAGE_NT_SIGNATURE;
+    nt.FileHeader.Machine = IMAGE_FILE_MACHINE_AMD64;
+    nt.FileHeader.NumberOfSections = numSections;
+    nt.FileHeader.TimeDateStamp = 0x5E0B6F00;
+    nt.FileHeader.SizeOfOptionalHeader = sizeof(IMAGE_OPTIONAL_HEADER64);
+    nt.FileHeader.Characteristics = IMAGE_FILE_EXECUTABLE_IMAGE | IMAGE_FILE_LARGE_ADDRESS_AWARE;
+    nt.OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+    nt.OptionalHeader.MajorLinkerVersion = 14;
+    nt.OptionalHeader.AddressOfEntryPoint = entryPoint;
+    nt.OptionalHeader.BaseOfCode = sections[0].rva;
+    nt.OptionalHeader.ImageBase = IMAGE_BASE;
+    nt.OptionalHeader.SectionAlignment = SECTION_ALIGNMENT;
+    nt.OptionalHeader.FileAlignment = FILE_ALIGNMENT;
+    nt.OptionalHeader.MajorOperatingSystemVersion = 6;
+    nt.OptionalHeader.MajorSubsystemVersion = 6;
+    nt.OptionalHeader.SizeOfImage = AlignUp(last->rva + (DWORD)last->contents->size, SECTION_ALIGNMENT);
+    nt.OptionalHeader.SizeOfHeaders = HEADERS_SIZE;
+    nt.OptionalHeader.Subsystem = IMAGE_SUBSYSTEM_WINDOWS_CUI;
+    nt.OptionalHeader.DllCharacteristics = 0x8160; // high entropy VA, dynamic base, NX compatible, terminal server aware
+    nt.OptionalHeader.SizeOfStackReserve = 0x100000;
+    nt.OptionalHeader.SizeOfStackCommit = 0x1000;
+    nt.OptionalHeader.SizeOfHeapReserve = 0x100000;
+    nt.OptionalHeader.SizeOfHeapCommit = 0x1000;
+    nt.OptionalHeader.NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+    nt.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC] = *relocations;
+    nt.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG] = *debug;
+    for (WORD i = 0; i < numSections; i++) {
+        if (sections[i].characteristics & IMAGE_SCN_CNT_CODE)
+            nt.OptionalHeader.SizeOfCode += AlignUp((DWORD)sections[i].contents->size, FILE_ALIGNMENT);
+        else
+            nt.OptionalHeader.SizeOfInitializedData += AlignUp((DWORD)sections[i].contents->size, FILE_ALIGNMENT);
+    }
+    Append(pOut, &nt, sizeof(nt));
+
+    DWORD rawOffset = HEADERS_SIZE;
+    for (WORD i = 0; i < numSections; i++) {
+        AppendSectionHeader(pOut, &sections[i], rawOffset);
+        rawOffset += AlignUp((DWORD)sections[i].contents->size, FILE_ALIGNMENT);
+    }
+    AlignBuffer(pOut, HEADERS_SIZE, 0);
+
+    for (WORD i = 0; i < numSections; i++) {
+        Append(pOut, sections[i].contents->data, sections[i].contents->size);
+        AlignBuffer(pOut, FILE_ALIGNMENT, 0);
+    }
+}
+
+// The PDB's name hash (hashStringV1), needed to place names in the GSI hash buckets
+static DWORD HashStringV1(const char* name)
+{
+    size_t length = strlen(name);
+    const BYTE* p = (const BYTE*)name;
+    DWORD result = 0;
+    for (size_t i = 0; i < length / 4; i++, p += 4) {
+        DWORD word;
+        memcpy(&word, p, sizeof(word));
+        result ^= word;
+    }
+    size_t remainder = length % 4;
+    if (remainder >= 2) {
+        WORD half;
+        memcpy(&half, p, sizeof(half));
+        result ^= half;
+        p += 2;
+        remainder -= 2;
+    }
+    if (remainder == 1) result ^= *p;
+    result |= 0x20202020;
+    result ^= result >> 11;
+    return result ^ (result >> 16);
+}
+
+// Appends a symbol record, padded so the next record starts 4 byte aligned. Returns the record's offset.
+static size_t BeginSymbolRecord(struct ByteBuffer* pStream, WORD kind)
+{
+    size_t offset = pStream->size;
+    AppendU16(pStream, 0);
+    AppendU16(pStream, kind);
+    return offset;
+}
+
+static void EndSymbolRecord(struct ByteBuffer* pStream, size_t offset)
+{
+    AlignBuffer(pStream, 4, 0);
+    PatchU16(pStream, offset, (WORD)(pStream->size - offset - sizeof(WORD)));
+}
+
+typedef struct GsiEntry {
+    DWORD bucket;
+    DWORD recordOffset;
+} GsiEntry;
+
+static int CompareGsiEntries(const void* a, const void* b)
+{
+    const struct GsiEntry* left = (const struct GsiEntry*)a;
+    const struct GsiEntry* right = (const struct GsiEntry*)b;
+    if (left->bucket != right->bucket) return left->bucket < right->bucket ? -1 : 1;
+    return left->recordOffset < right->recordOffset ? -1 : (left->recordOffset > right->recordOffset ? 1 : 0);
+}
+
+// Writes a GSI hash table: header, hash records grouped by bucket, the bucket bitmap, then one offset per used bucket
+static void BuildGsiHash(struct GsiEntry* entries, DWORD count, struct ByteBuffer* pOut)
+{
+    qsort(entries, count, sizeof(struct GsiEntry), CompareGsiEntries);
+    DWORD bitmap[GSI_BITMAP_BYTES / 4];
+    memset(bitmap, 0, sizeof(bitmap));
+    DWORD usedBuckets = 0;
+    for (DWORD i = 0; i < count; i++) {
+        if (i == 0 || entries[i].bucket != entries[i - 1].bucket) usedBuckets++;
+        bitmap[entries[i].bucket / 32] |= 1u << (entries[i].bucket % 32);
+    }
+
+    AppendU32(pOut, 0xFFFFFFFF);
+    AppendU32(pOut, 0xF12F091A);
+    AppendU32(pOut, count * 8);
+    AppendU32(pOut, GSI_BITMAP_BYTES + usedBuckets * 4);
+    for (DWORD i = 0; i < count; i++) {
+        AppendU32(pOut, entries[i].recordOffset + 1);
+        AppendU32(pOut, 1);
+    }
+    Append(pOut, bitmap, sizeof(bitmap));
+    for (DWORD i = 0; i < count; i++) {
+        // bucket offsets are in units of the 12 byte in-memory hash record
+        if (i == 0 || entries[i].bucket != entries[i - 1].bucket) AppendU32(pOut, i * 12);
+    }
+}
+
+static void AppendStructType(struct ByteBuffer* pTpi, WORD property, DWORD fieldList, DWORD size, const char* name)
+{
+    size_t offset = BeginSymbolRecord(pTpi, LF_STRUCTURE);
+    AppendU16(pTpi, 0);             // member count
+    AppendU16(pTpi, property);
+    AppendU32(pTpi, fieldList);
+    AppendU32(pTpi, 0);             // derived
+    AppendU32(pTpi, 0);             // vshape
+    if (size < 0x8000) AppendU16(pTpi, (WORD)size);
+    else {
+        AppendU16(pTpi, LF_ULONG);
+        AppendU32(pTpi, size);
+    }
+    Append(pTpi, name, strlen(name) + 1);
+    EndSymbolRecord(pTpi, offset);
+}
+
+// Lays the streams out one after another behind the superblock and the two free page map blocks
+static void BuildMsfFile(struct ByteBuffer* streams, struct ByteBuffer* pOut)
+{
+    DWORD nextBlock = 3;
+    DWORD streamStart[NUM_STREAMS];
+    for (int i = 0; i < NUM_STREAMS; i++) {
+        streamStart[i] = nextBlock;
+        nextBlock += (DWORD)((streams[i].size + MSF_BLOCK_SIZE - 1) / MSF_BLOCK_SIZE);
+    }
+
+    struct ByteBuffer directory = { 0 };
+    AppendU32(&directory, NUM_STREAMS);
+    for (int i = 0; i < NUM_STREAMS; i++) AppendU32(&directory, (DWORD)streams[i].size);
+    for (int i = 0; i < NUM_STREAMS; i++) {
+        DWORD nBlocks = (DWORD)((streams[i].size + MSF_BLOCK_SIZE - 1) / MSF_BLOCK_SIZE);
+        for (DWORD b = 0; b < nBlocks; b++) AppendU32(&directory, streamStart[i] + b);
+    }
+    DWORD directoryBlock = nextBlock;
+    DWORD nDirectoryBlocks = (DWORD)((directory.size + MSF_BLOCK_SIZE - 1) / MSF_BLOCK_SIZE);
+    DWORD blockMapBlock = directoryBlock + nDirectoryBlocks;
+    DWORD numBlocks = blockMapBlock + 1;
+
+    static const char magic[32] = "Microsoft C/C++ MSF 7.00\r\n\x1a" "DS\0\0";
+    Append(pOut, magic, sizeof(magic));
+    AppendU32(pOut, MSF_BLOCK_SIZE);
+    AppendU32(pOut, 1);             // free block map
+    AppendU32(pOut, numBlocks);
+    AppendU32(pOut, (DWORD)directory.size);
+    AppendU32(pOut, 0);
+    AppendU32(pOut, blockMapBlock);
+    AlignBuffer(pOut, MSF_BLOCK_SIZE, 0);
+    AppendFill(pOut, 0, 2 * MSF_BLOCK_SIZE); // every block is in use
+
+    for (int i = 0; i < NUM_STREAMS; i++) {
+        Append(pOut, streams[i].data, streams[i].size);
+        AlignBuffer(pOut, MSF_BLOCK_SIZE, 0);
+    }
+    Append(pOut, directory.data, directory.size);
+    AlignBuffer(pOut, MSF_BLOCK_SIZE, 0);
+    for (DWORD b = 0; b < nDirectoryBlocks; b++) AppendU32(pOut, directoryBlock + b);
+    AlignBuffer(pOut, MSF_BLOCK_SIZE, 0);
+
+    if (directory.failed) pOut->failed = TRUE;
+    FreeByteBuffer(&directory);
+}
+
+// Builds a PDB with one module holding a procedure per function, a procedure reference in the globals and a
+// decorated public per function, a few struct types and the section headers
+static void BuildPdbFile(const struct SyntheticImage* pImage, const struct SectionData* sections, WORD numSections, struct ByteBuffer* pOut)
+{
+    struct ByteBuffer streams[NUM_STREAMS];
+    memset(streams, 0, sizeof(streams));
+
+    // info stream: version, signature, age, GUID
+    AppendU32(&streams[STREAM_INFO], 20000404);
+    AppendU32(&streams[STREAM_INFO], 0x5E0B6F00);
+    AppendU32(&streams[STREAM_INFO], pImage->age);
+    Append(&streams[STREAM_INFO], &pImage->guid, sizeof(GUID));
+
+    // TPI: a forward reference and the complete definition of each struct
+    static const struct { const char* name; DWORD size; } types[] = {
+        { "_SYNTHETIC_CONTEXT", 0x4D0 }, { "_SYNTHETIC_LIST_ENTRY", 0x10 }, { "_SYNTHETIC_OBJECT", 0x12345 },
+    };
+    struct ByteBuffer records = { 0 };
+    for (size_t i = 0; i < _countof(types); i++) {
+        AppendStructType(&records, 0x80, 0, 0, types[i].name);
+        AppendStructType(&records, 0, 0x1001, types[i].size, types[i].name);
+    }
+    AppendU32(&streams[STREAM_TPI], 20040203);
+    AppendU32(&streams[STREAM_TPI], 56);
+    AppendU32(&streams[STREAM_TPI], 0x1000);
+    AppendU32(&streams[STREAM_TPI], 0x1000 + 2 * (DWORD)_countof(types));
+    AppendU32(&streams[STREAM_TPI], (DWORD)records.size);
+    AppendFill(&streams[STREAM_TPI], 0, 36);
+    Append(&streams[STREAM_TPI], records.data, records.size);
+    FreeByteBuffer(&records);
+
+    // module stream, symbol records and hash tables
+    struct ByteBuffer* module = &streams[STREAM_MODULE];
+    struct ByteBuffer* symbols = &streams[STREAM_SYMBOL_RECORDS];
+    struct GsiEntry* globals = (struct GsiEntry*)malloc((pImage->numFunctions + 1) * sizeof(struct GsiEntry));
+    struct GsiEntry* publics = (struct GsiEntry*)malloc((pImage->numFunctions + 1) * sizeof(struct GsiEntry));
+    if (!globals || !publics) pOut->failed = TRUE;
+
+    AppendU32(module, 4);           // CV_SIGNATURE_C13
+    for (DWORD i = 0; globals && publics && i < pImage->numFunctions; i++) {
+        const struct SyntheticFunction* function = &pImage->functions[i];
+        WORD section = 0;
+        while (section + 1 < numSections && sections[section + 1].rva <= function->rva) section++;
+        DWORD offset = function->rva - sections[section].rva;
+
+        size_t procedure = BeginSymbolRecord(module, S_GPROC32);
+        AppendU32(module, 0);       // parent
+        size_t endField = module->size;
+        AppendU32(module, 0);       // end, patched below
+        AppendU32(module, 0);       // next
+        AppendU32(module, function->size);
+        AppendU32(module, 0);       // debug start
+        AppendU32(module, function->size);
+        AppendU32(module, 0x1000);  // type
+        AppendU32(module, offset);
+        AppendU16(module, section + 1);
+        AppendU8(module, 0);        // flags
+        Append(module, function->name, strlen(function->name) + 1);
+        EndSymbolRecord(module, procedure);
+        PatchU32(module, endField, (DWORD)module->size);
+        size_t end = BeginSymbolRecord(module, S_END);
+        EndSymbolRecord(module, end);
+
+        globals[i].bucket = HashStringV1(function->name) % GSI_HASH_BUCKETS;
+        globals[i].recordOffset = (DWORD)symbols->size;
+        size_t reference = BeginSymbolRecord(symbols, S_PROCREF);
+        AppendU32(symbols, 0);
+        AppendU32(symbols, (DWORD)procedure);
+        AppendU16(symbols, 1);      // module index, 1-based
+        Append(symbols, function->name, strlen(function->name) + 1);
+        EndSymbolRecord(symbols, reference);
+
+        char decorated[48];
+        snprintf(decorated, sizeof(decorated), "?%s@@YAXXZ", function->name);
+        publics[i].bucket = HashStringV1(decorated) % GSI_HASH_BUCKETS;
+        publics[i].recordOffset = (DWORD)symbols->size;
+        size_t publicRecord = BeginSymbolRecord(symbols, S_PUB32);
+        AppendU32(symbols, 2);      // function
+        AppendU32(symbols, offset);
+        AppendU16(symbols, section + 1);
+        Append(symbols, decorated, strlen(decorated) + 1);
+        EndSymbolRecord(symbols, publicRecord);
+    }
+
+    if (globals && publics) {
+        BuildGsiHash(globals, pImage->numFunctions, &streams[STREAM_GLOBALS]);
+        struct ByteBuffer publicsHash = { 0 };
+        BuildGsiHash(publics, pImage->numFunctions, &publicsHash);
+        AppendU32(&streams[STREAM_PUBLICS], (DWORD)publicsHash.size);
+        AppendFill(&streams[STREAM_PUBLICS], 0, 20);
+        AppendU32(&streams[STREAM_PUBLICS], numSections);
+        Append(&streams[STREAM_PUBLICS], publicsHash.data, publicsHash.size);
+        if (publicsHash.failed) pOut->failed = TRUE;
+        FreeByteBuffer(&publicsHash);
+    }
+    free(globals);
+    free(publics);
+
+    for (WORD i = 0; i < numSections; i++) AppendSectionHeader(&streams[STREAM_SECTION_HEADERS], &sections[i], 0);
+
+    // DBI: header, one module, then the optional debug header pointing at the section headers
+    struct ByteBuffer moduleInfo = { 0 };
+    AppendFill(&moduleInfo, 0, 32);
+    AppendU16(&moduleInfo, 0);
+    AppendU16(&moduleInfo, STREAM_MODULE);
+    AppendU32(&moduleInfo, (DWORD)module->size);
+    AppendFill(&moduleInfo, 0, 24);
+    Append(&moduleInfo, "synthetic.obj", sizeof("synthetic.obj"));
+    Append(&moduleInfo, "synthetic.obj", sizeof("synthetic.obj"));
+    AlignBuffer(&moduleInfo, 4, 0);
+
+    WORD dbgHeader[11];
+    for (int i = 0; i < 11; i++) dbgHeader[i] = PDB_NIL_STREAM;
+    dbgHeader[5] = STREAM_SECTION_HEADERS;
+
+    struct ByteBuffer* dbi = &streams[STREAM_DBI];
+    AppendU32(dbi, 0xFFFFFFFF);
+    AppendU32(dbi, 19990903);
+    AppendU32(dbi, pImage->age);
+    AppendU16(dbi, STREAM_GLOBALS);
+    AppendU16(dbi, 0);
+    AppendU16(dbi, STREAM_PUBLICS);
+    AppendU16(dbi, 0);
+    AppendU16(dbi, STREAM_SYMBOL_RECORDS);
+    AppendU16(dbi, 0);
+    AppendU32(dbi, (DWORD)moduleInfo.size);
+    AppendFill(dbi, 0, 20);         // section contributions, section map, source info, type server map, MFC index
+    AppendU32(dbi, sizeof(dbgHeader));
+    AppendU32(dbi, 0);              // EC substream
+    AppendU16(dbi, 0);
+    AppendU16(dbi, IMAGE_FILE_MACHINE_AMD64);
+    AppendU32(dbi, 0);
+    Append(dbi, moduleInfo.data, moduleInfo.size);
+    Append(dbi, dbgHeader, sizeof(dbgHeader));
+    if (moduleInfo.failed) pOut->failed = TRUE;
+    FreeByteBuffer(&moduleInfo);
+
+    for (int i = 0; i < NUM_STREAMS; i++)
+        if (streams[i].failed) pOut->failed = TRUE;
+    if (!pOut->failed) BuildMsfFile(streams, pOut);
+    for (int i = 0; i < NUM_STREAMS; i++) FreeByteBuffer(&streams[i]);
+}
+
+Error GenerateSyntheticImage(const struct SyntheticImageOptions* pOptions, struct SyntheticImage* pImage)
+{
+    memset(pImage, 0, sizeof(struct SyntheticImage));
+    if (pOptions->numCodeSections == 0 || pOptions->numCodeSections > MAX_CODE_SECTIONS)
+        return NewError(__FUNCTION__, -1, L"Between 1 and 12 code sections are supported", 0);
+    if (pOptions->codeSize / pOptions->numCodeSections < 4096 || pOptions->codeSize > 0x40000000)
+        return NewError(__FUNCTION__, -2, L"Code size must be between 4 KB per section and 1 GB", 0);
+    if (pOptions->duplicatePercent > 100)
+        return NewError(__FUNCTION__, -3, L"Duplicate percentage must be at most 100", 0);
+
+    struct CodeSection codeSections[MAX_CODE_SECTIONS];
+    memset(codeSections, 0, sizeof(codeSections));
+    struct SyntheticLayout layout;
+    DWORD rva = SECTION_ALIGNMENT;
+    layout.codeRva = rva;
+    for (DWORD i = 0; i < pOptions->numCodeSections; i++) {
+        codeSections[i].rva = rva;
+        codeSections[i].capacity = AlignUp(pOptions->codeSize / pOptions->numCodeSections, FUNCTION_ALIGNMENT);
+        rva += AlignUp(codeSections[i].capacity, SECTION_ALIGNMENT);
+    }
+    layout.codeSpan = rva - layout.codeRva;
+    layout.rdataRva = rva;
+    layout.dataRva = layout.rdataRva + RDATA_SIZE;
+    layout.dataSize = pOptions->dataSize > SECTION_ALIGNMENT ? pOptions->dataSize : SECTION_ALIGNMENT;
+    DWORD relocRva = layout.dataRva + AlignUp(layout.dataSize, SECTION_ALIGNMENT);
+
+    // the CodeView GUID is derived from the seed, so the same options always produce the same files
+    ULONGLONG state = MakeSeed(pOptions->seed, 0xFFFFFFFE);
+    for (size_t i = 0; i < sizeof(GUID); i += 4) {
+        DWORD value = NextRandom(&state);
+        memcpy((BYTE*)&pImage->guid + i, &value, 4);
+    }
+    pImage->age = 1;
+
+    struct FunctionList functions = { 0 };
+    struct ByteBuffer relocations = { 0 }, rdata = { 0 }, data = { 0 }, reloc = { 0 }, pe = { 0 }, pdb = { 0 };
+    Error e = GenerateCode(pOptions, &layout, codeSections, &functions, &relocations);
+
+    do {
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -4);
+            break;
+        }
+
+        // .rdata: the debug directory and its CodeView record, then import-like pointer slots
+        IMAGE_DEBUG_DIRECTORY debugDirectory;
+        memset(&debugDirectory, 0, sizeof(debugDirectory));
+        debugDirectory.Type = IMAGE_DEBUG_TYPE_CODEVIEW;
+        debugDirectory.SizeOfData = 24 + sizeof(PDB_NAME);
+        debugDirectory.AddressOfRawData = layout.rdataRva + sizeof(debugDirectory);
+        DWORD rdataRawOffset = HEADERS_SIZE;
+        for (DWORD i = 0; i < pOptions->numCodeSections; i++) rdataRawOffset += AlignUp((DWORD)codeSections[i].code.size, FILE_ALIGNMENT);
+        debugDirectory.PointerToRawData = rdataRawOffset + sizeof(debugDirectory);
+        Append(&rdata, &debugDirectory, sizeof(debugDirectory));
+        Append(&rdata, "RSDS", 4);
+        Append(&rdata, &pImage->guid, sizeof(GUID));
+        AppendU32(&rdata, pImage->age);
+        Append(&rdata, PDB_NAME, sizeof(PDB_NAME));
+        AppendFill(&rdata, 0, RDATA_SIZE / 2 - rdata.size);
+        for (DWORD i = 0; i < RDATA_SIZE / 2; i += 8) AppendU64(&rdata, 0x7FF800000000ull + (ULONGLONG)i * 0x40);
+
+        // .data: mostly zero, with pointers and small integers in between
+        for (DWORD i = 0; i < layout.dataSize; i += 8)
+            AppendU64(&data, NextRandom(&state) % 4 == 0 ? IMAGE_BASE + layout.codeRva + NextRandom(&state) % layout.codeSpan : 0);
+        data.size = layout.dataSize;
+
+        BuildRelocationSection(&relocations, &reloc);
+
+        struct SectionData sections[MAX_CODE_SECTIONS + 3];
+        WORD numSections = 0;
+        for (DWORD i = 0; i < pOptions->numCodeSections; i++, numSections++) {
+            if (i == 0) strcpy_s(sections[numSections].name, sizeof(sections[numSections].name), ".text");
+            else snprintf(sections[numSections].name, sizeof(sections[numSections].name), "CODE%u", (unsigned)i);
+            sections[numSections].rva = codeSections[i].rva;
+            sections[numSections].characteristics = IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_READ;
+            sections[numSections].contents = &codeSections[i].code;
+        }
+        struct SectionData rdataSection = { ".rdata", layout.rdataRva, IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ, &rdata };
+        struct SectionData dataSection = { ".data", layout.dataRva, IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ | IMAGE_SCN_MEM_WRITE, &data };
+        struct SectionData relocSection = { ".reloc", relocRva, IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ, &reloc };
+        sections[numSections++] = rdataSection;
+        sections[numSections++] = dataSection;
+        sections[numSections++] = relocSection;
+
+        IMAGE_DATA_DIRECTORY relocDirectory = { relocRva, (DWORD)reloc.size };
+        IMAGE_DATA_DIRECTORY debugDataDirectory = { layout.rdataRva, sizeof(IMAGE_DEBUG_DIRECTORY) };
+        BuildPeFile(sections, numSections, functions.count ? functions.items[0].rva : layout.codeRva, &relocDirectory, &debugDataDirectory, &pe);
+
+        pImage->functions = functions.items;
+        pImage->numFunctions = functions.count;
+        BuildPdbFile(pImage, sections, numSections, &pdb);
+
+        BOOL failed = relocations.failed || rdata.failed || data.failed || reloc.failed || pe.failed || pdb.failed;
+        for (DWORD i = 0; i < pOptions->numCodeSections; i++) failed |= codeSections[i].code.failed;
+        if (failed) {
+            e = NewError(__FUNCTION__, -5, L"realloc failed; out of memory", 0);
+            break;
+        }
+
+        pImage->image = pe.data;
+        pImage->imageSize = pe.size;
+        pImage->pdb = pdb.data;
+        pImage->pdbSize = pdb.size;
+        pe.data = NULL;
+        pdb.data = NULL;
+        functions.items = NULL;
+    } while (FALSE);
+
+    for (DWORD i = 0; i < pOptions->numCodeSections; i++) FreeByteBuffer(&codeSections[i].code);
+    FreeByteBuffer(&relocations);
+    FreeByteBuffer(&rdata);
+    FreeByteBuffer(&data);
+    FreeByteBuffer(&reloc);
+    FreeByteBuffer(&pe);
+    FreeByteBuffer(&pdb);
+    free(functions.seeds);
+    if (e.ContainsError) {
+        free(functions.items);
+        memset(pImage, 0, sizeof(struct SyntheticImage));
+    }
+    return e;
+}
+
+static Error WriteWholeFile(LPCWSTR path, const BYTE* data, size_t size)
+{
+    FILE* file = OpenFileW(path, "wb");
+    if (!file)
+        return NewError(__FUNCTION__, -1, L"Failed to create the file", GetLastError());
+    BOOL ok = fwrite(data, 1, size, file) == size;
+    ok &= fclose(file) == 0;
+    if (!ok)
+        return NewError(__FUNCTION__, -2, L"Failed to write the file", GetLastError());
+    return NewNoError();
+}
+
+Error WriteSyntheticImage(const struct SyntheticImage* pImage, LPCWSTR imagePath, LPCWSTR pdbPath)
+{
+    Error e = WriteWholeFile(imagePath, pImage->image, pImage->imageSize);
+    if (!e.ContainsError && pdbPath) e = WriteWholeFile(pdbPath, pImage->pdb, pImage->pdbSize);
+    if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -1);
+    return e;
+}
+
+void FreeSyntheticImage(struct SyntheticImage* pImage)
+{
+    free(pImage->image);
+    free(pImage->pdb);
+    free(pImage->functions);
+    memset(pImage, 0, sizeof(struct SyntheticImage));
+}
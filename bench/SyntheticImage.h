@@ -0,0 +1,47 @@
+#pragma once
+#include "Platform.h"
+#include "Error.h"
+
+// Shape of a generated image
+typedef struct SyntheticImageOptions {
+    DWORD codeSize;             // bytes of code, split evenly over the code sections
+    DWORD numCodeSections;      // executable sections: .text, then CODE1, CODE2, ... (at most 12)
+    DWORD dataSize;             // bytes of the writable .data section
+    DWORD duplicatePercent;     // share of functions that are near copies of an earlier function, 0 to 100
+    DWORD seed;
+} SyntheticImageOptions;
+
+typedef struct SyntheticFunction {
+    char name[32];
+    DWORD rva;
+    DWORD size;
+    DWORD duplicateOf;          // index of the function this one copies, or the function's own index
+} SyntheticFunction;
+
+/*
+ * A PE64 image made of prologue-heavy generated functions, together with a minimal PDB (MSF 7.00) describing them.
+ * Functions are built from common x64 instruction templates with RIP-relative loads, rel32 calls and base relocated
+ * immediates, so both exact and masked signatures behave like they do on compiler output. Near duplicates repeat an
+ * earlier function with one operand changed in their second half, which is what makes minimal unique signatures long.
+ *
+ * The PDB has an info, TPI, DBI, globals, publics, symbol record, section header and one module stream: enough for
+ * PdbFile.h, not for DbgHelp.
+ */
+typedef struct SyntheticImage {
+    BYTE* image;
+    size_t imageSize;
+    BYTE* pdb;
+    size_t pdbSize;
+    GUID guid;
+    DWORD age;
+    struct SyntheticFunction* functions;
+    DWORD numFunctions;
+} SyntheticImage;
+
+// Generates the image and PDB in memory. Free after use with FreeSyntheticImage.
+Error GenerateSyntheticImage(const struct SyntheticImageOptions* pOptions, struct SyntheticImage* pImage);
+
+// Writes the image and its PDB, e.g. to map them with MapImageView and OpenPdbFile.
+Error WriteSyntheticImage(const struct SyntheticImage* pImage, LPCWSTR imagePath, LPCWSTR pdbPath);
+
+void FreeSyntheticImage(struct SyntheticImage* pImage);
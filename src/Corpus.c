@@ -0,0 +1,424 @@
+#include "Corpus.h"
+#include "SuffixIndex.h"
+#include "ThreadPool.h"
+
+// A build seen so far, to recognize copies of the same image under other paths
+typedef struct CorpusBuild {
+    GUID guid;
+    DWORD age;
+    const WCHAR* path;
+} CorpusBuild;
+
+typedef struct Corpus {
+    const struct CorpusConfig* pConfig;
+    struct TaskPool pool;
+    WCHAR** files;
+    DWORD numFiles;
+    DWORD filesCapacity;
+    SRWLOCK lock;               // builds, output, database and summary
+    struct CorpusBuild* builds;
+    DWORD numBuilds;
+    DWORD buildsCapacity;
+    DWORD numFinished;
+    struct CorpusSummary summary;
+    ULONGLONG startTime;
+} Corpus;
+
+// An image on its way through the tasks. Each task hands it on to the next one or ends it.
+typedef struct CorpusImage {
+    struct Corpus* pCorpus;
+    const WCHAR* path;
+    struct ImageView image;
+    struct PDBLookupContext ctx;
+    WCHAR* pdbPath;
+} CorpusImage;
+
+static BOOL HasImageExtension(LPCWSTR fileName)
+{
+    const WCHAR* extension = wcsrchr(fileName, L'.');
+    return extension && (_wcsicmp(extension, L".exe") == 0 || _wcsicmp(extension, L".dll") == 0 || _wcsicmp(extension, L".sys") == 0);
+}
+
+static Error AddCorpusFile(struct Corpus* pCorpus, WCHAR* path)
+{
+    if (pCorpus->numFiles == pCorpus->filesCapacity) {
+        DWORD capacity = pCorpus->filesCapacity ? pCorpus->filesCapacity * 2 : 256;
+        WCHAR** files = (WCHAR**)realloc(pCorpus->files, capacity * sizeof(WCHAR*));
+        if (!files)
+            return NewError(__FUNCTION__, -1, L"realloc failed; out of memory", 0);
+        pCorpus->files = files;
+        pCorpus->filesCapacity = capacity;
+    }
+    pCorpus->files[pCorpus->numFiles++] = path;
+    return NewNoError();
+}
+
+// Collects the image files under the directory. Subdirectories that cannot be listed are skipped with a warning.
+static Error FindCorpusFiles(struct Corpus* pCorpus, LPCWSTR directory)
+{
+    size_t patternLength = wcslen(directory) + 3;
+    WCHAR* pattern = (WCHAR*)malloc(patternLength * sizeof(WCHAR));
+    if (!pattern)
+        return NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0);
+    swprintf_s(pattern, patternLength, L"%s\\*", directory);
+
+    WIN32_FIND_DATAW findData;
+    HANDLE hFind = FindFirstFileW(pattern, &findData);
+    free(pattern);
+    if (hFind == INVALID_HANDLE_VALUE)
+        return NewError(__FUNCTION__, -2, L"FindFirstFileW failed", GetLastError());
+
+    Error e = NewNoError();
+    do {
+        if (wcscmp(findData.cFileName, L".") == 0 || wcscmp(findData.cFileName, L"..") == 0)
+            continue;
+        BOOL isDirectory = (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        // junctions may lead back up the tree
+        if (isDirectory && (findData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+            continue;
+        if (!isDirectory && !HasImageExtension(findData.cFileName))
+            continue;
+
+        size_t pathLength = wcslen(directory) + wcslen(findData.cFileName) + 2;
+        WCHAR* path = (WCHAR*)malloc(pathLength * sizeof(WCHAR));
+        if (!path) {
+            e = NewError(__FUNCTION__, -3, L"malloc failed; out of memory", 0);
+            break;
+        }
+        swprintf_s(path, pathLength, L"%s\\%s", directory, findData.cFileName);
+
+        if (isDirectory) {
+            e = FindCorpusFiles(pCorpus, path);
+            if (e.ContainsError) {
+                WCHAR* message = e.Format(&e);
+                fwprintf(pCorpus->pConfig->log, L"[-] WARNING: skipping %s: %s\n", path, message ? message : L"out of memory");
+                free(message);
+                Error_Free(&e);
+                e = NewNoError();
+            }
+            free(path);
+        } else {
+            e = AddCorpusFile(pCorpus, path);
+            if (e.ContainsError) {
+                e.AddFunctionToStack(&e, __FUNCTION__, -4);
+                free(path);
+            }
+        }
+    } while (!e.ContainsError && FindNextFileW(hFind, &findData));
+    FindClose(hFind);
+    return e;
+}
+
+// Ends an image, successful or not, reports the progress and frees it. Takes ownership of the error.
+static void EndCorpusImage(struct CorpusImage* pImage, Error e, LPCWSTR outcome)
+{
+    struct Corpus* pCorpus = pImage->pCorpus;
+    wchar_t* message = NULL;
+    if (e.ContainsError) {
+        // corpus runs are long, so the formatted message is freed, and it has to fit on one output line
+        message = e.Format(&e);
+        if (message) for (wchar_t* c = message; *c; c++) if (*c == L'\r' || *c == L'\n') *c = L' ';
+        Error_Free(&e);
+    }
+
+    AcquireSRWLockExclusive(&pCorpus->lock);
+    if (message || !outcome) {
+        fwprintf(pCorpus->pConfig->output, L"%s\terror\t%s\n", pImage->path, message ? message : L"out of memory");
+        pCorpus->summary.numFailed++;
+        outcome = L"failed";
+    }
+    DWORD finished = ++pCorpus->numFinished;
+    double seconds = (double)(ReadStatsClock() - pCorpus->startTime) / (double)GetStatsClockFrequency();
+    fwprintf(pCorpus->pConfig->log, L"[+] [%lu/%lu] %s: %s (%.1f images/s)\n", finished, pCorpus->numFiles, pImage->path, outcome,
+        seconds > 0 ? finished / seconds : 0.0);
+    ReleaseSRWLockExclusive(&pCorpus->lock);
+
+    free(message);
+    free(pImage->pdbPath);
+    CleanupPDBLookupCtx(&pImage->ctx);
+    UnmapImageView(&pImage->image);
+    free(pImage);
+}
+
+// Queues the next task of an image on the current worker, or ends the image if that fails
+static void ContinueCorpusImage(struct TaskPool* pPool, DWORD workerIndex, TaskPoolTask task, struct CorpusImage* pImage)
+{
+    Error e = PushTask(pPool, workerIndex, task, pImage);
+    if (e.ContainsError) EndCorpusImage(pImage, e, NULL);
+}
+
+static void PrintCorpusSignature(FILE* out, const BYTE* signature, DWORD signatureLength)
+{
+    for (DWORD i = 0; i < signatureLength; i++)
+        fwprintf(out, (i + 1) < signatureLength ? L"0x%02X, " : L"0x%02X", signature[i]);
+    fwprintf(out, L"\n");
+}
+
+// Last task: builds or loads the suffix index, then writes the signatures of every function in one go
+static void ExtractCorpusSignatures(struct TaskPool* pPool, void* context, DWORD workerIndex)
+{
+    UNREFERENCED_PARAMETER(pPool);
+    UNREFERENCED_PARAMETER(workerIndex);
+    struct CorpusImage* pImage = (struct CorpusImage*)context;
+    struct Corpus* pCorpus = pImage->pCorpus;
+    FILE* out = pCorpus->pConfig->output;
+    const struct SymbolIndex* pSymbols = &pImage->ctx.symbolIndex;
+    struct SuffixIndex index;
+    BOOL indexOpen = FALSE;
+    WCHAR* indexPath = NULL;
+    DWORD* lengths = NULL;
+    char* imageName = NULL;
+    ULONGLONG numSignatures = 0, numNotUnique = 0;
+    Error e = NewNoError();
+    do {
+        size_t indexPathLength = wcslen(pImage->pdbPath) + 5;
+        indexPath = (WCHAR*)malloc(indexPathLength * sizeof(WCHAR));
+        if (!indexPath) {
+            e = NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0);
+            break;
+        }
+        swprintf_s(indexPath, indexPathLength, L"%s.sai", pImage->pdbPath);
+
+        ULONGLONG start = StartStatsTimer();
+        e = OpenSuffixIndex(indexPath, &pImage->image, &pImage->ctx.pdbInfo.guid, pImage->ctx.pdbInfo.age, &index);
+        StopStatsTimer(STATS_TIMER_SUFFIX_INDEX, start);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -2);
+            break;
+        }
+        indexOpen = TRUE;
+
+        // the lengths are found outside of the lock, only writing them out is serialized
+        start = StartStatsTimer();
+        lengths = (DWORD*)calloc((size_t)pSymbols->header->numEntries + 1, sizeof(DWORD));
+        if (!lengths) {
+            e = NewError(__FUNCTION__, -3, L"calloc failed; out of memory", 0);
+            break;
+        }
+        for (DWORD i = 0; i < pSymbols->header->numEntries; i++) {
+            if (pSymbols->entries[i].kind == PDB_SYMBOL_FUNCTION)
+                lengths[i] = GetMinimalUniqueLength(&index, pSymbols->entries[i].rva);
+        }
+        StopStatsTimer(STATS_TIMER_UNIQUE_SIGNATURE, start);
+
+        const WCHAR* fileName = wcsrchr(pImage->path, L'\\');
+        imageName = WideToUtf8(fileName ? fileName + 1 : pImage->path);
+        if (!imageName) {
+            e = NewError(__FUNCTION__, -4, L"WideToUtf8 failed", 0);
+            break;
+        }
+
+        AcquireSRWLockExclusive(&pCorpus->lock);
+        DWORD dbImage = 0;
+        if (pCorpus->pConfig->pDb) {
+            e = AddSignatureDbImage(pCorpus->pConfig->pDb, &pImage->ctx.pdbInfo.guid, pImage->ctx.pdbInfo.age,
+                pImage->image.ntHeaders->FileHeader.TimeDateStamp, imageName, &dbImage);
+            if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -5);
+        }
+        for (DWORD i = 0; i < pSymbols->header->numEntries && !e.ContainsError; i++) {
+            const SymbolIndexEntry* entry = &pSymbols->entries[i];
+            if (entry->kind != PDB_SYMBOL_FUNCTION) continue;
+            const char* name = pSymbols->strings + entry->nameOffset;
+
+            const BYTE* signature = lengths[i] ? GetSpanByRva(&pImage->image, entry->rva, lengths[i]) : NULL;
+            if (!signature) {
+                fwprintf(out, L"%s\t%S\t0x%08X\t%lu\tnot-unique\n", pImage->path, name, entry->rva, entry->size);
+                numNotUnique++;
+                continue;
+            }
+            const WCHAR* fit = entry->size == 0 ? L"unknown-size" : lengths[i] <= entry->size ? L"inside" : L"spills";
+            fwprintf(out, L"%s\t%S\t0x%08X\t%lu\t%lu\t%s\t", pImage->path, name, entry->rva, entry->size, lengths[i], fit);
+            PrintCorpusSignature(out, signature, lengths[i]);
+            if (pCorpus->pConfig->pDb) {
+                e = AddSignatureDbEntry(pCorpus->pConfig->pDb, dbImage, name, entry->rva, 0, signature, NULL, lengths[i]);
+                if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -6);
+            }
+            numSignatures++;
+        }
+        if (!e.ContainsError) {
+            pCorpus->summary.numImages++;
+            pCorpus->summary.numSignatures += numSignatures;
+            pCorpus->summary.numNotUnique += numNotUnique;
+        }
+        ReleaseSRWLockExclusive(&pCorpus->lock);
+    } while (FALSE);
+
+    WCHAR outcome[64];
+    swprintf_s(outcome, _countof(outcome), L"%llu signature(s), %llu not unique", numSignatures, numNotUnique);
+    free(imageName);
+    free(lengths);
+    if (indexOpen) FreeSuffixIndex(&index);
+    free(indexPath);
+    EndCorpusImage(pImage, e, outcome);
+}
+
+// Only runs for PDBs without a saved symbol index: parsing them is CPU bound, unlike the download before
+static void ParseCorpusPdb(struct TaskPool* pPool, void* context, DWORD workerIndex)
+{
+    struct CorpusImage* pImage = (struct CorpusImage*)context;
+    ULONGLONG start = StartStatsTimer();
+    Error e = InitializePDBLookup(pImage->pdbPath, &pImage->ctx);
+    StopStatsTimer(STATS_TIMER_PDB_LOAD, start);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        EndCorpusImage(pImage, e, NULL);
+        return;
+    }
+    ContinueCorpusImage(pPool, workerIndex, ExtractCorpusSignatures, pImage);
+}
+
+// Uses the symbol index saved by an earlier run, or makes sure the symbol store holds the PDB
+static void FindCorpusSymbols(struct TaskPool* pPool, void* context, DWORD workerIndex)
+{
+    struct CorpusImage* pImage = (struct CorpusImage*)context;
+    const struct CorpusConfig* pConfig = pImage->pCorpus->pConfig;
+
+    WCHAR* cacheDir = NULL;
+    if (!pConfig->cacheDir) {
+        const WCHAR* lastSlash = wcsrchr(pImage->path, L'\\');
+        size_t folderLength = lastSlash ? lastSlash - pImage->path + 1 : 0;
+        size_t cacheDirLength = folderLength + 8;
+        cacheDir = (WCHAR*)malloc(cacheDirLength * sizeof(WCHAR));
+        if (!cacheDir) {
+            EndCorpusImage(pImage, NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0), NULL);
+            return;
+        }
+        swprintf_s(cacheDir, cacheDirLength, L"%.*ssymbols", (int)folderLength, pImage->path);
+    }
+    pImage->pdbPath = GetSymbolStorePath(cacheDir ? cacheDir : pConfig->cacheDir, pImage->ctx.pdbInfo.pdbName, &pImage->ctx.pdbInfo.guid, pImage->ctx.pdbInfo.age);
+    free(cacheDir);
+    if (!pImage->pdbPath) {
+        EndCorpusImage(pImage, NewError(__FUNCTION__, -2, L"malloc failed; out of memory", 0), NULL);
+        return;
+    }
+
+    ULONGLONG start = StartStatsTimer();
+    Error e = InitializePDBLookupFromIndex(pImage->pdbPath, &pImage->ctx);
+    StopStatsTimer(STATS_TIMER_SYMBOL_INDEX, start);
+    if (!e.ContainsError) {
+        ContinueCorpusImage(pPool, workerIndex, ExtractCorpusSignatures, pImage);
+        return;
+    }
+    Error_Free(&e);
+
+    struct DownloadStats stats;
+    start = StartStatsTimer();
+    e = FetchPDB(&pImage->ctx, pConfig->symbolServer ? pConfig->symbolServer : DEFAULT_SYMBOL_SERVER, pConfig->connections, pImage->pdbPath, &stats);
+    StopStatsTimer(STATS_TIMER_PDB_DOWNLOAD, start);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -3);
+        EndCorpusImage(pImage, e, NULL);
+        return;
+    }
+    AddStatsCount(STATS_BYTES_DOWNLOADED, stats.bytesReceived);
+    ContinueCorpusImage(pPool, workerIndex, ParseCorpusPdb, pImage);
+}
+
+// First task: maps the image and reads its CodeView record, which tells whether the build was seen before
+static void OpenCorpusImage(struct TaskPool* pPool, void* context, DWORD workerIndex)
+{
+    struct CorpusImage* pImage = (struct CorpusImage*)context;
+    struct Corpus* pCorpus = pImage->pCorpus;
+
+    ULONGLONG start = StartStatsTimer();
+    Error e = MapImageView(pImage->path, &pImage->image);
+    StopStatsTimer(STATS_TIMER_MAP_IMAGE, start);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        EndCorpusImage(pImage, e, NULL);
+        return;
+    }
+
+    start = StartStatsTimer();
+    e = GetPEInfo(&pImage->image, &pImage->ctx);
+    StopStatsTimer(STATS_TIMER_PE_INFO, start);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -2);
+        EndCorpusImage(pImage, e, NULL);
+        return;
+    }
+
+    AcquireSRWLockExclusive(&pCorpus->lock);
+    const struct CorpusBuild* first = NULL;
+    for (DWORD i = 0; i < pCorpus->numBuilds && !first; i++) {
+        const struct CorpusBuild* build = &pCorpus->builds[i];
+        if (build->age == pImage->ctx.pdbInfo.age && memcmp(&build->guid, &pImage->ctx.pdbInfo.guid, sizeof(GUID)) == 0)
+            first = build;
+    }
+    if (first) {
+        fwprintf(pCorpus->pConfig->output, L"%s\tduplicate\t%s\n", pImage->path, first->path);
+        pCorpus->summary.numDuplicates++;
+    } else {
+        if (pCorpus->numBuilds == pCorpus->buildsCapacity) {
+            DWORD capacity = pCorpus->buildsCapacity ? pCorpus->buildsCapacity * 2 : 256;
+            struct CorpusBuild* builds = (struct CorpusBuild*)realloc(pCorpus->builds, capacity * sizeof(struct CorpusBuild));
+            if (builds) {
+                pCorpus->builds = builds;
+                pCorpus->buildsCapacity = capacity;
+            }
+        }
+        // a build that cannot be remembered is still processed, it just is not recognized again
+        if (pCorpus->numBuilds < pCorpus->buildsCapacity) {
+            struct CorpusBuild* build = &pCorpus->builds[pCorpus->numBuilds++];
+            build->guid = pImage->ctx.pdbInfo.guid;
+            build->age = pImage->ctx.pdbInfo.age;
+            build->path = pImage->path;
+        }
+    }
+    ReleaseSRWLockExclusive(&pCorpus->lock);
+
+    if (first) EndCorpusImage(pImage, NewNoError(), L"duplicate");
+    else ContinueCorpusImage(pPool, workerIndex, FindCorpusSymbols, pImage);
+}
+
+Error ProcessCorpus(const struct CorpusConfig* pConfig, struct CorpusSummary* pSummary)
+{
+    ZeroMemory(pSummary, sizeof(struct CorpusSummary));
+    struct Corpus corpus = { 0 };
+    corpus.pConfig = pConfig;
+    InitializeSRWLock(&corpus.lock);
+    corpus.startTime = ReadStatsClock();
+
+    Error e = NewNoError();
+    do {
+        e = FindCorpusFiles(&corpus, pConfig->directory);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -1);
+            break;
+        }
+        corpus.summary.numFiles = corpus.numFiles;
+        fwprintf(pConfig->log, L"[+] Found %lu image file(s) under %s\n", corpus.numFiles, pConfig->directory);
+        if (corpus.numFiles == 0) break;
+
+        e = CreateTaskPool(pConfig->threads ? pConfig->threads : 2 * GetProcessorCount(), &corpus.pool);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -2);
+            break;
+        }
+        fwprintf(pConfig->log, L"[+] Processing with %lu worker(s)\n", corpus.pool.numThreads);
+
+        for (DWORD i = 0; i < corpus.numFiles; i++) {
+            struct CorpusImage* pImage = (struct CorpusImage*)calloc(1, sizeof(struct CorpusImage));
+            if (!pImage) {
+                e = NewError(__FUNCTION__, -3, L"calloc failed; out of memory", 0);
+                break;
+            }
+            pImage->pCorpus = &corpus;
+            pImage->path = corpus.files[i];
+            Error pushError = PushTask(&corpus.pool, TASK_POOL_EXTERNAL, OpenCorpusImage, pImage);
+            if (pushError.ContainsError) EndCorpusImage(pImage, pushError, NULL);
+        }
+
+        // the images already queued finish even if queueing the rest failed
+        WaitTaskPool(&corpus.pool);
+        corpus.summary.steals = corpus.pool.steals;
+        FreeTaskPool(&corpus.pool);
+    } while (FALSE);
+
+    corpus.summary.seconds = (double)(ReadStatsClock() - corpus.startTime) / (double)GetStatsClockFrequency();
+    *pSummary = corpus.summary;
+    for (DWORD i = 0; i < corpus.numFiles; i++) free(corpus.files[i]);
+    free(corpus.files);
+    free(corpus.builds);
+    return e;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "Pdb.h"
+#include "SignatureDb.h"
+#include "TaskPool.h"
+
+typedef struct CorpusConfig {
+    LPCWSTR directory;
+    LPCWSTR symbolServer;
+    LPCWSTR cacheDir;           // symbol store, NULL for a symbols folder next to each image
+    DWORD connections;          // parallel range requests for large PDB downloads
+    DWORD threads;              // workers, 0 for two per processor
+    FILE* output;               // signature lines
+    FILE* log;                  // progress lines
+    struct SignatureDbBuilder* pDb; // also collects every signature here when not NULL
+} CorpusConfig;
+
+typedef struct CorpusSummary {
+    DWORD numFiles;             // files found with an image extension
+    DWORD numImages;            // distinct builds whose signatures were written
+    DWORD numDuplicates;        // files with the GUID and age of an image found before
+    DWORD numFailed;
+    ULONGLONG numSignatures;
+    ULONGLONG numNotUnique;     // functions without a unique signature
+    LONG64 steals;              // tasks one worker took over from another
+    double seconds;
+} CorpusSummary;
+
+/*
+ * Writes the minimal unique signature of every function of every .exe, .dll and .sys file under the directory,
+ * like --all does for one image. Files with the CodeView GUID and age of an earlier file are reported as
+ * duplicates and not processed again.
+ *
+ * Each image goes through four tasks on a work-stealing TaskPool: reading its headers, finding or fetching its
+ * PDB, parsing the PDB when it was not indexed yet, and building its suffix index and writing its signatures.
+ * A worker finishes the image it started before taking a new one, which bounds the number of images held in
+ * memory, and workers waiting on downloads leave the processors to the others, so the default is two workers per
+ * processor. Lines are written one image at a time, as soon as the image is done:
+ *   <pePath> <functionName> <RVA> <size> <length> inside|spills <signature bytes>
+ *   <pePath> <functionName> <RVA> <size> not-unique
+ *   <pePath> duplicate <path of the first file of the build>
+ *   <pePath> error <message>
+ */
+Error ProcessCorpus(const struct CorpusConfig* pConfig, struct CorpusSummary* pSummary);
@@ -0,0 +1,216 @@
+#include <string.h>
+#include "Disasm.h"
+
+// Operand layout of an opcode
+#define OPERAND_MODRM 0x001
+#define OPERAND_IMM8 0x002
+#define OPERAND_IMM16 0x004
+#define OPERAND_IMMZ 0x008     // 32 bits, 16 with an operand size prefix
+#define OPERAND_IMMV 0x010     // 32 bits, 64 with REX.W, 16 with an operand size prefix
+#define OPERAND_REL8 0x020
+#define OPERAND_REL32 0x040
+#define OPERAND_MOFFS 0x080    // absolute address, 64 bits or 32 with an address size prefix
+#define OPERAND_GROUP3 0x100   // test r/m, imm has an immediate only when ModRM.reg is 0 or 1
+#define OPERAND_INVALID 0x200
+
+static BOOL IsLegacyPrefix(BYTE value)
+{
+    switch (value) {
+    case 0xF0: case 0xF2: case 0xF3:
+    case 0x2E: case 0x36: case 0x3E: case 0x26: case 0x64: case 0x65:
+    case 0x66: case 0x67:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+static WORD GetOneByteOperands(BYTE opcode)
+{
+    // arithmetic block: r/m forms, then AL/eAX with an immediate
+    if (opcode < 0x40) {
+        switch (opcode & 7) {
+        case 0: case 1: case 2: case 3: return OPERAND_MODRM;
+        case 4: return OPERAND_IMM8;
+        case 5: return OPERAND_IMMZ;
+        default: return OPERAND_INVALID;
+        }
+    }
+    if (opcode >= 0x50 && opcode <= 0x5F) return 0;
+    if (opcode >= 0x70 && opcode <= 0x7F) return OPERAND_REL8;
+    if (opcode >= 0x84 && opcode <= 0x8F) return OPERAND_MODRM;
+    if (opcode >= 0x90 && opcode <= 0x9F) return opcode == 0x9A ? OPERAND_INVALID : 0;
+    if (opcode >= 0xB0 && opcode <= 0xB7) return OPERAND_IMM8;
+    if (opcode >= 0xB8 && opcode <= 0xBF) return OPERAND_IMMV;
+    if (opcode >= 0xD8 && opcode <= 0xDF) return OPERAND_MODRM;
+
+    switch (opcode) {
+    case 0x63: return OPERAND_MODRM;
+    case 0x68: return OPERAND_IMMZ;
+    case 0x69: return OPERAND_MODRM | OPERAND_IMMZ;
+    case 0x6A: return OPERAND_IMM8;
+    case 0x6B: return OPERAND_MODRM | OPERAND_IMM8;
+    case 0x6C: case 0x6D: case 0x6E: case 0x6F: return 0;
+    case 0x80: case 0x83: return OPERAND_MODRM | OPERAND_IMM8;
+    case 0x81: return OPERAND_MODRM | OPERAND_IMMZ;
+    case 0xA0: case 0xA1: case 0xA2: case 0xA3: return OPERAND_MOFFS;
+    case 0xA8: return OPERAND_IMM8;
+    case 0xA9: return OPERAND_IMMZ;
+    case 0xA4: case 0xA5: case 0xA6: case 0xA7:
+    case 0xAA: case 0xAB: case 0xAC: case 0xAD: case 0xAE: case 0xAF: return 0;
+    case 0xC0: case 0xC1: case 0xC6: return OPERAND_MODRM | OPERAND_IMM8;
+    case 0xC7: return OPERAND_MODRM | OPERAND_IMMZ;
+    case 0xC2: case 0xCA: return OPERAND_IMM16;
+    case 0xC8: return OPERAND_IMM16 | OPERAND_IMM8;
+    case 0xCD: return OPERAND_IMM8;
+    case 0xC3: case 0xC9: case 0xCB: case 0xCC: case 0xCF: return 0;
+    case 0xD0: case 0xD1: case 0xD2: case 0xD3: return OPERAND_MODRM;
+    case 0xD7: return 0;
+    case 0xE0: case 0xE1: case 0xE2: case 0xE3: case 0xEB: return OPERAND_REL8;
+    case 0xE4: case 0xE5: case 0xE6: case 0xE7: return OPERAND_IMM8;
+    case 0xE8: case 0xE9: return OPERAND_REL32;
+    case 0xEC: case 0xED: case 0xEE: case 0xEF: return 0;
+    case 0xF1: case 0xF4: case 0xF5:
+    case 0xF8: case 0xF9: case 0xFA: case 0xFB: case 0xFC: case 0xFD: return 0;
+    case 0xF6: case 0xF7: return OPERAND_MODRM | OPERAND_GROUP3;
+    case 0xFE: case 0xFF: return OPERAND_MODRM;
+    default: return OPERAND_INVALID;
+    }
+}
+
+// Opcodes following 0F, except the 0F 38 and 0F 3A escapes
+static WORD GetTwoByteOperands(BYTE opcode)
+{
+    if (opcode >= 0x80 && opcode <= 0x8F) return OPERAND_REL32;
+    if (opcode >= 0xC8 && opcode <= 0xCF) return 0;
+
+    switch (opcode) {
+    case 0x05: case 0x06: case 0x07: case 0x08: case 0x09: case 0x0B: case 0x0E:
+    case 0x30: case 0x31: case 0x32: case 0x33: case 0x34: case 0x35: case 0x37:
+    case 0x77: case 0xA0: case 0xA1: case 0xA2: case 0xA8: case 0xA9: case 0xAA:
+        return 0;
+    case 0x0F:
+    case 0x70: case 0x71: case 0x72: case 0x73:
+    case 0xA4: case 0xAC: case 0xBA: case 0xC2: case 0xC4: case 0xC5: case 0xC6:
+        return OPERAND_MODRM | OPERAND_IMM8;
+    case 0x04: case 0x0A: case 0x0C: case 0x24: case 0x25: case 0x26: case 0x27:
+    case 0x36: case 0x39: case 0x3B: case 0x3C: case 0x3D: case 0x3E: case 0x3F:
+    case 0x7A: case 0x7B: case 0xA6: case 0xA7:
+        return OPERAND_INVALID;
+    default:
+        return OPERAND_MODRM;
+    }
+}
+
+// VEX and EVEX encoded instructions always have a ModRM byte, except vzeroupper and vzeroall
+static WORD GetVectorOperands(BYTE map, BYTE opcode)
+{
+    switch (map) {
+    case 1:
+        if (opcode == 0x77) return 0;
+        switch (opcode) {
+        case 0x70: case 0x71: case 0x72: case 0x73: case 0xC2: case 0xC4: case 0xC5: case 0xC6:
+            return OPERAND_MODRM | OPERAND_IMM8;
+        default:
+            return OPERAND_MODRM;
+        }
+    case 2: case 5: case 6:
+        return OPERAND_MODRM;
+    case 3:
+        return OPERAND_MODRM | OPERAND_IMM8;
+    default:
+        return OPERAND_INVALID;
+    }
+}
+
+BOOL DecodeInstruction(const BYTE* code, size_t available, struct Instruction* pInstruction)
+{
+    memset(pInstruction, 0, sizeof(struct Instruction));
+    size_t limit = available < INSTRUCTION_MAX_LENGTH ? available : INSTRUCTION_MAX_LENGTH;
+    size_t i = 0;
+    BOOL operandSize16 = FALSE, addressSize32 = FALSE, rexW = FALSE;
+
+    while (i < limit && IsLegacyPrefix(code[i])) {
+        if (code[i] == 0x66) operandSize16 = TRUE;
+        if (code[i] == 0x67) addressSize32 = TRUE;
+        i++;
+    }
+    if (i < limit && (code[i] & 0xF0) == 0x40) {
+        rexW = (code[i] & 0x08) != 0;
+        i++;
+    }
+    if (i >= limit) return FALSE;
+
+    BYTE opcode = code[i];
+    WORD operands;
+    if (opcode == 0xC4 || opcode == 0xC5 || opcode == 0x62) {
+        // two and three byte VEX, four byte EVEX; these are never LES, LDS or BOUND in 64-bit mode
+        size_t prefixLength = opcode == 0xC5 ? 2 : (opcode == 0xC4 ? 3 : 4);
+        if (i + prefixLength >= limit) return FALSE;
+        BYTE map = opcode == 0xC5 ? 1 : (opcode == 0xC4 ? (code[i + 1] & 0x1F) : (code[i + 1] & 0x07));
+        i += prefixLength;
+        pInstruction->opcodeOffset = (BYTE)i;
+        operands = GetVectorOperands(map, code[i++]);
+    }
+    else {
+        pInstruction->opcodeOffset = (BYTE)i++;
+        if (opcode != 0x0F) {
+            operands = GetOneByteOperands(opcode);
+        }
+        else {
+            if (i >= limit) return FALSE;
+            BYTE secondOpcode = code[i++];
+            if (secondOpcode == 0x38 || secondOpcode == 0x3A) {
+                if (i >= limit) return FALSE;
+                i++;
+                operands = secondOpcode == 0x38 ? OPERAND_MODRM : OPERAND_MODRM | OPERAND_IMM8;
+            }
+            else {
+                operands = GetTwoByteOperands(secondOpcode);
+            }
+        }
+    }
+    if (operands & OPERAND_INVALID) return FALSE;
+
+    size_t displacementSize = 0;
+    if (operands & OPERAND_MODRM) {
+        if (i >= limit) return FALSE;
+        BYTE modrm = code[i++];
+        BYTE mod = modrm >> 6, reg = (modrm >> 3) & 7, rm = modrm & 7;
+        if (mod != 3) {
+            if (rm == 4) {
+                if (i >= limit) return FALSE;
+                BYTE sib = code[i++];
+                if (mod == 0 && (sib & 7) == 5) displacementSize = 4;
+            }
+            if (mod == 0 && rm == 5) {
+                displacementSize = 4;
+                pInstruction->ripRelative = TRUE;
+            }
+            else if (mod == 1) displacementSize = 1;
+            else if (mod == 2) displacementSize = 4;
+        }
+        if ((operands & OPERAND_GROUP3) && reg <= 1)
+            operands |= opcode == 0xF6 ? OPERAND_IMM8 : OPERAND_IMMZ;
+    }
+    pInstruction->displacementOffset = (BYTE)i;
+    pInstruction->displacementSize = (BYTE)displacementSize;
+    i += displacementSize;
+
+    size_t immediateSize = 0;
+    if (operands & OPERAND_IMM8) immediateSize += 1;
+    if (operands & OPERAND_IMM16) immediateSize += 2;
+    if (operands & OPERAND_IMMZ) immediateSize += operandSize16 ? 2 : 4;
+    if (operands & OPERAND_IMMV) immediateSize += rexW ? 8 : (operandSize16 ? 2 : 4);
+    if (operands & OPERAND_REL8) immediateSize += 1;
+    if (operands & OPERAND_REL32) immediateSize += 4;
+    if (operands & OPERAND_MOFFS) immediateSize += addressSize32 ? 4 : 8;
+    pInstruction->immediateOffset = (BYTE)i;
+    pInstruction->immediateSize = (BYTE)immediateSize;
+    pInstruction->relativeBranch = (operands & (OPERAND_REL8 | OPERAND_REL32)) != 0;
+    i += immediateSize;
+
+    if (i > limit) return FALSE;
+    pInstruction->length = (BYTE)i;
+    return TRUE;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "Platform.h"
+
+// Longest legal x86 instruction
+#define INSTRUCTION_MAX_LENGTH 15
+
+/*
+ * The layout of one decoded x86-64 instruction. Only lengths and operand positions are decoded, which is enough to
+ * find the bytes that change when code or the data it references moves. Offsets are relative to the first byte of
+ * the instruction and a size of 0 means the operand is absent.
+ */
+typedef struct Instruction {
+    BYTE length;
+    BYTE opcodeOffset;          // first opcode byte, after all prefixes
+    BYTE displacementOffset;    // ModRM memory displacement
+    BYTE displacementSize;
+    BYTE immediateOffset;       // immediate operand, or the branch displacement of a relative branch
+    BYTE immediateSize;
+    BOOL ripRelative;           // the displacement is relative to the next instruction
+    BOOL relativeBranch;        // the immediate is a branch displacement (call, jmp, jcc, loop)
+} Instruction;
+
+// Decodes the instruction at `code`. Returns FALSE if the bytes are not a valid 64-bit mode instruction or it does
+// not fit in `available` bytes.
+BOOL DecodeInstruction(const BYTE* code, size_t available, struct Instruction* pInstruction);
@@ -0,0 +1,468 @@
+#include "Download.h"
+#include "Stats.h"
+#include <fdi.h>
+
+static LPCWSTR g_UserAgent = L"Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/136.0.0.0 Safari/537.36";
+
+// A connection to the server of one URL, shared by all requests for that URL
+typedef struct HttpSession {
+    HINTERNET hSession;
+    HINTERNET hConnect;
+    WCHAR hostName[256];
+    WCHAR urlPath[2048];
+    DWORD requestFlags;
+} HttpSession;
+
+static void CloseHttpSession(struct HttpSession* pSession)
+{
+    if (pSession->hConnect) WinHttpCloseHandle(pSession->hConnect);
+    if (pSession->hSession) WinHttpCloseHandle(pSession->hSession);
+    ZeroMemory(pSession, sizeof(struct HttpSession));
+}
+
+static Error OpenHttpSession(LPCWSTR url, struct HttpSession* pSession)
+{
+    ZeroMemory(pSession, sizeof(struct HttpSession));
+    URL_COMPONENTS urlComponents = { 0 };
+    urlComponents.dwStructSize = sizeof(URL_COMPONENTS);
+    urlComponents.lpszHostName = pSession->hostName;
+    urlComponents.dwHostNameLength = _countof(pSession->hostName);
+    urlComponents.lpszUrlPath = pSession->urlPath;
+    urlComponents.dwUrlPathLength = _countof(pSession->urlPath);
+    if (!WinHttpCrackUrl(url, 0, 0, &urlComponents))
+        return NewError(__FUNCTION__, -1, L"WinHttpCrackUrl failed; invalid URL", GetLastError());
+    pSession->requestFlags = urlComponents.nScheme == INTERNET_SCHEME_HTTPS ? WINHTTP_FLAG_SECURE : 0;
+
+    pSession->hSession = WinHttpOpen(g_UserAgent, WINHTTP_ACCESS_TYPE_DEFAULT_PROXY, WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
+    if (!pSession->hSession)
+        return NewError(__FUNCTION__, -2, L"WinHttpOpen failed", GetLastError());
+
+    pSession->hConnect = WinHttpConnect(pSession->hSession, pSession->hostName, urlComponents.nPort, 0);
+    if (!pSession->hConnect) {
+        DWORD lastError = GetLastError();
+        CloseHttpSession(pSession);
+        return NewError(__FUNCTION__, -3, L"WinHttpConnect failed", lastError);
+    }
+    return NewNoError();
+}
+
+// Sends a GET for the byte range [first, last], or [first, end of file] when `last` is 0
+static Error SendRequest(const struct HttpSession* pSession, ULONGLONG first, ULONGLONG last, HINTERNET* phRequest, DWORD* statusCode)
+{
+    HINTERNET hRequest = WinHttpOpenRequest(pSession->hConnect, L"GET", pSession->urlPath, NULL, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, pSession->requestFlags);
+    if (!hRequest)
+        return NewError(__FUNCTION__, -1, L"WinHttpOpenRequest failed", GetLastError());
+
+    Error e = NewNoError();
+    do {
+        if (first > 0 || last > 0) {
+            WCHAR range[64];
+            if (last > 0) swprintf_s(range, _countof(range), L"Range: bytes=%llu-%llu", first, last);
+            else swprintf_s(range, _countof(range), L"Range: bytes=%llu-", first);
+            if (!WinHttpAddRequestHeaders(hRequest, range, (DWORD)-1, WINHTTP_ADDREQ_FLAG_ADD | WINHTTP_ADDREQ_FLAG_REPLACE)) {
+                e = NewError(__FUNCTION__, -2, L"WinHttpAddRequestHeaders failed", GetLastError());
+                break;
+            }
+        }
+
+        if (!WinHttpSendRequest(hRequest, WINHTTP_NO_ADDITIONAL_HEADERS, 0, WINHTTP_NO_REQUEST_DATA, 0, 0, 0)) {
+            e = NewError(__FUNCTION__, -3, L"WinHttpSendRequest failed", GetLastError());
+            break;
+        }
+        if (!WinHttpReceiveResponse(hRequest, NULL)) {
+            e = NewError(__FUNCTION__, -4, L"WinHttpReceiveResponse failed", GetLastError());
+            break;
+        }
+
+        DWORD statusSize = sizeof(DWORD);
+        if (!WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER, WINHTTP_HEADER_NAME_BY_INDEX, statusCode, &statusSize, WINHTTP_NO_HEADER_INDEX)) {
+            e = NewError(__FUNCTION__, -5, L"WinHttpQueryHeaders failed", GetLastError());
+            break;
+        }
+    } while (FALSE);
+
+    if (e.ContainsError) WinHttpCloseHandle(hRequest);
+    else *phRequest = hRequest;
+    return e;
+}
+
+// Returns the Content-Length of a response, or 0 if the server did not send one
+static ULONGLONG GetContentLength(HINTERNET hRequest)
+{
+    WCHAR value[32];
+    DWORD valueSize = sizeof(value);
+    if (!WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_CONTENT_LENGTH, WINHTTP_HEADER_NAME_BY_INDEX, value, &valueSize, WINHTTP_NO_HEADER_INDEX))
+        return 0;
+    return _wcstoui64(value, NULL, 10);
+}
+
+static BOOL AcceptsRanges(HINTERNET hRequest)
+{
+    WCHAR value[32];
+    DWORD valueSize = sizeof(value);
+    if (!WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_ACCEPT_RANGES, WINHTTP_HEADER_NAME_BY_INDEX, value, &valueSize, WINHTTP_NO_HEADER_INDEX))
+        return FALSE;
+    return _wcsicmp(value, L"bytes") == 0;
+}
+
+// Writes `length` bytes at `offset`. Positioned writes let parallel ranges share one handle.
+static BOOL WriteAt(HANDLE hFile, const BYTE* data, DWORD length, ULONGLONG offset)
+{
+    OVERLAPPED overlapped = { 0 };
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD written = 0;
+    AddStatsCount(STATS_SYSCALLS, 1);
+    return WriteFile(hFile, data, length, &written, &overlapped) && written == length;
+}
+
+// Streams a response body to `offset` in the file. `received` counts the bytes written, even on failure, so the
+// caller knows where to resume.
+static Error ReceiveToFile(HINTERNET hRequest, HANDLE hFile, ULONGLONG offset, BYTE* buffer, volatile LONG* cancel, ULONGLONG* received)
+{
+    *received = 0;
+    for (;;) {
+        // fill the whole buffer before writing, so large files are written in a few big chunks
+        DWORD filled = 0, read = 0, reads = 0;
+        BOOL readOk = TRUE;
+        while (filled < DOWNLOAD_BUFFER_SIZE) {
+            readOk = WinHttpReadData(hRequest, buffer + filled, DOWNLOAD_BUFFER_SIZE - filled, &read);
+            reads++;
+            if (!readOk || read == 0) break;
+            filled += read;
+        }
+        DWORD lastError = GetLastError();
+        AddStatsCount(STATS_SYSCALLS, reads);
+
+        if (filled > 0) {
+            if (!WriteAt(hFile, buffer, filled, offset + *received))
+                return NewError(__FUNCTION__, -1, L"WriteFile failed", GetLastError());
+            *received += filled;
+        }
+        if (!readOk)
+            return NewError(__FUNCTION__, -2, L"WinHttpReadData failed", lastError);
+        if (cancel && *cancel)
+            return NewError(__FUNCTION__, -3, L"Transfer cancelled", 0);
+        if (read == 0)
+            return NewNoError();
+    }
+}
+
+// One slice of a parallel download
+typedef struct RangeWorker {
+    const struct HttpSession* pSession;
+    HANDLE hFile;
+    ULONGLONG first;
+    ULONGLONG last;
+    ULONGLONG received;
+    volatile LONG* cancel;
+    Error error;
+} RangeWorker;
+
+static DWORD WINAPI RangeWorkerThread(LPVOID parameter)
+{
+    struct RangeWorker* worker = (struct RangeWorker*)parameter;
+    BYTE* buffer = (BYTE*)malloc(DOWNLOAD_BUFFER_SIZE);
+    if (!buffer) {
+        worker->error = NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0);
+        InterlockedExchange(worker->cancel, 1);
+        return 0;
+    }
+
+    // a range that breaks off is resumed from where it stopped
+    worker->error = NewNoError();
+    for (int attempt = 0; attempt <= DOWNLOAD_RETRIES && worker->first + worker->received <= worker->last; attempt++) {
+        Error_Free(&worker->error);
+        HINTERNET hRequest = NULL;
+        DWORD statusCode = 0;
+        worker->error = SendRequest(worker->pSession, worker->first + worker->received, worker->last, &hRequest, &statusCode);
+        if (worker->error.ContainsError) continue;
+        if (statusCode != 206) {
+            WinHttpCloseHandle(hRequest);
+            worker->error = NewError(__FUNCTION__, -2, L"Server did not honour the range request", statusCode);
+            break;
+        }
+
+        ULONGLONG received = 0;
+        worker->error = ReceiveToFile(hRequest, worker->hFile, worker->first + worker->received, buffer, worker->cancel, &received);
+        worker->received += received;
+        WinHttpCloseHandle(hRequest);
+        if (!worker->error.ContainsError || *worker->cancel) break;
+    }
+    if (!worker->error.ContainsError && worker->first + worker->received != worker->last + 1)
+        worker->error = NewError(__FUNCTION__, -3, L"Range ended early", 0);
+
+    if (worker->error.ContainsError) InterlockedExchange(worker->cancel, 1);
+    free(buffer);
+    return 0;
+}
+
+// Splits [0, fileSize) over parallel range requests writing into the same file
+static Error DownloadRanges(const struct HttpSession* pSession, HANDLE hFile, ULONGLONG fileSize, DWORD connections, ULONGLONG* received)
+{
+    struct RangeWorker workers[DOWNLOAD_MAX_CONNECTIONS] = { 0 };
+    HANDLE threads[DOWNLOAD_MAX_CONNECTIONS] = { 0 };
+    volatile LONG cancel = 0;
+    ULONGLONG sliceSize = (fileSize + connections - 1) / connections;
+
+    DWORD nThreads = 0;
+    for (DWORD i = 0; i < connections; i++) {
+        workers[i].pSession = pSession;
+        workers[i].hFile = hFile;
+        workers[i].first = i * sliceSize;
+        workers[i].last = (i + 1 == connections ? fileSize : (i + 1) * sliceSize) - 1;
+        workers[i].cancel = &cancel;
+        workers[i].error = NewNoError();
+        threads[i] = CreateThread(NULL, 0, RangeWorkerThread, &workers[i], 0, NULL);
+        if (!threads[i]) {
+            InterlockedExchange(&cancel, 1);
+            break;
+        }
+        nThreads++;
+    }
+    if (nThreads > 0) WaitForMultipleObjects(nThreads, threads, TRUE, INFINITE);
+
+    Error e = nThreads == connections ? NewNoError() : NewError(__FUNCTION__, -1, L"CreateThread failed", GetLastError());
+    *received = 0;
+    for (DWORD i = 0; i < nThreads; i++) {
+        CloseHandle(threads[i]);
+        *received += workers[i].received;
+        if (workers[i].error.ContainsError && !e.ContainsError) {
+            e = workers[i].error;
+            e.AddFunctionToStack(&e, __FUNCTION__, -2);
+        }
+        else Error_Free(&workers[i].error);
+    }
+    return e;
+}
+
+// Reserves disk space for the whole file up front without moving its end, so an interrupted transfer can still
+// be resumed from the file size
+static void PreallocateFile(HANDLE hFile, ULONGLONG size)
+{
+    FILE_ALLOCATION_INFO allocationInfo = { 0 };
+    allocationInfo.AllocationSize.QuadPart = (LONGLONG)size;
+    SetFileInformationByHandle(hFile, FileAllocationInfo, &allocationInfo, sizeof(allocationInfo));
+}
+
+static BOOL SetFileSize(HANDLE hFile, ULONGLONG size)
+{
+    LARGE_INTEGER position;
+    position.QuadPart = (LONGLONG)size;
+    return SetFilePointerEx(hFile, position, NULL, FILE_BEGIN) && SetEndOfFile(hFile);
+}
+
+Error DownloadFile(LPCWSTR url, LPCWSTR outputPath, DWORD maxConnections, struct DownloadStats* pStats)
+{
+    ZeroMemory(pStats, sizeof(struct DownloadStats));
+    LARGE_INTEGER frequency, start, end;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    struct HttpSession session;
+    Error e = OpenHttpSession(url, &session);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+
+    HANDLE hOut = INVALID_HANDLE_VALUE;
+    BYTE* buffer = NULL;
+    HINTERNET hRequest = NULL;
+    do {
+        hOut = CreateFileW(outputPath, GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        AddStatsCount(STATS_FILE_OPENS, 1);
+        AddStatsCount(STATS_SYSCALLS, 1);
+        if (hOut == INVALID_HANDLE_VALUE) {
+            e = NewError(__FUNCTION__, -2, L"CreateFileW failed", GetLastError());
+            break;
+        }
+        buffer = (BYTE*)malloc(DOWNLOAD_BUFFER_SIZE);
+        if (!buffer) {
+            e = NewError(__FUNCTION__, -3, L"malloc failed; out of memory", 0);
+            break;
+        }
+
+        // whatever an earlier interrupted call left in the file is kept and resumed
+        LARGE_INTEGER existingSize = { 0 };
+        GetFileSizeEx(hOut, &existingSize);
+        ULONGLONG offset = (ULONGLONG)existingSize.QuadPart;
+        pStats->resumedFrom = offset;
+        pStats->connections = 1;
+
+        for (int attempt = 0; attempt <= DOWNLOAD_RETRIES; attempt++) {
+            if (attempt > 0) Error_Free(&e);
+            e = SendRequest(&session, offset, 0, &hRequest, &pStats->statusCode);
+            if (e.ContainsError) {
+                e.AddFunctionToStack(&e, __FUNCTION__, -4);
+                continue;
+            }
+
+            if (pStats->statusCode == 416 && offset > 0) {
+                // the partial file is already complete
+                pStats->fileSize = offset;
+                break;
+            }
+            if (pStats->statusCode != 200 && pStats->statusCode != 206) {
+                e = NewError(__FUNCTION__, -5, L"Server returned an error status", pStats->statusCode);
+                break;
+            }
+            if (pStats->statusCode == 200 && offset > 0) {
+                // the server ignored the range, start over
+                offset = 0;
+                pStats->resumedFrom = 0;
+                if (!SetFileSize(hOut, 0)) {
+                    e = NewError(__FUNCTION__, -6, L"Failed to truncate the partial file", GetLastError());
+                    break;
+                }
+            }
+
+            ULONGLONG contentLength = GetContentLength(hRequest);
+            if (contentLength > 0) {
+                pStats->fileSize = offset + contentLength;
+                if (attempt == 0) PreallocateFile(hOut, pStats->fileSize);
+            }
+
+            DWORD connections = maxConnections < DOWNLOAD_MAX_CONNECTIONS ? maxConnections : DOWNLOAD_MAX_CONNECTIONS;
+            if (offset == 0 && connections > 1 && contentLength >= DOWNLOAD_PARALLEL_THRESHOLD && AcceptsRanges(hRequest)) {
+                WinHttpCloseHandle(hRequest);
+                hRequest = NULL;
+
+                // every slice is written in place, so the file gets its final size first
+                ULONGLONG received = 0;
+                if (!SetFileSize(hOut, contentLength)) {
+                    e = NewError(__FUNCTION__, -7, L"Failed to size the output file", GetLastError());
+                    break;
+                }
+                pStats->connections = connections;
+                e = DownloadRanges(&session, hOut, contentLength, connections, &received);
+                pStats->bytesReceived += received;
+                if (e.ContainsError) {
+                    // holes cannot be resumed from the file size, so a failed parallel transfer starts from scratch
+                    SetFileSize(hOut, 0);
+                    e.AddFunctionToStack(&e, __FUNCTION__, -8);
+                }
+                break;
+            }
+
+            ULONGLONG received = 0;
+            e = ReceiveToFile(hRequest, hOut, offset, buffer, NULL, &received);
+            WinHttpCloseHandle(hRequest);
+            hRequest = NULL;
+            pStats->bytesReceived += received;
+            offset += received;
+            if (!e.ContainsError) {
+                if (pStats->fileSize != 0 && offset != pStats->fileSize) {
+                    e = NewError(__FUNCTION__, -9, L"Connection closed before the whole file was received", 0);
+                    continue;
+                }
+                pStats->fileSize = offset;
+                break;
+            }
+            e.AddFunctionToStack(&e, __FUNCTION__, -10);
+        }
+    } while (FALSE);
+
+    if (hRequest) WinHttpCloseHandle(hRequest);
+    if (hOut != INVALID_HANDLE_VALUE) {
+        // drop the unused part of the preallocation
+        if (!e.ContainsError) SetFileSize(hOut, pStats->fileSize);
+        CloseHandle(hOut);
+    }
+    free(buffer);
+    CloseHttpSession(&session);
+
+    QueryPerformanceCounter(&end);
+    pStats->seconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+    return e;
+}
+
+// Cabinet extraction through FDI with wide path support: cabinet names are passed to FDI as UTF-8 and converted
+// back in the open callback.
+typedef struct CabinetContext {
+    LPCWSTR outputPath;
+    BOOL extracted;
+} CabinetContext;
+
+static FNALLOC(CabinetAlloc) { return malloc(cb); }
+static FNFREE(CabinetFree) { free(pv); }
+
+static FNOPEN(CabinetOpen)
+{
+    UNREFERENCED_PARAMETER(oflag);
+    UNREFERENCED_PARAMETER(pmode);
+    WCHAR path[MAX_PATH * 4];
+    if (!MultiByteToWideChar(CP_UTF8, 0, pszFile, -1, path, _countof(path))) return -1;
+    HANDLE hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    AddStatsCount(STATS_FILE_OPENS, 1);
+    AddStatsCount(STATS_SYSCALLS, 1);
+    return hFile == INVALID_HANDLE_VALUE ? -1 : (INT_PTR)hFile;
+}
+
+static FNREAD(CabinetRead)
+{
+    DWORD read = 0;
+    BOOL readOk = ReadFile((HANDLE)hf, pv, cb, &read, NULL);
+    AddStatsCount(STATS_SYSCALLS, 1);
+    AddStatsCount(STATS_BYTES_READ, read);
+    return readOk ? read : (UINT)-1;
+}
+
+static FNWRITE(CabinetWrite)
+{
+    DWORD written = 0;
+    AddStatsCount(STATS_SYSCALLS, 1);
+    return WriteFile((HANDLE)hf, pv, cb, &written, NULL) ? written : (UINT)-1;
+}
+
+static FNCLOSE(CabinetClose) { return CloseHandle((HANDLE)hf) ? 0 : -1; }
+
+static FNSEEK(CabinetSeek)
+{
+    // SEEK_SET, SEEK_CUR and SEEK_END have the same values as FILE_BEGIN, FILE_CURRENT and FILE_END
+    DWORD position = SetFilePointer((HANDLE)hf, dist, NULL, seektype);
+    return position == INVALID_SET_FILE_POINTER ? -1 : (long)position;
+}
+
+static FNFDINOTIFY(CabinetNotify)
+{
+    struct CabinetContext* context = (struct CabinetContext*)pfdin->pv;
+    switch (fdint) {
+    case fdintCOPY_FILE: {
+        // symbol cabinets hold one file, anything after it is skipped
+        if (context->extracted) return 0;
+        HANDLE hFile = CreateFileW(context->outputPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        AddStatsCount(STATS_FILE_OPENS, 1);
+        AddStatsCount(STATS_SYSCALLS, 1);
+        return hFile == INVALID_HANDLE_VALUE ? -1 : (INT_PTR)hFile;
+    }
+    case fdintCLOSE_FILE_INFO:
+        CloseHandle((HANDLE)pfdin->hf);
+        context->extracted = TRUE;
+        return TRUE;
+    default:
+        return 0;
+    }
+}
+
+Error ExpandCabinet(LPCWSTR cabinetPath, LPCWSTR outputPath)
+{
+    char cabinetName[MAX_PATH * 4];
+    if (!WideCharToMultiByte(CP_UTF8, 0, cabinetPath, -1, cabinetName, sizeof(cabinetName), NULL, NULL))
+        return NewError(__FUNCTION__, -1, L"Cabinet path is too long", GetLastError());
+
+    ERF erf = { 0 };
+    HFDI hfdi = FDICreate(CabinetAlloc, CabinetFree, CabinetOpen, CabinetRead, CabinetWrite, CabinetClose, CabinetSeek, cpuUNKNOWN, &erf);
+    if (!hfdi)
+        return NewError(__FUNCTION__, -2, L"FDICreate failed", erf.erfOper);
+
+    struct CabinetContext context = { outputPath, FALSE };
+    char emptyPath[1] = "";
+    BOOL copied = FDICopy(hfdi, cabinetName, emptyPath, 0, CabinetNotify, NULL, &context);
+    FDIDestroy(hfdi);
+    if (!copied)
+        return NewError(__FUNCTION__, -3, L"FDICopy failed; not a valid cabinet", erf.erfOper);
+    if (!context.extracted)
+        return NewError(__FUNCTION__, -4, L"Cabinet is empty", 0);
+    return NewNoError();
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <Windows.h>
+#include <WinHTTP.h>
+#include "Error.h"
+#pragma comment(lib, "WinHTTP.lib")
+#pragma comment(lib, "Cabinet.lib")
+
+#define DOWNLOAD_BUFFER_SIZE (4 * 1024 * 1024)
+#define DOWNLOAD_RETRIES 3
+#define DOWNLOAD_MAX_CONNECTIONS 8
+#define DOWNLOAD_DEFAULT_CONNECTIONS 4
+// Files smaller than this are always fetched over one connection
+#define DOWNLOAD_PARALLEL_THRESHOLD (64ULL * 1024 * 1024)
+
+typedef struct DownloadStats {
+    DWORD statusCode;           // HTTP status of the last response, e.g. 404 when the file is not on the server
+    ULONGLONG fileSize;         // size of the complete file
+    ULONGLONG bytesReceived;    // bytes transferred by this call
+    ULONGLONG resumedFrom;      // offset an interrupted earlier transfer was resumed at, 0 for a fresh download
+    DWORD connections;          // number of parallel range requests used
+    double seconds;
+} DownloadStats;
+
+/*
+ * Streams `url` into `outputPath` through multi-megabyte buffers. A partial file left by an interrupted earlier
+ * call is resumed with a Range request, and a transfer that breaks off is resumed up to DOWNLOAD_RETRIES times.
+ * Large files on servers that accept ranges are split over up to `maxConnections` parallel range requests.
+ */
+Error DownloadFile(LPCWSTR url, LPCWSTR outputPath, DWORD maxConnections, struct DownloadStats* pStats);
+
+// Extracts the single file of a cabinet, such as a compressed `.pd_` symbol file, to `outputPath`.
+Error ExpandCabinet(LPCWSTR cabinetPath, LPCWSTR outputPath);
@@ -0,0 +1,306 @@
+#include "Dump.h"
+
+#define MINIDUMP_MODULE_LIST_STREAM 4
+#define MINIDUMP_MEMORY_LIST_STREAM 5
+#define MINIDUMP_MEMORY64_LIST_STREAM 9
+
+// The minidump file format, as in DbgHelp.h, which is not available outside of Windows
+#pragma pack(push, 4)
+typedef struct DumpHeader {
+    DWORD signature;
+    DWORD version;
+    DWORD numStreams;
+    DWORD streamDirectoryRva;
+    DWORD checkSum;
+    DWORD timeDateStamp;
+    ULONGLONG flags;
+} DumpHeader;
+
+typedef struct DumpDirectory {
+    DWORD streamType;
+    DWORD dataSize;
+    DWORD rva;
+} DumpDirectory;
+
+typedef struct DumpLocation {
+    DWORD dataSize;
+    DWORD rva;
+} DumpLocation;
+
+typedef struct DumpModuleEntry {
+    ULONGLONG baseOfImage;
+    DWORD sizeOfImage;
+    DWORD checkSum;
+    DWORD timeDateStamp;
+    DWORD moduleNameRva;
+    DWORD versionInfo[13];
+    struct DumpLocation cvRecord;
+    struct DumpLocation miscRecord;
+    ULONGLONG reserved0;
+    ULONGLONG reserved1;
+} DumpModuleEntry;
+
+typedef struct DumpMemoryDescriptor {
+    ULONGLONG start;
+    struct DumpLocation memory;
+} DumpMemoryDescriptor;
+
+typedef struct DumpMemoryDescriptor64 {
+    ULONGLONG start;
+    ULONGLONG dataSize;
+} DumpMemoryDescriptor64;
+#pragma pack(pop)
+
+// Returns a pointer to `length` bytes at an offset in the dump, or NULL if they are not all in the file
+static const BYTE* GetDumpSpan(const struct Dump* pDump, ULONGLONG rva, ULONGLONG length)
+{
+    if (rva > pDump->file.size || length > pDump->file.size - rva) return NULL;
+    return pDump->file.data + rva;
+}
+
+// Copies a MINIDUMP_STRING, a byte length followed by UTF-16 characters, into a heap allocated wide string
+static WCHAR* ReadDumpString(const struct Dump* pDump, DWORD rva)
+{
+    const BYTE* lengthData = GetDumpSpan(pDump, rva, sizeof(DWORD));
+    if (!lengthData) return NULL;
+    DWORD numUnits = *(const DWORD*)lengthData / sizeof(WORD);
+    const WORD* units = (const WORD*)GetDumpSpan(pDump, (ULONGLONG)rva + sizeof(DWORD), (ULONGLONG)numUnits * sizeof(WORD));
+    if (!units) return NULL;
+
+    WCHAR* name = (WCHAR*)malloc(((size_t)numUnits + 1) * sizeof(WCHAR));
+    if (!name) return NULL;
+    size_t n = 0;
+    for (DWORD i = 0; i < numUnits; i++) {
+#ifndef _WIN32
+        // wchar_t is UTF-32 here, so surrogate pairs are joined
+        if (units[i] >= 0xD800 && units[i] < 0xDC00 && i + 1 < numUnits && units[i + 1] >= 0xDC00 && units[i + 1] < 0xE000) {
+            name[n++] = (WCHAR)(0x10000 + (((DWORD)units[i] - 0xD800) << 10) + (units[i + 1] - 0xDC00));
+            i++;
+            continue;
+        }
+#endif
+        name[n++] = (WCHAR)units[i];
+    }
+    name[n] = L'\0';
+    return name;
+}
+
+static Error ReadModuleList(struct Dump* pDump, const DumpDirectory* directory)
+{
+    const BYTE* stream = GetDumpSpan(pDump, directory->rva, directory->dataSize);
+    if (!stream || directory->dataSize < sizeof(DWORD))
+        return NewError(__FUNCTION__, -1, L"Module list is out of file bounds", 0);
+    DWORD numModules = *(const DWORD*)stream;
+    if ((ULONGLONG)numModules * sizeof(DumpModuleEntry) > directory->dataSize - sizeof(DWORD))
+        return NewError(__FUNCTION__, -2, L"Module list is truncated", 0);
+
+    pDump->modules = (struct DumpModule*)calloc(numModules ? numModules : 1, sizeof(struct DumpModule));
+    if (!pDump->modules)
+        return NewError(__FUNCTION__, -3, L"calloc failed; out of memory", 0);
+
+    const DumpModuleEntry* entries = (const DumpModuleEntry*)(stream + sizeof(DWORD));
+    for (DWORD i = 0; i < numModules; i++) {
+        struct DumpModule* module = &pDump->modules[pDump->numModules];
+        module->name = ReadDumpString(pDump, entries[i].moduleNameRva);
+        if (!module->name)
+            return NewError(__FUNCTION__, -4, L"Module name is out of file bounds", 0);
+        module->base = entries[i].baseOfImage;
+        module->size = entries[i].sizeOfImage;
+        module->timeDateStamp = entries[i].timeDateStamp;
+        pDump->numModules++;
+    }
+    return NewNoError();
+}
+
+// Memory ranges of the MemoryListStream each point to their own bytes. A range cut off by a truncated dump is
+// shortened to the bytes that are present.
+static Error ReadMemoryList(struct Dump* pDump, const DumpDirectory* directory)
+{
+    const BYTE* stream = GetDumpSpan(pDump, directory->rva, directory->dataSize);
+    if (!stream || directory->dataSize < sizeof(DWORD))
+        return NewError(__FUNCTION__, -1, L"Memory list is out of file bounds", 0);
+    DWORD numRanges = *(const DWORD*)stream;
+    if ((ULONGLONG)numRanges * sizeof(DumpMemoryDescriptor) > directory->dataSize - sizeof(DWORD))
+        return NewError(__FUNCTION__, -2, L"Memory list is truncated", 0);
+
+    pDump->ranges = (struct DumpRange*)calloc(numRanges ? numRanges : 1, sizeof(struct DumpRange));
+    if (!pDump->ranges)
+        return NewError(__FUNCTION__, -3, L"calloc failed; out of memory", 0);
+
+    const DumpMemoryDescriptor* descriptors = (const DumpMemoryDescriptor*)(stream + sizeof(DWORD));
+    for (DWORD i = 0; i < numRanges; i++) {
+        ULONGLONG rva = descriptors[i].memory.rva;
+        if (rva >= pDump->file.size) continue;
+        ULONGLONG length = descriptors[i].memory.dataSize;
+        if (length > pDump->file.size - rva) length = pDump->file.size - rva;
+
+        struct DumpRange* range = &pDump->ranges[pDump->numRanges++];
+        range->address = descriptors[i].start;
+        range->length = length;
+        range->data = pDump->file.data + rva;
+    }
+    return NewNoError();
+}
+
+// The bytes of the Memory64ListStream ranges are stored one after the other from a single base offset
+static Error ReadMemory64List(struct Dump* pDump, const DumpDirectory* directory)
+{
+    const BYTE* stream = GetDumpSpan(pDump, directory->rva, directory->dataSize);
+    if (!stream || directory->dataSize < 2 * sizeof(ULONGLONG))
+        return NewError(__FUNCTION__, -1, L"Memory64 list is out of file bounds", 0);
+    ULONGLONG numRanges = ((const ULONGLONG*)stream)[0];
+    ULONGLONG rva = ((const ULONGLONG*)stream)[1];
+    if (numRanges > (directory->dataSize - 2 * sizeof(ULONGLONG)) / sizeof(DumpMemoryDescriptor64))
+        return NewError(__FUNCTION__, -2, L"Memory64 list is truncated", 0);
+
+    pDump->ranges = (struct DumpRange*)calloc(numRanges ? (size_t)numRanges : 1, sizeof(struct DumpRange));
+    if (!pDump->ranges)
+        return NewError(__FUNCTION__, -3, L"calloc failed; out of memory", 0);
+
+    const DumpMemoryDescriptor64* descriptors = (const DumpMemoryDescriptor64*)(stream + 2 * sizeof(ULONGLONG));
+    for (ULONGLONG i = 0; i < numRanges && rva < pDump->file.size; i++) {
+        ULONGLONG length = descriptors[i].dataSize;
+        if (length > pDump->file.size - rva) length = pDump->file.size - rva;
+
+        struct DumpRange* range = &pDump->ranges[pDump->numRanges++];
+        range->address = descriptors[i].start;
+        range->length = length;
+        range->data = pDump->file.data + rva;
+        rva += length;
+    }
+    return NewNoError();
+}
+
+static int CompareDumpRanges(const void* a, const void* b)
+{
+    ULONGLONG addressA = ((const struct DumpRange*)a)->address;
+    ULONGLONG addressB = ((const struct DumpRange*)b)->address;
+    return addressA < addressB ? -1 : addressA > addressB ? 1 : 0;
+}
+
+Error OpenDump(LPCWSTR filePath, struct Dump* pDump)
+{
+    memset(pDump, 0, sizeof(struct Dump));
+    Error e = MapFileReadOnly(filePath, &pDump->file);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+
+    do {
+        const DumpHeader* header = (const DumpHeader*)GetDumpSpan(pDump, 0, sizeof(DumpHeader));
+        if (!header || header->signature != MINIDUMP_MAGIC) {
+            e = NewError(__FUNCTION__, -2, L"Not a minidump file", 0);
+            break;
+        }
+        const DumpDirectory* directories = (const DumpDirectory*)GetDumpSpan(pDump, header->streamDirectoryRva, (ULONGLONG)header->numStreams * sizeof(DumpDirectory));
+        if (!directories) {
+            e = NewError(__FUNCTION__, -3, L"Stream directory is out of file bounds", 0);
+            break;
+        }
+
+        // a full memory dump has a Memory64ListStream, which holds the same ranges as any MemoryListStream
+        const DumpDirectory* moduleList = NULL;
+        const DumpDirectory* memoryList = NULL;
+        const DumpDirectory* memory64List = NULL;
+        for (DWORD i = 0; i < header->numStreams; i++) {
+            if (directories[i].streamType == MINIDUMP_MODULE_LIST_STREAM) moduleList = &directories[i];
+            else if (directories[i].streamType == MINIDUMP_MEMORY_LIST_STREAM) memoryList = &directories[i];
+            else if (directories[i].streamType == MINIDUMP_MEMORY64_LIST_STREAM) memory64List = &directories[i];
+        }
+        if (!moduleList) {
+            e = NewError(__FUNCTION__, -4, L"Minidump has no module list", 0);
+            break;
+        }
+        if (!memoryList && !memory64List) {
+            e = NewError(__FUNCTION__, -5, L"Minidump has no memory list", 0);
+            break;
+        }
+
+        e = ReadModuleList(pDump, moduleList);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -6);
+            break;
+        }
+        e = memory64List ? ReadMemory64List(pDump, memory64List) : ReadMemoryList(pDump, memoryList);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -7);
+            break;
+        }
+        qsort(pDump->ranges, pDump->numRanges, sizeof(struct DumpRange), CompareDumpRanges);
+    } while (FALSE);
+
+    if (e.ContainsError) FreeDump(pDump);
+    return e;
+}
+
+void FreeDump(struct Dump* pDump)
+{
+    if (pDump->modules) {
+        for (DWORD i = 0; i < pDump->numModules; i++)
+            free(pDump->modules[i].name);
+    }
+    free(pDump->modules);
+    free(pDump->ranges);
+    UnmapFile(&pDump->file);
+    memset(pDump, 0, sizeof(struct Dump));
+}
+
+const struct DumpModule* FindDumpModule(const struct Dump* pDump, LPCWSTR name)
+{
+    for (DWORD i = 0; i < pDump->numModules; i++) {
+        const WCHAR* moduleName = pDump->modules[i].name;
+        const WCHAR* fileName = moduleName;
+        for (const WCHAR* p = moduleName; *p; p++) {
+            if (*p == L'\\' || *p == L'/') fileName = p + 1;
+        }
+        if (_wcsicmp(moduleName, name) == 0 || _wcsicmp(fileName, name) == 0)
+            return &pDump->modules[i];
+    }
+    return NULL;
+}
+
+Error GetDumpModuleImage(const struct Dump* pDump, const struct DumpModule* pModule, struct ImageView* pImage)
+{
+    ULONGLONG start = pModule->base;
+    ULONGLONG end = pModule->base + pModule->size;
+
+    // at most one segment per range, fewer where ranges follow each other in memory and in the file
+    DWORD maxSegments = 0;
+    for (DWORD i = 0; i < pDump->numRanges; i++) {
+        const struct DumpRange* range = &pDump->ranges[i];
+        if (range->address < end && range->address + range->length > start) maxSegments++;
+    }
+    struct ImageSegment* segments = (struct ImageSegment*)malloc((maxSegments ? maxSegments : 1) * sizeof(struct ImageSegment));
+    if (!segments)
+        return NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0);
+
+    DWORD numSegments = 0;
+    for (DWORD i = 0; i < pDump->numRanges; i++) {
+        const struct DumpRange* range = &pDump->ranges[i];
+        ULONGLONG overlapStart = range->address > start ? range->address : start;
+        ULONGLONG overlapEnd = range->address + range->length < end ? range->address + range->length : end;
+
+        // ranges are sorted by address, a range overlapping the one before only adds its tail
+        struct ImageSegment* last = numSegments ? &segments[numSegments - 1] : NULL;
+        if (last && overlapStart < start + last->rva + last->length) overlapStart = start + last->rva + last->length;
+        if (overlapStart >= overlapEnd) continue;
+
+        DWORD rva = (DWORD)(overlapStart - start);
+        DWORD length = (DWORD)(overlapEnd - overlapStart);
+        const BYTE* data = range->data + (overlapStart - range->address);
+        if (last && last->rva + last->length == rva && last->data + last->length == data) {
+            last->length += length;
+            continue;
+        }
+        segments[numSegments].rva = rva;
+        segments[numSegments].length = length;
+        segments[numSegments].data = data;
+        numSegments++;
+    }
+
+    Error e = CreateLoadedImageView(segments, numSegments, pModule->base, pImage);
+    if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -2);
+    free(segments);
+    return e;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "Image.h"
+
+#define MINIDUMP_MAGIC 0x504D444D // 'MDMP'
+
+// A module loaded in the dumped process
+typedef struct DumpModule {
+    WCHAR* name;                // full path as recorded by the loader
+    ULONGLONG base;
+    DWORD size;
+    DWORD timeDateStamp;
+} DumpModule;
+
+// A range of captured memory and where its bytes are in the dump file
+typedef struct DumpRange {
+    ULONGLONG address;
+    ULONGLONG length;
+    const BYTE* data;
+} DumpRange;
+
+/*
+ * A user-mode minidump mapped once, with its module list and memory ranges parsed. Ranges come from the
+ * Memory64ListStream of full memory dumps or the MemoryListStream of smaller ones, sorted by address.
+ * Image views into the dump point into its mapping and have to be unmapped before FreeDump.
+ */
+typedef struct Dump {
+    struct FileMapping file;
+    struct DumpModule* modules;
+    DWORD numModules;
+    struct DumpRange* ranges;
+    DWORD numRanges;
+} Dump;
+
+// Maps a minidump file and parses its module list and memory ranges. Free after use with FreeDump.
+Error OpenDump(LPCWSTR filePath, struct Dump* pDump);
+void FreeDump(struct Dump* pDump);
+
+// Finds a module by its full path or only its file name, ignoring case. Returns NULL if it is not loaded.
+const struct DumpModule* FindDumpModule(const struct Dump* pDump, LPCWSTR name);
+
+// Views the captured memory of a module as a loaded image, with pages the dump does not hold left out.
+// Fails if the page with the headers was not captured. Free after use with UnmapImageView.
+Error GetDumpModuleImage(const struct Dump* pDump, const struct DumpModule* pModule, struct ImageView* pImage);
@@ -100,7 +100,7 @@ wchar_t* Error_Format(void* pvErr) {
         }
         else wFuncName = (wchar_t*)L"";
 
-        int written = swprintf_s(OutBuffer + Offset, szTotalLength - Offset, L"%s[%d] -> ", wFuncName, err->StackTrace[idx].ErrorCode);
+        int written = swprintf_s(OutBuffer + Offset, szTotalLength - Offset, L"%ls[%d] -> ", wFuncName, err->StackTrace[idx].ErrorCode);
         if (written < 0) {
             free(wFuncName);
             free(OutBuffer);
@@ -113,7 +113,7 @@ wchar_t* Error_Format(void* pvErr) {
         Offset -= 4;  // Remove the last " -> "
         OutBuffer[Offset] = L'\0';
     }
-    int Written = swprintf_s(OutBuffer + Offset, szTotalLength - Offset, L": %s", err->Description ? err->Description : L"");
+    int Written = swprintf_s(OutBuffer + Offset, szTotalLength - Offset, L": %ls", err->Description ? err->Description : L"");
     if (Written < 0) {
         free(OutBuffer);
         return NULL;
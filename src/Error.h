@@ -1,5 +1,5 @@
 #pragma once
-#include <Windows.h>
+#include "Platform.h"
 #include <stdio.h>
 
 // A structure representing each entry in the error stack trace
@@ -28,12 +28,6 @@ typedef struct {
     wchar_t* (*Format)(void* pvErr);
 } Error;
 
-/* Helper: count digits in an integer (including a '-' sign if needed) */
-static int count_digits(int n);
-
-/* Helper: count digits in an unsigned number (for LastErrorCode) */
-static int count_udigits(DWORD n);
-
 // Adds a new function call to the error’s stack trace.
 void Error_AddNewFunctionToStack(void* pvErr, const char* FunctionName, int ErrorCode);
 
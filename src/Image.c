@@ -0,0 +1,278 @@
+#include "Image.h"
+#include "Stats.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+Error MapFileReadOnly(LPCWSTR filePath, struct FileMapping* pMapping)
+{
+    memset(pMapping, 0, sizeof(struct FileMapping));
+#ifdef _WIN32
+    HANDLE hFile = CreateFileW(filePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return NewError(__FUNCTION__, -1, L"CreateFileW failed", GetLastError());
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart == 0) {
+        DWORD lastError = GetLastError();
+        CloseHandle(hFile);
+        return NewError(__FUNCTION__, -2, L"GetFileSizeEx failed or the file is empty", lastError);
+    }
+
+    HANDLE hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!hMapping) {
+        DWORD lastError = GetLastError();
+        CloseHandle(hFile);
+        return NewError(__FUNCTION__, -3, L"CreateFileMappingW failed", lastError);
+    }
+
+    const BYTE* data = (const BYTE*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        DWORD lastError = GetLastError();
+        CloseHandle(hMapping);
+        CloseHandle(hFile);
+        return NewError(__FUNCTION__, -4, L"MapViewOfFile failed", lastError);
+    }
+
+    pMapping->hFile = hFile;
+    pMapping->hMapping = hMapping;
+    pMapping->data = data;
+    pMapping->size = (ULONGLONG)fileSize.QuadPart;
+    AddStatsCount(STATS_SYSCALLS, 4);
+#else
+    char* path = WideToUtf8(filePath);
+    if (!path)
+        return NewError(__FUNCTION__, -1, L"WideToUtf8 failed", 0);
+
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0)
+        return NewError(__FUNCTION__, -1, L"open failed", GetLastError());
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        DWORD lastError = GetLastError();
+        close(fd);
+        return NewError(__FUNCTION__, -2, L"fstat failed or the file is empty", lastError);
+    }
+
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        DWORD lastError = GetLastError();
+        close(fd);
+        return NewError(__FUNCTION__, -4, L"mmap failed", lastError);
+    }
+
+    pMapping->fd = fd;
+    pMapping->data = (const BYTE*)data;
+    pMapping->size = (ULONGLONG)st.st_size;
+    AddStatsCount(STATS_SYSCALLS, 3);
+#endif
+    // the mapping is counted as read in full, although only the pages touched are
+    AddStatsCount(STATS_FILE_OPENS, 1);
+    AddStatsCount(STATS_BYTES_READ, pMapping->size);
+    return NewNoError();
+}
+
+void UnmapFile(struct FileMapping* pMapping)
+{
+    if (!pMapping->data) return;
+#ifdef _WIN32
+    UnmapViewOfFile(pMapping->data);
+    CloseHandle(pMapping->hMapping);
+    CloseHandle(pMapping->hFile);
+    AddStatsCount(STATS_SYSCALLS, 3);
+#else
+    munmap((void*)pMapping->data, (size_t)pMapping->size);
+    close(pMapping->fd);
+    AddStatsCount(STATS_SYSCALLS, 2);
+#endif
+    memset(pMapping, 0, sizeof(struct FileMapping));
+}
+
+// Parses the DOS, NT and section headers at the start of the image, which are laid out the same in both layouts
+static Error ParseImageHeaders(const BYTE* base, ULONGLONG size, struct ImageView* pImage)
+{
+    Error e = NewNoError();
+    do {
+        if (size < sizeof(IMAGE_DOS_HEADER)) {
+            e = NewError(__FUNCTION__, -1, L"File is too small to be a PE image", 0);
+            break;
+        }
+        const IMAGE_DOS_HEADER* dosHeader = (const IMAGE_DOS_HEADER*)base;
+        if (dosHeader->e_magic != IMAGE_DOS_SIGNATURE || dosHeader->e_lfanew < 0) {
+            e = NewError(__FUNCTION__, -2, L"Invalid DOS header", 0);
+            break;
+        }
+
+        ULONGLONG ntOffset = (ULONGLONG)dosHeader->e_lfanew;
+        if (ntOffset + sizeof(IMAGE_NT_HEADERS64) > size) {
+            e = NewError(__FUNCTION__, -3, L"NT headers are out of file bounds", 0);
+            break;
+        }
+        const IMAGE_NT_HEADERS64* ntHeaders = (const IMAGE_NT_HEADERS64*)(base + ntOffset);
+        if (ntHeaders->Signature != IMAGE_NT_SIGNATURE || ntHeaders->OptionalHeader.Magic != IMAGE_NT_OPTIONAL_HDR64_MAGIC) {
+            e = NewError(__FUNCTION__, -4, L"Invalid NT headers or not a PE64 image", 0);
+            break;
+        }
+
+        // the section table follows the optional header, whose size is given by the file header
+        ULONGLONG sectionsOffset = ntOffset + offsetof(IMAGE_NT_HEADERS64, OptionalHeader) + ntHeaders->FileHeader.SizeOfOptionalHeader;
+        WORD numSections = ntHeaders->FileHeader.NumberOfSections;
+        if (sectionsOffset + (ULONGLONG)numSections * sizeof(IMAGE_SECTION_HEADER) > size) {
+            e = NewError(__FUNCTION__, -5, L"Section headers are out of file bounds", 0);
+            break;
+        }
+
+        pImage->dosHeader = dosHeader;
+        pImage->ntHeaders = ntHeaders;
+        pImage->sections = (const IMAGE_SECTION_HEADER*)(base + sectionsOffset);
+        pImage->numSections = numSections;
+    } while (FALSE);
+    return e;
+}
+
+Error MapImageView(LPCWSTR filePath, struct ImageView* pImage)
+{
+    memset(pImage, 0, sizeof(struct ImageView));
+    Error e = MapFileReadOnly(filePath, &pImage->file);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+
+    e = ParseImageHeaders(pImage->file.data, pImage->file.size, pImage);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -2);
+        UnmapImageView(pImage);
+    }
+    return e;
+}
+
+Error CreateLoadedImageView(const struct ImageSegment* segments, DWORD numSegments, ULONGLONG imageBase, struct ImageView* pImage)
+{
+    memset(pImage, 0, sizeof(struct ImageView));
+    pImage->layout = IMAGE_LAYOUT_LOADED;
+    pImage->imageBase = imageBase;
+    if (numSegments == 0 || segments[0].rva != 0)
+        return NewError(__FUNCTION__, -1, L"The image headers are not present", 0);
+
+    pImage->segments = (struct ImageSegment*)malloc(numSegments * sizeof(struct ImageSegment));
+    if (!pImage->segments)
+        return NewError(__FUNCTION__, -2, L"malloc failed; out of memory", 0);
+    memcpy(pImage->segments, segments, numSegments * sizeof(struct ImageSegment));
+    pImage->numSegments = numSegments;
+
+    Error e = ParseImageHeaders(segments[0].data, segments[0].length, pImage);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -3);
+        UnmapImageView(pImage);
+    }
+    return e;
+}
+
+Error MapLoadedImageView(LPCWSTR filePath, ULONGLONG imageBase, struct ImageView* pImage)
+{
+    struct FileMapping file;
+    Error e = MapFileReadOnly(filePath, &file);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+    if (file.size > MAXDWORD) {
+        UnmapFile(&file);
+        return NewError(__FUNCTION__, -2, L"A loaded image cannot be larger than 4 GB", 0);
+    }
+
+    // the whole capture is one segment starting at the image base
+    struct ImageSegment segment = { 0, (DWORD)file.size, file.data };
+    e = CreateLoadedImageView(&segment, 1, imageBase, pImage);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -3);
+        UnmapFile(&file);
+        return e;
+    }
+    pImage->file = file;
+    return e;
+}
+
+void UnmapImageView(struct ImageView* pImage)
+{
+    UnmapFile(&pImage->file);
+    free(pImage->segments);
+    memset(pImage, 0, sizeof(struct ImageView));
+}
+
+const BYTE* GetSpanByOffset(const struct ImageView* pImage, ULONGLONG offset, DWORD length)
+{
+    // a loaded image has no file offsets
+    if (pImage->layout != IMAGE_LAYOUT_FILE) return NULL;
+    if (offset > pImage->file.size || length > pImage->file.size - offset) return NULL;
+    return pImage->file.data + offset;
+}
+
+// Finds the segment holding the whole span. Segments are sorted by RVA and do not overlap.
+static const BYTE* GetLoadedSpan(const struct ImageView* pImage, DWORD rva, DWORD length)
+{
+    DWORD low = 0, high = pImage->numSegments;
+    while (low < high) {
+        DWORD middle = low + (high - low) / 2;
+        if (pImage->segments[middle].rva <= rva) low = middle + 1;
+        else high = middle;
+    }
+    if (low == 0) return NULL;
+
+    const struct ImageSegment* segment = &pImage->segments[low - 1];
+    if ((ULONGLONG)rva + length > (ULONGLONG)segment->rva + segment->length) return NULL;
+    return segment->data + (rva - segment->rva);
+}
+
+DWORD GetSectionFileLength(const struct ImageView* pImage, const IMAGE_SECTION_HEADER* section)
+{
+    ULONGLONG length = section->SizeOfRawData;
+    if (section->Misc.VirtualSize && section->Misc.VirtualSize < length) length = section->Misc.VirtualSize;
+    if ((ULONGLONG)section->PointerToRawData >= pImage->file.size) return 0;
+    if (section->PointerToRawData + length > pImage->file.size) length = pImage->file.size - section->PointerToRawData;
+    return (DWORD)length;
+}
+
+const IMAGE_DATA_DIRECTORY* GetDataDirectory(const struct ImageView* pImage, DWORD entry)
+{
+    if (pImage->ntHeaders->OptionalHeader.NumberOfRvaAndSizes <= entry) return NULL;
+    return &pImage->ntHeaders->OptionalHeader.DataDirectory[entry];
+}
+
+const BYTE* GetSpanByRva(const struct ImageView* pImage, DWORD rva, DWORD length)
+{
+    if (pImage->layout == IMAGE_LAYOUT_LOADED)
+        return GetLoadedSpan(pImage, rva, length);
+
+    for (WORD i = 0; i < pImage->numSections; i++) {
+        const IMAGE_SECTION_HEADER* section = &pImage->sections[i];
+        DWORD vaStart = section->VirtualAddress;
+        DWORD vaEnd = vaStart + section->Misc.VirtualSize;
+        if (rva < vaStart || rva >= vaEnd) continue;
+
+        // the span must be backed by the section's raw data in the file
+        ULONGLONG delta = rva - vaStart;
+        if (delta + length > section->SizeOfRawData) return NULL;
+        return GetSpanByOffset(pImage, section->PointerToRawData + delta, length);
+    }
+
+    return NULL;
+}
+
+ULONGLONG RvaToOffset(DWORD rva, const IMAGE_SECTION_HEADER* sections, WORD numSections)
+{
+    for (WORD i = 0; i < numSections; i++) {
+        DWORD vaStart = sections[i].VirtualAddress;
+        DWORD vaEnd = vaStart + sections[i].Misc.VirtualSize;
+        if (rva >= vaStart && rva < vaEnd)
+            return (ULONGLONG)(rva - vaStart) + sections[i].PointerToRawData;
+    }
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "Platform.h"
+#include "Error.h"
+
+// A read-only view of a whole file mapped into memory
+typedef struct FileMapping {
+    const BYTE* data;
+    ULONGLONG size;
+#ifdef _WIN32
+    HANDLE hFile;
+    HANDLE hMapping;
+#else
+    int fd;
+#endif
+} FileMapping;
+
+// How the bytes of an image view are laid out
+typedef enum ImageLayout {
+    IMAGE_LAYOUT_FILE,          // a PE file as stored on disk, sections at their raw data offsets
+    IMAGE_LAYOUT_LOADED         // a module as mapped by the loader, sections at their RVAs, e.g. captured from memory
+} ImageLayout;
+
+// A run of loaded bytes present in the input, e.g. the part of one memory range of a dump that lies in the module
+typedef struct ImageSegment {
+    DWORD rva;
+    DWORD length;
+    const BYTE* data;
+} ImageSegment;
+
+// A PE image mapped once, with its DOS, NT and section headers parsed in place.
+// All pointers point into the mapping and stay valid until UnmapImageView.
+typedef struct ImageView {
+    struct FileMapping file;    // not mapped for views into a dump, which owns the bytes
+    const IMAGE_DOS_HEADER* dosHeader;
+    const IMAGE_NT_HEADERS64* ntHeaders;
+    const IMAGE_SECTION_HEADER* sections;
+    WORD numSections;
+    ImageLayout layout;
+    ULONGLONG imageBase;        // address a loaded image was captured at, 0 if not known
+    struct ImageSegment* segments; // loaded layout: the bytes present, sorted by RVA
+    DWORD numSegments;
+} ImageView;
+
+// Maps the whole file read-only. Free after use with UnmapFile.
+Error MapFileReadOnly(LPCWSTR filePath, struct FileMapping* pMapping);
+void UnmapFile(struct FileMapping* pMapping);
+
+// Maps a PE64 file and validates its headers. Free after use with UnmapImageView.
+Error MapImageView(LPCWSTR filePath, struct ImageView* pImage);
+void UnmapImageView(struct ImageView* pImage);
+
+// Views loaded bytes as an image, without copying them. The first segment has to start with the headers at RVA 0.
+// The segments are copied, the bytes they point to have to outlive the view. Free after use with UnmapImageView.
+Error CreateLoadedImageView(const struct ImageSegment* segments, DWORD numSegments, ULONGLONG imageBase, struct ImageView* pImage);
+
+// Maps a raw capture of a loaded module, i.e. the bytes from its base address on, as a loaded image.
+Error MapLoadedImageView(LPCWSTR filePath, ULONGLONG imageBase, struct ImageView* pImage);
+
+// Returns a pointer to `length` bytes at a file offset, or NULL if the range is outside of the file or the image
+// is in the loaded layout.
+// Offsets are 64-bit so that a raw pointer plus a delta near 4 GB cannot wrap around into the file.
+const BYTE* GetSpanByOffset(const struct ImageView* pImage, ULONGLONG offset, DWORD length);
+
+// Returns a pointer to `length` bytes at an RVA, or NULL if the range is not backed by a section's raw data, or
+// in the loaded layout by bytes present in the input.
+const BYTE* GetSpanByRva(const struct ImageView* pImage, DWORD rva, DWORD length);
+
+// Number of raw bytes of the section that are both present in the file and part of the mapped image
+DWORD GetSectionFileLength(const struct ImageView* pImage, const IMAGE_SECTION_HEADER* section);
+
+// Returns a data directory entry, or NULL when the optional header's table is too short to have it; the bytes past
+// its end are the section headers.
+const IMAGE_DATA_DIRECTORY* GetDataDirectory(const struct ImageView* pImage, DWORD entry);
+
+ULONGLONG RvaToOffset(DWORD rva, const IMAGE_SECTION_HEADER* sections, WORD numSections);
@@ -0,0 +1,218 @@
+#include "ImageSymbols.h"
+
+// Bit of the UNWIND_INFO flags, in the top five bits of its first byte, marking a fragment of another function
+#define UNWIND_FLAG_CHAININFO 0x4
+
+// Returns the null terminated string at an RVA, or NULL if its terminator is not within the image bytes
+static const char* GetImageString(const struct ImageView* pImage, DWORD rva)
+{
+    for (DWORD length = 1; length <= IMAGE_SYMBOL_MAX_NAME; length++) {
+        const char* c = (const char*)GetSpanByRva(pImage, rva + length - 1, 1);
+        if (!c) return NULL;
+        if (*c == '\0') return (const char*)GetSpanByRva(pImage, rva, length);
+    }
+    return NULL;
+}
+
+static BOOL IsExecutableRva(const struct ImageView* pImage, DWORD rva)
+{
+    for (WORD i = 0; i < pImage->numSections; i++) {
+        const IMAGE_SECTION_HEADER* section = &pImage->sections[i];
+        DWORD length = section->Misc.VirtualSize ? section->Misc.VirtualSize : section->SizeOfRawData;
+        if ((section->Characteristics & IMAGE_SCN_MEM_EXECUTE) && rva >= section->VirtualAddress && rva - section->VirtualAddress < length)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// The export directory with its three tables, NULL if the image has none or they are out of bounds
+typedef struct ExportTables {
+    const IMAGE_EXPORT_DIRECTORY* directory;
+    DWORD directoryRva;
+    DWORD directorySize;
+    const DWORD* functions;
+    const DWORD* names;
+    const WORD* ordinals;
+} ExportTables;
+
+// Bytes taken by a table of `count` entries. Counted in 64 bits, as the counts of a corrupt directory can wrap a
+// 32-bit product around to a small length, and FALSE when the table would not fit into the image.
+static BOOL GetTableLength(const struct ImageView* pImage, DWORD count, DWORD entrySize, DWORD* length)
+{
+    ULONGLONG bytes = (ULONGLONG)count * entrySize;
+    if (bytes > 0xFFFFFFFF || bytes > pImage->ntHeaders->OptionalHeader.SizeOfImage) return FALSE;
+    *length = (DWORD)bytes;
+    return TRUE;
+}
+
+static BOOL GetExportTables(const struct ImageView* pImage, struct ExportTables* pTables)
+{
+    const IMAGE_DATA_DIRECTORY* dataDirectory = GetDataDirectory(pImage, IMAGE_DIRECTORY_ENTRY_EXPORT);
+    memset(pTables, 0, sizeof(struct ExportTables));
+    if (!dataDirectory || dataDirectory->Size < sizeof(IMAGE_EXPORT_DIRECTORY)) return FALSE;
+
+    const IMAGE_EXPORT_DIRECTORY* directory = (const IMAGE_EXPORT_DIRECTORY*)GetSpanByRva(pImage, dataDirectory->VirtualAddress, sizeof(IMAGE_EXPORT_DIRECTORY));
+    if (!directory) return FALSE;
+    pTables->directory = directory;
+    pTables->directoryRva = dataDirectory->VirtualAddress;
+    pTables->directorySize = dataDirectory->Size;
+    DWORD functionsLength, namesLength, ordinalsLength;
+    if (!GetTableLength(pImage, directory->NumberOfFunctions, sizeof(DWORD), &functionsLength) ||
+        !GetTableLength(pImage, directory->NumberOfNames, sizeof(DWORD), &namesLength) ||
+        !GetTableLength(pImage, directory->NumberOfNames, sizeof(WORD), &ordinalsLength))
+        return FALSE;
+    pTables->functions = (const DWORD*)GetSpanByRva(pImage, directory->AddressOfFunctions, functionsLength);
+    pTables->names = (const DWORD*)GetSpanByRva(pImage, directory->AddressOfNames, namesLength);
+    pTables->ordinals = (const WORD*)GetSpanByRva(pImage, directory->AddressOfNameOrdinals, ordinalsLength);
+    return pTables->functions && pTables->names && pTables->ordinals;
+}
+
+// Returns the RVA of the export with the given index into the name table, or 0 for a forwarder or a bad ordinal
+static DWORD GetNamedExportRva(const struct ExportTables* pTables, DWORD nameIndex)
+{
+    WORD ordinal = pTables->ordinals[nameIndex];
+    if (ordinal >= pTables->directory->NumberOfFunctions) return 0;
+    DWORD rva = pTables->functions[ordinal];
+    // a forwarder points to a "Module.Function" string inside the export directory instead of code
+    if (rva >= pTables->directoryRva && rva - pTables->directoryRva < pTables->directorySize) return 0;
+    return rva;
+}
+
+BOOL FindExportedFunction(const struct ImageView* pImage, const char* name, DWORD* rva)
+{
+    struct ExportTables tables;
+    if (!GetExportTables(pImage, &tables)) return FALSE;
+
+    // the linker sorts the name table in byte order, which is what the loader's binary search relies on too
+    DWORD low = 0, high = tables.directory->NumberOfNames;
+    while (low < high) {
+        DWORD middle = low + (high - low) / 2;
+        const char* exportName = GetImageString(pImage, tables.names[middle]);
+        if (!exportName) return FALSE;
+        int result = strcmp(exportName, name);
+        if (result == 0) {
+            *rva = GetNamedExportRva(&tables, middle);
+            return *rva != 0;
+        }
+        if (result < 0) low = middle + 1;
+        else high = middle;
+    }
+    return FALSE;
+}
+
+static const IMAGE_RUNTIME_FUNCTION_ENTRY* GetRuntimeFunctions(const struct ImageView* pImage, DWORD* count)
+{
+    *count = 0;
+    // other architectures lay out .pdata differently
+    if (pImage->ntHeaders->FileHeader.Machine != IMAGE_FILE_MACHINE_AMD64) return NULL;
+
+    const IMAGE_DATA_DIRECTORY* dataDirectory = GetDataDirectory(pImage, IMAGE_DIRECTORY_ENTRY_EXCEPTION);
+    if (!dataDirectory) return NULL;
+    DWORD numEntries = dataDirectory->Size / sizeof(IMAGE_RUNTIME_FUNCTION_ENTRY);
+    const IMAGE_RUNTIME_FUNCTION_ENTRY* entries = (const IMAGE_RUNTIME_FUNCTION_ENTRY*)GetSpanByRva(pImage, dataDirectory->VirtualAddress, numEntries * sizeof(IMAGE_RUNTIME_FUNCTION_ENTRY));
+    if (!entries) return NULL;
+    *count = numEntries;
+    return entries;
+}
+
+BOOL FindRuntimeFunction(const struct ImageView* pImage, DWORD rva, DWORD* begin, DWORD* end)
+{
+    DWORD numEntries;
+    const IMAGE_RUNTIME_FUNCTION_ENTRY* entries = GetRuntimeFunctions(pImage, &numEntries);
+
+    // entries are sorted by start address and do not overlap
+    DWORD low = 0, high = numEntries;
+    while (low < high) {
+        DWORD middle = low + (high - low) / 2;
+        if (entries[middle].BeginAddress <= rva) low = middle + 1;
+        else high = middle;
+    }
+    if (low == 0 || rva >= entries[low - 1].EndAddress) return FALSE;
+
+    *begin = entries[low - 1].BeginAddress;
+    *end = entries[low - 1].EndAddress;
+    return TRUE;
+}
+
+// Size of a function symbol, the same for lookups and enumeration: from its RVA to the end of the .pdata entry
+// holding it, so an export inside a function gets the rest of it. 0 without an entry, as for leaf functions.
+static DWORD GetFunctionSymbolSize(const struct ImageView* pImage, DWORD rva)
+{
+    DWORD begin, end;
+    return FindRuntimeFunction(pImage, rva, &begin, &end) ? end - rva : 0;
+}
+
+BOOL FindImageSymbol(const struct ImageView* pImage, const char* name, struct PdbSymbol* pSymbol)
+{
+    DWORD rva;
+    size_t prefixLength = strlen(IMAGE_SYMBOL_PREFIX);
+    BOOL isAddress = strncmp(name, IMAGE_SYMBOL_PREFIX, prefixLength) == 0 && name[prefixLength];
+    if (isAddress) {
+        char* end;
+        unsigned long long value = strtoull(name + prefixLength, &end, 16);
+        if (*end || value > 0xFFFFFFFF) return FALSE;
+        rva = (DWORD)value;
+    } else if (!FindExportedFunction(pImage, name, &rva)) {
+        return FALSE;
+    }
+
+    DWORD begin, end;
+    BOOL executable = IsExecutableRva(pImage, rva);
+    // an address inside a function stands for the whole function, an export keeps its own start
+    if (executable && isAddress && FindRuntimeFunction(pImage, rva, &begin, &end)) rva = begin;
+    pSymbol->kind = executable ? PDB_SYMBOL_FUNCTION : PDB_SYMBOL_DATA;
+    pSymbol->size = executable ? GetFunctionSymbolSize(pImage, rva) : 0;
+    pSymbol->rva = rva;
+    return TRUE;
+}
+
+static int CompareRvas(const void* a, const void* b)
+{
+    DWORD left = *(const DWORD*)a, right = *(const DWORD*)b;
+    return left < right ? -1 : left > right ? 1 : 0;
+}
+
+void EnumerateImageSymbols(const struct ImageView* pImage, PdbSymbolCallback callback, void* context)
+{
+    DWORD numEntries;
+    const IMAGE_RUNTIME_FUNCTION_ENTRY* entries = GetRuntimeFunctions(pImage, &numEntries);
+
+    // exported functions keep their name, so their RVAs are collected to leave them out of the sub_ names
+    struct ExportTables tables;
+    DWORD numExports = GetExportTables(pImage, &tables) ? tables.directory->NumberOfNames : 0;
+    DWORD* exportRvas = (DWORD*)malloc((numExports ? numExports : 1) * sizeof(DWORD));
+    DWORD numExportRvas = 0;
+    for (DWORD i = 0; i < numExports; i++) {
+        DWORD rva = GetNamedExportRva(&tables, i);
+        const char* name = GetImageString(pImage, tables.names[i]);
+        if (!rva || !name) continue;
+
+        struct PdbSymbol symbol = { rva, 0, PDB_SYMBOL_DATA };
+        if (IsExecutableRva(pImage, rva)) {
+            symbol.kind = PDB_SYMBOL_FUNCTION;
+            symbol.size = GetFunctionSymbolSize(pImage, rva);
+            if (exportRvas) exportRvas[numExportRvas++] = rva;
+        }
+        if (!callback(context, name, &symbol)) {
+            free(exportRvas);
+            return;
+        }
+    }
+    if (exportRvas) qsort(exportRvas, numExportRvas, sizeof(DWORD), CompareRvas);
+
+    for (DWORD i = 0; i < numEntries; i++) {
+        const IMAGE_RUNTIME_FUNCTION_ENTRY* entry = &entries[i];
+        if (entry->EndAddress <= entry->BeginAddress) continue;
+        if (exportRvas && bsearch(&entry->BeginAddress, exportRvas, numExportRvas, sizeof(DWORD), CompareRvas)) continue;
+
+        // chained entries describe a separated part of a function, such as its cold code, not a function start
+        const BYTE* unwindInfo = GetSpanByRva(pImage, entry->UnwindInfoAddress, 1);
+        if (unwindInfo && ((*unwindInfo >> 3) & UNWIND_FLAG_CHAININFO)) continue;
+
+        char name[32];
+        snprintf(name, sizeof(name), IMAGE_SYMBOL_PREFIX "%X", entry->BeginAddress);
+        struct PdbSymbol symbol = { entry->BeginAddress, entry->EndAddress - entry->BeginAddress, PDB_SYMBOL_FUNCTION };
+        if (!callback(context, name, &symbol)) break;
+    }
+    free(exportRvas);
+}
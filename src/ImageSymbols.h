@@ -0,0 +1,29 @@
+#pragma once
+#include "PdbFile.h"
+
+// Name given to a function known only from its .pdata entry, followed by its RVA in hex, e.g. sub_1A2B0
+#define IMAGE_SYMBOL_PREFIX "sub_"
+// Longest export name that is read
+#define IMAGE_SYMBOL_MAX_NAME 4096
+
+/*
+ * Symbols read from the image itself, for images without a published PDB or when the symbol server is not to be
+ * contacted: exports by name, and the bounds of every function with unwind data in the x64 .pdata table, which
+ * is every function except leaf functions that neither use the stack nor save registers. Both tables are sorted
+ * in the image, so lookups are binary searches over the mapped bytes without any setup.
+ */
+
+// Finds a named export. Forwarded exports, which have no code in this image, are not found.
+BOOL FindExportedFunction(const struct ImageView* pImage, const char* name, DWORD* rva);
+
+// Finds the .pdata entry whose [begin, end) range holds the RVA. Only x64 images are supported.
+BOOL FindRuntimeFunction(const struct ImageView* pImage, DWORD rva, DWORD* begin, DWORD* end);
+
+// Resolves an export name, or sub_<hex RVA> for any code address, to the function holding it. The size runs from
+// the symbol to the end of its .pdata entry, as in EnumerateImageSymbols, and is 0 for leaf functions, which have
+// no entry there.
+BOOL FindImageSymbol(const struct ImageView* pImage, const char* name, struct PdbSymbol* pSymbol);
+
+// Calls `callback` for every named export, as a function when it is in an executable section and as data
+// otherwise, and for every other function that starts a .pdata entry, named sub_<RVA>.
+void EnumerateImageSymbols(const struct ImageView* pImage, PdbSymbolCallback callback, void* context);
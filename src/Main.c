@@ -1,4 +1,12 @@
-﻿#include "Signature.h"
+﻿#include "Corpus.h"
+#include "Dump.h"
+#include "Pdb.h"
+#include "Server.h"
+#include "Signature.h"
+#include "SignatureDb.h"
+#include "StreamScan.h"
+#include <wctype.h>
+#include <ctype.h>
 
 wchar_t* GetFolderPathFromFileName(const wchar_t* fullPath) {
     const wchar_t* lastSlash = wcsrchr(fullPath, L'\\');
@@ -31,113 +39,1397 @@ wchar_t* GetFolderPathFromFileName(const wchar_t* fullPath) {
     return folderPath;
 }
 
-int wmain(int argc, wchar_t* argv[])
-{
-    if (argc != 4) {
-        wprintf(L"Usage: %s <pePath> <functionName> <sigLength>\n", argv[0]);
-        return 1;
+// Command line options. Flags may appear anywhere; positional arguments keep their order.
+typedef struct Options {
+    WCHAR* pePath;
+    WCHAR* funcName;
+    WCHAR* dumpPath;    // --dump <file>: <pePath> names a module loaded in this minidump, scanned as it is in memory
+    BOOL loaded;        // --loaded <base>: <pePath> is a raw capture of a module loaded at the hex base address
+    ULONGLONG loadedBase;
+    DWORD sigLength;
+    BOOL useIndex;      // --index: answer uniqueness queries from a cached suffix index of the executable sections
+    WCHAR* batchPath;   // --batch <file|->: resolve every function name listed in the file (or stdin)
+    WCHAR* allPath;     // --all <file|->: write the unique signature of every function in the PDB to the file (or stdout)
+    WCHAR* corpusPath;  // --corpus <dir>: write the unique signatures of every image under the directory to stdout
+    WCHAR* buildsPath;  // --builds <file|->: find one signature of the function that is unique in every PE listed in the file (or stdin)
+    WCHAR* scanPath;    // --scan <file> <pattern>: print the offset of every match of the pattern in a file of any size
+    WCHAR* scanPattern;
+    WCHAR* offsetsPath; // --offsets <file|->: print the offsets of the Type.Field and Type queries in the file (or stdin)
+    BOOL offsetsJson;   // --format json: print the offsets as JSON instead of a C header
+    BOOL noPdb;         // --no-pdb: resolve functions from the image's exports and .pdata, with no PDB and no network
+    WCHAR* pdbPath;     // --from-disk <pdb>: use this local PDB instead of the symbol store and the symbol server
+    WCHAR* symbolServer; // --symbol-server <url>: where missing PDBs are downloaded from
+    WCHAR* cacheDir;    // --cache <dir>: symbol store directory, <peDir>\symbols by default
+    DWORD connections;  // --connections <n>: parallel range requests for large PDB downloads
+    BOOL wildcards;     // --wildcards: mask relocatable operands and print a pattern with a mask
+    BOOL anywhere;      // --anywhere: let the unique signature start at any offset inside the function
+    WCHAR* sections;    // --sections <names>: comma separated sections to scan instead of the executable ones
+    BOOL virtualLayout; // --virtual: scan sections as the loader maps them rather than as stored in the file
+    DWORD threads;      // --threads <n>: scan threads, 0 (the default) for one per processor
+    WCHAR* dbPath;      // --db <file>: also store the signatures of this run in a binary signature database
+    WCHAR* mergeOutput; // --merge-db <out> <in>...: merge signature databases instead of scanning
+    WCHAR** mergeInputs;
+    int numMergeInputs;
+    BOOL serve;         // --serve: answer requests on a named pipe, keeping images and PDBs loaded between them
+    BOOL connect;       // --connect: send the request lines on stdin to a running server
+    WCHAR* pipeName;    // --pipe <name>: pipe of --serve and --connect, \\.\pipe\SigScanner by default
+    DWORD cacheMB;      // --cache-mb <n>: memory budget of the server's image cache
+    BOOL stats;         // --stats=json[:<file>]: report phase timings and counters as JSON to stderr (or the file)
+    WCHAR* statsPath;
+} Options;
+
+// Progress messages go to stdout, except in batch mode where stdout only carries results
+static FILE* g_Log = NULL;
+
+static void PrintUsage(const wchar_t* programName) {
+    wprintf(L"Usage: %s [options] <pePath> <functionName> <sigLength>\n", programName);
+    wprintf(L"       %s [options] --anywhere <pePath> <functionName>\n", programName);
+    wprintf(L"       %s [options] --batch <namesFile|-> <pePath> <sigLength>\n", programName);
+    wprintf(L"       %s [options] --all <outFile|-> <pePath>\n", programName);
+    wprintf(L"       %s [options] --offsets <queriesFile|-> [--format header|json] <pePath>\n", programName);
+    wprintf(L"       %s [options] --corpus <directory>\n", programName);
+    wprintf(L"       %s [options] --builds <pePathsFile|-> <functionName> <sigLength>\n", programName);
+    wprintf(L"       %s --scan <file> <pattern>\n", programName);
+    wprintf(L"       %s --merge-db <outDb> <inDb>...\n", programName);
+    wprintf(L"       %s [options] --serve [--pipe <name>] [--cache-mb <n>]\n", programName);
+    wprintf(L"       %s --connect [--pipe <name>] < requests\n", programName);
+    wprintf(L"Input: <pePath> is a PE file, a module name with --dump <minidump>, or a module capture with --loaded <hexBase>\n");
+    wprintf(L"Options: --index, --wildcards, --anywhere, --no-pdb, --from-disk <pdb>, --sections <names>, --virtual, --threads <n>, --db <file>, --symbol-server <url>, --cache <dir>, --connections <n>, --stats=json[:<file>]\n");
+}
+
+static BOOL ParseOptions(int argc, wchar_t* argv[], struct Options* options) {
+    ZeroMemory(options, sizeof(struct Options));
+    options->connections = DOWNLOAD_DEFAULT_CONNECTIONS;
+    options->pipeName = SERVER_DEFAULT_PIPE;
+    options->cacheMB = SERVER_DEFAULT_MEMORY_MB;
+    WCHAR* positional[3];
+    int nPositional = 0;
+    for (int i = 1; i < argc; i++) {
+        if (wcscmp(argv[i], L"--index") == 0) options->useIndex = TRUE;
+        else if (wcscmp(argv[i], L"--wildcards") == 0) options->wildcards = TRUE;
+        else if (wcscmp(argv[i], L"--anywhere") == 0) options->anywhere = TRUE;
+        else if (wcscmp(argv[i], L"--sections") == 0 && i + 1 < argc) options->sections = argv[++i];
+        else if (wcscmp(argv[i], L"--virtual") == 0) options->virtualLayout = TRUE;
+        else if (wcscmp(argv[i], L"--threads") == 0 && i + 1 < argc) options->threads = _wtoi(argv[++i]);
+        else if (wcscmp(argv[i], L"--batch") == 0 && i + 1 < argc) options->batchPath = argv[++i];
+        else if (wcscmp(argv[i], L"--all") == 0 && i + 1 < argc) options->allPath = argv[++i];
+        else if (wcscmp(argv[i], L"--offsets") == 0 && i + 1 < argc) options->offsetsPath = argv[++i];
+        else if (wcscmp(argv[i], L"--corpus") == 0 && i + 1 < argc) options->corpusPath = argv[++i];
+        else if (wcscmp(argv[i], L"--builds") == 0 && i + 1 < argc) options->buildsPath = argv[++i];
+        else if (wcscmp(argv[i], L"--scan") == 0 && i + 1 < argc) options->scanPath = argv[++i];
+        else if (wcscmp(argv[i], L"--dump") == 0 && i + 1 < argc) options->dumpPath = argv[++i];
+        else if (wcscmp(argv[i], L"--loaded") == 0 && i + 1 < argc) {
+            options->loaded = TRUE;
+            options->loadedBase = wcstoull(argv[++i], NULL, 16);
+        }
+        else if (wcscmp(argv[i], L"--format") == 0 && i + 1 < argc) {
+            i++;
+            if (wcscmp(argv[i], L"json") == 0) options->offsetsJson = TRUE;
+            else if (wcscmp(argv[i], L"header") != 0) return FALSE;
+        }
+        else if (wcscmp(argv[i], L"--db") == 0 && i + 1 < argc) options->dbPath = argv[++i];
+        else if (wcscmp(argv[i], L"--merge-db") == 0 && i + 2 < argc) {
+            // every argument after the output database is an input
+            options->mergeOutput = argv[i + 1];
+            options->mergeInputs = &argv[i + 2];
+            options->numMergeInputs = argc - i - 2;
+            return nPositional == 0;
+        }
+        else if (wcscmp(argv[i], L"--no-pdb") == 0) options->noPdb = TRUE;
+        else if (wcscmp(argv[i], L"--from-disk") == 0 && i + 1 < argc) options->pdbPath = argv[++i];
+        else if (wcscmp(argv[i], L"--symbol-server") == 0 && i + 1 < argc) options->symbolServer = argv[++i];
+        else if (wcscmp(argv[i], L"--cache") == 0 && i + 1 < argc) options->cacheDir = argv[++i];
+        else if (wcscmp(argv[i], L"--connections") == 0 && i + 1 < argc) options->connections = _wtoi(argv[++i]);
+        else if (wcscmp(argv[i], L"--serve") == 0) options->serve = TRUE;
+        else if (wcscmp(argv[i], L"--connect") == 0) options->connect = TRUE;
+        else if (wcscmp(argv[i], L"--pipe") == 0 && i + 1 < argc) options->pipeName = argv[++i];
+        else if (wcscmp(argv[i], L"--cache-mb") == 0 && i + 1 < argc) options->cacheMB = _wtoi(argv[++i]);
+        else if (wcscmp(argv[i], L"--stats=json") == 0) options->stats = TRUE;
+        else if (wcsncmp(argv[i], L"--stats=json:", 13) == 0 && argv[i][13]) {
+            options->stats = TRUE;
+            options->statsPath = argv[i] + 13;
+        }
+        else if (wcsncmp(argv[i], L"--", 2) == 0 || nPositional == _countof(positional)) return FALSE;
+        else positional[nPositional++] = argv[i];
     }
 
-    WCHAR* pePath = argv[1];
-    WCHAR* funcName = argv[2];
-    DWORD sigLength = _wtoi(argv[3]);
+    // a loaded image is read from a single dump or capture
+    if ((options->dumpPath || options->loaded) &&
+        ((options->dumpPath && options->loaded) || options->serve || options->connect || options->scanPath || options->corpusPath)) return FALSE;
 
-    wprintf(L"[+] Supplied PE path: %s\n", pePath);
-    wprintf(L"[+] Supplied function name: %s\n", funcName);
-    wprintf(L"[+] Input Signature length: %lu\n", sigLength);
-    wprintf(L"[+] Extracting PE information\n");
+    // the symbols of a single image; the image has no types to look up offsets in
+    if ((options->noPdb || options->pdbPath) &&
+        ((options->noPdb && (options->pdbPath || options->offsetsPath)) || options->serve || options->connect || options->scanPath || options->corpusPath)) return FALSE;
 
-    struct PDBLookupContext ctx;
-    Error e = GetPEInfo(pePath, &ctx);
+    // every build is a PE file of its own with its own PDB, and one pattern has to fit all of them
+    if (options->buildsPath) {
+        if (nPositional != 2 || options->dumpPath || options->loaded || options->pdbPath || options->useIndex || options->anywhere ||
+            options->batchPath || options->allPath || options->offsetsPath || options->serve || options->connect || options->scanPath || options->corpusPath) return FALSE;
+        options->funcName = positional[0];
+        options->sigLength = _wtoi(positional[1]);
+        return TRUE;
+    }
+
+    // windows are looked up in the suffix index, which holds the exact bytes of the executable sections of the file
+    if (options->anywhere &&
+        (options->wildcards || options->dumpPath || options->loaded || options->sections || options->virtualLayout || options->batchPath || options->offsetsPath || options->serve || options->connect || options->scanPath || options->corpusPath)) return FALSE;
+
+    // the images come with each request
+    if (options->serve || options->connect)
+        return nPositional == 0 && !(options->serve && options->connect);
+
+    // the file is scanned as raw bytes, so there is no PDB and no function to look up
+    if (options->scanPath) {
+        if (nPositional != 1 || options->corpusPath || options->batchPath || options->allPath || options->offsetsPath) return FALSE;
+        options->scanPattern = positional[0];
+        return TRUE;
+    }
+
+    // the images are the ones found in the directory
+    if (options->corpusPath)
+        return nPositional == 0 && !options->batchPath && !options->allPath && !options->offsetsPath;
+
+    // type layouts only need the PDB
+    if (options->offsetsPath) {
+        if (nPositional != 1 || options->batchPath || options->allPath) return FALSE;
+        options->pePath = positional[0];
+        return TRUE;
+    }
+
+    // the whole image mode needs neither names nor a length, and always answers from the suffix index, which holds
+    // the exact bytes of the executable sections of the file
+    if (options->allPath) {
+        if (nPositional != 1 || options->batchPath || options->wildcards || options->dumpPath || options->loaded || options->sections || options->virtualLayout)
+            return FALSE;
+        options->pePath = positional[0];
+        options->useIndex = TRUE;
+        return TRUE;
+    }
+
+    // batch mode takes the function names from the list instead of the command line
+    if (options->batchPath) {
+        if (nPositional != 2) return FALSE;
+        options->pePath = positional[0];
+        options->sigLength = _wtoi(positional[1]);
+        return TRUE;
+    }
+    // the length of a window anywhere in the function is the answer rather than an input
+    if (options->anywhere) {
+        if (nPositional != 2) return FALSE;
+        options->pePath = positional[0];
+        options->funcName = positional[1];
+        options->useIndex = TRUE;
+        return TRUE;
+    }
+    if (nPositional != 3) return FALSE;
+
+    options->pePath = positional[0];
+    options->funcName = positional[1];
+    options->sigLength = _wtoi(positional[2]);
+    return TRUE;
+}
+
+// Signatures of this run are collected here when --db is given, and saved once at the end
+static struct SignatureDbBuilder g_Db;
+static DWORD g_DbImage;
+static BOOL g_DbEnabled = FALSE;
+
+static void RecordSignature(const char* name, DWORD rva, DWORD offset, const BYTE* pattern, const BYTE* mask, DWORD length) {
+    if (!g_DbEnabled) return;
+    Error e = AddSignatureDbEntry(&g_Db, g_DbImage, name, rva, offset, pattern, mask, length);
     if (e.ContainsError) {
-        fwprintf(stderr, L"[-] Get PE info failed: %s\n", e.Format(&e));
+        fwprintf(stderr, L"[-] WARNING: %S is not stored in the signature database: %s\n", name, e.Format(&e));
+        Error_Free(&e);
+    }
+}
+
+static void RecordSignatureW(const WCHAR* name, DWORD rva, const BYTE* pattern, const BYTE* mask, DWORD length) {
+    if (!g_DbEnabled) return;
+    char* utf8Name = WideToUtf8(name);
+    if (!utf8Name) return;
+    RecordSignature(utf8Name, rva, 0, pattern, mask, length);
+    free(utf8Name);
+}
+
+// Starts collecting for --db. Signatures already in the file are kept, those of this run replace older ones.
+static BOOL OpenSignatureDb(const struct Options* options) {
+    if (!options->dbPath) return TRUE;
+    ZeroMemory(&g_Db, sizeof(g_Db));
+    if (GetFileAttributesW(options->dbPath) != INVALID_FILE_ATTRIBUTES) {
+        struct SignatureDb existing;
+        Error e = LoadSignatureDb(options->dbPath, &existing);
+        if (!e.ContainsError) {
+            e = MergeSignatureDb(&g_Db, &existing);
+            FreeSignatureDb(&existing);
+        }
+        if (e.ContainsError) {
+            fwprintf(stderr, L"[-] Existing signature database %s is unusable: %s\n", options->dbPath, e.Format(&e));
+            FreeSignatureDbBuilder(&g_Db);
+            return FALSE;
+        }
+    }
+    g_DbEnabled = TRUE;
+    return TRUE;
+}
+
+// Makes the image the one new signatures belong to
+static BOOL SelectSignatureDbImage(LPCWSTR pePath, const struct ImageView* pImage, const struct PDBLookupContext* pCtx) {
+    const WCHAR* imageName = wcsrchr(pePath, L'\\');
+    imageName = imageName ? imageName + 1 : pePath;
+    char* utf8ImageName = WideToUtf8(imageName);
+    Error e;
+    if (!utf8ImageName)
+        e = NewError(__FUNCTION__, -1, L"WideToUtf8 failed", 0);
+    else
+        e = AddSignatureDbImage(&g_Db, &pCtx->pdbInfo.guid, pCtx->pdbInfo.age, pImage->ntHeaders->FileHeader.TimeDateStamp, utf8ImageName, &g_DbImage);
+    free(utf8ImageName);
+    if (e.ContainsError) {
+        fwprintf(stderr, L"[-] Preparing the signature database failed: %s\n", e.Format(&e));
+        FreeSignatureDbBuilder(&g_Db);
+        g_DbEnabled = FALSE;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Starts collecting for --db with the image of this run as the one new signatures belong to
+static BOOL BeginSignatureDb(const struct Options* options, const struct ImageView* pImage, const struct PDBLookupContext* pCtx) {
+    if (!options->dbPath) return TRUE;
+    if (!OpenSignatureDb(options)) return FALSE;
+    return SelectSignatureDbImage(options->pePath, pImage, pCtx);
+}
+
+static BOOL EndSignatureDb(const struct Options* options) {
+    if (!g_DbEnabled) return TRUE;
+    ULONGLONG start = StartStatsTimer();
+    Error e = SaveSignatureDb(&g_Db, options->dbPath);
+    StopStatsTimer(STATS_TIMER_SIGNATURE_DB, start);
+    if (e.ContainsError)
+        fwprintf(stderr, L"[-] Saving the signature database failed: %s\n", e.Format(&e));
+    else
+        fwprintf(g_Log, L"[+] Signature database %s holds %zu signature(s) of %lu image(s)\n", options->dbPath, g_Db.numEntries, g_Db.numImages);
+    FreeSignatureDbBuilder(&g_Db);
+    g_DbEnabled = FALSE;
+    return !e.ContainsError;
+}
+
+// Merges the --merge-db inputs into one database. Later inputs win for functions that appear more than once.
+static int RunMerge(const struct Options* options) {
+    struct SignatureDbBuilder builder = { 0 };
+    ULONGLONG start = StartStatsTimer();
+    for (int i = 0; i < options->numMergeInputs; i++) {
+        struct SignatureDb db;
+        Error e = LoadSignatureDb(options->mergeInputs[i], &db);
+        if (!e.ContainsError) {
+            e = MergeSignatureDb(&builder, &db);
+            FreeSignatureDb(&db);
+        }
+        if (e.ContainsError) {
+            fwprintf(stderr, L"[-] Merging %s failed: %s\n", options->mergeInputs[i], e.Format(&e));
+            FreeSignatureDbBuilder(&builder);
+            return 1;
+        }
+    }
+
+    Error e = SaveSignatureDb(&builder, options->mergeOutput);
+    StopStatsTimer(STATS_TIMER_SIGNATURE_DB, start);
+    if (e.ContainsError) {
+        fwprintf(stderr, L"[-] Saving %s failed: %s\n", options->mergeOutput, e.Format(&e));
+        FreeSignatureDbBuilder(&builder);
         return 1;
     }
+    wprintf(L"[+] Merged %d database(s) with %lu image(s) into %s\n", options->numMergeInputs, builder.numImages, options->mergeOutput);
+    FreeSignatureDbBuilder(&builder);
+    return 0;
+}
 
-    wprintf(L"[+] PDB file name in the PE is: %S\n", ctx.pdbInfo.pdbName);
-    WCHAR* folderPath = GetFolderPathFromFileName(pePath);
-    if (!folderPath) {
-        fwprintf(stderr, L"[-] Failed to get folder path: %lu\n", GetLastError());
+static void PrintSignatureBytes(FILE* out, const BYTE* signature, DWORD signatureLength) {
+    for (DWORD i = 0; i < signatureLength; i++) {
+        fwprintf(out, L"0x%02X", signature[i]);
+        if ((i + 1) < signatureLength)
+            fwprintf(out, L", ");
+    }
+    fwprintf(out, L"\n");
+}
+
+// Prints a masked signature as an IDA style pattern, e.g. "48 8B 05 ? ? ? ?", followed by its "xxx????" mask.
+static void PrintSignaturePattern(const BYTE* signature, const BYTE* mask, DWORD signatureLength, BOOL withMask) {
+    for (DWORD i = 0; i < signatureLength; i++) {
+        if (mask[i]) wprintf(L"%02X", signature[i]);
+        else wprintf(L"?");
+        if ((i + 1) < signatureLength)
+            wprintf(L" ");
+    }
+    if (withMask) {
+        wprintf(L"\n");
+        for (DWORD i = 0; i < signatureLength; i++)
+            wprintf(L"%c", mask[i] ? L'x' : L'?');
+    }
+    wprintf(L"\n");
+}
+
+// Reports how many bytes each section of the scan scope contributed, against scanning the whole file every time.
+static void PrintScanScopeStats(const struct ScanScope* pScope, const struct ImageView* pImage) {
+    ULONGLONG scopeBytes = 0;
+    DWORD scans = 0;
+    for (DWORD i = 0; i < pScope->numRegions; i++) {
+        const struct ScanRegion* region = &pScope->regions[i];
+        fwprintf(g_Log, L"[+] Scanned %-8S %12llu bytes (%llu per pass, %lu passes)\n", region->name, region->bytesScanned,
+            (ULONGLONG)region->length, region->scans);
+        scopeBytes += region->length;
+        if (region->scans > scans) scans = region->scans;
+    }
+    if (scans == 0) return;
+
+    // a loaded image is measured against its size in memory, which may not all be captured
+    BOOL isFile = pImage->layout == IMAGE_LAYOUT_FILE;
+    ULONGLONG totalBytes = isFile ? pImage->file.size : pImage->ntHeaders->OptionalHeader.SizeOfImage;
+    if (totalBytes == 0) return;
+    fwprintf(g_Log, L"[+] Scan scope is %llu of %llu %s bytes (%.1f%%)\n", scopeBytes, totalBytes, isFile ? L"file" : L"image",
+        100.0 * (double)scopeBytes / (double)totalBytes);
+}
+
+// Finds the unique signature of either kind. `mask` is NULL for exact signatures, and so is `*uniqueMask` then.
+static Error FindUniqueSignatureOfKind(const struct ImageView* pImage, struct ScanScope* pScope, const struct SuffixIndex* pIndex, BYTE* signature, const BYTE* mask, DWORD signatureLength, int functionRVA, BOOL* isUnique, BYTE** uniqueSignature, BYTE** uniqueMask, DWORD* uniqueSignatureLength) {
+    *uniqueMask = NULL;
+    if (mask)
+        return FindUniqueMaskedSignature(pImage, pScope, signature, mask, signatureLength, functionRVA, isUnique, uniqueSignature, uniqueMask, uniqueSignatureLength);
+    return FindUniqueSignature(pImage, pScope, pIndex, signature, signatureLength, functionRVA, isUnique, uniqueSignature, uniqueSignatureLength);
+}
+
+// Resolves every function listed in the names file ("-" for stdin, one name per line, '#' starts a comment)
+// against the already mapped image and loaded PDB, and prints one tab separated line per function:
+// name, RVA, signature length, whether the requested length was already unique, and the signature bytes
+// (the pattern with --wildcards).
+static int RunBatch(const struct Options* options, const struct ImageView* pImage, struct ScanScope* pScope, struct PDBLookupContext* pCtx, const struct SuffixIndex* pIndex) {
+    BOOL fromStdin = wcscmp(options->batchPath, L"-") == 0;
+    FILE* input = fromStdin ? stdin : OpenFileW(options->batchPath, "r");
+    if (!input) {
+        fwprintf(stderr, L"[-] Failed to open function list %s\n", options->batchPath);
         return 1;
     }
 
-    size_t fullPdbPathBufferLength = wcslen(folderPath) + strlen(ctx.pdbInfo.pdbName) + 1;
-    WCHAR* fullPdbPath = (WCHAR*)malloc(fullPdbPathBufferLength * sizeof(WCHAR));
-    if (!fullPdbPath) {
-        fwprintf(stderr, L"[-] malloc failed, out of memory\n");
+    DWORD nResolved = 0, nFailed = 0;
+    WCHAR line[MAX_SYM_NAME];
+    while (fgetws(line, _countof(line), input)) {
+        WCHAR* name = line;
+        while (iswspace(*name)) name++;
+        size_t nameLength = wcslen(name);
+        while (nameLength > 0 && iswspace(name[nameLength - 1])) name[--nameLength] = L'\0';
+        if (nameLength == 0 || name[0] == L'#')
+            continue;
+
+        ULONGLONG start = StartStatsTimer();
+        int funcRVA = GetFunctionRVA(name, pCtx);
+        StopStatsTimer(STATS_TIMER_FUNCTION_RVA, start);
+        if (funcRVA < 0) {
+            wprintf(L"%s\tnot-found\n", name);
+            nFailed++;
+            continue;
+        }
+
+        start = StartStatsTimer();
+        BYTE* sigBuffer = NULL;
+        Error e = GetFunctionSignatureFromPE(pImage, options->sigLength, funcRVA, &sigBuffer);
+        if (e.ContainsError) {
+            wprintf(L"%s\t0x%08X\terror\t%s\n", name, funcRVA, e.Format(&e));
+            Error_Free(&e);
+            nFailed++;
+            continue;
+        }
+
+        BYTE* maskBuffer = NULL;
+        if (options->wildcards) {
+            e = GetFunctionSignatureMask(pImage, options->sigLength, funcRVA, &maskBuffer);
+            if (e.ContainsError) {
+                wprintf(L"%s\t0x%08X\terror\t%s\n", name, funcRVA, e.Format(&e));
+                Error_Free(&e);
+                free(sigBuffer);
+                nFailed++;
+                continue;
+            }
+        }
+        StopStatsTimer(STATS_TIMER_SIGNATURE, start);
+
+        BOOL isUnique = TRUE;
+        BYTE* uniqueSigBuffer = NULL;
+        BYTE* uniqueMaskBuffer = NULL;
+        DWORD uniqueSigLength = 0;
+        start = StartStatsTimer();
+        e = FindUniqueSignatureOfKind(pImage, pScope, pIndex, sigBuffer, maskBuffer, options->sigLength, funcRVA, &isUnique, &uniqueSigBuffer, &uniqueMaskBuffer, &uniqueSigLength);
+        StopStatsTimer(STATS_TIMER_UNIQUE_SIGNATURE, start);
+        if (e.ContainsError) {
+            wprintf(L"%s\t0x%08X\terror\t%s\n", name, funcRVA, e.Format(&e));
+            Error_Free(&e);
+            free(maskBuffer);
+            free(sigBuffer);
+            nFailed++;
+            continue;
+        }
+
+        const BYTE* signature = isUnique ? sigBuffer : uniqueSigBuffer;
+        const BYTE* mask = isUnique ? maskBuffer : uniqueMaskBuffer;
+        DWORD signatureLength = isUnique ? options->sigLength : uniqueSigLength;
+        wprintf(L"%s\t0x%08X\t%lu\t%s\t", name, funcRVA, signatureLength, isUnique ? L"unique" : L"extended");
+        if (mask) PrintSignaturePattern(signature, mask, signatureLength, FALSE);
+        else PrintSignatureBytes(stdout, signature, signatureLength);
+        RecordSignatureW(name, (DWORD)funcRVA, signature, mask, signatureLength);
+        free(uniqueMaskBuffer);
+        free(uniqueSigBuffer);
+        free(maskBuffer);
+        free(sigBuffer);
+        nResolved++;
+    }
+
+    if (!fromStdin) fclose(input);
+    fwprintf(g_Log, L"[+] Batch done: %lu resolved, %lu failed\n", nResolved, nFailed);
+    PrintScanScopeStats(pScope, pImage);
+    return nFailed == 0 ? 0 : 2;
+}
+
+// Writes the minimal unique signature of every function in the PDB, one tab separated line per function: name,
+// RVA, size, signature length, whether the signature fits in the function or runs past its end (unknown-size when
+// the symbol has no size), and the bytes.
+// All lengths come from a single suffix index over the executable sections, so the cost is one index build plus
+// a constant time lookup per function rather than one image scan per function. With --anywhere the signature may
+// start inside the function and its offset from the function start is written before the bytes.
+static int RunAll(const struct Options* options, const struct ImageView* pImage, const struct PDBLookupContext* pCtx, const struct SuffixIndex* pIndex) {
+    BOOL toStdout = wcscmp(options->allPath, L"-") == 0;
+    FILE* out = toStdout ? stdout : OpenFileW(options->allPath, "w");
+    if (!out) {
+        fwprintf(stderr, L"[-] Failed to create output file %s\n", options->allPath);
         return 1;
     }
-    swprintf_s(fullPdbPath, fullPdbPathBufferLength, L"%s%S", folderPath, ctx.pdbInfo.pdbName);
 
-    wprintf(L"[+] Downloading PDB file to %s\n", fullPdbPath);
-    e = DownloadPDB(&ctx, fullPdbPath);
-    if (e.ContainsError) {
-        fwprintf(stderr, L"[-] PDB download failed: %s\n", e.Format(&e));
+    LARGE_INTEGER frequency, start, end;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+    ULONGLONG statsStart = StartStatsTimer();
+
+    const struct SymbolIndex* pSymbols = &pCtx->symbolIndex;
+    DWORD nResolved = 0, nFailed = 0;
+    for (DWORD i = 0; i < pSymbols->header->numEntries; i++) {
+        const SymbolIndexEntry* entry = &pSymbols->entries[i];
+        if (entry->kind != PDB_SYMBOL_FUNCTION) continue;
+        const char* name = pSymbols->strings + entry->nameOffset;
+
+        DWORD offset = 0;
+        DWORD length = options->anywhere ? GetShortestUniqueWindow(pIndex, entry->rva, entry->size, &offset) : GetMinimalUniqueLength(pIndex, entry->rva);
+        const BYTE* signature = length ? GetSpanByRva(pImage, entry->rva + offset, length) : NULL;
+        if (!signature) {
+            fwprintf(out, L"%S\t0x%08X\t%lu\tnot-unique\n", name, entry->rva, entry->size);
+            nFailed++;
+            continue;
+        }
+
+        const WCHAR* fit = entry->size == 0 ? L"unknown-size" : offset + length <= entry->size ? L"inside" : L"spills";
+        fwprintf(out, L"%S\t0x%08X\t%lu\t%lu\t%s\t", name, entry->rva, entry->size, length, fit);
+        // the offset column only exists with --anywhere, so the default output keeps its layout
+        if (options->anywhere) fwprintf(out, L"+0x%lX\t", offset);
+        PrintSignatureBytes(out, signature, length);
+        RecordSignature(name, entry->rva, offset, signature, NULL, length);
+        nResolved++;
+    }
+
+    StopStatsTimer(STATS_TIMER_UNIQUE_SIGNATURE, statsStart);
+    QueryPerformanceCounter(&end);
+    double seconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+    if (!toStdout) fclose(out);
+    fwprintf(g_Log, L"[+] %lu functions resolved, %lu without a unique signature, in %.3f s (%.0f functions/s)\n",
+        nResolved, nFailed, seconds, seconds > 0 ? (nResolved + nFailed) / seconds : 0.0);
+    return 0;
+}
+
+// Writes a JSON string, escaping quotes, backslashes and control characters
+static void PrintJsonString(FILE* out, const char* s) {
+    fputwc(L'"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fwprintf(out, L"\\%C", *s);
+        else if ((BYTE)*s < 0x20) fwprintf(out, L"\\u%04x", (BYTE)*s);
+        else fputwc((BYTE)*s, out);
+    }
+    fputwc(L'"', out);
+}
+
+// Writes a query as a macro name: "_EPROCESS.Pcb" becomes _EPROCESS_Pcb
+static void PrintMacroName(FILE* out, const char* query) {
+    for (; *query; query++) fputwc(isalnum((BYTE)*query) || *query == '_' ? (BYTE)*query : L'_', out);
+}
+
+// Prints one field, in a header as the macro <prefix>_<name> or <name> without a prefix
+static void PrintFieldOffset(FILE* out, BOOL json, const char* prefix, const char* name, const struct TypeField* field, DWORD offset) {
+    if (json) {
+        fwprintf(out, L"{ \"offset\": %lu, \"size\": %lu, \"type\": ", offset, field->size);
+        PrintJsonString(out, field->typeName);
+        if (field->bitLength) fwprintf(out, L", \"bitPosition\": %lu, \"bitLength\": %lu", field->bitPosition, field->bitLength);
+        fwprintf(out, L" }");
+        return;
+    }
+    fwprintf(out, L"#define ");
+    if (prefix) {
+        PrintMacroName(out, prefix);
+        fputwc(L'_', out);
+    }
+    PrintMacroName(out, name);
+    fwprintf(out, L" 0x%X", offset);
+    if (field->bitLength) fwprintf(out, L" // bits %lu..%lu", field->bitPosition, field->bitPosition + field->bitLength - 1);
+    fwprintf(out, L"\n");
+}
+
+static void PrintTypeLayout(FILE* out, BOOL json, const struct TypeLayout* layout) {
+    if (json) {
+        fwprintf(out, L"{ \"size\": %lu, \"fields\": {", layout->size);
+        for (DWORD i = 0; i < layout->numFields; i++) {
+            fwprintf(out, L"%s\n      ", i ? L"," : L"");
+            PrintJsonString(out, layout->fields[i].name);
+            fwprintf(out, L": ");
+            PrintFieldOffset(out, TRUE, NULL, NULL, &layout->fields[i], layout->fields[i].offset);
+        }
+        fwprintf(out, L"\n    } }");
+        return;
+    }
+    fwprintf(out, L"\n// %S, 0x%X bytes\n#define ", layout->name, layout->size);
+    PrintMacroName(out, layout->name);
+    fwprintf(out, L"_SIZE 0x%X\n", layout->size);
+    for (DWORD i = 0; i < layout->numFields; i++)
+        PrintFieldOffset(out, FALSE, layout->name, layout->fields[i].name, &layout->fields[i], layout->fields[i].offset);
+}
+
+// Resolves "Type.Field.Member...", following fields of struct type. The offset adds up along the path.
+static const struct TypeField* ResolveFieldPath(char* path, struct PDBLookupContext* pCtx, DWORD* offset) {
+    const struct TypeField* field = NULL;
+    const char* typeName = path;
+    char* member = strchr(path, '.');
+    *member++ = '\0';
+    *offset = 0;
+    while (member) {
+        char* next = strchr(member, '.');
+        if (next) *next++ = '\0';
+
+        WCHAR* wideTypeName = Utf8ToWide(typeName);
+        const struct TypeLayout* layout = NULL;
+        Error e = wideTypeName ? GetTypeLayout(wideTypeName, pCtx, &layout) : NewError(__FUNCTION__, -1, L"Utf8ToWide failed", 0);
+        free(wideTypeName);
+        if (e.ContainsError) {
+            Error_Free(&e);
+            return NULL;
+        }
+        field = FindTypeField(layout, member);
+        if (!field) return NULL;
+        *offset += field->offset;
+        typeName = field->typeName;
+        member = next;
+    }
+    return field;
+}
+
+// Answers every query in the file ("-" for stdin, one per line, '#' starts a comment): "Type.Field" prints the
+// field's offset and "Type" the whole layout, as a C header or with --format json as one JSON object. Each type is
+// enumerated through DbgHelp once, however many of its fields are asked for.
+static int RunOffsets(const struct Options* options, struct PDBLookupContext* pCtx) {
+    BOOL fromStdin = wcscmp(options->offsetsPath, L"-") == 0;
+    FILE* input = fromStdin ? stdin : OpenFileW(options->offsetsPath, "r");
+    if (!input) {
+        fwprintf(stderr, L"[-] Failed to open query list %s\n", options->offsetsPath);
         return 1;
     }
 
-    wprintf(L"[+] Initializing DbgHelp\n");
-    e = InitializePDBLookup(fullPdbPath, &ctx);
+    BOOL json = options->offsetsJson;
+    WCHAR key[64];
+    FormatSymbolStoreKey(&pCtx->pdbInfo.guid, pCtx->pdbInfo.age, key, _countof(key));
+    if (json) {
+        wprintf(L"{\n  \"pdb\": ");
+        PrintJsonString(stdout, GetPdbFileName(pCtx->pdbInfo.pdbName));
+        wprintf(L",\n  \"id\": \"%s\",\n  \"queries\": {", key);
+    }
+    else
+        wprintf(L"// Generated by SigScanner from %S %s\n#pragma once\n", GetPdbFileName(pCtx->pdbInfo.pdbName), key);
+
+    DWORD nResolved = 0, nFailed = 0;
+    char line[MAX_SYM_NAME];
+    while (fgets(line, sizeof(line), input)) {
+        char* query = line;
+        while (isspace((BYTE)*query)) query++;
+        size_t queryLength = strlen(query);
+        while (queryLength > 0 && isspace((BYTE)query[queryLength - 1])) query[--queryLength] = '\0';
+        if (queryLength == 0 || query[0] == '#')
+            continue;
+
+        if (json) {
+            wprintf(L"%s\n    ", nResolved + nFailed ? L"," : L"");
+            PrintJsonString(stdout, query);
+            wprintf(L": ");
+        }
+
+        char* path = _strdup(query);
+        BOOL resolved = FALSE;
+        if (path && strchr(path, '.')) {
+            DWORD offset;
+            const struct TypeField* field = ResolveFieldPath(path, pCtx, &offset);
+            if (field) {
+                PrintFieldOffset(stdout, json, NULL, query, field, offset);
+                resolved = TRUE;
+            }
+        }
+        else if (path) {
+            WCHAR* typeName = Utf8ToWide(path);
+            const struct TypeLayout* layout = NULL;
+            Error e = typeName ? GetTypeLayout(typeName, pCtx, &layout) : NewNoError();
+            if (layout) {
+                PrintTypeLayout(stdout, json, layout);
+                resolved = TRUE;
+            }
+            Error_Free(&e);
+            free(typeName);
+        }
+        free(path);
+
+        if (resolved) {
+            nResolved++;
+            continue;
+        }
+        if (json) wprintf(L"null");
+        else wprintf(L"// %S not found\n", query);
+        fwprintf(stderr, L"[-] %S not found in the PDB\n", query);
+        nFailed++;
+    }
+    if (json) wprintf(L"\n  }\n}\n");
+
+    if (!fromStdin) fclose(input);
+    fwprintf(g_Log, L"[+] Offsets done: %lu resolved, %lu not found, %lu type(s) read\n", nResolved, nFailed, pCtx->typeLayouts.numLayouts);
+    return nFailed == 0 ? 0 : 2;
+}
+
+// Opens the image of this run: the PE file itself, a module of the --dump minidump, or a --loaded capture.
+// `pDump` stays empty unless the image is a view into it. Close with CloseInputImage.
+static Error OpenInputImage(const struct Options* options, struct Dump* pDump, struct ImageView* pImage) {
+    ZeroMemory(pDump, sizeof(struct Dump));
+    Error e;
+    if (!options->dumpPath) {
+        e = options->loaded ? MapLoadedImageView(options->pePath, options->loadedBase, pImage) : MapImageView(options->pePath, pImage);
+        if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+
+    e = OpenDump(options->dumpPath, pDump);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -2);
+        return e;
+    }
+    const struct DumpModule* module = FindDumpModule(pDump, options->pePath);
+    if (!module) {
+        FreeDump(pDump);
+        return NewError(__FUNCTION__, -3, L"The module is not loaded in the dumped process", 0);
+    }
+    e = GetDumpModuleImage(pDump, module, pImage);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -4);
+        FreeDump(pDump);
+        return e;
+    }
+
+    ULONGLONG capturedBytes = 0;
+    for (DWORD i = 0; i < pImage->numSegments; i++) capturedBytes += pImage->segments[i].length;
+    fwprintf(g_Log, L"[+] Module %s is loaded at 0x%llX, %llu of %lu bytes captured in %lu range(s)\n", module->name, module->base,
+        capturedBytes, module->size, pImage->numSegments);
+    return e;
+}
+
+static void CloseInputImage(struct Dump* pDump, struct ImageView* pImage) {
+    UnmapImageView(pImage);
+    FreeDump(pDump);
+}
+
+// Loads the symbols of the image from a PDB: the --from-disk one, or the one in the symbol store, which is
+// downloaded first when it is missing. A symbol index saved next to the PDB is used instead when it matches.
+// `*pPdbPath` is set to the PDB, next to which the other caches are kept.
+static BOOL LoadPdbSymbols(const struct Options* options, struct PDBLookupContext* pCtx, WCHAR** pPdbPath) {
+    WCHAR* fullPdbPath = options->pdbPath;
+    if (!fullPdbPath) {
+        // symbols of a dumped module are kept next to the dump
+        WCHAR* folderPath = GetFolderPathFromFileName(options->dumpPath ? options->dumpPath : options->pePath);
+        if (!folderPath) {
+            fwprintf(stderr, L"[-] Failed to get folder path: %lu\n", GetLastError());
+            return FALSE;
+        }
+
+        WCHAR* cacheDir = options->cacheDir;
+        if (!cacheDir) {
+            size_t cacheDirLength = wcslen(folderPath) + 8;
+            cacheDir = (WCHAR*)malloc(cacheDirLength * sizeof(WCHAR));
+            if (!cacheDir) {
+                fwprintf(stderr, L"[-] malloc failed, out of memory\n");
+                free(folderPath);
+                return FALSE;
+            }
+            swprintf_s(cacheDir, cacheDirLength, L"%ssymbols", folderPath);
+        }
+
+        fullPdbPath = GetSymbolStorePath(cacheDir, pCtx->pdbInfo.pdbName, &pCtx->pdbInfo.guid, pCtx->pdbInfo.age);
+        if (cacheDir != options->cacheDir) free(cacheDir);
+        free(folderPath);
+        if (!fullPdbPath) {
+            fwprintf(stderr, L"[-] malloc failed, out of memory\n");
+            return FALSE;
+        }
+    }
+    *pPdbPath = fullPdbPath;
+
+    ULONGLONG start = StartStatsTimer();
+    Error e = InitializePDBLookupFromIndex(fullPdbPath, pCtx);
+    StopStatsTimer(STATS_TIMER_SYMBOL_INDEX, start);
+    if (!e.ContainsError) {
+        fwprintf(g_Log, L"[+] Using the cached symbol index of %s\n", fullPdbPath);
+        return TRUE;
+    }
+    Error_Free(&e);
+
+    if (options->pdbPath) {
+        // a local PDB is only checked against the image, never downloaded or replaced
+        if (!IsValidSymbolStoreEntry(fullPdbPath, &pCtx->pdbInfo.guid, pCtx->pdbInfo.age)) {
+            fwprintf(stderr, L"[-] %s is missing or is not the PDB of the image\n", fullPdbPath);
+            return FALSE;
+        }
+    } else {
+        fwprintf(g_Log, L"[+] Fetching PDB file into %s\n", fullPdbPath);
+        struct DownloadStats stats;
+        start = StartStatsTimer();
+        e = FetchPDB(pCtx, options->symbolServer ? options->symbolServer : DEFAULT_SYMBOL_SERVER, options->connections, fullPdbPath, &stats);
+        StopStatsTimer(STATS_TIMER_PDB_DOWNLOAD, start);
+        if (e.ContainsError) {
+            fwprintf(stderr, L"[-] PDB download failed: %s\n", e.Format(&e));
+            return FALSE;
+        }
+        AddStatsCount(STATS_BYTES_DOWNLOADED, stats.bytesReceived);
+        if (stats.bytesReceived > 0) {
+            double megabytes = (double)stats.bytesReceived / (1024.0 * 1024.0);
+            fwprintf(g_Log, L"[+] Downloaded %.1f MB in %.2f s (%.1f MB/s, %lu connection(s)%s)\n", megabytes, stats.seconds,
+                stats.seconds > 0 ? megabytes / stats.seconds : 0.0, stats.connections, stats.resumedFrom ? L", resumed" : L"");
+        }
+    }
+
+    fwprintf(g_Log, L"[+] Loading PDB\n");
+    start = StartStatsTimer();
+    e = InitializePDBLookup(fullPdbPath, pCtx);
+    StopStatsTimer(STATS_TIMER_PDB_LOAD, start);
     if (e.ContainsError) {
         fwprintf(stderr, L"[-] InitializePDBLookup failed: %s\n", e.Format(&e));
-        free(ctx.pdbInfo.pdbName);
+        free(pCtx->pdbInfo.pdbName);
+        pCtx->pdbInfo.pdbName = NULL;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Prints the shortest unique signature starting anywhere inside the function, and where it starts
+static int RunAnywhere(const struct ImageView* pImage, struct PDBLookupContext* pCtx, const struct SuffixIndex* pIndex, const WCHAR* funcName, DWORD funcRVA) {
+    // why the index is missing was printed when it was opened
+    if (!pIndex) return 1;
+
+    // the extent comes from the PDB, or from .pdata for public symbols and images without a PDB
+    DWORD funcSize = GetFunctionSize(funcName, pCtx);
+    DWORD begin, end;
+    if (!funcSize && FindRuntimeFunction(pImage, funcRVA, &begin, &end)) funcSize = end - funcRVA;
+    if (funcSize) wprintf(L"[+] Searching %lu start offsets\n", funcSize);
+    else fwprintf(stderr, L"[-] WARNING: the size of the function is unknown, only its start is tried\n");
+
+    DWORD offset = 0;
+    ULONGLONG start = StartStatsTimer();
+    DWORD length = GetShortestUniqueWindow(pIndex, funcRVA, funcSize, &offset);
+    DWORD prefixLength = GetMinimalUniqueLength(pIndex, funcRVA);
+    StopStatsTimer(STATS_TIMER_UNIQUE_SIGNATURE, start);
+    const BYTE* window = length ? GetSpanByRva(pImage, funcRVA + offset, length) : NULL;
+    if (!window) {
+        fwprintf(stderr, L"[-] No unique signature starts inside the function\n");
+        return 2;
+    }
+
+    wprintf(L"Unique signature (%lu bytes) at function+0x%lX:\n", length, offset);
+    PrintSignatureBytes(stdout, window, length);
+    if (offset + length > funcSize)
+        fwprintf(stderr, L"[-] WARNING: the signature runs past the end of the function\n");
+    if (prefixLength && prefixLength != length)
+        wprintf(L"Unique signature at the function start is %lu bytes\n", prefixLength);
+
+    char* utf8Name = WideToUtf8(funcName);
+    if (utf8Name) RecordSignature(utf8Name, funcRVA, offset, window, NULL, length);
+    free(utf8Name);
+    return 0;
+}
+
+// Resolves the signature(s) asked for on the command line in one image
+static int RunImage(const struct Options* options)
+{
+    WCHAR* pePath = options->pePath;
+    WCHAR* funcName = options->funcName;
+    DWORD sigLength = options->sigLength;
+    g_Log = (options->batchPath || options->allPath || options->offsetsPath) ? stderr : stdout;
+
+    fwprintf(g_Log, L"[+] Supplied PE path: %s\n", pePath);
+    if (options->dumpPath) fwprintf(g_Log, L"[+] Supplied minidump: %s\n", options->dumpPath);
+    if (options->loaded) fwprintf(g_Log, L"[+] Supplied load address: 0x%llX\n", options->loadedBase);
+    if (funcName) fwprintf(g_Log, L"[+] Supplied function name: %s\n", funcName);
+    if (!options->allPath && !options->offsetsPath && !options->anywhere) fwprintf(g_Log, L"[+] Input Signature length: %lu\n", sigLength);
+    fwprintf(g_Log, L"[+] Extracting PE information\n");
+
+    // everything below starts out empty, so every exit goes through the one cleanup at the end
+    struct Dump dump = { 0 };
+    struct ImageView image = { 0 };
+    struct ScanScope scope = { 0 };
+    struct ThreadPool threadPool = { 0 };
+    struct PDBLookupContext ctx = { 0 };
+    struct SuffixIndex index;
+    struct SuffixIndex* pIndex = NULL;
+    WCHAR* fullPdbPath = NULL;
+    BYTE* sigBuffer = NULL;
+    BYTE* maskBuffer = NULL;
+    BYTE* uniqueSigBuffer = NULL;
+    BYTE* uniqueMaskBuffer = NULL;
+    int status = 1;
+    Error e = NewNoError();
+    do {
+        ULONGLONG start = StartStatsTimer();
+        e = OpenInputImage(options, &dump, &image);
+        StopStatsTimer(STATS_TIMER_MAP_IMAGE, start);
+        if (e.ContainsError) {
+            fwprintf(stderr, L"[-] Mapping PE image failed: %s\n", e.Format(&e));
+            break;
+        }
+
+        start = StartStatsTimer();
+        e = CreateScanScope(&image, options->sections, options->virtualLayout ? SCAN_LAYOUT_VIRTUAL : SCAN_LAYOUT_FILE, &scope);
+        StopStatsTimer(STATS_TIMER_SCAN_SCOPE, start);
+        if (e.ContainsError) {
+            fwprintf(stderr, L"[-] Selecting the sections to scan failed: %s\n", e.Format(&e));
+            break;
+        }
+
+        e = CreateThreadPool(options->threads, &threadPool);
+        if (e.ContainsError) {
+            fwprintf(stderr, L"[-] Starting the scan threads failed: %s\n", e.Format(&e));
+            break;
+        }
+        scope.pThreadPool = &threadPool;
+        fwprintf(g_Log, L"[+] Scanning with %lu thread(s)\n", threadPool.numThreads);
+
+        start = StartStatsTimer();
+        e = GetPEInfo(&image, &ctx);
+        StopStatsTimer(STATS_TIMER_PE_INFO, start);
+        if (e.ContainsError && !options->noPdb) {
+            fwprintf(stderr, L"[-] Get PE info failed: %s\n", e.Format(&e));
+            break;
+        }
+
+        if (options->noPdb) {
+            // images without a PDB often have no CodeView record either, their signatures then get a zero GUID
+            if (e.ContainsError) {
+                Error_Free(&e);
+                ZeroMemory(&ctx.pdbInfo, sizeof(ctx.pdbInfo));
+            }
+            fwprintf(g_Log, L"[+] Resolving functions from the exports and .pdata of the image\n");
+            start = StartStatsTimer();
+            e = InitializeImageLookup(&image, options->allPath != NULL, &ctx);
+            StopStatsTimer(STATS_TIMER_SYMBOL_INDEX, start);
+            if (e.ContainsError) {
+                fwprintf(stderr, L"[-] Reading the symbols of the image failed: %s\n", e.Format(&e));
+                break;
+            }
+        } else {
+            fwprintf(g_Log, L"[+] PDB file name in the PE is: %S\n", ctx.pdbInfo.pdbName);
+            if (!LoadPdbSymbols(options, &ctx, &fullPdbPath)) break;
+        }
+
+        if (options->offsetsPath) {
+            status = RunOffsets(options, &ctx);
+            break;
+        }
+
+        if (options->useIndex) {
+            // without a PDB there is no cache entry to keep the index in, so it is built for this run only
+            WCHAR* indexPath = NULL;
+            if (fullPdbPath) {
+                size_t indexPathLength = wcslen(fullPdbPath) + 5;
+                indexPath = (WCHAR*)malloc(indexPathLength * sizeof(WCHAR));
+                if (!indexPath) {
+                    fwprintf(stderr, L"[-] malloc failed, out of memory\n");
+                    break;
+                }
+                swprintf_s(indexPath, indexPathLength, L"%s.sai", fullPdbPath);
+                fwprintf(g_Log, L"[+] Opening suffix index %s\n", indexPath);
+            } else {
+                fwprintf(g_Log, L"[+] Building suffix index\n");
+            }
+
+            start = StartStatsTimer();
+            e = indexPath ? OpenSuffixIndex(indexPath, &image, &ctx.pdbInfo.guid, ctx.pdbInfo.age, &index)
+                : BuildSuffixIndex(&image, &ctx.pdbInfo.guid, ctx.pdbInfo.age, &index);
+            StopStatsTimer(STATS_TIMER_SUFFIX_INDEX, start);
+            if (!e.ContainsError)
+                pIndex = &index;
+            else if (options->anywhere || options->allPath)
+                fwprintf(stderr, L"[-] Suffix index unavailable: %s\n", e.Format(&e));
+            else
+                fwprintf(stderr, L"[-] WARNING: suffix index unavailable, falling back to scanning: %s\n", e.Format(&e));
+            Error_Free(&e);
+            e = NewNoError();
+            free(indexPath);
+        }
+
+        start = StartStatsTimer();
+        BOOL dbReady = BeginSignatureDb(options, &image, &ctx);
+        StopStatsTimer(STATS_TIMER_SIGNATURE_DB, start);
+        if (!dbReady) break;
+
+        if (options->allPath) {
+            if (pIndex) status = RunAll(options, &image, &ctx, pIndex);
+            if (!EndSignatureDb(options)) status = 1;
+            break;
+        }
+
+        if (options->batchPath) {
+            status = RunBatch(options, &image, &scope, &ctx, pIndex);
+            if (!EndSignatureDb(options)) status = 1;
+            break;
+        }
+
+        wprintf(L"[+] Retrieving function relative virtual address\n");
+        start = StartStatsTimer();
+        int funcRVA = GetFunctionRVA(funcName, &ctx);
+        StopStatsTimer(STATS_TIMER_FUNCTION_RVA, start);
+        if (funcRVA < 0) {
+            fwprintf(stderr, L"[-] Symbol '%s' not found in %s\n", funcName, options->noPdb ? L"the exports or .pdata" : L"PDB");
+            break;
+        }
+        wprintf(L"Function '%s' RVA = 0x%08X\n", funcName, funcRVA);
+        // the bounds of the function come from its .pdata entry when there is no PDB
+        ULONG funcSize = options->noPdb ? GetFunctionSize(funcName, &ctx) : 0;
+        if (funcSize) wprintf(L"Function '%s' size = 0x%lX\n", funcName, funcSize);
+        if (image.imageBase) wprintf(L"Function '%s' VA = 0x%llX\n", funcName, image.imageBase + (DWORD)funcRVA);
+
+        if (options->anywhere) {
+            status = RunAnywhere(&image, &ctx, pIndex, funcName, (DWORD)funcRVA);
+            if (!EndSignatureDb(options)) status = 1;
+            break;
+        }
+
+        wprintf(L"[+] Fetching function signature\n");
+        start = StartStatsTimer();
+        e = GetFunctionSignatureFromPE(&image, sigLength, funcRVA, &sigBuffer);
+        if (e.ContainsError) {
+            fwprintf(stderr, L"[-] Failed to read %d-byte signature at RVA 0x%08X from %s\n", sigLength, funcRVA, pePath);
+            fwprintf(stderr, L"  (%s)\n", e.Format(&e));
+            break;
+        }
+
+        if (options->wildcards) {
+            e = GetFunctionSignatureMask(&image, sigLength, funcRVA, &maskBuffer);
+            if (e.ContainsError) {
+                fwprintf(stderr, L"[-] Failed to mask the signature: %s\n", e.Format(&e));
+                break;
+            }
+        }
+        StopStatsTimer(STATS_TIMER_SIGNATURE, start);
+
+        BOOL isUnique = FALSE;
+        DWORD uniqueSigLength = 0;
+        start = StartStatsTimer();
+        e = FindUniqueSignatureOfKind(&image, &scope, pIndex, sigBuffer, maskBuffer, sigLength, funcRVA, &isUnique, &uniqueSigBuffer, &uniqueMaskBuffer, &uniqueSigLength);
+        StopStatsTimer(STATS_TIMER_UNIQUE_SIGNATURE, start);
+        // like RunBatch: a signature that was never checked is neither printed nor recorded
+        if (e.ContainsError) {
+            fwprintf(stderr, L"[-] Failed to find a unique signature: %s\n", e.Format(&e));
+            break;
+        }
+
+        if (isUnique) RecordSignatureW(funcName, (DWORD)funcRVA, sigBuffer, maskBuffer, sigLength);
+        else RecordSignatureW(funcName, (DWORD)funcRVA, uniqueSigBuffer, uniqueMaskBuffer, uniqueSigLength);
+
+        wprintf(L"Signature (%d bytes):\n", sigLength);
+        if (maskBuffer) PrintSignaturePattern(sigBuffer, maskBuffer, sigLength, TRUE);
+        else PrintSignatureBytes(stdout, sigBuffer, sigLength);
+
+        if (!isUnique) {
+            HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+            CONSOLE_SCREEN_BUFFER_INFO consoleScreenBufferInfo;
+            GetConsoleScreenBufferInfo(hConsole, &consoleScreenBufferInfo);
+            WORD oldAttributes = consoleScreenBufferInfo.wAttributes;
+
+            // yellow/orange color
+            SetConsoleTextAttribute(hConsole, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_INTENSITY);
+            wprintf(L"\nWARNING: the above %lu-byte pattern repeats in the image.\nMinimal unique signature is %lu bytes.\n", sigLength, uniqueSigLength);
+
+            SetConsoleTextAttribute(hConsole, oldAttributes);
+            wprintf(L"Unique signature (%d bytes):\n", uniqueSigLength);
+            if (uniqueMaskBuffer) PrintSignaturePattern(uniqueSigBuffer, uniqueMaskBuffer, uniqueSigLength, TRUE);
+            else PrintSignatureBytes(stdout, uniqueSigBuffer, uniqueSigLength);
+        }
+
+        PrintScanScopeStats(&scope, &image);
+        status = EndSignatureDb(options) ? 0 : 1;
+    } while (FALSE);
+
+    // a run that stopped before its signatures were saved leaves the database file as it was
+    if (g_DbEnabled) {
+        FreeSignatureDbBuilder(&g_Db);
+        g_DbEnabled = FALSE;
+    }
+    Error_Free(&e);
+    free(uniqueMaskBuffer);
+    free(uniqueSigBuffer);
+    free(maskBuffer);
+    free(sigBuffer);
+    if (pIndex) FreeSuffixIndex(pIndex);
+    if (fullPdbPath != options->pdbPath) free(fullPdbPath);
+    CleanupPDBLookupCtx(&ctx);
+    FreeScanScope(&scope);
+    FreeThreadPool(&threadPool);
+    CloseInputImage(&dump, &image);
+    return status;
+}
+
+// One PE of a --builds run, with the function resolved through its own symbols
+typedef struct BuildImage {
+    WCHAR* pePath;
+    struct ImageView image;
+    struct ScanScope scope;
+    struct PDBLookupContext ctx;
+    int funcRVA;
+} BuildImage;
+
+// Maps a build and finds the function in it, through its PDB or, with --no-pdb, its exports and .pdata.
+// Whatever was opened is closed by CloseBuildImage, also when this fails.
+static BOOL OpenBuildImage(const struct Options* options, struct BuildImage* pBuild) {
+    ULONGLONG start = StartStatsTimer();
+    Error e = MapImageView(pBuild->pePath, &pBuild->image);
+    StopStatsTimer(STATS_TIMER_MAP_IMAGE, start);
+    if (e.ContainsError) {
+        fwprintf(stderr, L"[-] Mapping %s failed: %s\n", pBuild->pePath, e.Format(&e));
+        return FALSE;
+    }
+
+    start = StartStatsTimer();
+    e = CreateScanScope(&pBuild->image, options->sections, options->virtualLayout ? SCAN_LAYOUT_VIRTUAL : SCAN_LAYOUT_FILE, &pBuild->scope);
+    StopStatsTimer(STATS_TIMER_SCAN_SCOPE, start);
+    if (e.ContainsError) {
+        fwprintf(stderr, L"[-] Selecting the sections to scan in %s failed: %s\n", pBuild->pePath, e.Format(&e));
+        return FALSE;
+    }
+
+    start = StartStatsTimer();
+    e = GetPEInfo(&pBuild->image, &pBuild->ctx);
+    StopStatsTimer(STATS_TIMER_PE_INFO, start);
+    if (e.ContainsError && !options->noPdb) {
+        fwprintf(stderr, L"[-] Get PE info of %s failed: %s\n", pBuild->pePath, e.Format(&e));
+        return FALSE;
+    }
+
+    if (options->noPdb) {
+        if (e.ContainsError) {
+            Error_Free(&e);
+            ZeroMemory(&pBuild->ctx.pdbInfo, sizeof(pBuild->ctx.pdbInfo));
+        }
+        start = StartStatsTimer();
+        e = InitializeImageLookup(&pBuild->image, FALSE, &pBuild->ctx);
+        StopStatsTimer(STATS_TIMER_SYMBOL_INDEX, start);
+        if (e.ContainsError) {
+            fwprintf(stderr, L"[-] Reading the symbols of %s failed: %s\n", pBuild->pePath, e.Format(&e));
+            return FALSE;
+        }
+    } else {
+        // each build keeps its PDB in the symbol store it would use on its own
+        struct Options buildOptions = *options;
+        buildOptions.pePath = pBuild->pePath;
+        WCHAR* fullPdbPath = NULL;
+        fwprintf(g_Log, L"[+] PDB file name in %s is: %S\n", pBuild->pePath, pBuild->ctx.pdbInfo.pdbName);
+        BOOL loaded = LoadPdbSymbols(&buildOptions, &pBuild->ctx, &fullPdbPath);
+        free(fullPdbPath);
+        if (!loaded) return FALSE;
+    }
+
+    start = StartStatsTimer();
+    pBuild->funcRVA = GetFunctionRVA(options->funcName, &pBuild->ctx);
+    StopStatsTimer(STATS_TIMER_FUNCTION_RVA, start);
+    if (pBuild->funcRVA < 0) {
+        fwprintf(stderr, L"[-] Symbol '%s' not found in the symbols of %s\n", options->funcName, pBuild->pePath);
+        return FALSE;
+    }
+    fwprintf(g_Log, L"[+] Function '%s' RVA = 0x%08X in %s\n", options->funcName, pBuild->funcRVA, pBuild->pePath);
+    if (!FindScanRegion(&pBuild->scope, (DWORD)pBuild->funcRVA))
+        fwprintf(stderr, L"[-] WARNING: the function is outside of the scanned sections of %s\n", pBuild->pePath);
+    return TRUE;
+}
+
+static void CloseBuildImage(struct BuildImage* pBuild) {
+    CleanupPDBLookupCtx(&pBuild->ctx);
+    FreeScanScope(&pBuild->scope);
+    UnmapImageView(&pBuild->image);
+    free(pBuild->pePath);
+}
+
+// Reads the PE paths of --builds, one per line. Free each path and the array after use.
+static BOOL ReadBuildList(const struct Options* options, WCHAR*** pPaths, DWORD* pNumPaths) {
+    BOOL fromStdin = wcscmp(options->buildsPath, L"-") == 0;
+    FILE* input = fromStdin ? stdin : OpenFileW(options->buildsPath, "r");
+    if (!input) {
+        fwprintf(stderr, L"[-] Failed to open build list %s\n", options->buildsPath);
+        return FALSE;
+    }
+
+    WCHAR** paths = NULL;
+    DWORD numPaths = 0, capacity = 0;
+    BOOL ok = TRUE;
+    WCHAR line[MAX_PATH * 3];
+    while (ok && fgetws(line, _countof(line), input)) {
+        WCHAR* path = line;
+        while (iswspace(*path)) path++;
+        size_t pathLength = wcslen(path);
+        while (pathLength > 0 && iswspace(path[pathLength - 1])) path[--pathLength] = L'\0';
+        if (pathLength == 0 || path[0] == L'#')
+            continue;
+
+        if (numPaths == capacity) {
+            DWORD newCapacity = capacity ? capacity * 2 : 16;
+            WCHAR** newPaths = (WCHAR**)realloc(paths, newCapacity * sizeof(WCHAR*));
+            if (!newPaths) {
+                ok = FALSE;
+                break;
+            }
+            paths = newPaths;
+            capacity = newCapacity;
+        }
+        paths[numPaths] = _wcsdup(path);
+        if (!paths[numPaths]) ok = FALSE;
+        else numPaths++;
+    }
+    if (!fromStdin) fclose(input);
+
+    if (!ok) {
+        fwprintf(stderr, L"[-] malloc failed, out of memory\n");
+        for (DWORD i = 0; i < numPaths; i++) free(paths[i]);
+        free(paths);
+        return FALSE;
+    }
+    *pPaths = paths;
+    *pNumPaths = numPaths;
+    return TRUE;
+}
+
+// Finds one signature of the function that matches it and is unique in every build of the --builds list. The
+// builds are all opened first and then scanned together, so the scans of all builds share the thread pool and
+// the signature is grown once for all of them.
+static int RunBuilds(const struct Options* options) {
+    g_Log = stdout;
+    fwprintf(g_Log, L"[+] Supplied build list: %s\n", options->buildsPath);
+    fwprintf(g_Log, L"[+] Supplied function name: %s\n", options->funcName);
+    fwprintf(g_Log, L"[+] Input Signature length: %lu\n", options->sigLength);
+
+    WCHAR** paths;
+    DWORD numBuilds;
+    if (!ReadBuildList(options, &paths, &numBuilds)) return 1;
+    if (numBuilds == 0) {
+        fwprintf(stderr, L"[-] No builds listed in %s\n", options->buildsPath);
+        free(paths);
         return 1;
     }
 
-    wprintf(L"[+] Retrieving function relative virtual address\n");
-    int funcRVA = GetFunctionRVA(funcName, &ctx);
-    if (funcRVA < 0) {
-        fwprintf(stderr, L"[-] Symbol '%s' not found in PDB\n", funcName);
-        CleanupPDBLookupCtx(&ctx);
+    // the lookup context of a build points at its image, so the builds never move once opened
+    struct BuildImage* builds = (struct BuildImage*)calloc(numBuilds, sizeof(struct BuildImage));
+    struct CrossBuildTarget* targets = (struct CrossBuildTarget*)calloc(numBuilds, sizeof(struct CrossBuildTarget));
+    if (!builds || !targets) {
+        fwprintf(stderr, L"[-] malloc failed, out of memory\n");
+        for (DWORD i = 0; i < numBuilds; i++) free(paths[i]);
+        free(paths);
+        free(builds);
+        free(targets);
         return 1;
     }
-    wprintf(L"Function '%s' RVA = 0x%08X\n", funcName, funcRVA);
+    for (DWORD i = 0; i < numBuilds; i++) builds[i].pePath = paths[i];
+    free(paths);
+
+    int status = 1;
+    struct ThreadPool threadPool = { 0 };
+    do {
+        Error e = CreateThreadPool(options->threads, &threadPool);
+        if (e.ContainsError) {
+            fwprintf(stderr, L"[-] Starting the scan threads failed: %s\n", e.Format(&e));
+            break;
+        }
+        fwprintf(g_Log, L"[+] Scanning %lu build(s) with %lu thread(s)\n", numBuilds, threadPool.numThreads);
+
+        BOOL opened = TRUE;
+        for (DWORD i = 0; i < numBuilds && opened; i++) {
+            opened = OpenBuildImage(options, &builds[i]);
+            targets[i].pImage = &builds[i].image;
+            targets[i].pScope = &builds[i].scope;
+            targets[i].functionRVA = builds[i].funcRVA;
+        }
+        if (!opened) break;
+
+        BYTE* signature;
+        BYTE* mask;
+        DWORD signatureLength;
+        ULONGLONG start = StartStatsTimer();
+        e = FindCrossBuildSignature(targets, numBuilds, &threadPool, options->sigLength, options->wildcards, &signature, &mask, &signatureLength);
+        StopStatsTimer(STATS_TIMER_UNIQUE_SIGNATURE, start);
+        if (e.ContainsError) {
+            fwprintf(stderr, L"[-] No signature is unique in every build: %s\n", e.Format(&e));
+            status = 2;
+            break;
+        }
+
+        DWORD wildcards = 0;
+        for (DWORD i = 0; i < signatureLength; i++) wildcards += mask[i] == 0x00;
+        wprintf(L"Signature unique in all %lu build(s) (%lu bytes, %lu wildcard(s)):\n", numBuilds, signatureLength, wildcards);
+        PrintSignaturePattern(signature, mask, signatureLength, TRUE);
+
+        // the signature is stored for every build, each with the function's RVA in that build
+        status = 0;
+        if (options->dbPath) {
+            start = StartStatsTimer();
+            BOOL dbReady = OpenSignatureDb(options);
+            StopStatsTimer(STATS_TIMER_SIGNATURE_DB, start);
+            for (DWORD i = 0; i < numBuilds && dbReady; i++) {
+                dbReady = SelectSignatureDbImage(builds[i].pePath, &builds[i].image, &builds[i].ctx);
+                if (dbReady) RecordSignatureW(options->funcName, (DWORD)builds[i].funcRVA, signature, mask, signatureLength);
+            }
+            if (!dbReady || !EndSignatureDb(options)) status = 1;
+        }
+        free(mask);
+        free(signature);
+    } while (FALSE);
+
+    for (DWORD i = 0; i < numBuilds; i++) CloseBuildImage(&builds[i]);
+    free(targets);
+    free(builds);
+    FreeThreadPool(&threadPool);
+    return status;
+}
 
-    wprintf(L"[+] Fetching function signature\n");
-    BYTE* sigBuffer;
-    e = GetFunctionSignatureFromPE(pePath, sigLength, funcRVA, &sigBuffer);
+// Runs the pipe server with the scan and symbol options of the command line
+static int RunServe(const struct Options* options) {
+    struct ServerConfig config = { 0 };
+    config.pipeName = options->pipeName;
+    config.symbolServer = options->symbolServer;
+    config.cacheDir = options->cacheDir;
+    config.connections = options->connections;
+    config.threads = options->threads;
+    config.memoryBudget = (ULONGLONG)options->cacheMB * 1024 * 1024;
+    config.sections = options->sections;
+    config.virtualLayout = options->virtualLayout;
+
+    Error e = RunServer(&config);
     if (e.ContainsError) {
-        fwprintf(stderr, L"[-] Failed to read %d-byte signature at RVA 0x%08X from %s\n", sigLength, funcRVA, pePath);
-        fwprintf(stderr, L"  (%s)\n", e.Format(&e));
-        CleanupPDBLookupCtx(&ctx);
+        fwprintf(stderr, L"[-] Server stopped: %s\n", e.Format(&e));
         return 1;
     }
+    return 0;
+}
+
+// Writes the signatures of every image under the --corpus directory, and stores them in --db if given
+static int RunCorpus(const struct Options* options) {
+    g_Log = stderr;
+    ULONGLONG start = StartStatsTimer();
+    BOOL dbReady = OpenSignatureDb(options);
+    StopStatsTimer(STATS_TIMER_SIGNATURE_DB, start);
+    if (!dbReady) return 1;
 
-    BOOL isUnique;
-    BYTE* uniqueSigBuffer;
-    DWORD uniqueSigLength;
-    e = FindUniqueSignature(pePath, sigBuffer, sigLength, funcRVA, &isUnique, &uniqueSigBuffer, &uniqueSigLength);
-    if (e.ContainsError) 
-        fwprintf(stderr, L"[-] WARNING: unique signature check failed: %s\n", e.Format(&e));
+    struct CorpusConfig config = { 0 };
+    config.directory = options->corpusPath;
+    config.symbolServer = options->symbolServer;
+    config.cacheDir = options->cacheDir;
+    config.connections = options->connections;
+    config.threads = options->threads;
+    config.output = stdout;
+    config.log = g_Log;
+    config.pDb = g_DbEnabled ? &g_Db : NULL;
 
-    wprintf(L"Signature (%d bytes):\n", sigLength);
-    for (DWORD i = 0; i < sigLength; i++) {
-        wprintf(L"0x%02X", sigBuffer[i]);
-        if ((i + 1) < sigLength)
-            wprintf(L", ");
+    struct CorpusSummary summary;
+    Error e = ProcessCorpus(&config, &summary);
+    int status = summary.numFailed == 0 ? 0 : 2;
+    if (e.ContainsError) {
+        fwprintf(stderr, L"[-] Processing %s failed: %s\n", options->corpusPath, e.Format(&e));
+        status = 1;
     }
-    wprintf(L"\n");
-    free(sigBuffer);
+    fwprintf(g_Log, L"[+] Corpus done: %lu file(s), %lu image(s), %lu duplicate(s), %lu failed, %llu signature(s) in %.1f s (%.1f images/s, %lld task(s) stolen)\n",
+        summary.numFiles, summary.numImages, summary.numDuplicates, summary.numFailed, summary.numSignatures, summary.seconds,
+        summary.seconds > 0 ? (summary.numImages + summary.numDuplicates + summary.numFailed) / summary.seconds : 0.0, summary.steals);
+    if (!EndSignatureDb(options)) status = 1;
+    return status;
+}
 
-    if (!isUnique) {
-        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-        CONSOLE_SCREEN_BUFFER_INFO consoleScreenBufferInfo;
-        GetConsoleScreenBufferInfo(hConsole, &consoleScreenBufferInfo);
-        WORD oldAttributes = consoleScreenBufferInfo.wAttributes;
+static BOOL PrintScanMatch(void* context, ULONGLONG offset) {
+    UNREFERENCED_PARAMETER(context);
+    wprintf(L"0x%016llX\n", offset);
+    return TRUE;
+}
 
-        // yellow/orange color
-        SetConsoleTextAttribute(hConsole, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_INTENSITY);
-        wprintf(L"\nWARNING: the above %lu-byte pattern repeats in the image.\nMinimal unique signature is %lu bytes.\n", sigLength, uniqueSigLength);
+// Prints the file offset of every match of the --scan pattern. The file is streamed, so it may be larger than memory.
+static int RunScan(const struct Options* options) {
+    char* text = WideToUtf8(options->scanPattern);
+    if (!text) {
+        fwprintf(stderr, L"[-] WideToUtf8 failed\n");
+        return 1;
+    }
+    BYTE* pattern;
+    BYTE* mask;
+    DWORD patternLength;
+    Error e = ParseScanPattern(text, &pattern, &mask, &patternLength);
+    free(text);
+    if (e.ContainsError) {
+        fwprintf(stderr, L"[-] Invalid pattern: %s\n", e.Format(&e));
+        return 1;
+    }
 
-        SetConsoleTextAttribute(hConsole, oldAttributes);
-        wprintf(L"Unique signature (%d bytes):\n", uniqueSigLength);
-        for (DWORD i = 0; i < uniqueSigLength; i++) {
-            wprintf(L"0x%02X", uniqueSigBuffer[i]);
-            if ((i + 1) < uniqueSigLength)
-                wprintf(L", ");
-        }
-        wprintf(L"\n");
+    struct StreamScanStats stats;
+    e = StreamScanFile(options->scanPath, pattern, mask, patternLength, PrintScanMatch, NULL, &stats);
+    free(mask);
+    free(pattern);
+    if (e.ContainsError) {
+        fwprintf(stderr, L"[-] Scanning %s failed: %s\n", options->scanPath, e.Format(&e));
+        return 1;
     }
+    double gigabytes = (double)stats.bytesScanned / 1e9;
+    fwprintf(stderr, L"[+] %llu match(es) in %.2f GB in %.2f s (%.2f GB/s)\n", stats.matches, gigabytes, stats.seconds,
+        stats.seconds > 0 ? gigabytes / stats.seconds : 0.0);
+    return stats.matches > 0 ? 0 : 2;
+}
 
+static int RunConnect(const struct Options* options) {
+    Error e = RunClient(options->pipeName, stdin, stdout);
+    if (e.ContainsError) {
+        fwprintf(stderr, L"[-] Request to %s failed: %s\n", options->pipeName, e.Format(&e));
+        return 1;
+    }
     return 0;
 }
+
+int wmain(int argc, wchar_t* argv[])
+{
+    struct Options options;
+    if (!ParseOptions(argc, argv, &options)) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    if (options.stats) EnableStats();
+    ULONGLONG start = StartStatsTimer();
+    int status;
+    if (options.mergeOutput) status = RunMerge(&options);
+    else if (options.serve) status = RunServe(&options);
+    else if (options.connect) status = RunConnect(&options);
+    else if (options.corpusPath) status = RunCorpus(&options);
+    else if (options.buildsPath) status = RunBuilds(&options);
+    else if (options.scanPath) status = RunScan(&options);
+    else status = RunImage(&options);
+    StopStatsTimer(STATS_TIMER_TOTAL, start);
+
+    if (options.stats) {
+        Error e = SaveStatsReport(options.statsPath);
+        if (e.ContainsError) {
+            fwprintf(stderr, L"[-] Writing the stats report failed: %s\n", e.Format(&e));
+            Error_Free(&e);
+            if (status == 0) status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,402 @@
+#include "MultiScan.h"
+
+#define FILTER_BITS_MAX 20          // 128 KB filter, small enough to stay in L2 while scanning
+#define MIN_CHUNK_SIZE (256 * 1024)
+#define MAX_CHUNK_SIZE (8 * 1024 * 1024)
+
+typedef struct MultiScanPattern {
+    size_t bytesOffset;     // pattern bytes, then mask bytes, in the scanner's byte store
+    DWORD length;
+} MultiScanPattern;
+
+// The run of compared bytes a pattern is found by
+typedef struct MultiScanAnchor {
+    DWORD key;              // the anchor bytes, little endian
+    DWORD offset;           // of the anchor in the pattern
+    DWORD pattern;
+} MultiScanAnchor;
+
+static const DWORD g_AnchorWidths[MULTISCAN_ANCHOR_WIDTHS] = { 4, 2, 1 };
+
+static inline DWORD LoadKey(const BYTE* data, DWORD width)
+{
+    if (width == 4) {
+        DWORD key;
+        memcpy(&key, data, sizeof(key));
+        return key;
+    }
+    if (width == 2) return (DWORD)data[0] | ((DWORD)data[1] << 8);
+    return data[0];
+}
+
+// Keys of one and two bytes index the filter directly, four byte keys are hashed down to FILTER_BITS_MAX bits
+static inline DWORD GetFilterBits(DWORD width)
+{
+    return width * 8 < FILTER_BITS_MAX ? width * 8 : FILTER_BITS_MAX;
+}
+
+static inline DWORD HashKey(DWORD key, DWORD width)
+{
+    if (width < 4) return key;
+    return (DWORD)(key * 0x9E3779B1u) >> (32 - FILTER_BITS_MAX);
+}
+
+// Bytes that fill code and data (padding, REX.W, mov opcodes) make anchors that hit on almost every function
+static DWORD GetByteCommonness(BYTE value)
+{
+    switch (value) {
+    case 0x00: case 0xCC: return 4;
+    case 0xFF: return 3;
+    case 0x48: case 0x90: return 2;
+    case 0x89: case 0x8B: case 0x24: case 0x4C: return 1;
+    default: return 0;
+    }
+}
+
+// Every anchor already on a filter bit is verified again at each offset that hits the bit, as costly as one more
+// padding byte in the anchor
+#define ANCHOR_COLLISION_SCORE 4
+
+/*
+ * Picks the widest anchor the pattern's compared bytes allow and, among those, the one that looks least common and
+ * shares its filter bit with the fewest anchors picked so far. Without the second part, patterns that start with the
+ * same prologue all pick the same anchor in it, and every occurrence of the prologue verifies all of them.
+ */
+static BOOL SelectAnchor(const BYTE* pattern, const BYTE* mask, DWORD length, DWORD* const* anchorsPerHash, DWORD* tableIndex, DWORD* anchorOffset)
+{
+    for (DWORD t = 0; t < MULTISCAN_ANCHOR_WIDTHS; t++) {
+        DWORD width = g_AnchorWidths[t];
+        DWORD bestScore = (DWORD)-1, bestHash = 0;
+        DWORD run = 0;
+        for (DWORD i = 0; i < length; i++) {
+            run = mask[i] == 0xFF ? run + 1 : 0;
+            if (run < width) continue;
+
+            DWORD start = i + 1 - width;
+            DWORD hash = HashKey(LoadKey(pattern + start, width), width);
+            DWORD score = anchorsPerHash[t][hash] * ANCHOR_COLLISION_SCORE;
+            for (DWORD j = start; j <= i; j++) score += GetByteCommonness(pattern[j]);
+            if (score < bestScore) {
+                bestScore = score;
+                bestHash = hash;
+                *anchorOffset = start;
+            }
+        }
+        if (bestScore != (DWORD)-1) {
+            anchorsPerHash[t][bestHash]++;
+            *tableIndex = t;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+Error AddMultiScanPattern(struct MultiScanner* pScanner, const BYTE* pattern, const BYTE* mask, DWORD length, DWORD* patternIndex)
+{
+    if (pScanner->compiled)
+        return NewError(__FUNCTION__, -1, L"Patterns cannot be added to a compiled scanner", 0);
+    if (length == 0)
+        return NewError(__FUNCTION__, -2, L"Empty pattern", 0);
+    if (mask) {
+        DWORD compared = 0;
+        for (DWORD i = 0; i < length; i++) {
+            if (mask[i] != 0x00 && mask[i] != 0xFF)
+                return NewError(__FUNCTION__, -3, L"Mask bytes must be 0x00 or 0xFF", 0);
+            compared += mask[i] == 0xFF;
+        }
+        if (compared == 0)
+            return NewError(__FUNCTION__, -3, L"Pattern has no compared bytes", 0);
+    }
+
+    size_t capacity = pScanner->patternsCapacity;
+    if (!ReserveArray((void**)&pScanner->patterns, &capacity, (size_t)pScanner->numPatterns + 1, sizeof(struct MultiScanPattern), 1024) ||
+        !ReserveArray((void**)&pScanner->bytes, &pScanner->bytesCapacity, pScanner->bytesSize + 2 * (size_t)length, 1, 65536))
+        return NewError(__FUNCTION__, -4, L"realloc failed; out of memory", 0);
+    pScanner->patternsCapacity = (DWORD)capacity;
+
+    struct MultiScanPattern* entry = &pScanner->patterns[pScanner->numPatterns];
+    entry->bytesOffset = pScanner->bytesSize;
+    entry->length = length;
+    memcpy(pScanner->bytes + pScanner->bytesSize, pattern, length);
+    if (mask) memcpy(pScanner->bytes + pScanner->bytesSize + length, mask, length);
+    else memset(pScanner->bytes + pScanner->bytesSize + length, 0xFF, length);
+    pScanner->bytesSize += 2 * (size_t)length;
+    if (length > pScanner->maxPatternLength) pScanner->maxPatternLength = length;
+
+    *patternIndex = pScanner->numPatterns++;
+    return NewNoError();
+}
+
+static Error BuildTable(struct MultiScanner* pScanner, struct MultiScanTable* pTable, const DWORD* tableOf, const DWORD* anchorOffsets)
+{
+    DWORD width = pTable->width;
+    DWORD filterBits = GetFilterBits(width);
+    DWORD numAnchors = 0;
+    for (DWORD i = 0; i < pScanner->numPatterns; i++)
+        if (tableOf[i] == (DWORD)(pTable - pScanner->tables)) numAnchors++;
+    if (numAnchors == 0)
+        return NewNoError();
+
+    // about two buckets per anchor, so chains stay short
+    pTable->bucketBits = 1;
+    while (pTable->bucketBits < filterBits && ((DWORD)1 << pTable->bucketBits) < 2 * numAnchors) pTable->bucketBits++;
+    DWORD numBuckets = (DWORD)1 << pTable->bucketBits;
+    DWORD bucketShift = filterBits - pTable->bucketBits;
+
+    pTable->filter = (BYTE*)calloc(((size_t)1 << filterBits) / 8 + 1, 1);
+    pTable->bucketStarts = (DWORD*)calloc((size_t)numBuckets + 1, sizeof(DWORD));
+    pTable->anchors = (struct MultiScanAnchor*)malloc(numAnchors * sizeof(struct MultiScanAnchor));
+    if (!pTable->filter || !pTable->bucketStarts || !pTable->anchors)
+        return NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0);
+
+    // counting sort of the anchors by bucket
+    for (DWORD i = 0; i < pScanner->numPatterns; i++) {
+        if (tableOf[i] != (DWORD)(pTable - pScanner->tables)) continue;
+        DWORD key = LoadKey(pScanner->bytes + pScanner->patterns[i].bytesOffset + anchorOffsets[i], width);
+        DWORD hash = HashKey(key, width);
+        pTable->filter[hash >> 3] |= (BYTE)(1 << (hash & 7));
+        pTable->bucketStarts[(hash >> bucketShift) + 1]++;
+    }
+    for (DWORD b = 0; b < numBuckets; b++) pTable->bucketStarts[b + 1] += pTable->bucketStarts[b];
+
+    DWORD* fill = (DWORD*)malloc(numBuckets * sizeof(DWORD));
+    if (!fill)
+        return NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0);
+    memcpy(fill, pTable->bucketStarts, numBuckets * sizeof(DWORD));
+    for (DWORD i = 0; i < pScanner->numPatterns; i++) {
+        if (tableOf[i] != (DWORD)(pTable - pScanner->tables)) continue;
+        DWORD key = LoadKey(pScanner->bytes + pScanner->patterns[i].bytesOffset + anchorOffsets[i], width);
+        struct MultiScanAnchor* anchor = &pTable->anchors[fill[HashKey(key, width) >> bucketShift]++];
+        anchor->key = key;
+        anchor->offset = anchorOffsets[i];
+        anchor->pattern = i;
+        if (anchorOffsets[i] > pTable->maxAnchorOffset) pTable->maxAnchorOffset = anchorOffsets[i];
+    }
+    free(fill);
+
+    pTable->numAnchors = numAnchors;
+    return NewNoError();
+}
+
+Error CompileMultiScanner(struct MultiScanner* pScanner)
+{
+    if (pScanner->compiled)
+        return NewError(__FUNCTION__, -1, L"Scanner is already compiled", 0);
+
+    size_t count = pScanner->numPatterns ? pScanner->numPatterns : 1;
+    DWORD* tableOf = (DWORD*)malloc(count * sizeof(DWORD));
+    DWORD* anchorOffsets = (DWORD*)malloc(count * sizeof(DWORD));
+    // anchors picked so far on each filter bit of each table
+    DWORD* anchorsPerHash[MULTISCAN_ANCHOR_WIDTHS];
+    BOOL allocated = tableOf && anchorOffsets;
+    for (DWORD t = 0; t < MULTISCAN_ANCHOR_WIDTHS; t++) {
+        anchorsPerHash[t] = (DWORD*)calloc((size_t)1 << GetFilterBits(g_AnchorWidths[t]), sizeof(DWORD));
+        allocated = allocated && anchorsPerHash[t];
+    }
+    if (!allocated) {
+        free(tableOf);
+        free(anchorOffsets);
+        for (DWORD t = 0; t < MULTISCAN_ANCHOR_WIDTHS; t++) free(anchorsPerHash[t]);
+        return NewError(__FUNCTION__, -2, L"malloc failed; out of memory", 0);
+    }
+
+    for (DWORD i = 0; i < pScanner->numPatterns; i++) {
+        const struct MultiScanPattern* pattern = &pScanner->patterns[i];
+        const BYTE* bytes = pScanner->bytes + pattern->bytesOffset;
+        // AddMultiScanPattern rejected patterns without compared bytes, so there is always an anchor
+        SelectAnchor(bytes, bytes + pattern->length, pattern->length, anchorsPerHash, &tableOf[i], &anchorOffsets[i]);
+    }
+    for (DWORD t = 0; t < MULTISCAN_ANCHOR_WIDTHS; t++) free(anchorsPerHash[t]);
+
+    Error e = NewNoError();
+    for (DWORD t = 0; t < MULTISCAN_ANCHOR_WIDTHS; t++) {
+        pScanner->tables[t].width = g_AnchorWidths[t];
+        e = BuildTable(pScanner, &pScanner->tables[t], tableOf, anchorOffsets);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -3);
+            break;
+        }
+    }
+
+    free(tableOf);
+    free(anchorOffsets);
+    if (!e.ContainsError) pScanner->compiled = TRUE;
+    return e;
+}
+
+static inline BOOL MatchesPattern(const BYTE* data, const BYTE* pattern, const BYTE* mask, DWORD length)
+{
+    DWORD i = 0;
+    for (; i + 8 <= length; i += 8) {
+        ULONGLONG d, p, m;
+        memcpy(&d, data + i, 8);
+        memcpy(&p, pattern + i, 8);
+        memcpy(&m, mask + i, 8);
+        if ((d ^ p) & m) return FALSE;
+    }
+    for (; i < length; i++)
+        if ((data[i] ^ pattern[i]) & mask[i]) return FALSE;
+    return TRUE;
+}
+
+// Matches found by one chunk of a scan
+typedef struct MatchList {
+    struct MultiScanMatch* items;
+    size_t count;
+    size_t capacity;
+} MatchList;
+
+// Finds the matches that start in [chunkStart, chunkEnd). Anchors are read past chunkEnd as far as the pattern
+// they belong to could still start inside the chunk.
+static inline BOOL ScanTable(const struct MultiScanner* pScanner, const struct MultiScanTable* pTable, const DWORD width, const BYTE* data, size_t dataLength,
+    size_t chunkStart, size_t chunkEnd, struct MatchList* pList)
+{
+    if (pTable->numAnchors == 0 || dataLength < width) return TRUE;
+
+    size_t end = chunkEnd + pTable->maxAnchorOffset;
+    if (end > dataLength - width + 1) end = dataLength - width + 1;
+    const DWORD bucketShift = GetFilterBits(width) - pTable->bucketBits;
+    const BYTE* filter = pTable->filter;
+
+    for (size_t i = chunkStart; i < end; i++) {
+        DWORD key = LoadKey(data + i, width);
+        DWORD hash = HashKey(key, width);
+        if (!(filter[hash >> 3] & (1 << (hash & 7)))) continue;
+
+        DWORD bucket = hash >> bucketShift;
+        for (DWORD a = pTable->bucketStarts[bucket]; a < pTable->bucketStarts[bucket + 1]; a++) {
+            const struct MultiScanAnchor* anchor = &pTable->anchors[a];
+            if (anchor->key != key || i < anchor->offset) continue;
+            size_t start = i - anchor->offset;
+            if (start < chunkStart || start >= chunkEnd) continue;
+
+            const struct MultiScanPattern* pattern = &pScanner->patterns[anchor->pattern];
+            if (pattern->length > dataLength - start) continue;
+            const BYTE* bytes = pScanner->bytes + pattern->bytesOffset;
+            if (!MatchesPattern(data + start, bytes, bytes + pattern->length, pattern->length)) continue;
+
+            if (!ReserveArray((void**)&pList->items, &pList->capacity, pList->count + 1, sizeof(struct MultiScanMatch), 256)) return FALSE;
+            pList->items[pList->count].offset = start;
+            pList->items[pList->count].pattern = anchor->pattern;
+            pList->count++;
+        }
+    }
+    return TRUE;
+}
+
+// Specializing on the anchor width lets the compiler drop the width checks from the per-byte loop
+static BOOL ScanChunk(const struct MultiScanner* pScanner, const BYTE* data, size_t dataLength, size_t chunkStart, size_t chunkEnd, struct MatchList* pList)
+{
+    for (DWORD t = 0; t < MULTISCAN_ANCHOR_WIDTHS; t++) {
+        const struct MultiScanTable* pTable = &pScanner->tables[t];
+        BOOL ok;
+        switch (pTable->width) {
+        case 4: ok = ScanTable(pScanner, pTable, 4, data, dataLength, chunkStart, chunkEnd, pList); break;
+        case 2: ok = ScanTable(pScanner, pTable, 2, data, dataLength, chunkStart, chunkEnd, pList); break;
+        default: ok = ScanTable(pScanner, pTable, 1, data, dataLength, chunkStart, chunkEnd, pList); break;
+        }
+        if (!ok) return FALSE;
+    }
+    return TRUE;
+}
+
+typedef struct MultiScanJob {
+    const struct MultiScanner* pScanner;
+    const BYTE* data;
+    size_t dataLength;
+    size_t chunkSize;
+    struct MatchList* lists;    // one per chunk
+    volatile LONG failed;
+} MultiScanJob;
+
+static void ScanChunkWork(void* context, DWORD itemIndex, DWORD workerIndex)
+{
+    struct MultiScanJob* job = (struct MultiScanJob*)context;
+    (void)workerIndex;
+    if (job->failed) return;
+
+    size_t chunkStart = (size_t)itemIndex * job->chunkSize;
+    size_t chunkEnd = chunkStart + job->chunkSize;
+    if (chunkEnd > job->dataLength) chunkEnd = job->dataLength;
+    if (!ScanChunk(job->pScanner, job->data, job->dataLength, chunkStart, chunkEnd, &job->lists[itemIndex]))
+        InterlockedExchange(&job->failed, 1);
+}
+
+static int CompareMatches(const void* a, const void* b)
+{
+    const struct MultiScanMatch* left = (const struct MultiScanMatch*)a;
+    const struct MultiScanMatch* right = (const struct MultiScanMatch*)b;
+    if (left->offset != right->offset) return left->offset < right->offset ? -1 : 1;
+    return left->pattern < right->pattern ? -1 : (left->pattern > right->pattern ? 1 : 0);
+}
+
+Error FindMultiScanMatches(const struct MultiScanner* pScanner, struct ThreadPool* pPool, const BYTE* data, size_t dataLength, struct MultiScanMatch** matches, size_t* numMatches)
+{
+    *matches = NULL;
+    *numMatches = 0;
+    if (!pScanner->compiled)
+        return NewError(__FUNCTION__, -1, L"Scanner is not compiled", 0);
+
+    // enough chunks per thread to even out the load, each big enough to amortize the hand off
+    DWORD numThreads = pPool ? pPool->numThreads : 1;
+    size_t chunkSize = dataLength;
+    if (numThreads > 1) {
+        chunkSize = dataLength / ((size_t)numThreads * 8);
+        if (chunkSize < MIN_CHUNK_SIZE) chunkSize = MIN_CHUNK_SIZE;
+        if (chunkSize > MAX_CHUNK_SIZE) chunkSize = MAX_CHUNK_SIZE;
+    }
+    if (chunkSize == 0) chunkSize = 1;
+    DWORD numChunks = (DWORD)((dataLength + chunkSize - 1) / chunkSize);
+    if (numChunks == 0) return NewNoError();
+
+    struct MultiScanJob job = { 0 };
+    job.pScanner = pScanner;
+    job.data = data;
+    job.dataLength = dataLength;
+    job.chunkSize = chunkSize;
+    job.lists = (struct MatchList*)calloc(numChunks, sizeof(struct MatchList));
+    if (!job.lists)
+        return NewError(__FUNCTION__, -2, L"calloc failed; out of memory", 0);
+
+    if (pPool) RunThreadPool(pPool, ScanChunkWork, &job, numChunks);
+    else ScanChunkWork(&job, 0, 0);
+
+    Error e = NewNoError();
+    size_t total = 0;
+    for (DWORD c = 0; c < numChunks; c++) total += job.lists[c].count;
+    if (job.failed) {
+        e = NewError(__FUNCTION__, -3, L"realloc failed; out of memory", 0);
+    }
+    else if (total > 0) {
+        *matches = (struct MultiScanMatch*)malloc(total * sizeof(struct MultiScanMatch));
+        if (!*matches) {
+            e = NewError(__FUNCTION__, -2, L"malloc failed; out of memory", 0);
+        }
+        else {
+            size_t n = 0;
+            for (DWORD c = 0; c < numChunks; c++) {
+                if (job.lists[c].count == 0) continue;
+                memcpy(*matches + n, job.lists[c].items, job.lists[c].count * sizeof(struct MultiScanMatch));
+                n += job.lists[c].count;
+            }
+            qsort(*matches, total, sizeof(struct MultiScanMatch), CompareMatches);
+            *numMatches = total;
+        }
+    }
+
+    for (DWORD c = 0; c < numChunks; c++) free(job.lists[c].items);
+    free(job.lists);
+    return e;
+}
+
+void FreeMultiScanner(struct MultiScanner* pScanner)
+{
+    for (DWORD t = 0; t < MULTISCAN_ANCHOR_WIDTHS; t++) {
+        free(pScanner->tables[t].filter);
+        free(pScanner->tables[t].bucketStarts);
+        free(pScanner->tables[t].anchors);
+    }
+    free(pScanner->patterns);
+    free(pScanner->bytes);
+    memset(pScanner, 0, sizeof(struct MultiScanner));
+}
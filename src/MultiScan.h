@@ -0,0 +1,57 @@
+#pragma once
+#include "Platform.h"
+#include "Error.h"
+#include "ThreadPool.h"
+
+// Where one pattern of a MultiScanner occurs in the scanned buffer
+typedef struct MultiScanMatch {
+    size_t offset;
+    DWORD pattern;          // index returned by AddMultiScanPattern
+} MultiScanMatch;
+
+// Patterns anchored on runs of 4, 2 and 1 fully compared bytes are kept in separate tables
+#define MULTISCAN_ANCHOR_WIDTHS 3
+
+typedef struct MultiScanTable {
+    DWORD width;            // anchor bytes
+    DWORD bucketBits;
+    BYTE* filter;           // one bit per anchor hash, tested before the buckets are touched
+    DWORD* bucketStarts;    // (1 << bucketBits) + 1 indices into anchors
+    struct MultiScanAnchor* anchors;
+    DWORD numAnchors;
+    DWORD maxAnchorOffset;
+} MultiScanTable;
+
+/*
+ * A set of patterns, each with an optional wildcard mask, compiled so that one pass over a buffer finds the matches
+ * of all of them. Every pattern is anchored on its rarest-looking run of compared bytes; the scan hashes the buffer
+ * at each offset, rejects almost every offset with a bitmap lookup, and only verifies the few patterns whose anchor
+ * hashes to the same bucket. Anchors are spread over the bitmap so patterns with a common prefix do not pile up on
+ * one bit. The cost per byte still grows with the number of patterns, as more offsets pass the bitmap.
+ *
+ * Zero initialize, add patterns, compile, then scan any number of buffers. Free after use with FreeMultiScanner.
+ */
+typedef struct MultiScanner {
+    struct MultiScanPattern* patterns;
+    DWORD numPatterns;
+    DWORD patternsCapacity;
+    BYTE* bytes;            // pattern bytes followed by mask bytes of every pattern
+    size_t bytesSize;
+    size_t bytesCapacity;
+    DWORD maxPatternLength;
+    struct MultiScanTable tables[MULTISCAN_ANCHOR_WIDTHS];
+    BOOL compiled;
+} MultiScanner;
+
+// Adds a pattern. A NULL mask compares every byte, otherwise a 0x00 mask byte is a wildcard. Patterns must have at
+// least one compared byte, and cannot be added once the scanner is compiled.
+Error AddMultiScanPattern(struct MultiScanner* pScanner, const BYTE* pattern, const BYTE* mask, DWORD length, DWORD* patternIndex);
+
+// Builds the anchor tables. Must be called once after the last pattern is added.
+Error CompileMultiScanner(struct MultiScanner* pScanner);
+
+// Finds every match of every pattern in the buffer, sorted by offset, then pattern. The buffer is split over the
+// pool when one is given. Free `*matches` after use with free.
+Error FindMultiScanMatches(const struct MultiScanner* pScanner, struct ThreadPool* pPool, const BYTE* data, size_t dataLength, struct MultiScanMatch** matches, size_t* numMatches);
+
+void FreeMultiScanner(struct MultiScanner* pScanner);
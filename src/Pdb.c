@@ -1,315 +1,525 @@
 #include "Pdb.h"
 
-Error GetPEInfo(LPCWSTR filePath, struct PDBLookupContext* pPdbLookupCtx)
+Error GetPEInfo(const struct ImageView* pImage, struct PDBLookupContext* pPdbLookupCtx)
 {
-    HANDLE hFile = CreateFileW(filePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-    if (hFile == INVALID_HANDLE_VALUE)
-        return NewError(__FUNCTION__, -1, L"CreateFileW failed", GetLastError());
+    const IMAGE_DATA_DIRECTORY* debugDataDirectory = GetDataDirectory(pImage, IMAGE_DIRECTORY_ENTRY_DEBUG);
+    if (!debugDataDirectory)
+        return NewError(__FUNCTION__, -1, L"Debug directory not found", 0);
+    DWORD nDebugDirectories = debugDataDirectory->Size / sizeof(IMAGE_DEBUG_DIRECTORY);
+    const IMAGE_DEBUG_DIRECTORY* debugDirectories = (const IMAGE_DEBUG_DIRECTORY*)GetSpanByRva(pImage, debugDataDirectory->VirtualAddress, nDebugDirectories * sizeof(IMAGE_DEBUG_DIRECTORY));
+    if (!debugDirectories || nDebugDirectories == 0)
+        return NewError(__FUNCTION__, -1, L"Debug directory not found", 0);
+
+    for (DWORD i = 0; i < nDebugDirectories; i++)
+    {
+        if (debugDirectories[i].Type != IMAGE_DEBUG_TYPE_CODEVIEW)
+            continue;
+
+        // 'RSDS' signature, GUID, age and then the null terminated PDB name
+        DWORD headerSize = sizeof(DWORD) + sizeof(GUID) + sizeof(DWORD);
+        // the record is found by its file offset in an image file, and by its RVA in a loaded image
+        const BYTE* codeView = pImage->layout == IMAGE_LAYOUT_LOADED
+            ? GetSpanByRva(pImage, debugDirectories[i].AddressOfRawData, debugDirectories[i].SizeOfData)
+            : GetSpanByOffset(pImage, debugDirectories[i].PointerToRawData, debugDirectories[i].SizeOfData);
+        if (!codeView || debugDirectories[i].SizeOfData <= headerSize)
+            return NewError(__FUNCTION__, -2, L"CodeView record is out of file bounds", 0);
+        if (*(const DWORD*)codeView != 0x53445352)
+            return NewError(__FUNCTION__, -3, L"CodeView record is not in RSDS format", 0);
+
+        memcpy(&pPdbLookupCtx->pdbInfo.guid, codeView + sizeof(DWORD), sizeof(GUID));
+        memcpy(&pPdbLookupCtx->pdbInfo.age, codeView + sizeof(DWORD) + sizeof(GUID), sizeof(DWORD));
+
+        const CHAR* name = (const CHAR*)(codeView + headerSize);
+        size_t nameLength = strnlen(name, debugDirectories[i].SizeOfData - headerSize);
+        CHAR* nameBuffer = (CHAR*)malloc(nameLength + 1);
+        if (!nameBuffer)
+            return NewError(__FUNCTION__, -4, L"malloc failed; out of memory", 0);
+        memcpy(nameBuffer, name, nameLength);
+        nameBuffer[nameLength] = '\0';
+        pPdbLookupCtx->pdbInfo.pdbName = nameBuffer;
+        return NewNoError();
+    }
+
+    return NewError(__FUNCTION__, -5, L"CodeView debug directory not found", 0);
+}
 
+Error DownloadPDB(struct PDBLookupContext* pPdbLookupCtx, LPCWSTR serverUrl, DWORD maxConnections, LPCWSTR outputPath, struct DownloadStats* pStats) {
+    WCHAR guidString[64];
+    FormatSymbolStoreKey(&pPdbLookupCtx->pdbInfo.guid, pPdbLookupCtx->pdbInfo.age, guidString, _countof(guidString));
+
+    // format: <serverUrl>/<pdbName>/<guidStr>/<pdbName>
+    const char* pdbFileName = GetPdbFileName(pPdbLookupCtx->pdbInfo.pdbName);
+    size_t serverUrlLength = wcslen(serverUrl);
+    LPCWSTR separator = serverUrlLength > 0 && serverUrl[serverUrlLength - 1] == L'/' ? L"" : L"/";
+    size_t urlLength = serverUrlLength + 2 * strlen(pdbFileName) + wcslen(guidString) + 4;
+    WCHAR* url = (WCHAR*)malloc(urlLength * sizeof(WCHAR));
+    size_t cabinetPathLength = wcslen(outputPath) + 5;
+    WCHAR* cabinetPath = (WCHAR*)malloc(cabinetPathLength * sizeof(WCHAR));
     Error e = NewNoError();
     do {
-        DWORD bytesRead;
-        IMAGE_DOS_HEADER dosHeader;
-        IMAGE_NT_HEADERS64 ntHeader;
-        IMAGE_SECTION_HEADER sectionHeader;
-
-        if (!ReadFile(hFile, &dosHeader, sizeof(dosHeader), &bytesRead, NULL) || bytesRead != sizeof(dosHeader) || dosHeader.e_magic != IMAGE_DOS_SIGNATURE) {
-            e = NewError(__FUNCTION__, -2, L"ReadFile failed", GetLastError());
+        if (!url || !cabinetPath) {
+            e = NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0);
             break;
         }
+        swprintf_s(url, urlLength, L"%s%s%S/%s/%S", serverUrl, separator, pdbFileName, guidString, pdbFileName);
 
-        if (SetFilePointer(hFile, dosHeader.e_lfanew, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
-            e = NewError(__FUNCTION__, -3, L"SetFilePointer failed", GetLastError());
+        e = DownloadFile(url, outputPath, maxConnections, pStats);
+        if (!e.ContainsError || pStats->statusCode != 404) {
+            if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -2);
             break;
         }
 
-        if (!ReadFile(hFile, &ntHeader, sizeof(ntHeader), &bytesRead, NULL) || bytesRead != sizeof(ntHeader) || ntHeader.Signature != IMAGE_NT_SIGNATURE) {
-            e = NewError(__FUNCTION__, -4, L"ReadFile failed", GetLastError());
+        // some stores only have the compressed copy, named with the last character of the extension replaced by '_'
+        Error_Free(&e);
+        DeleteFileW(outputPath);
+        url[wcslen(url) - 1] = L'_';
+        swprintf_s(cabinetPath, cabinetPathLength, L"%s.cab", outputPath);
+        e = DownloadFile(url, cabinetPath, maxConnections, pStats);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -3);
             break;
         }
 
-        DWORD debugSectionRVA = ntHeader.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG].VirtualAddress;
-        DWORD nSections = ntHeader.FileHeader.NumberOfSections;
-
-        for (DWORD i = 0; i < nSections; i++)
-        {
-            if (!ReadFile(hFile, &sectionHeader, sizeof(sectionHeader), &bytesRead, NULL) || bytesRead != sizeof(sectionHeader)) {
-                e = NewError(__FUNCTION__, -5, L"ReadFile failed", GetLastError());
-                break;
-            }
-
-            DWORD vaStart = sectionHeader.VirtualAddress;
-            DWORD vaEnd = vaStart + sectionHeader.Misc.VirtualSize;
-            if (debugSectionRVA >= vaStart && debugSectionRVA < vaEnd)
-            {
-                DWORD offset = (debugSectionRVA - vaStart) + sectionHeader.PointerToRawData;
-                if (SetFilePointer(hFile, offset, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
-                    e = NewError(__FUNCTION__, -6, L"SetFilePointer failed", GetLastError());
-                    break;
-                }
-                IMAGE_DEBUG_DIRECTORY debugDirectory;
-                if (!ReadFile(hFile, &debugDirectory, sizeof(debugDirectory), &bytesRead, NULL) || bytesRead != sizeof(debugDirectory)) {
-                    e = NewError(__FUNCTION__, -7, L"ReadFile failed", GetLastError());
-                    break;
-                }
-
-                if (debugDirectory.Type == IMAGE_DEBUG_TYPE_CODEVIEW)
-                {
-                    if (SetFilePointer(hFile, debugDirectory.PointerToRawData, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
-                        e = NewError(__FUNCTION__, -8, L"SetFilePointer failed", GetLastError());
-                        break;
-                    }
-                    DWORD signature;
-                    // 'RSDS' little‑endian
-                    if (!ReadFile(hFile, &signature, sizeof(signature), &bytesRead, NULL) || bytesRead != sizeof(signature) || signature != 'SDSR') {
-                        e = NewError(__FUNCTION__, -9, L"ReadFile failed", GetLastError());
-                        break;
-                    }
-                    if (!ReadFile(hFile, &pPdbLookupCtx->pdbInfo.guid, sizeof(GUID), &bytesRead, NULL) || bytesRead != sizeof(GUID)) {
-                        e = NewError(__FUNCTION__, -10, L"ReadFile failed", GetLastError());
-                        break;
-                    }
-                    if (!ReadFile(hFile, &pPdbLookupCtx->pdbInfo.age, sizeof(DWORD), &bytesRead, NULL) || bytesRead != sizeof(DWORD)) {
-                        e = NewError(__FUNCTION__, -11, L"ReadFile failed", GetLastError());
-                        break;
-                    }
-
-                    CHAR* nameBuffer = (CHAR*)malloc(MAX_PATH * 3);
-                    if (!nameBuffer) {
-                        e = NewError(__FUNCTION__, -12, L"malloc failed; out of memory", 0);
-                        break;
-                    }
-                    DWORD idx = 0;
-                    CHAR character;
-                    while (idx + 1 < (MAX_PATH * 3) && ReadFile(hFile, &character, 1, &bytesRead, NULL) && bytesRead == 1 && character != '\0')
-                        nameBuffer[idx++] = character;
-                    nameBuffer[idx] = '\0';
-                    pPdbLookupCtx->pdbInfo.pdbName = nameBuffer;
-                }
-                break;
-            }
+        e = ExpandCabinet(cabinetPath, outputPath);
+        DeleteFileW(cabinetPath);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -4);
+            break;
         }
     } while (FALSE);
 
-    if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+    free(url);
+    free(cabinetPath);
     return e;
 }
 
-Error DownloadPDB(struct PDBLookupContext* pPdbLookupCtx, LPCWSTR outputPath) {
-    LPCWSTR UserAgent = L"Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/136.0.0.0 Safari/537.36";
-    // guid format: {Data1}{Data2}{Data3}{Data4}{age}
-    WCHAR guidString[64];
-    swprintf_s(
-        guidString, _countof(guidString),
-        L"%08X%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X%X",
-        pPdbLookupCtx->pdbInfo.guid.Data1, pPdbLookupCtx->pdbInfo.guid.Data2, pPdbLookupCtx->pdbInfo.guid.Data3,
-        pPdbLookupCtx->pdbInfo.guid.Data4[0], pPdbLookupCtx->pdbInfo.guid.Data4[1],
-        pPdbLookupCtx->pdbInfo.guid.Data4[2], pPdbLookupCtx->pdbInfo.guid.Data4[3],
-        pPdbLookupCtx->pdbInfo.guid.Data4[4], pPdbLookupCtx->pdbInfo.guid.Data4[5],
-        pPdbLookupCtx->pdbInfo.guid.Data4[6], pPdbLookupCtx->pdbInfo.guid.Data4[7],
-        pPdbLookupCtx->pdbInfo.age);
-
-    // format: /download/symbols/<pdbName>/<guidStr>/<pdbName>
-    WCHAR url[MAX_PATH * 2 + 64];
-    swprintf_s(url, _countof(url), L"/download/symbols/%S/%s/%S", pPdbLookupCtx->pdbInfo.pdbName, guidString, pPdbLookupCtx->pdbInfo.pdbName);
-    Error e = NewNoError();
+Error FetchPDB(struct PDBLookupContext* pPdbLookupCtx, LPCWSTR serverUrl, DWORD maxConnections, LPCWSTR pdbPath, struct DownloadStats* pStats) {
+    ZeroMemory(pStats, sizeof(struct DownloadStats));
+    const GUID* guid = &pPdbLookupCtx->pdbInfo.guid;
+    DWORD age = pPdbLookupCtx->pdbInfo.age;
+    if (IsValidSymbolStoreEntry(pdbPath, guid, age))
+        return NewNoError();
+
+    struct SymbolStoreLock lock;
+    Error e = LockSymbolStoreEntry(pdbPath, &lock);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
 
-    HINTERNET hWinHttp = NULL, hConnect = NULL, hRequest = NULL;
-    HANDLE hOut = INVALID_HANDLE_VALUE;
+    size_t tempPathLength = wcslen(pdbPath) + 5;
+    WCHAR* tempPath = (WCHAR*)malloc(tempPathLength * sizeof(WCHAR));
     do {
-        hWinHttp = WinHttpOpen(UserAgent, WINHTTP_ACCESS_TYPE_DEFAULT_PROXY, WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
-        if (!hWinHttp) {
-            e = NewError(__FUNCTION__, -1, L"WinHttpOpen failed", GetLastError());
-            break;
-        }
-
-        hConnect = WinHttpConnect(hWinHttp, L"msdl.microsoft.com", INTERNET_DEFAULT_HTTPS_PORT, 0);
-        if (!hConnect) {
-            e = NewError(__FUNCTION__, -2, L"WinHttpConnect failed", GetLastError());
-            break;
-        }
-
-        hRequest = WinHttpOpenRequest(hConnect, L"GET", url, NULL, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, WINHTTP_FLAG_SECURE);
-        if (!hRequest) {
-            e = NewError(__FUNCTION__, -3, L"WinHttpOpenRequest failed", GetLastError());
+        if (!tempPath) {
+            e = NewError(__FUNCTION__, -2, L"malloc failed; out of memory", 0);
             break;
         }
+        swprintf_s(tempPath, tempPathLength, L"%s.tmp", pdbPath);
 
-        if (!WinHttpSendRequest(hRequest, WINHTTP_NO_ADDITIONAL_HEADERS, 0, WINHTTP_NO_REQUEST_DATA, 0, 0, 0)) {
-            e = NewError(__FUNCTION__, -4, L"WinHttpSendRequest failed", GetLastError());
+        // another process may have stored the entry while we were waiting for the lock
+        if (IsValidSymbolStoreEntry(pdbPath, guid, age))
             break;
-        }
 
-        if (!WinHttpReceiveResponse(hRequest, NULL)) {
-            e = NewError(__FUNCTION__, -5, L"WinHttpReceiveResponse failed", GetLastError());
+        // a partial download is kept, the next run resumes it
+        e = DownloadPDB(pPdbLookupCtx, serverUrl, maxConnections, tempPath, pStats);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -3);
             break;
         }
-
-        hOut = CreateFileW(outputPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-        if (hOut == INVALID_HANDLE_VALUE) {
-            e = NewError(__FUNCTION__, -6, L"CreateFileW failed", GetLastError());
+        if (!IsValidSymbolStoreEntry(tempPath, guid, age)) {
+            e = NewError(__FUNCTION__, -4, L"Downloaded file is not the PDB matching the PE", 0);
+            DeleteFileW(tempPath);
             break;
         }
-
-        BYTE* buffer = (BYTE*)malloc((1 << 6) * sizeof(BYTE)); // 64 KB
-        if (!buffer) {
-            e = NewError(__FUNCTION__, -7, L"malloc failed; Out of memory", 0);
+        if (!ReplaceFileAtomic(tempPath, pdbPath)) {
+            e = NewError(__FUNCTION__, -5, L"Failed to move the PDB into the symbol store", GetLastError());
+            DeleteFileW(tempPath);
             break;
         }
-
-        DWORD downloadedSize = 0, writtenSize = 0;
-        while (WinHttpReadData(hRequest, buffer, sizeof(buffer), &downloadedSize) && downloadedSize > 0)
-        {
-            if (!WriteFile(hOut, buffer, downloadedSize, &writtenSize, NULL) || writtenSize != downloadedSize)
-            {
-                e = NewError(__FUNCTION__, -7, L"WriteFile failed", GetLastError());
-                free(buffer);
-                break;
-            }
-        }
-        free(buffer);
     } while (FALSE);
 
-    if (hOut) CloseHandle(hOut);
-    if (hRequest) WinHttpCloseHandle(hRequest);
-    if (hConnect) WinHttpCloseHandle(hConnect);
-    if (hWinHttp) WinHttpCloseHandle(hWinHttp);
+    free(tempPath);
+    UnlockSymbolStoreEntry(&lock);
     return e;
 }
 
+static WCHAR* GetSymbolIndexPath(LPCWSTR pdbPath) {
+    size_t pathLength = wcslen(pdbPath) + 6;
+    WCHAR* indexPath = (WCHAR*)malloc(pathLength * sizeof(WCHAR));
+    if (indexPath) swprintf_s(indexPath, pathLength, L"%s.sidx", pdbPath);
+    return indexPath;
+}
+
 Error InitializePDBLookup(LPCWSTR pdbPath, struct PDBLookupContext* pPdbLookupCtx) {
-    HANDLE hPdbFile = CreateFileW(pdbPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-    if (hPdbFile == INVALID_HANDLE_VALUE)
-        return NewError(__FUNCTION__, -1, L"CreateFileW failed", GetLastError());
+    struct PdbFile pdbFile;
+    Error e = OpenPdbFile(pdbPath, &pdbFile);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
 
-    DWORD pdbSize = GetFileSize(hPdbFile, NULL);
-    if (pdbSize <= 0) {
-        return NewError(__FUNCTION__, -2, L"GetFileSize failed", GetLastError());
+    e = BuildSymbolIndex(&pdbFile, &pPdbLookupCtx->pdbInfo.guid, pPdbLookupCtx->pdbInfo.age, &pPdbLookupCtx->symbolIndex);
+    ClosePdbFile(&pdbFile);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -2);
+        return e;
     }
-    HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, GetCurrentProcessId());
-    if (!hProcess) {
-        CloseHandle(hPdbFile);
-        return NewError(__FUNCTION__, -3, L"OpenProcess failed", GetLastError());
+
+    pPdbLookupCtx->pdbPath = _wcsdup(pdbPath);
+    WCHAR* indexPath = GetSymbolIndexPath(pdbPath);
+    if (!pPdbLookupCtx->pdbPath || !indexPath) {
+        free(indexPath);
+        FreeSymbolIndex(&pPdbLookupCtx->symbolIndex);
+        free(pPdbLookupCtx->pdbPath);
+        pPdbLookupCtx->pdbPath = NULL;
+        return NewError(__FUNCTION__, -3, L"malloc failed; out of memory", 0);
+    }
+
+    // a failure to persist the index is not fatal, the in-memory index is still usable
+    e = SaveSymbolIndex(&pPdbLookupCtx->symbolIndex, indexPath);
+    Error_Free(&e);
+    free(indexPath);
+    return NewNoError();
+}
+
+Error InitializePDBLookupFromIndex(LPCWSTR pdbPath, struct PDBLookupContext* pPdbLookupCtx) {
+    WCHAR* indexPath = GetSymbolIndexPath(pdbPath);
+    if (!indexPath)
+        return NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0);
+
+    Error e = LoadSymbolIndex(indexPath, &pPdbLookupCtx->pdbInfo.guid, pPdbLookupCtx->pdbInfo.age, &pPdbLookupCtx->symbolIndex);
+    free(indexPath);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -2);
+        return e;
+    }
+
+    pPdbLookupCtx->pdbPath = _wcsdup(pdbPath);
+    if (!pPdbLookupCtx->pdbPath) {
+        FreeSymbolIndex(&pPdbLookupCtx->symbolIndex);
+        return NewError(__FUNCTION__, -3, L"_wcsdup failed; out of memory", 0);
     }
+    return NewNoError();
+}
+
+Error InitializeImageLookup(const struct ImageView* pImage, BOOL withIndex, struct PDBLookupContext* pPdbLookupCtx) {
+    if (withIndex) {
+        Error e = BuildImageSymbolIndex(pImage, &pPdbLookupCtx->pdbInfo.guid, pPdbLookupCtx->pdbInfo.age, &pPdbLookupCtx->symbolIndex);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -1);
+            return e;
+        }
+    }
+    pPdbLookupCtx->pImage = pImage;
+    return NewNoError();
+}
 
-    if (!SymInitializeW(hProcess, pdbPath, FALSE)) {
+// Field offsets are not part of the symbol index, so DbgHelp is only loaded once one is asked for
+static BOOL InitializeTypeSession(struct PDBLookupContext* pPdbLookupCtx) {
+    if (pPdbLookupCtx->hProcess) return TRUE;
+
+    ULONGLONG start = StartStatsTimer();
+    HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, GetCurrentProcessId());
+    if (!hProcess) return FALSE;
+    if (!SymInitializeW(hProcess, pPdbLookupCtx->pdbPath, FALSE)) {
         CloseHandle(hProcess);
-        CloseHandle(hPdbFile);
-        return NewError(__FUNCTION__, -4, L"SymInitializeW failed", GetLastError());
+        return FALSE;
     }
 
-    SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS | SYMOPT_AUTO_PUBLICS | SYMOPT_DEBUG | SYMOPT_LOAD_ANYTHING);
-    DWORD64 symbolTable = SymLoadModuleExW(hProcess, NULL, pdbPath, NULL, PDB_BASE, pdbSize, NULL, 0);
-    if (!symbolTable) {
+    SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS | SYMOPT_DEBUG | SYMOPT_LOAD_ANYTHING);
+    HANDLE hPdbFile = CreateFileW(pPdbLookupCtx->pdbPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    DWORD pdbSize = hPdbFile != INVALID_HANDLE_VALUE ? GetFileSize(hPdbFile, NULL) : 0;
+    if (hPdbFile != INVALID_HANDLE_VALUE) CloseHandle(hPdbFile);
+    AddStatsCount(STATS_FILE_OPENS, 1);
+    AddStatsCount(STATS_SYSCALLS, 3);
+    BOOL loaded = pdbSize && SymLoadModuleExW(hProcess, NULL, pPdbLookupCtx->pdbPath, NULL, PDB_BASE, pdbSize, NULL, 0);
+    StopStatsTimer(STATS_TIMER_DBGHELP_LOAD, start);
+    if (!loaded) {
         SymCleanup(hProcess);
         CloseHandle(hProcess);
-        CloseHandle(hPdbFile);
-        return NewError(__FUNCTION__, -5, L"SymLoadModuleExW failed", GetLastError());
+        return FALSE;
     }
 
-    pPdbLookupCtx->hPdbFile = hPdbFile;
     pPdbLookupCtx->hProcess = hProcess;
-    return NewNoError();
+    return TRUE;
 }
 
 void CleanupPDBLookupCtx(struct PDBLookupContext* pPdbLookupCtx) {
-    SymUnloadModule64(pPdbLookupCtx->hProcess, PDB_BASE);
-    SymCleanup(pPdbLookupCtx->hProcess);
-    CloseHandle(pPdbLookupCtx->hProcess);
-    CloseHandle(pPdbLookupCtx->hPdbFile);
+    if (pPdbLookupCtx->hProcess) {
+        SymUnloadModule64(pPdbLookupCtx->hProcess, PDB_BASE);
+        SymCleanup(pPdbLookupCtx->hProcess);
+        CloseHandle(pPdbLookupCtx->hProcess);
+    }
+    FreeTypeLayoutCache(&pPdbLookupCtx->typeLayouts);
+    FreeSymbolIndex(&pPdbLookupCtx->symbolIndex);
+    free(pPdbLookupCtx->pdbPath);
     free(pPdbLookupCtx->pdbInfo.pdbName);
     ZeroMemory(pPdbLookupCtx, sizeof(struct PDBLookupContext));
 }
 
+static BOOL FindSymbol(LPCWSTR symbolName, struct PDBLookupContext* pPdbLookupCtx, struct PdbSymbol* pSymbol) {
+    char* name = WideToUtf8(symbolName);
+    if (!name) return FALSE;
+    BOOL found = pPdbLookupCtx->pImage ? FindImageSymbol(pPdbLookupCtx->pImage, name, pSymbol) : FindIndexedSymbol(&pPdbLookupCtx->symbolIndex, name, pSymbol);
+    free(name);
+    return found;
+}
+
 int GetFunctionRVA(LPCWSTR symbolName, struct PDBLookupContext* pPdbLookupCtx) {
-    SYMBOL_INFOW symbolInfo = { 0 };
-    symbolInfo.SizeOfStruct = sizeof(SYMBOL_INFOW);
-    if (!SymFromNameW(pPdbLookupCtx->hProcess, symbolName, &symbolInfo)) return -1;
-    return (int)(symbolInfo.Address - symbolInfo.ModBase);
+    struct PdbSymbol symbol;
+    if (!FindSymbol(symbolName, pPdbLookupCtx, &symbol)) return -1;
+    return (int)symbol.rva;
 }
 
-ULONG GetAttributeOffset(LPCWSTR structName, LPCWSTR propertyName, struct PDBLookupContext* pPdbLookupCtx)
-{
-    ULONG symbolInfoSize = sizeof(SYMBOL_INFOW) + MAX_SYM_NAME * sizeof(WCHAR);
-    SYMBOL_INFOW* symbolInfo = (SYMBOL_INFOW*)malloc(symbolInfoSize);
-    if (!symbolInfo)
-        return 0;
+ULONG GetFunctionSize(LPCWSTR symbolName, struct PDBLookupContext* pPdbLookupCtx) {
+    struct PdbSymbol symbol;
+    if (!FindSymbol(symbolName, pPdbLookupCtx, &symbol)) return 0;
+    return symbol.size;
+}
 
-    ZeroMemory(symbolInfo, symbolInfoSize);
-    symbolInfo->SizeOfStruct = sizeof(SYMBOL_INFO);
-    symbolInfo->MaxNameLen = MAX_SYM_NAME;
-    if (!SymGetTypeFromNameW(pPdbLookupCtx->hProcess, PDB_BASE, structName, symbolInfo)) {
-        free(symbolInfo);
-        return 0;
-    }
-    
-    TI_FINDCHILDREN_PARAMS tempFp = { 0 };
-    if (!SymGetTypeInfo(pPdbLookupCtx->hProcess, PDB_BASE, symbolInfo->TypeIndex, TI_GET_CHILDRENCOUNT, &tempFp)) {
-        free(symbolInfo);
-        return 0;
+// Symbol tags and basic types of DbgHelp type queries, as numbered in the DIA SDK's cvconst.h
+#define TYPE_TAG_DATA 7
+#define TYPE_TAG_UDT 11
+#define TYPE_TAG_ENUM 12
+#define TYPE_TAG_FUNCTION_TYPE 13
+#define TYPE_TAG_POINTER_TYPE 14
+#define TYPE_TAG_ARRAY_TYPE 15
+#define TYPE_TAG_BASE_TYPE 16
+#define TYPE_TAG_TYPEDEF 17
+#define BASIC_TYPE_VOID 1
+#define BASIC_TYPE_CHAR 2
+#define BASIC_TYPE_WCHAR 3
+#define BASIC_TYPE_INT 6
+#define BASIC_TYPE_UINT 7
+#define BASIC_TYPE_FLOAT 8
+#define BASIC_TYPE_BOOL 10
+#define BASIC_TYPE_LONG 13
+#define BASIC_TYPE_ULONG 14
+#define BASIC_TYPE_HRESULT 31
+
+static const char* GetBasicTypeName(DWORD basicType, ULONG64 length) {
+    switch (basicType) {
+    case BASIC_TYPE_VOID: return "void";
+    case BASIC_TYPE_CHAR: return "char";
+    case BASIC_TYPE_WCHAR: return "wchar_t";
+    case BASIC_TYPE_BOOL: return "bool";
+    case BASIC_TYPE_HRESULT: return "HRESULT";
+    case BASIC_TYPE_FLOAT: return length == 4 ? "float" : "double";
+    case BASIC_TYPE_INT:
+    case BASIC_TYPE_LONG:
+        return length == 1 ? "char" : length == 2 ? "short" : length == 4 ? "long" : "long long";
+    case BASIC_TYPE_UINT:
+    case BASIC_TYPE_ULONG:
+        return length == 1 ? "unsigned char" : length == 2 ? "unsigned short" : length == 4 ? "unsigned long" : "unsigned long long";
+    default: return "unknown";
     }
+}
 
-    ULONG childParamsSize = sizeof(TI_FINDCHILDREN_PARAMS) + tempFp.Count * sizeof(ULONG);
-    TI_FINDCHILDREN_PARAMS* childParams = (TI_FINDCHILDREN_PARAMS*)malloc(childParamsSize);
-    if (childParams == NULL)
-    {
-        free(symbolInfo);
-        return 0;
+// Spells a type the way C declares it, with pointers and array bounds appended to the name of the element type
+static void GetTypeName(HANDLE hProcess, ULONG typeId, char* buffer, size_t bufferSize) {
+    DWORD tag = 0;
+    ULONG64 length = 0;
+    SymGetTypeInfo(hProcess, PDB_BASE, typeId, TI_GET_SYMTAG, &tag);
+    SymGetTypeInfo(hProcess, PDB_BASE, typeId, TI_GET_LENGTH, &length);
+
+    ULONG elementId = 0;
+    switch (tag) {
+    case TYPE_TAG_POINTER_TYPE:
+    case TYPE_TAG_ARRAY_TYPE: {
+        SymGetTypeInfo(hProcess, PDB_BASE, typeId, TI_GET_TYPEID, &elementId);
+        GetTypeName(hProcess, elementId, buffer, bufferSize);
+        size_t nameLength = strlen(buffer);
+        if (tag == TYPE_TAG_POINTER_TYPE) {
+            if (nameLength + 1 < bufferSize) strcpy_s(buffer + nameLength, bufferSize - nameLength, "*");
+            return;
+        }
+        DWORD count = 0;
+        SymGetTypeInfo(hProcess, PDB_BASE, typeId, TI_GET_COUNT, &count);
+        char bounds[16];
+        sprintf_s(bounds, sizeof(bounds), "[%lu]", count);
+        if (nameLength + strlen(bounds) < bufferSize) strcpy_s(buffer + nameLength, bufferSize - nameLength, bounds);
+        return;
+    }
+    case TYPE_TAG_BASE_TYPE: {
+        DWORD basicType = 0;
+        SymGetTypeInfo(hProcess, PDB_BASE, typeId, TI_GET_BASETYPE, &basicType);
+        strcpy_s(buffer, bufferSize, GetBasicTypeName(basicType, length));
+        return;
+    }
+    case TYPE_TAG_FUNCTION_TYPE:
+        strcpy_s(buffer, bufferSize, "function");
+        return;
+    case TYPE_TAG_UDT:
+    case TYPE_TAG_ENUM:
+    case TYPE_TAG_TYPEDEF: {
+        WCHAR* name = NULL;
+        char* utf8Name = NULL;
+        if (SymGetTypeInfo(hProcess, PDB_BASE, typeId, TI_GET_SYMNAME, &name) && name) {
+            utf8Name = WideToUtf8(name);
+            LocalFree(name);
+        }
+        if (utf8Name && strlen(utf8Name) < bufferSize) strcpy_s(buffer, bufferSize, utf8Name);
+        else strcpy_s(buffer, bufferSize, "unknown");
+        free(utf8Name);
+        return;
+    }
+    default:
+        strcpy_s(buffer, bufferSize, "unknown");
     }
-    ZeroMemory(childParams, childParamsSize);
-    childParams->Count = tempFp.Count;
-    childParams->Start = tempFp.Start;
+}
+
+// Enumerates the data members of a type once: name, offset, size, type and bit field position
+static Error ReadTypeLayout(HANDLE hProcess, LPCWSTR typeName, struct TypeLayout* pLayout) {
+    ZeroMemory(pLayout, sizeof(struct TypeLayout));
+    ULONG symbolInfoSize = sizeof(SYMBOL_INFOW) + MAX_SYM_NAME * sizeof(WCHAR);
+    SYMBOL_INFOW* symbolInfo = (SYMBOL_INFOW*)malloc(symbolInfoSize);
+    char* utf8TypeName = WideToUtf8(typeName);
+    TI_FINDCHILDREN_PARAMS* childParams = NULL;
+    char* fieldTypeName = (char*)malloc(MAX_SYM_NAME);
+    Error e = NewNoError();
     do {
-        if (!SymGetTypeInfo(pPdbLookupCtx->hProcess, PDB_BASE, symbolInfo->TypeIndex, TI_FINDCHILDREN, childParams))
+        if (!symbolInfo || !utf8TypeName || !fieldTypeName) {
+            e = NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0);
             break;
-        for (ULONG i = childParams->Start; i < childParams->Count; i++)
-        {
-            WCHAR* pSymName = NULL;
-            ULONG Offset = 0;
-            if (!SymGetTypeInfo(pPdbLookupCtx->hProcess, PDB_BASE, childParams->ChildId[i], TI_GET_OFFSET, &Offset))
-                break;
-            if (!SymGetTypeInfo(pPdbLookupCtx->hProcess, PDB_BASE, childParams->ChildId[i], TI_GET_SYMNAME, &pSymName))
+        }
+        ZeroMemory(symbolInfo, symbolInfoSize);
+        symbolInfo->SizeOfStruct = sizeof(SYMBOL_INFOW);
+        symbolInfo->MaxNameLen = MAX_SYM_NAME;
+        if (!SymGetTypeFromNameW(hProcess, PDB_BASE, typeName, symbolInfo)) {
+            e = NewError(__FUNCTION__, -2, L"Type not found in the PDB", GetLastError());
+            break;
+        }
+
+        e = InitTypeLayout(utf8TypeName, symbolInfo->Size, pLayout);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -3);
+            break;
+        }
+
+        DWORD childCount = 0;
+        if (!SymGetTypeInfo(hProcess, PDB_BASE, symbolInfo->TypeIndex, TI_GET_CHILDRENCOUNT, &childCount)) {
+            e = NewError(__FUNCTION__, -4, L"TI_GET_CHILDRENCOUNT failed", GetLastError());
+            break;
+        }
+        ULONG childParamsSize = sizeof(TI_FINDCHILDREN_PARAMS) + childCount * sizeof(ULONG);
+        childParams = (TI_FINDCHILDREN_PARAMS*)calloc(1, childParamsSize);
+        if (!childParams) {
+            e = NewError(__FUNCTION__, -5, L"calloc failed; out of memory", 0);
+            break;
+        }
+        childParams->Count = childCount;
+        if (childCount && !SymGetTypeInfo(hProcess, PDB_BASE, symbolInfo->TypeIndex, TI_FINDCHILDREN, childParams)) {
+            e = NewError(__FUNCTION__, -6, L"TI_FINDCHILDREN failed", GetLastError());
+            break;
+        }
+
+        for (ULONG i = 0; i < childCount && !e.ContainsError; i++) {
+            ULONG childId = childParams->ChildId[i];
+            DWORD tag = 0;
+            // only data members have an offset, nested types, methods and static members are skipped
+            if (!SymGetTypeInfo(hProcess, PDB_BASE, childId, TI_GET_SYMTAG, &tag) || tag != TYPE_TAG_DATA)
+                continue;
+            DWORD offset = 0;
+            if (!SymGetTypeInfo(hProcess, PDB_BASE, childId, TI_GET_OFFSET, &offset))
+                continue;
+
+            WCHAR* name = NULL;
+            if (!SymGetTypeInfo(hProcess, PDB_BASE, childId, TI_GET_SYMNAME, &name) || !name)
+                continue;
+            char* utf8Name = WideToUtf8(name);
+            LocalFree(name);
+            if (!utf8Name) {
+                e = NewError(__FUNCTION__, -7, L"WideToUtf8 failed", 0);
                 break;
-            if (pSymName)
-            {
-                if (wcscmp(pSymName, propertyName) == 0)
-                {
-                    LocalFree(pSymName);
-                    free(childParams);
-                    free(symbolInfo);
-                    return Offset;
-                }
             }
+
+            ULONG typeId = 0;
+            ULONG64 size = 0;
+            SymGetTypeInfo(hProcess, PDB_BASE, childId, TI_GET_TYPEID, &typeId);
+            SymGetTypeInfo(hProcess, PDB_BASE, typeId, TI_GET_LENGTH, &size);
+            GetTypeName(hProcess, typeId, fieldTypeName, MAX_SYM_NAME);
+
+            // for a bit field the member's own length is its width in bits
+            DWORD bitPosition = 0;
+            ULONG64 bitLength = 0;
+            if (SymGetTypeInfo(hProcess, PDB_BASE, childId, TI_GET_BITPOSITION, &bitPosition))
+                SymGetTypeInfo(hProcess, PDB_BASE, childId, TI_GET_LENGTH, &bitLength);
+
+            e = AddTypeField(pLayout, utf8Name, fieldTypeName, offset, (DWORD)size, bitPosition, (DWORD)bitLength);
+            free(utf8Name);
+            if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -8);
         }
+        if (e.ContainsError) break;
+
+        e = FinishTypeLayout(pLayout);
+        if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -9);
     } while (FALSE);
+
+    if (e.ContainsError) FreeTypeLayout(pLayout);
+    free(fieldTypeName);
     free(childParams);
+    free(utf8TypeName);
     free(symbolInfo);
-    return 0;
+    return e;
 }
 
-ULONG GetStructSize(LPCWSTR StructName, struct PDBLookupContext* pPdbLookupCtx)
+Error GetTypeLayout(LPCWSTR typeName, struct PDBLookupContext* pPdbLookupCtx, const struct TypeLayout** ppLayout) {
+    char* name = WideToUtf8(typeName);
+    if (!name)
+        return NewError(__FUNCTION__, -1, L"WideToUtf8 failed", 0);
+    *ppLayout = FindCachedTypeLayout(&pPdbLookupCtx->typeLayouts, name);
+    free(name);
+    if (*ppLayout)
+        return NewNoError();
+
+    if (!InitializeTypeSession(pPdbLookupCtx))
+        return NewError(__FUNCTION__, -2, L"Loading the PDB into DbgHelp failed", GetLastError());
+
+    ULONGLONG start = StartStatsTimer();
+    struct TypeLayout layout;
+    Error e = ReadTypeLayout(pPdbLookupCtx->hProcess, typeName, &layout);
+    if (!e.ContainsError) {
+        e = AddCachedTypeLayout(&pPdbLookupCtx->typeLayouts, &layout, ppLayout);
+        if (e.ContainsError) FreeTypeLayout(&layout);
+    }
+    StopStatsTimer(STATS_TIMER_TYPE_LAYOUT, start);
+    if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -3);
+    return e;
+}
+
+ULONG GetAttributeOffset(LPCWSTR structName, LPCWSTR propertyName, struct PDBLookupContext* pPdbLookupCtx)
 {
-    ULONG symbolInfoSize = sizeof(SYMBOL_INFOW) + MAX_SYM_NAME * sizeof(WCHAR);
-    SYMBOL_INFOW* symbolInfo = (SYMBOL_INFOW*)malloc(symbolInfoSize);
-    if (!symbolInfo)
-        return 0;
-    ZeroMemory(symbolInfo, symbolInfoSize);
-    symbolInfo->SizeOfStruct = sizeof(SYMBOL_INFO);
-    symbolInfo->MaxNameLen = MAX_SYM_NAME;
-    if (!SymGetTypeFromNameW(pPdbLookupCtx->hProcess, PDB_BASE, StructName, symbolInfo))
+    const struct TypeLayout* layout;
+    Error e = GetTypeLayout(structName, pPdbLookupCtx, &layout);
+    if (e.ContainsError) {
+        Error_Free(&e);
         return 0;
+    }
 
-    return symbolInfo->Size;
+    char* name = WideToUtf8(propertyName);
+    if (!name)
+        return 0;
+    const struct TypeField* field = FindTypeField(layout, name);
+    free(name);
+    return field ? field->offset : 0;
 }
 
-DWORD RvaToOffset(DWORD rva, PIMAGE_SECTION_HEADER sections, WORD numSections)
+ULONG GetStructSize(LPCWSTR StructName, struct PDBLookupContext* pPdbLookupCtx)
 {
-    for (WORD i = 0; i < numSections; i++) {
-        DWORD vaStart = sections[i].VirtualAddress;
-        DWORD vaEnd = vaStart + sections[i].Misc.VirtualSize;
-        if (rva >= vaStart && rva < vaEnd)
-            return (rva - vaStart) + sections[i].PointerToRawData;
+    char* name = WideToUtf8(StructName);
+    if (!name)
+        return 0;
+    DWORD size = 0;
+    BOOL found = FindIndexedTypeSize(&pPdbLookupCtx->symbolIndex, name, &size);
+    free(name);
+    if (found)
+        return size;
+
+    const struct TypeLayout* layout;
+    Error e = GetTypeLayout(StructName, pPdbLookupCtx, &layout);
+    if (e.ContainsError) {
+        Error_Free(&e);
+        return 0;
     }
-
-    return 0;
+    return layout->size;
 }
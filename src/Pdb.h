@@ -3,8 +3,14 @@
 #include <WinHTTP.h>
 #include <DbgHelp.h>
 #include "Error.h"
+#include "Image.h"
+#include "ImageSymbols.h"
+#include "SymbolIndex.h"
+#include "SymbolStore.h"
+#include "Download.h"
+#include "Stats.h"
+#include "TypeLayout.h"
 #pragma comment(lib, "DbgHelp.lib")
-#pragma comment(lib, "WinHTTP.lib")
 
 #define PDB_BASE (DWORD64)0x10000000
 
@@ -16,15 +22,31 @@ typedef struct PdbInfo {
 
 typedef struct PDBLookupContext {
     struct PdbInfo pdbInfo;
-    HANDLE hProcess;
-    HANDLE hPdbFile;
+    struct SymbolIndex symbolIndex; // answers symbol and type size lookups
+    const struct ImageView* pImage; // set when symbols are read from the image's exports and .pdata instead of a PDB
+    WCHAR* pdbPath;
+    HANDLE hProcess;                // DbgHelp session, created on the first field offset query
+    struct TypeLayoutCache typeLayouts; // layouts read through DbgHelp so far
 } PdbLookupContext;
 
-Error GetPEInfo(LPCWSTR filePath, struct PDBLookupContext* pPdbLookupCtx);
-Error DownloadPDB(struct PDBLookupContext* pPdbLookupCtx, LPCWSTR outputPath);
+Error GetPEInfo(const struct ImageView* pImage, struct PDBLookupContext* pPdbLookupCtx);
+// Downloads the PDB from `serverUrl`, falling back to the compressed `.pd_` copy when the server has no plain one.
+Error DownloadPDB(struct PDBLookupContext* pPdbLookupCtx, LPCWSTR serverUrl, DWORD maxConnections, LPCWSTR outputPath, struct DownloadStats* pStats);
+// Makes sure `pdbPath`, a symbol store entry, holds the PDB matching the PE. Downloads it only when it is missing
+// or does not match, under the entry's lock and through a temporary file.
+Error FetchPDB(struct PDBLookupContext* pPdbLookupCtx, LPCWSTR serverUrl, DWORD maxConnections, LPCWSTR pdbPath, struct DownloadStats* pStats);
+// Opens the PDB and builds its symbol index, which is saved next to it as <pdbPath>.sidx for later runs.
 Error InitializePDBLookup(LPCWSTR pdbPath, struct PDBLookupContext* pPdbLookupCtx);
+// Uses a previously saved <pdbPath>.sidx matching the PE's GUID and age, without opening the PDB.
+Error InitializePDBLookupFromIndex(LPCWSTR pdbPath, struct PDBLookupContext* pPdbLookupCtx);
+// Resolves symbols from the image itself, without any PDB or network access. Names are looked up in the image
+// directly; `withIndex` also builds the symbol index, which only enumerating every function needs.
+Error InitializeImageLookup(const struct ImageView* pImage, BOOL withIndex, struct PDBLookupContext* pPdbLookupCtx);
 void CleanupPDBLookupCtx(struct PDBLookupContext* pPdbLookupCtx);
 int GetFunctionRVA(LPCWSTR symbolName, struct PDBLookupContext* pPdbLookupCtx);
+ULONG GetFunctionSize(LPCWSTR symbolName, struct PDBLookupContext* pPdbLookupCtx);
+// Returns the fields, offsets and sizes of a struct, class or union. The type is enumerated through DbgHelp on the
+// first call and answered from the context's cache afterwards; the layout stays valid until CleanupPDBLookupCtx.
+Error GetTypeLayout(LPCWSTR typeName, struct PDBLookupContext* pPdbLookupCtx, const struct TypeLayout** ppLayout);
 ULONG GetAttributeOffset(LPCWSTR structName, LPCWSTR propertyName, struct PDBLookupContext* pPdbLookupCtx);
-ULONG GetStructSize(LPCWSTR StructName, struct PDBLookupContext* pPdbLookupCtx);
-DWORD RvaToOffset(DWORD rva, PIMAGE_SECTION_HEADER sections, WORD numSections);
\ No newline at end of file
+ULONG GetStructSize(LPCWSTR StructName, struct PDBLookupContext* pPdbLookupCtx);
\ No newline at end of file
@@ -0,0 +1,595 @@
+#include "PdbFile.h"
+#include <ctype.h>
+
+#define MSF_MAGIC_SIZE 32
+static const char g_MsfMagic[MSF_MAGIC_SIZE] = "Microsoft C/C++ MSF 7.00\r\n\x1a" "DS\0\0";
+
+// CodeView symbol record kinds used for name lookups
+#define S_LDATA32 0x110C
+#define S_GDATA32 0x110D
+#define S_PUB32 0x110E
+#define S_LPROC32 0x110F
+#define S_GPROC32 0x1110
+#define S_PROCREF 0x1125
+#define S_LPROCREF 0x1127
+#define S_LPROC32_ID 0x1146
+#define S_GPROC32_ID 0x1147
+
+// CodeView type record kinds and numeric leaves needed for type sizes
+#define LF_CLASS 0x1504
+#define LF_STRUCTURE 0x1505
+#define LF_UNION 0x1506
+#define LF_NUMERIC 0x8000
+#define LF_CHAR 0x8000
+#define LF_SHORT 0x8001
+#define LF_USHORT 0x8002
+#define LF_LONG 0x8003
+#define LF_ULONG 0x8004
+#define LF_QUADWORD 0x8009
+#define LF_UQUADWORD 0x800A
+#define TYPE_PROPERTY_FWDREF 0x80
+
+// GSI hash tables have 4096 buckets plus one, flagged in a bitmap rounded up to 32 bits
+#define GSI_HASH_BUCKETS 4096
+#define GSI_BITMAP_BYTES (((GSI_HASH_BUCKETS + 1 + 31) / 32) * 4)
+#define GSI_HASH_HEADER_SIZE 16
+#define GSI_HASH_RECORD_SIZE 8
+#define GSI_BUCKET_UNIT 12
+#define PUBLICS_HEADER_SIZE 28
+#define DBI_HEADER_SIZE 64
+#define DBI_MODULE_INFO_SIZE 64
+#define DBG_HEADER_SECTION_HEADERS 5
+
+static WORD ReadU16(const BYTE* p) { WORD value; memcpy(&value, p, sizeof(value)); return value; }
+static DWORD ReadU32(const BYTE* p) { DWORD value; memcpy(&value, p, sizeof(value)); return value; }
+
+static DWORD BlockCount(DWORD size, DWORD blockSize) { return (size + blockSize - 1) / blockSize; }
+
+static BOOL IsNilStream(DWORD size) { return size == 0xFFFFFFFF; }
+
+BOOL ReadPdbStream(const struct PdbFile* pPdb, DWORD streamIndex, DWORD offset, void* buffer, DWORD length)
+{
+    if (streamIndex >= pPdb->numStreams || IsNilStream(pPdb->streamSizes[streamIndex])) return FALSE;
+    if ((ULONGLONG)offset + length > pPdb->streamSizes[streamIndex]) return FALSE;
+
+    BYTE* out = (BYTE*)buffer;
+    const DWORD* blocks = pPdb->streamBlocks[streamIndex];
+    while (length > 0) {
+        DWORD blockOffset = offset % pPdb->blockSize;
+        DWORD chunk = pPdb->blockSize - blockOffset;
+        if (chunk > length) chunk = length;
+        memcpy(out, pPdb->file.data + (ULONGLONG)blocks[offset / pPdb->blockSize] * pPdb->blockSize + blockOffset, chunk);
+        out += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+    return TRUE;
+}
+
+Error LoadPdbStream(const struct PdbFile* pPdb, DWORD streamIndex, struct PdbStream* pStream)
+{
+    memset(pStream, 0, sizeof(struct PdbStream));
+    if (streamIndex >= pPdb->numStreams || IsNilStream(pPdb->streamSizes[streamIndex]))
+        return NewError(__FUNCTION__, -1, L"Stream does not exist", 0);
+
+    DWORD size = pPdb->streamSizes[streamIndex];
+    const DWORD* blocks = pPdb->streamBlocks[streamIndex];
+    DWORD nBlocks = BlockCount(size, pPdb->blockSize);
+    pStream->size = size;
+    if (size == 0) return NewNoError();
+
+    // most streams are written in one piece, in which case the mapping can be used as is
+    BOOL contiguous = TRUE;
+    for (DWORD i = 1; i < nBlocks && contiguous; i++) contiguous = blocks[i] == blocks[i - 1] + 1;
+    if (contiguous) {
+        pStream->data = pPdb->file.data + (ULONGLONG)blocks[0] * pPdb->blockSize;
+        return NewNoError();
+    }
+
+    pStream->owned = (BYTE*)malloc(size);
+    if (!pStream->owned)
+        return NewError(__FUNCTION__, -2, L"malloc failed; out of memory", 0);
+    ReadPdbStream(pPdb, streamIndex, 0, pStream->owned, size);
+    pStream->data = pStream->owned;
+    return NewNoError();
+}
+
+void FreePdbStream(struct PdbStream* pStream)
+{
+    free(pStream->owned);
+    memset(pStream, 0, sizeof(struct PdbStream));
+}
+
+// Reads the superblock and assembles the stream directory
+static Error LoadStreamDirectory(struct PdbFile* pPdb)
+{
+    const BYTE* base = pPdb->file.data;
+    ULONGLONG fileSize = pPdb->file.size;
+    if (fileSize < MSF_MAGIC_SIZE + 24 || memcmp(base, g_MsfMagic, MSF_MAGIC_SIZE) != 0)
+        return NewError(__FUNCTION__, -1, L"Not an MSF 7.00 file", 0);
+
+    pPdb->blockSize = ReadU32(base + 32);
+    pPdb->numBlocks = ReadU32(base + 40);
+    DWORD numDirectoryBytes = ReadU32(base + 44);
+    DWORD blockMapAddr = ReadU32(base + 52);
+    if (pPdb->blockSize < 512 || (pPdb->blockSize & (pPdb->blockSize - 1)) != 0)
+        return NewError(__FUNCTION__, -2, L"Invalid MSF block size", 0);
+    if ((ULONGLONG)pPdb->numBlocks * pPdb->blockSize > fileSize)
+        pPdb->numBlocks = (DWORD)(fileSize / pPdb->blockSize);
+
+    DWORD nDirectoryBlocks = BlockCount(numDirectoryBytes, pPdb->blockSize);
+    if (numDirectoryBytes < sizeof(DWORD) || blockMapAddr >= pPdb->numBlocks || nDirectoryBlocks * sizeof(DWORD) > pPdb->blockSize)
+        return NewError(__FUNCTION__, -3, L"Invalid MSF stream directory", 0);
+
+    pPdb->directory = (BYTE*)malloc((size_t)nDirectoryBlocks * pPdb->blockSize);
+    if (!pPdb->directory)
+        return NewError(__FUNCTION__, -4, L"malloc failed; out of memory", 0);
+
+    const BYTE* blockMap = base + (ULONGLONG)blockMapAddr * pPdb->blockSize;
+    for (DWORD i = 0; i < nDirectoryBlocks; i++) {
+        DWORD block = ReadU32(blockMap + i * sizeof(DWORD));
+        if (block >= pPdb->numBlocks)
+            return NewError(__FUNCTION__, -5, L"MSF directory block is out of file bounds", 0);
+        memcpy(pPdb->directory + (size_t)i * pPdb->blockSize, base + (ULONGLONG)block * pPdb->blockSize, pPdb->blockSize);
+    }
+
+    // directory: stream count, the size of every stream, then the block list of every stream
+    const DWORD* words = (const DWORD*)pPdb->directory;
+    DWORD nWords = numDirectoryBytes / sizeof(DWORD);
+    pPdb->numStreams = words[0];
+    if ((ULONGLONG)pPdb->numStreams + 1 > nWords)
+        return NewError(__FUNCTION__, -6, L"MSF directory is truncated", 0);
+    pPdb->streamSizes = words + 1;
+
+    pPdb->streamBlocks = (const DWORD**)calloc(pPdb->numStreams ? pPdb->numStreams : 1, sizeof(DWORD*));
+    if (!pPdb->streamBlocks)
+        return NewError(__FUNCTION__, -7, L"calloc failed; out of memory", 0);
+
+    DWORD cursor = 1 + pPdb->numStreams;
+    for (DWORD i = 0; i < pPdb->numStreams; i++) {
+        DWORD size = pPdb->streamSizes[i];
+        DWORD nBlocks = IsNilStream(size) ? 0 : BlockCount(size, pPdb->blockSize);
+        if ((ULONGLONG)cursor + nBlocks > nWords)
+            return NewError(__FUNCTION__, -8, L"MSF directory is truncated", 0);
+        for (DWORD j = 0; j < nBlocks; j++) {
+            if (words[cursor + j] >= pPdb->numBlocks)
+                return NewError(__FUNCTION__, -9, L"MSF stream block is out of file bounds", 0);
+        }
+        pPdb->streamBlocks[i] = words + cursor;
+        cursor += nBlocks;
+    }
+    return NewNoError();
+}
+
+// Reads the module list and the optional debug header out of the DBI stream
+static Error LoadDbiStream(struct PdbFile* pPdb, WORD* globalsIndex, WORD* publicsIndex, WORD* symRecordsIndex, WORD* sectionHeadersIndex)
+{
+    struct PdbStream dbi;
+    Error e = LoadPdbStream(pPdb, PDB_STREAM_DBI, &dbi);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+
+    do {
+        if (dbi.size < DBI_HEADER_SIZE) {
+            e = NewError(__FUNCTION__, -2, L"DBI stream is truncated", 0);
+            break;
+        }
+        pPdb->dbiAge = ReadU32(dbi.data + 8);
+        *globalsIndex = ReadU16(dbi.data + 12);
+        *publicsIndex = ReadU16(dbi.data + 16);
+        *symRecordsIndex = ReadU16(dbi.data + 20);
+
+        // substreams follow the header in this order
+        DWORD moduleInfoSize = ReadU32(dbi.data + 24);
+        DWORD sectionContributionSize = ReadU32(dbi.data + 28);
+        DWORD sectionMapSize = ReadU32(dbi.data + 32);
+        DWORD sourceInfoSize = ReadU32(dbi.data + 36);
+        DWORD typeServerMapSize = ReadU32(dbi.data + 40);
+        DWORD optionalDbgHeaderSize = ReadU32(dbi.data + 48);
+        DWORD ecSubstreamSize = ReadU32(dbi.data + 52);
+
+        ULONGLONG dbgHeaderOffset = (ULONGLONG)DBI_HEADER_SIZE + moduleInfoSize + sectionContributionSize + sectionMapSize + sourceInfoSize + typeServerMapSize + ecSubstreamSize;
+        if (dbgHeaderOffset + optionalDbgHeaderSize > dbi.size) {
+            e = NewError(__FUNCTION__, -3, L"DBI substreams are out of stream bounds", 0);
+            break;
+        }
+
+        *sectionHeadersIndex = PDB_NIL_STREAM;
+        if (optionalDbgHeaderSize >= (DBG_HEADER_SECTION_HEADERS + 1) * sizeof(WORD))
+            *sectionHeadersIndex = ReadU16(dbi.data + dbgHeaderOffset + DBG_HEADER_SECTION_HEADERS * sizeof(WORD));
+
+        // first pass counts the modules, second pass records their symbol streams
+        for (int pass = 0; pass < 2; pass++) {
+            DWORD nModules = 0;
+            DWORD offset = DBI_HEADER_SIZE;
+            DWORD end = DBI_HEADER_SIZE + moduleInfoSize;
+            while (offset + DBI_MODULE_INFO_SIZE <= end) {
+                if (pass == 1) pPdb->moduleStreams[nModules] = ReadU16(dbi.data + offset + 34);
+                nModules++;
+
+                // module name and object file name, then padding to 4 bytes
+                DWORD cursor = offset + DBI_MODULE_INFO_SIZE;
+                for (int name = 0; name < 2; name++) {
+                    while (cursor < end && dbi.data[cursor] != 0) cursor++;
+                    cursor++;
+                }
+                offset = (cursor + 3) & ~3u;
+            }
+
+            if (pass == 0) {
+                pPdb->numModules = nModules;
+                pPdb->moduleStreams = (WORD*)calloc(nModules ? nModules : 1, sizeof(WORD));
+                if (!pPdb->moduleStreams) {
+                    e = NewError(__FUNCTION__, -4, L"calloc failed; out of memory", 0);
+                    break;
+                }
+            }
+        }
+    } while (FALSE);
+
+    FreePdbStream(&dbi);
+    return e;
+}
+
+// Maps the file, loads the stream directory and reads the info stream
+static Error OpenPdbContainer(LPCWSTR pdbPath, struct PdbFile* pPdb)
+{
+    memset(pPdb, 0, sizeof(struct PdbFile));
+    Error e = MapFileReadOnly(pdbPath, &pPdb->file);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+
+    do {
+        e = LoadStreamDirectory(pPdb);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -2);
+            break;
+        }
+
+        // info stream: version, signature, age, GUID
+        BYTE info[28];
+        if (!ReadPdbStream(pPdb, PDB_STREAM_INFO, 0, info, sizeof(info))) {
+            e = NewError(__FUNCTION__, -3, L"PDB info stream is missing", 0);
+            break;
+        }
+        pPdb->age = ReadU32(info + 8);
+        memcpy(&pPdb->guid, info + 12, sizeof(GUID));
+    } while (FALSE);
+
+    if (e.ContainsError) ClosePdbFile(pPdb);
+    return e;
+}
+
+Error OpenPdbFile(LPCWSTR pdbPath, struct PdbFile* pPdb)
+{
+    Error e = OpenPdbContainer(pdbPath, pPdb);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+
+    do {
+        WORD globalsIndex = PDB_NIL_STREAM, publicsIndex = PDB_NIL_STREAM, symRecordsIndex = PDB_NIL_STREAM, sectionHeadersIndex = PDB_NIL_STREAM;
+        e = LoadDbiStream(pPdb, &globalsIndex, &publicsIndex, &symRecordsIndex, &sectionHeadersIndex);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -2);
+            break;
+        }
+
+        e = LoadPdbStream(pPdb, symRecordsIndex, &pPdb->symRecords);
+        if (!e.ContainsError) e = LoadPdbStream(pPdb, globalsIndex, &pPdb->globals);
+        if (!e.ContainsError) e = LoadPdbStream(pPdb, publicsIndex, &pPdb->publics);
+        if (!e.ContainsError) e = LoadPdbStream(pPdb, sectionHeadersIndex, &pPdb->sectionHeaders);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -3);
+            break;
+        }
+    } while (FALSE);
+
+    if (e.ContainsError) ClosePdbFile(pPdb);
+    return e;
+}
+
+Error ReadPdbIdentity(LPCWSTR pdbPath, GUID* guid, DWORD* age, DWORD* dbiAge)
+{
+    struct PdbFile pdb;
+    Error e = OpenPdbContainer(pdbPath, &pdb);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+
+    *guid = pdb.guid;
+    *age = pdb.age;
+    if (!ReadPdbStream(&pdb, PDB_STREAM_DBI, 8, dbiAge, sizeof(DWORD)))
+        *dbiAge = pdb.age;
+    ClosePdbFile(&pdb);
+    return NewNoError();
+}
+
+void ClosePdbFile(struct PdbFile* pPdb)
+{
+    FreePdbStream(&pPdb->symRecords);
+    FreePdbStream(&pPdb->globals);
+    FreePdbStream(&pPdb->publics);
+    FreePdbStream(&pPdb->sectionHeaders);
+    free(pPdb->moduleStreams);
+    free((void*)pPdb->streamBlocks);
+    free(pPdb->directory);
+    UnmapFile(&pPdb->file);
+    memset(pPdb, 0, sizeof(struct PdbFile));
+}
+
+BOOL PdbSectionOffsetToRva(const struct PdbFile* pPdb, WORD section, DWORD offset, DWORD* rva)
+{
+    DWORD numSections = pPdb->sectionHeaders.size / sizeof(IMAGE_SECTION_HEADER);
+    if (section == 0 || section > numSections) return FALSE;
+
+    IMAGE_SECTION_HEADER header;
+    memcpy(&header, pPdb->sectionHeaders.data + (section - 1) * sizeof(IMAGE_SECTION_HEADER), sizeof(header));
+    *rva = header.VirtualAddress + offset;
+    return TRUE;
+}
+
+// The PDB's own name hash (LHashPbCb / hashStringV1): xor of little endian dwords, then the tail, case folded
+static DWORD HashStringV1(const char* name, size_t length)
+{
+    DWORD result = 0;
+    const BYTE* p = (const BYTE*)name;
+    for (size_t i = 0; i < length / 4; i++, p += 4) result ^= ReadU32(p);
+
+    size_t remainder = length % 4;
+    if (remainder >= 2) {
+        result ^= ReadU16(p);
+        p += 2;
+        remainder -= 2;
+    }
+    if (remainder == 1) result ^= *p;
+
+    result |= 0x20202020;
+    result ^= result >> 11;
+    return result ^ (result >> 16);
+}
+
+// Returns the symbol record at `offset` in the symbol record stream, or NULL if it is out of bounds
+static const BYTE* GetSymbolRecord(const struct PdbFile* pPdb, DWORD offset, WORD* kind)
+{
+    if ((ULONGLONG)offset + 4 > pPdb->symRecords.size) return NULL;
+    const BYTE* record = pPdb->symRecords.data + offset;
+    WORD length = ReadU16(record);
+    if (length < 2 || (ULONGLONG)offset + 2 + length > pPdb->symRecords.size) return NULL;
+    *kind = ReadU16(record + 2);
+    return record;
+}
+
+// Converts a record found through a hash table into a symbol
+static BOOL ResolveSymbolRecord(const struct PdbFile* pPdb, const BYTE* record, WORD kind, struct PdbSymbol* pSymbol)
+{
+    switch (kind) {
+    case S_PROCREF:
+    case S_LPROCREF: {
+        // reference into a module stream: checksum, offset of the procedure record, 1-based module index
+        DWORD symbolOffset = ReadU32(record + 8);
+        WORD module = ReadU16(record + 12);
+        if (module == 0 || module > pPdb->numModules) return FALSE;
+
+        BYTE procedure[40];
+        if (!ReadPdbStream(pPdb, pPdb->moduleStreams[module - 1], symbolOffset, procedure, sizeof(procedure))) return FALSE;
+        WORD procedureKind = ReadU16(procedure + 2);
+        if (procedureKind != S_GPROC32 && procedureKind != S_LPROC32 && procedureKind != S_GPROC32_ID && procedureKind != S_LPROC32_ID) return FALSE;
+        if (!PdbSectionOffsetToRva(pPdb, ReadU16(procedure + 36), ReadU32(procedure + 32), &pSymbol->rva)) return FALSE;
+        pSymbol->size = ReadU32(procedure + 16);
+        pSymbol->kind = PDB_SYMBOL_FUNCTION;
+        return TRUE;
+    }
+    case S_PUB32:
+    case S_GDATA32:
+    case S_LDATA32:
+        if (!PdbSectionOffsetToRva(pPdb, ReadU16(record + 12), ReadU32(record + 8), &pSymbol->rva)) return FALSE;
+        pSymbol->size = 0;
+        pSymbol->kind = kind == S_PUB32 ? PDB_SYMBOL_PUBLIC : PDB_SYMBOL_DATA;
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+// Splits a GSI hash table into its record array, bucket bitmap and bucket array
+static BOOL ParseGsiHash(const BYTE* hash, DWORD hashSize, const BYTE** records, DWORD* nRecords, const BYTE** bitmap, const BYTE** buckets, DWORD* nBuckets)
+{
+    if (hashSize < GSI_HASH_HEADER_SIZE) return FALSE;
+    DWORD recordsSize = ReadU32(hash + 8);
+    DWORD bucketsSize = ReadU32(hash + 12);
+    if ((ULONGLONG)GSI_HASH_HEADER_SIZE + recordsSize + bucketsSize > hashSize || bucketsSize < GSI_BITMAP_BYTES) return FALSE;
+
+    *records = hash + GSI_HASH_HEADER_SIZE;
+    *nRecords = recordsSize / GSI_HASH_RECORD_SIZE;
+    *bitmap = *records + recordsSize;
+    *buckets = *bitmap + GSI_BITMAP_BYTES;
+    *nBuckets = (bucketsSize - GSI_BITMAP_BYTES) / sizeof(DWORD);
+    return TRUE;
+}
+
+// The publics stream starts with its own header, followed by a GSI hash table
+static const BYTE* GetPublicsHash(const struct PdbFile* pPdb, DWORD* hashSize)
+{
+    if (pPdb->publics.size <= PUBLICS_HEADER_SIZE) return NULL;
+    *hashSize = ReadU32(pPdb->publics.data);
+    if (*hashSize > pPdb->publics.size - PUBLICS_HEADER_SIZE) *hashSize = pPdb->publics.size - PUBLICS_HEADER_SIZE;
+    return pPdb->publics.data + PUBLICS_HEADER_SIZE;
+}
+
+// Returns the name of a record referenced by a GSI hash table. Every kind found in these tables keeps it at offset 14.
+static const char* GetGsiRecordName(const BYTE* record, size_t* maxLength)
+{
+    WORD length = ReadU16(record);
+    if (length < 13) return NULL;
+    *maxLength = (size_t)length + 2 - 14;
+    return (const char*)record + 14;
+}
+
+// Looks a name up in a GSI hash table. Exact matches win over case-insensitive ones.
+static BOOL FindInGsiHash(const struct PdbFile* pPdb, const BYTE* hash, DWORD hashSize, const char* name, struct PdbSymbol* pSymbol)
+{
+    const BYTE* records, * bitmap, * buckets;
+    DWORD nRecords, nBuckets;
+    if (!hash || !ParseGsiHash(hash, hashSize, &records, &nRecords, &bitmap, &buckets, &nBuckets)) return FALSE;
+
+    size_t nameLength = strlen(name);
+    DWORD bucket = HashStringV1(name, nameLength) % GSI_HASH_BUCKETS;
+    DWORD bitmapWord = ReadU32(bitmap + (bucket / 32) * 4);
+    if (!(bitmapWord & (1u << (bucket % 32)))) return FALSE;
+
+    // only non-empty buckets are stored, so the bucket's slot is the number of set bits before it
+    DWORD slot = 0;
+    for (DWORD i = 0; i < bucket / 32; i++) {
+        DWORD word = ReadU32(bitmap + i * 4);
+        while (word) { word &= word - 1; slot++; }
+    }
+    for (DWORD word = bitmapWord & ((1u << (bucket % 32)) - 1); word; word &= word - 1) slot++;
+    if (slot >= nBuckets) return FALSE;
+
+    DWORD first = ReadU32(buckets + slot * 4) / GSI_BUCKET_UNIT;
+    DWORD last = slot + 1 < nBuckets ? ReadU32(buckets + (slot + 1) * 4) / GSI_BUCKET_UNIT : nRecords;
+    if (last > nRecords) last = nRecords;
+
+    const BYTE* caseInsensitiveMatch = NULL;
+    WORD caseInsensitiveKind = 0;
+    for (DWORD i = first; i < last; i++) {
+        DWORD offset = ReadU32(records + i * GSI_HASH_RECORD_SIZE);
+        WORD kind;
+        const BYTE* record = offset ? GetSymbolRecord(pPdb, offset - 1, &kind) : NULL;
+        size_t maxLength;
+        const char* recordName = record ? GetGsiRecordName(record, &maxLength) : NULL;
+        if (!recordName) continue;
+        if (strnlen(recordName, maxLength) != nameLength) continue;
+        if (memcmp(recordName, name, nameLength) == 0) {
+            if (ResolveSymbolRecord(pPdb, record, kind, pSymbol)) return TRUE;
+            continue;
+        }
+        if (!caseInsensitiveMatch) {
+            size_t j = 0;
+            while (j < nameLength && tolower((unsigned char)recordName[j]) == tolower((unsigned char)name[j])) j++;
+            if (j == nameLength) {
+                caseInsensitiveMatch = record;
+                caseInsensitiveKind = kind;
+            }
+        }
+    }
+
+    return caseInsensitiveMatch && ResolveSymbolRecord(pPdb, caseInsensitiveMatch, caseInsensitiveKind, pSymbol);
+}
+
+BOOL PdbFindSymbol(const struct PdbFile* pPdb, const char* name, struct PdbSymbol* pSymbol)
+{
+    memset(pSymbol, 0, sizeof(struct PdbSymbol));
+    if (FindInGsiHash(pPdb, pPdb->globals.data, pPdb->globals.size, name, pSymbol))
+        return TRUE;
+    DWORD hashSize = 0;
+    const BYTE* hash = GetPublicsHash(pPdb, &hashSize);
+    return FindInGsiHash(pPdb, hash, hashSize, name, pSymbol);
+}
+
+// Resolves every record of a GSI hash table, in hash order
+static BOOL EnumerateGsiHash(const struct PdbFile* pPdb, const BYTE* hash, DWORD hashSize, PdbSymbolCallback callback, void* context)
+{
+    const BYTE* records, * bitmap, * buckets;
+    DWORD nRecords, nBuckets;
+    if (!hash || !ParseGsiHash(hash, hashSize, &records, &nRecords, &bitmap, &buckets, &nBuckets)) return TRUE;
+
+    for (DWORD i = 0; i < nRecords; i++) {
+        DWORD offset = ReadU32(records + i * GSI_HASH_RECORD_SIZE);
+        WORD kind;
+        const BYTE* record = offset ? GetSymbolRecord(pPdb, offset - 1, &kind) : NULL;
+        size_t maxLength;
+        const char* recordName = record ? GetGsiRecordName(record, &maxLength) : NULL;
+        if (!recordName || strnlen(recordName, maxLength) == maxLength) continue;
+
+        struct PdbSymbol symbol;
+        if (ResolveSymbolRecord(pPdb, record, kind, &symbol) && !callback(context, recordName, &symbol))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+void PdbEnumerateSymbols(const struct PdbFile* pPdb, PdbSymbolCallback callback, void* context)
+{
+    if (!EnumerateGsiHash(pPdb, pPdb->globals.data, pPdb->globals.size, callback, context))
+        return;
+    DWORD hashSize = 0;
+    const BYTE* hash = GetPublicsHash(pPdb, &hashSize);
+    EnumerateGsiHash(pPdb, hash, hashSize, callback, context);
+}
+
+// Decodes a numeric leaf. Returns the number of bytes it takes, or 0 if it is malformed.
+static DWORD ReadNumericLeaf(const BYTE* p, const BYTE* end, ULONGLONG* value)
+{
+    if (end - p < 2) return 0;
+    WORD leaf = ReadU16(p);
+    if (leaf < LF_NUMERIC) {
+        *value = leaf;
+        return 2;
+    }
+
+    DWORD size;
+    switch (leaf) {
+    case LF_CHAR: size = 1; break;
+    case LF_SHORT: case LF_USHORT: size = 2; break;
+    case LF_LONG: case LF_ULONG: size = 4; break;
+    case LF_QUADWORD: case LF_UQUADWORD: size = 8; break;
+    default: return 0;
+    }
+    if (end - p < 2 + (ptrdiff_t)size) return 0;
+
+    *value = 0;
+    memcpy(value, p + 2, size);
+    return 2 + size;
+}
+
+Error PdbEnumerateTypes(const struct PdbFile* pPdb, PdbTypeCallback callback, void* context)
+{
+    struct PdbStream tpi;
+    Error e = LoadPdbStream(pPdb, PDB_STREAM_TPI, &tpi);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+
+    do {
+        if (tpi.size < 8 || ReadU32(tpi.data + 4) > tpi.size) {
+            e = NewError(__FUNCTION__, -2, L"TPI stream header is truncated", 0);
+            break;
+        }
+
+        const BYTE* end = tpi.data + tpi.size;
+        for (const BYTE* record = tpi.data + ReadU32(tpi.data + 4); end - record >= 4; record += 2 + ReadU16(record)) {
+            const BYTE* recordEnd = record + 2 + ReadU16(record);
+            if (recordEnd > end) break;
+
+            // struct and class: count, properties, field list, derived list, vtable shape, then the size and name;
+            // union: count, properties, field list, then the size and name
+            WORD kind = ReadU16(record + 2);
+            DWORD sizeOffset;
+            if (kind == LF_STRUCTURE || kind == LF_CLASS) sizeOffset = 20;
+            else if (kind == LF_UNION) sizeOffset = 12;
+            else continue;
+            if (recordEnd - record < (ptrdiff_t)sizeOffset || (ReadU16(record + 6) & TYPE_PROPERTY_FWDREF)) continue;
+
+            ULONGLONG size;
+            DWORD leafLength = ReadNumericLeaf(record + sizeOffset, recordEnd, &size);
+            if (!leafLength) continue;
+            const char* name = (const char*)record + sizeOffset + leafLength;
+            size_t maxLength = (size_t)(recordEnd - (const BYTE*)name);
+            if (strnlen(name, maxLength) == maxLength) continue;
+
+            if (!callback(context, name, (DWORD)size)) break;
+        }
+    } while (FALSE);
+
+    FreePdbStream(&tpi);
+    return e;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "Image.h"
+
+// Well known stream indices of a PDB 7.0 file
+#define PDB_STREAM_INFO 1
+#define PDB_STREAM_TPI 2
+#define PDB_STREAM_DBI 3
+#define PDB_NIL_STREAM 0xFFFF
+
+typedef enum PdbSymbolKind {
+    PDB_SYMBOL_NONE,
+    PDB_SYMBOL_FUNCTION,    // procedure from a module stream, size is known
+    PDB_SYMBOL_PUBLIC,      // public symbol, size is unknown
+    PDB_SYMBOL_DATA,        // global or static data
+    PDB_SYMBOL_TYPE         // struct, class or union, only the size is set
+} PdbSymbolKind;
+
+typedef struct PdbSymbol {
+    DWORD rva;
+    DWORD size;
+    PdbSymbolKind kind;
+} PdbSymbol;
+
+// A stream's contents. `data` either points straight into the mapping, when the stream's blocks happen to be
+// contiguous, or into `owned`.
+typedef struct PdbStream {
+    const BYTE* data;
+    DWORD size;
+    BYTE* owned;
+} PdbStream;
+
+/*
+ * A read-only PDB (MSF 7.0) reader. Only the stream directory and the DBI, publics, globals, symbol record and
+ * section header streams are loaded; module streams are read on demand. After OpenPdbFile the object is never
+ * modified, so it can be queried from many threads at once.
+ */
+typedef struct PdbFile {
+    struct FileMapping file;
+    DWORD blockSize;
+    DWORD numBlocks;
+    DWORD numStreams;
+    BYTE* directory;                // copy of the stream directory
+    const DWORD* streamSizes;
+    const DWORD** streamBlocks;     // block list of every stream, pointing into `directory`
+
+    GUID guid;                      // from the PDB info stream
+    DWORD age;
+    DWORD dbiAge;                   // age recorded in the DBI stream, which images usually carry
+
+    WORD* moduleStreams;            // symbol stream index of every module, in module order
+    DWORD numModules;
+
+    struct PdbStream symRecords;    // records referenced by the globals and publics hash tables
+    struct PdbStream globals;       // globals stream, a GSI hash table
+    struct PdbStream publics;       // publics stream, a publics header followed by a GSI hash table
+    struct PdbStream sectionHeaders;
+} PdbFile;
+
+// Maps the PDB file and loads the stream directory and symbol streams. Free after use with ClosePdbFile.
+Error OpenPdbFile(LPCWSTR pdbPath, struct PdbFile* pPdb);
+void ClosePdbFile(struct PdbFile* pPdb);
+
+// Reads only the GUID and ages of a PDB, without loading any symbol stream.
+Error ReadPdbIdentity(LPCWSTR pdbPath, GUID* guid, DWORD* age, DWORD* dbiAge);
+
+// Copies `length` bytes at `offset` of a stream. Returns FALSE if the range is outside of the stream.
+BOOL ReadPdbStream(const struct PdbFile* pPdb, DWORD streamIndex, DWORD offset, void* buffer, DWORD length);
+
+// Loads a whole stream, without copying when its blocks are contiguous. Free after use with FreePdbStream.
+Error LoadPdbStream(const struct PdbFile* pPdb, DWORD streamIndex, struct PdbStream* pStream);
+void FreePdbStream(struct PdbStream* pStream);
+
+// Translates a section:offset address to an RVA using the PDB's copy of the section headers.
+BOOL PdbSectionOffsetToRva(const struct PdbFile* pPdb, WORD section, DWORD offset, DWORD* rva);
+
+// Resolves a symbol through the globals and publics hash tables. Procedures are preferred because their size is known.
+BOOL PdbFindSymbol(const struct PdbFile* pPdb, const char* name, struct PdbSymbol* pSymbol);
+
+// Callbacks for the enumeration functions below. Return FALSE to stop the enumeration.
+typedef BOOL (*PdbSymbolCallback)(void* context, const char* name, const struct PdbSymbol* pSymbol);
+typedef BOOL (*PdbTypeCallback)(void* context, const char* name, DWORD size);
+
+// Calls `callback` for every procedure, data and public symbol reachable from the globals and publics hash tables.
+// A name can be reported more than once, e.g. as a procedure and as a public.
+void PdbEnumerateSymbols(const struct PdbFile* pPdb, PdbSymbolCallback callback, void* context);
+
+// Calls `callback` with the name and size of every complete struct, class and union in the TPI stream.
+Error PdbEnumerateTypes(const struct PdbFile* pPdb, PdbTypeCallback callback, void* context);
@@ -0,0 +1,190 @@
+#include "Platform.h"
+#include "Stats.h"
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+// Converts a wide string to a heap allocated UTF-8 string. Free after use with free.
+char* WideToUtf8(const wchar_t* wide) {
+#ifdef _WIN32
+    int size = WideCharToMultiByte(CP_UTF8, 0, wide, -1, NULL, 0, NULL, NULL);
+    if (size <= 0) return NULL;
+    char* out = (char*)malloc(size);
+    if (out && !WideCharToMultiByte(CP_UTF8, 0, wide, -1, out, size, NULL, NULL)) {
+        free(out);
+        return NULL;
+    }
+    return out;
+#else
+    // wchar_t is UTF-32 here, so every code point takes at most 4 bytes
+    size_t length = wcslen(wide);
+    char* out = (char*)malloc(length * 4 + 1);
+    if (!out) return NULL;
+
+    size_t n = 0;
+    for (size_t i = 0; i < length; i++) {
+        unsigned long cp = (unsigned long)wide[i];
+        if (cp < 0x80) {
+            out[n++] = (char)cp;
+        } else if (cp < 0x800) {
+            out[n++] = (char)(0xC0 | (cp >> 6));
+            out[n++] = (char)(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            out[n++] = (char)(0xE0 | (cp >> 12));
+            out[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+            out[n++] = (char)(0x80 | (cp & 0x3F));
+        } else {
+            out[n++] = (char)(0xF0 | (cp >> 18));
+            out[n++] = (char)(0x80 | ((cp >> 12) & 0x3F));
+            out[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+            out[n++] = (char)(0x80 | (cp & 0x3F));
+        }
+    }
+    out[n] = '\0';
+    return out;
+#endif
+}
+
+// Converts a UTF-8 string to a heap allocated wide string. Free after use with free.
+wchar_t* Utf8ToWide(const char* utf8) {
+#ifdef _WIN32
+    int size = MultiByteToWideChar(CP_UTF8, 0, utf8, -1, NULL, 0);
+    if (size <= 0) return NULL;
+    wchar_t* out = (wchar_t*)malloc(size * sizeof(wchar_t));
+    if (out && !MultiByteToWideChar(CP_UTF8, 0, utf8, -1, out, size)) {
+        free(out);
+        return NULL;
+    }
+    return out;
+#else
+    size_t length = strlen(utf8);
+    wchar_t* out = (wchar_t*)malloc((length + 1) * sizeof(wchar_t));
+    if (!out) return NULL;
+
+    // invalid sequences are passed through byte by byte
+    size_t n = 0;
+    const unsigned char* s = (const unsigned char*)utf8;
+    for (size_t i = 0; i < length;) {
+        size_t extra = s[i] >= 0xF0 ? 3 : s[i] >= 0xE0 ? 2 : s[i] >= 0xC0 ? 1 : 0;
+        unsigned long cp = extra ? s[i] & (0x3F >> extra) : s[i];
+        size_t j = 1;
+        for (; j <= extra && i + j < length && (s[i + j] & 0xC0) == 0x80; j++) cp = (cp << 6) | (s[i + j] & 0x3F);
+        if (j <= extra) {
+            cp = s[i];
+            j = 1;
+        }
+        out[n++] = (wchar_t)cp;
+        i += j;
+    }
+    out[n] = L'\0';
+    return out;
+#endif
+}
+
+// Opens a file by wide path with fopen semantics.
+FILE* OpenFileW(LPCWSTR path, const char* mode) {
+    AddStatsCount(STATS_FILE_OPENS, 1);
+    AddStatsCount(STATS_SYSCALLS, 1);
+#ifdef _WIN32
+    wchar_t wideMode[8];
+    size_t i = 0;
+    for (; mode[i] && i + 1 < _countof(wideMode); i++) wideMode[i] = (wchar_t)mode[i];
+    wideMode[i] = L'\0';
+
+    FILE* file = NULL;
+    if (_wfopen_s(&file, path, wideMode) != 0) return NULL;
+    return file;
+#else
+    char* narrowPath = WideToUtf8(path);
+    if (!narrowPath) return NULL;
+    FILE* file = fopen(narrowPath, mode);
+    free(narrowPath);
+    return file;
+#endif
+}
+
+// Moves `from` over `to` in one step, so readers never observe a partially written file.
+BOOL ReplaceFileAtomic(LPCWSTR from, LPCWSTR to) {
+    AddStatsCount(STATS_SYSCALLS, 1);
+#ifdef _WIN32
+    return MoveFileExW(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    char* narrowFrom = WideToUtf8(from);
+    char* narrowTo = WideToUtf8(to);
+    BOOL result = narrowFrom && narrowTo && rename(narrowFrom, narrowTo) == 0;
+    free(narrowFrom);
+    free(narrowTo);
+    return result;
+#endif
+}
+
+BOOL WriteFileAtomic(LPCWSTR path, const void* data, size_t size) {
+    size_t pathLength = wcslen(path) + 5;
+    WCHAR* tempPath = (WCHAR*)malloc(pathLength * sizeof(WCHAR));
+    if (!tempPath) return FALSE;
+    swprintf_s(tempPath, pathLength, L"%ls.tmp", path);
+
+    BOOL result = FALSE;
+    FILE* file = OpenFileW(tempPath, "wb");
+    if (file) {
+        BOOL written = fwrite(data, 1, size, file) == size;
+        result = fclose(file) == 0 && written && ReplaceFileAtomic(tempPath, path);
+    }
+    free(tempPath);
+    return result;
+}
+
+// Creates one directory, treating an existing directory as success
+static BOOL CreateSingleDirectory(LPCWSTR path) {
+    AddStatsCount(STATS_SYSCALLS, 1);
+#ifdef _WIN32
+    return CreateDirectoryW(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    char* narrowPath = WideToUtf8(path);
+    BOOL result = narrowPath && (mkdir(narrowPath, 0755) == 0 || errno == EEXIST);
+    free(narrowPath);
+    return result;
+#endif
+}
+
+BOOL CreateDirectoryTree(LPCWSTR path) {
+    WCHAR* buffer = _wcsdup(path);
+    if (!buffer) return FALSE;
+
+    // create every prefix ending right before a separator, skipping the root and drive prefixes
+    BOOL result = TRUE;
+    for (WCHAR* p = buffer + 1; *p && result; p++) {
+        if (*p != L'\\' && *p != L'/') continue;
+        if (p[-1] == L':' || p[-1] == L'\\' || p[-1] == L'/') continue;
+        WCHAR separator = *p;
+        *p = L'\0';
+        result = CreateSingleDirectory(buffer);
+        *p = separator;
+    }
+    if (result) result = CreateSingleDirectory(buffer);
+    free(buffer);
+    return result;
+}
+
+BOOL RemoveFileW(LPCWSTR path) {
+    AddStatsCount(STATS_SYSCALLS, 1);
+#ifdef _WIN32
+    return DeleteFileW(path);
+#else
+    char* narrowPath = WideToUtf8(path);
+    BOOL result = narrowPath && remove(narrowPath) == 0;
+    free(narrowPath);
+    return result;
+#endif
+}
+
+BOOL ReserveArray(void** items, size_t* capacity, size_t needed, size_t itemSize, size_t initialCapacity) {
+    if (needed <= *capacity) return TRUE;
+    size_t newCapacity = *capacity ? *capacity * 2 : initialCapacity;
+    while (newCapacity < needed) newCapacity *= 2;
+    void* newItems = realloc(*items, newCapacity * itemSize);
+    if (!newItems) return FALSE;
+    *items = newItems;
+    *capacity = newCapacity;
+    return TRUE;
+}
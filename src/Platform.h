@@ -0,0 +1,253 @@
+#pragma once
+// Thin portability layer. On Windows this is just <Windows.h>; elsewhere it provides the handful of
+// Win32 types, secure CRT helpers and PE structures that the portable modules (image view, scanner)
+// rely on, so they can be built and benchmarked on Linux as well.
+#include <stdio.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <errno.h>
+
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef int64_t LONG64;
+typedef uint64_t ULONGLONG;
+typedef uint64_t DWORD64;
+typedef int BOOL;
+typedef char CHAR;
+typedef wchar_t WCHAR;
+typedef const wchar_t* LPCWSTR;
+typedef void* HANDLE;
+
+#define TRUE 1
+#define FALSE 0
+#define MAX_PATH 260
+#define MAXDWORD 0xffffffff
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+#define _TRUNCATE ((size_t)-1)
+#define _countof(a) (sizeof(a) / sizeof((a)[0]))
+#define __FUNCTION__ __func__
+#define _wcsdup wcsdup
+#define _wcsicmp wcscasecmp
+#define swprintf_s swprintf
+
+static inline DWORD GetLastError(void) { return (DWORD)errno; }
+
+// Interlocked operations are full barriers, as on Windows
+#define InterlockedIncrement(target) __sync_add_and_fetch((target), 1)
+#define InterlockedDecrement(target) __sync_sub_and_fetch((target), 1)
+#define InterlockedExchangeAdd(target, value) __sync_fetch_and_add((target), (value))
+#define InterlockedExchangeAdd64(target, value) __sync_fetch_and_add((target), (value))
+#define InterlockedExchange(target, value) (__sync_synchronize(), __sync_lock_test_and_set((target), (value)))
+#define InterlockedCompareExchange(target, exchange, comparand) __sync_val_compare_and_swap((target), (comparand), (exchange))
+
+static inline int strcpy_s(char* dst, size_t dstSize, const char* src) {
+    size_t len = strlen(src);
+    if (len >= dstSize) return ERANGE;
+    memcpy(dst, src, len + 1);
+    return 0;
+}
+
+static inline int mbstowcs_s(size_t* converted, wchar_t* dst, size_t dstSize, const char* src, size_t count) {
+    size_t n = 0;
+    (void)count;
+    while (src[n] && n + 1 < dstSize) {
+        dst[n] = (wchar_t)(unsigned char)src[n];
+        n++;
+    }
+    dst[n] = L'\0';
+    if (converted) *converted = n + 1;
+    return 0;
+}
+
+typedef struct _GUID {
+    DWORD Data1;
+    WORD Data2;
+    WORD Data3;
+    BYTE Data4[8];
+} GUID;
+
+#define IMAGE_DOS_SIGNATURE 0x5A4D
+#define IMAGE_NT_SIGNATURE 0x00004550
+#define IMAGE_NT_OPTIONAL_HDR64_MAGIC 0x20B
+#define IMAGE_NUMBEROF_DIRECTORY_ENTRIES 16
+#define IMAGE_SIZEOF_SHORT_NAME 8
+#define IMAGE_DIRECTORY_ENTRY_EXPORT 0
+#define IMAGE_DIRECTORY_ENTRY_EXCEPTION 3
+#define IMAGE_DIRECTORY_ENTRY_BASERELOC 5
+#define IMAGE_DIRECTORY_ENTRY_DEBUG 6
+#define IMAGE_REL_BASED_ABSOLUTE 0
+#define IMAGE_REL_BASED_HIGHLOW 3
+#define IMAGE_REL_BASED_DIR64 10
+#define IMAGE_DEBUG_TYPE_CODEVIEW 2
+#define IMAGE_FILE_MACHINE_AMD64 0x8664
+#define IMAGE_FILE_EXECUTABLE_IMAGE 0x0002
+#define IMAGE_FILE_LARGE_ADDRESS_AWARE 0x0020
+#define IMAGE_SUBSYSTEM_WINDOWS_CUI 3
+#define IMAGE_SCN_CNT_CODE 0x00000020
+#define IMAGE_SCN_CNT_INITIALIZED_DATA 0x00000040
+#define IMAGE_SCN_MEM_EXECUTE 0x20000000
+#define IMAGE_SCN_MEM_READ 0x40000000
+#define IMAGE_SCN_MEM_WRITE 0x80000000
+
+typedef struct _IMAGE_DOS_HEADER {
+    WORD e_magic;
+    WORD e_cblp;
+    WORD e_cp;
+    WORD e_crlc;
+    WORD e_cparhdr;
+    WORD e_minalloc;
+    WORD e_maxalloc;
+    WORD e_ss;
+    WORD e_sp;
+    WORD e_csum;
+    WORD e_ip;
+    WORD e_cs;
+    WORD e_lfarlc;
+    WORD e_ovno;
+    WORD e_res[4];
+    WORD e_oemid;
+    WORD e_oeminfo;
+    WORD e_res2[10];
+    LONG e_lfanew;
+} IMAGE_DOS_HEADER;
+
+typedef struct _IMAGE_FILE_HEADER {
+    WORD Machine;
+    WORD NumberOfSections;
+    DWORD TimeDateStamp;
+    DWORD PointerToSymbolTable;
+    DWORD NumberOfSymbols;
+    WORD SizeOfOptionalHeader;
+    WORD Characteristics;
+} IMAGE_FILE_HEADER;
+
+typedef struct _IMAGE_DATA_DIRECTORY {
+    DWORD VirtualAddress;
+    DWORD Size;
+} IMAGE_DATA_DIRECTORY;
+
+typedef struct _IMAGE_OPTIONAL_HEADER64 {
+    WORD Magic;
+    BYTE MajorLinkerVersion;
+    BYTE MinorLinkerVersion;
+    DWORD SizeOfCode;
+    DWORD SizeOfInitializedData;
+    DWORD SizeOfUninitializedData;
+    DWORD AddressOfEntryPoint;
+    DWORD BaseOfCode;
+    ULONGLONG ImageBase;
+    DWORD SectionAlignment;
+    DWORD FileAlignment;
+    WORD MajorOperatingSystemVersion;
+    WORD MinorOperatingSystemVersion;
+    WORD MajorImageVersion;
+    WORD MinorImageVersion;
+    WORD MajorSubsystemVersion;
+    WORD MinorSubsystemVersion;
+    DWORD Win32VersionValue;
+    DWORD SizeOfImage;
+    DWORD SizeOfHeaders;
+    DWORD CheckSum;
+    WORD Subsystem;
+    WORD DllCharacteristics;
+    ULONGLONG SizeOfStackReserve;
+    ULONGLONG SizeOfStackCommit;
+    ULONGLONG SizeOfHeapReserve;
+    ULONGLONG SizeOfHeapCommit;
+    DWORD LoaderFlags;
+    DWORD NumberOfRvaAndSizes;
+    IMAGE_DATA_DIRECTORY DataDirectory[IMAGE_NUMBEROF_DIRECTORY_ENTRIES];
+} IMAGE_OPTIONAL_HEADER64;
+
+typedef struct _IMAGE_NT_HEADERS64 {
+    DWORD Signature;
+    IMAGE_FILE_HEADER FileHeader;
+    IMAGE_OPTIONAL_HEADER64 OptionalHeader;
+} IMAGE_NT_HEADERS64;
+
+typedef struct _IMAGE_SECTION_HEADER {
+    BYTE Name[IMAGE_SIZEOF_SHORT_NAME];
+    union {
+        DWORD PhysicalAddress;
+        DWORD VirtualSize;
+    } Misc;
+    DWORD VirtualAddress;
+    DWORD SizeOfRawData;
+    DWORD PointerToRawData;
+    DWORD PointerToRelocations;
+    DWORD PointerToLinenumbers;
+    WORD NumberOfRelocations;
+    WORD NumberOfLinenumbers;
+    DWORD Characteristics;
+} IMAGE_SECTION_HEADER;
+
+typedef struct _IMAGE_DEBUG_DIRECTORY {
+    DWORD Characteristics;
+    DWORD TimeDateStamp;
+    WORD MajorVersion;
+    WORD MinorVersion;
+    DWORD Type;
+    DWORD SizeOfData;
+    DWORD AddressOfRawData;
+    DWORD PointerToRawData;
+} IMAGE_DEBUG_DIRECTORY;
+
+typedef struct _IMAGE_BASE_RELOCATION {
+    DWORD VirtualAddress;
+    DWORD SizeOfBlock;
+} IMAGE_BASE_RELOCATION;
+
+typedef struct _IMAGE_EXPORT_DIRECTORY {
+    DWORD Characteristics;
+    DWORD TimeDateStamp;
+    WORD MajorVersion;
+    WORD MinorVersion;
+    DWORD Name;
+    DWORD Base;
+    DWORD NumberOfFunctions;
+    DWORD NumberOfNames;
+    DWORD AddressOfFunctions;
+    DWORD AddressOfNames;
+    DWORD AddressOfNameOrdinals;
+} IMAGE_EXPORT_DIRECTORY;
+
+// x64 .pdata entry; Windows names the last field in a union with UnwindData
+typedef struct _IMAGE_RUNTIME_FUNCTION_ENTRY {
+    DWORD BeginAddress;
+    DWORD EndAddress;
+    DWORD UnwindInfoAddress;
+} IMAGE_RUNTIME_FUNCTION_ENTRY;
+#endif
+
+// Converts a wide string to a heap allocated UTF-8 string. Free after use with free.
+char* WideToUtf8(const wchar_t* wide);
+// Converts a UTF-8 string to a heap allocated wide string. Free after use with free.
+wchar_t* Utf8ToWide(const char* utf8);
+
+// Opens a file by wide path with fopen semantics.
+FILE* OpenFileW(LPCWSTR path, const char* mode);
+
+// Moves `from` over `to` in one step, so readers never observe a partially written file.
+BOOL ReplaceFileAtomic(LPCWSTR from, LPCWSTR to);
+
+// Writes `size` bytes to `<path>.tmp` and moves that over `path` with ReplaceFileAtomic, for cache and database files.
+BOOL WriteFileAtomic(LPCWSTR path, const void* data, size_t size);
+
+// Creates a directory and any missing parent directories. Succeeds if it already exists.
+BOOL CreateDirectoryTree(LPCWSTR path);
+
+// Deletes a file by wide path.
+BOOL RemoveFileW(LPCWSTR path);
+
+// Grows a realloc'ed array so that `needed` items fit, doubling its capacity and starting at `initialCapacity`.
+// Returns FALSE, with the array untouched, if out of memory.
+BOOL ReserveArray(void** items, size_t* capacity, size_t needed, size_t itemSize, size_t initialCapacity);
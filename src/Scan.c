@@ -0,0 +1,284 @@
+#include "Scan.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define SCAN_X64
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SCAN_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define SCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+typedef size_t (*ScanFindNextFn)(const BYTE* data, size_t dataLength, const BYTE* pattern, size_t patternLength, size_t start);
+typedef size_t (*ScanFindNextMaskedFn)(const BYTE* data, size_t dataLength, const BYTE* pattern, const BYTE* mask, size_t patternLength, size_t start);
+
+static size_t FindNextScalar(const BYTE* data, size_t dataLength, const BYTE* pattern, size_t patternLength, size_t start)
+{
+    BYTE first = pattern[0];
+    for (size_t i = start; i + patternLength <= dataLength; i++) {
+        const BYTE* candidate = (const BYTE*)memchr(data + i, first, dataLength - patternLength + 1 - i);
+        if (!candidate) break;
+        i = (size_t)(candidate - data);
+        if (memcmp(candidate + 1, pattern + 1, patternLength - 1) == 0) return i;
+    }
+    return SCAN_NOT_FOUND;
+}
+
+// Compares eight bytes at a time; a byte matches when it agrees with the pattern on every bit set in its mask byte
+static BOOL MatchesMasked(const BYTE* data, const BYTE* pattern, const BYTE* mask, size_t length)
+{
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        ULONGLONG dataWord, patternWord, maskWord;
+        memcpy(&dataWord, data + i, 8);
+        memcpy(&patternWord, pattern + i, 8);
+        memcpy(&maskWord, mask + i, 8);
+        if ((dataWord ^ patternWord) & maskWord) return FALSE;
+    }
+    for (; i < length; i++) {
+        if ((data[i] ^ pattern[i]) & mask[i]) return FALSE;
+    }
+    return TRUE;
+}
+
+// The masked kernels filter candidates on the first and last fully compared bytes, the way the exact kernels use the
+// first and last byte. Returns FALSE if the pattern is all wildcards.
+static BOOL FindMaskAnchors(const BYTE* mask, size_t patternLength, size_t* first, size_t* last)
+{
+    size_t i = 0;
+    while (i < patternLength && mask[i] != 0xFF) i++;
+    if (i == patternLength) return FALSE;
+    *first = i;
+    for (i = patternLength - 1; mask[i] != 0xFF; i--);
+    *last = i;
+    return TRUE;
+}
+
+static size_t FindNextMaskedScalar(const BYTE* data, size_t dataLength, const BYTE* pattern, const BYTE* mask, size_t patternLength, size_t start)
+{
+    size_t first, last;
+    if (!FindMaskAnchors(mask, patternLength, &first, &last)) return start;
+
+    for (size_t i = start; i + patternLength <= dataLength; i++) {
+        const BYTE* candidate = (const BYTE*)memchr(data + i + first, pattern[first], dataLength - patternLength + 1 - i);
+        if (!candidate) break;
+        i = (size_t)(candidate - data) - first;
+        if (MatchesMasked(data + i, pattern, mask, patternLength)) return i;
+    }
+    return SCAN_NOT_FOUND;
+}
+
+#ifdef SCAN_X64
+static unsigned CountTrailingZeros(unsigned mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+// Compares the first and last byte of the pattern against 16 positions at a time and only runs memcmp on the
+// positions where both agree.
+static size_t FindNextSse2(const BYTE* data, size_t dataLength, const BYTE* pattern, size_t patternLength, size_t start)
+{
+    if (patternLength < 2) return FindNextScalar(data, dataLength, pattern, patternLength, start);
+
+    const __m128i first = _mm_set1_epi8((char)pattern[0]);
+    const __m128i last = _mm_set1_epi8((char)pattern[patternLength - 1]);
+    size_t i = start;
+    for (; i + patternLength - 1 + 16 <= dataLength; i += 16) {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i blockLast = _mm_loadu_si128((const __m128i*)(data + i + patternLength - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(blockFirst, first), _mm_cmpeq_epi8(blockLast, last)));
+        while (mask) {
+            unsigned bit = CountTrailingZeros(mask);
+            if (memcmp(data + i + bit + 1, pattern + 1, patternLength - 2) == 0) return i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return FindNextScalar(data, dataLength, pattern, patternLength, i);
+}
+
+SCAN_TARGET_AVX2
+static size_t FindNextAvx2(const BYTE* data, size_t dataLength, const BYTE* pattern, size_t patternLength, size_t start)
+{
+    if (patternLength < 2) return FindNextScalar(data, dataLength, pattern, patternLength, start);
+
+    const __m256i first = _mm256_set1_epi8((char)pattern[0]);
+    const __m256i last = _mm256_set1_epi8((char)pattern[patternLength - 1]);
+    size_t i = start;
+    for (; i + patternLength - 1 + 32 <= dataLength; i += 32) {
+        __m256i blockFirst = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i blockLast = _mm256_loadu_si256((const __m256i*)(data + i + patternLength - 1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(blockFirst, first), _mm256_cmpeq_epi8(blockLast, last)));
+        while (mask) {
+            unsigned bit = CountTrailingZeros(mask);
+            if (memcmp(data + i + bit + 1, pattern + 1, patternLength - 2) == 0) return i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return FindNextSse2(data, dataLength, pattern, patternLength, i);
+}
+
+static size_t FindNextMaskedSse2(const BYTE* data, size_t dataLength, const BYTE* pattern, const BYTE* mask, size_t patternLength, size_t start)
+{
+    size_t first, last;
+    if (!FindMaskAnchors(mask, patternLength, &first, &last)) return start;
+
+    const __m128i firstByte = _mm_set1_epi8((char)pattern[first]);
+    const __m128i lastByte = _mm_set1_epi8((char)pattern[last]);
+    size_t i = start;
+    for (; i + last + 16 <= dataLength; i += 16) {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i*)(data + i + first));
+        __m128i blockLast = _mm_loadu_si128((const __m128i*)(data + i + last));
+        unsigned candidates = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(blockFirst, firstByte), _mm_cmpeq_epi8(blockLast, lastByte)));
+        while (candidates) {
+            size_t position = i + CountTrailingZeros(candidates);
+            // trailing wildcards may still run past the end of the data
+            if (position + patternLength <= dataLength && MatchesMasked(data + position, pattern, mask, patternLength)) return position;
+            candidates &= candidates - 1;
+        }
+    }
+    return FindNextMaskedScalar(data, dataLength, pattern, mask, patternLength, i);
+}
+
+SCAN_TARGET_AVX2
+static size_t FindNextMaskedAvx2(const BYTE* data, size_t dataLength, const BYTE* pattern, const BYTE* mask, size_t patternLength, size_t start)
+{
+    size_t first, last;
+    if (!FindMaskAnchors(mask, patternLength, &first, &last)) return start;
+
+    const __m256i firstByte = _mm256_set1_epi8((char)pattern[first]);
+    const __m256i lastByte = _mm256_set1_epi8((char)pattern[last]);
+    size_t i = start;
+    for (; i + last + 32 <= dataLength; i += 32) {
+        __m256i blockFirst = _mm256_loadu_si256((const __m256i*)(data + i + first));
+        __m256i blockLast = _mm256_loadu_si256((const __m256i*)(data + i + last));
+        unsigned candidates = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(blockFirst, firstByte), _mm256_cmpeq_epi8(blockLast, lastByte)));
+        while (candidates) {
+            size_t position = i + CountTrailingZeros(candidates);
+            if (position + patternLength <= dataLength && MatchesMasked(data + position, pattern, mask, patternLength)) return position;
+            candidates &= candidates - 1;
+        }
+    }
+    return FindNextMaskedSse2(data, dataLength, pattern, mask, patternLength, i);
+}
+
+static BOOL CpuSupportsAvx2(void)
+{
+    unsigned regs[4] = { 0 };
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return FALSE;
+    __cpuid(info, 1);
+    BOOL osxsave = (info[2] & (1 << 27)) != 0;
+    __cpuidex(info, 7, 0);
+    regs[1] = (unsigned)info[1];
+    if (!osxsave) return FALSE;
+    unsigned long long xcr0 = _xgetbv(0);
+#else
+    if (__get_cpuid_max(0, NULL) < 7) return FALSE;
+    __get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]);
+    if (!(regs[2] & (1u << 27))) return FALSE;
+    unsigned xcr0Low, xcr0High;
+    __asm__ volatile("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+    unsigned long long xcr0 = ((unsigned long long)xcr0High << 32) | xcr0Low;
+    __get_cpuid_count(7, 0, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+    // the OS has to save the XMM and YMM state, and CPUID.7:EBX bit 5 reports AVX2
+    return (xcr0 & 0x6) == 0x6 && (regs[1] & (1u << 5)) != 0;
+}
+#endif
+
+static ScanKernel g_ScanKernel = SCAN_KERNEL_AUTO;
+static ScanFindNextFn g_FindNext = NULL;
+static ScanFindNextMaskedFn g_FindNextMasked = NULL;
+
+static ScanKernel DetectScanKernel(void)
+{
+#ifdef SCAN_X64
+    return CpuSupportsAvx2() ? SCAN_KERNEL_AVX2 : SCAN_KERNEL_SSE2;
+#else
+    return SCAN_KERNEL_SCALAR;
+#endif
+}
+
+BOOL SetScanKernel(ScanKernel kernel)
+{
+    ScanKernel best = DetectScanKernel();
+    if (kernel == SCAN_KERNEL_AUTO) kernel = best;
+    if (kernel > best) return FALSE;
+
+    switch (kernel) {
+#ifdef SCAN_X64
+    case SCAN_KERNEL_AVX2: g_FindNext = FindNextAvx2; g_FindNextMasked = FindNextMaskedAvx2; break;
+    case SCAN_KERNEL_SSE2: g_FindNext = FindNextSse2; g_FindNextMasked = FindNextMaskedSse2; break;
+#endif
+    default: g_FindNext = FindNextScalar; g_FindNextMasked = FindNextMaskedScalar; break;
+    }
+    g_ScanKernel = kernel;
+    return TRUE;
+}
+
+ScanKernel GetScanKernel(void)
+{
+    if (!g_FindNext) SetScanKernel(SCAN_KERNEL_AUTO);
+    return g_ScanKernel;
+}
+
+const char* GetScanKernelName(ScanKernel kernel)
+{
+    switch (kernel) {
+    case SCAN_KERNEL_SCALAR: return "scalar";
+    case SCAN_KERNEL_SSE2: return "sse2";
+    case SCAN_KERNEL_AVX2: return "avx2";
+    default: return "auto";
+    }
+}
+
+size_t ScanFindNext(const BYTE* data, size_t dataLength, const BYTE* pattern, size_t patternLength, size_t start)
+{
+    if (patternLength == 0 || patternLength > dataLength || start > dataLength - patternLength) return SCAN_NOT_FOUND;
+    if (!g_FindNext) SetScanKernel(SCAN_KERNEL_AUTO);
+    return g_FindNext(data, dataLength, pattern, patternLength, start);
+}
+
+size_t ScanCountMatches(const BYTE* data, size_t dataLength, const BYTE* pattern, size_t patternLength, size_t maxMatches)
+{
+    size_t count = 0;
+    if (maxMatches == 0) return 0;
+
+    size_t position = ScanFindNext(data, dataLength, pattern, patternLength, 0);
+    while (position != SCAN_NOT_FOUND) {
+        if (++count == maxMatches) break;
+        position = ScanFindNext(data, dataLength, pattern, patternLength, position + 1);
+    }
+    return count;
+}
+
+size_t ScanFindNextMasked(const BYTE* data, size_t dataLength, const BYTE* pattern, const BYTE* mask, size_t patternLength, size_t start)
+{
+    if (patternLength == 0 || patternLength > dataLength || start > dataLength - patternLength) return SCAN_NOT_FOUND;
+    if (!g_FindNextMasked) SetScanKernel(SCAN_KERNEL_AUTO);
+    return g_FindNextMasked(data, dataLength, pattern, mask, patternLength, start);
+}
+
+size_t ScanCountMatchesMasked(const BYTE* data, size_t dataLength, const BYTE* pattern, const BYTE* mask, size_t patternLength, size_t maxMatches)
+{
+    size_t count = 0;
+    if (maxMatches == 0) return 0;
+
+    size_t position = ScanFindNextMasked(data, dataLength, pattern, mask, patternLength, 0);
+    while (position != SCAN_NOT_FOUND) {
+        if (++count == maxMatches) break;
+        position = ScanFindNextMasked(data, dataLength, pattern, mask, patternLength, position + 1);
+    }
+    return count;
+}
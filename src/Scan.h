@@ -0,0 +1,27 @@
+#pragma once
+#include "Platform.h"
+
+#define SCAN_NOT_FOUND ((size_t)-1)
+
+// Implementations of the substring search kernel. SCAN_KERNEL_AUTO picks the best one supported by the CPU.
+typedef enum ScanKernel {
+    SCAN_KERNEL_AUTO,
+    SCAN_KERNEL_SCALAR,
+    SCAN_KERNEL_SSE2,
+    SCAN_KERNEL_AVX2
+} ScanKernel;
+
+// Forces a kernel, e.g. to compare implementations in benchmarks. Returns FALSE if the CPU does not support it.
+BOOL SetScanKernel(ScanKernel kernel);
+ScanKernel GetScanKernel(void);
+const char* GetScanKernelName(ScanKernel kernel);
+
+// Returns the index of the first occurrence of the pattern at or after `start`, or SCAN_NOT_FOUND.
+size_t ScanFindNext(const BYTE* data, size_t dataLength, const BYTE* pattern, size_t patternLength, size_t start);
+
+// Counts occurrences of the pattern, stopping as soon as `maxMatches` have been found.
+size_t ScanCountMatches(const BYTE* data, size_t dataLength, const BYTE* pattern, size_t patternLength, size_t maxMatches);
+
+// Masked variants: a pattern byte is only compared where its mask byte is 0xFF, a 0x00 mask byte is a wildcard.
+size_t ScanFindNextMasked(const BYTE* data, size_t dataLength, const BYTE* pattern, const BYTE* mask, size_t patternLength, size_t start);
+size_t ScanCountMatchesMasked(const BYTE* data, size_t dataLength, const BYTE* pattern, const BYTE* mask, size_t patternLength, size_t maxMatches);
@@ -0,0 +1,147 @@
+#include "ScanScope.h"
+
+// Matches the section's 8 byte name against each entry of the comma separated list
+static BOOL IsSelectedSection(const IMAGE_SECTION_HEADER* section, LPCWSTR sectionNames)
+{
+    if (!sectionNames)
+        return (section->Characteristics & IMAGE_SCN_MEM_EXECUTE) != 0;
+
+    const WCHAR* name = sectionNames;
+    while (*name) {
+        size_t length = wcscspn(name, L",");
+        BOOL matches = length > 0 && length <= IMAGE_SIZEOF_SHORT_NAME;
+        for (size_t i = 0; matches && i < IMAGE_SIZEOF_SHORT_NAME; i++) {
+            WCHAR expected = i < length ? name[i] : L'\0';
+            if ((WCHAR)section->Name[i] != expected) matches = FALSE;
+        }
+        if (matches) return TRUE;
+
+        name += length;
+        if (*name == L',') name++;
+    }
+    return FALSE;
+}
+
+static DWORD GetVirtualLength(const IMAGE_SECTION_HEADER* section)
+{
+    return section->Misc.VirtualSize ? section->Misc.VirtualSize : section->SizeOfRawData;
+}
+
+// In the loaded layout every part of the section that is present in the input is a region of its own, pointing at
+// the input directly. Returns the number of regions, and only counts them when `regions` is NULL.
+static DWORD AddLoadedRegions(const struct ImageView* pImage, const IMAGE_SECTION_HEADER* section, struct ScanRegion* regions)
+{
+    ULONGLONG start = section->VirtualAddress;
+    ULONGLONG end = start + GetVirtualLength(section);
+    DWORD count = 0;
+    for (DWORD i = 0; i < pImage->numSegments; i++) {
+        const struct ImageSegment* segment = &pImage->segments[i];
+        ULONGLONG overlapStart = segment->rva > start ? segment->rva : start;
+        ULONGLONG overlapEnd = (ULONGLONG)segment->rva + segment->length < end ? (ULONGLONG)segment->rva + segment->length : end;
+        if (overlapStart >= overlapEnd) continue;
+
+        if (regions) {
+            struct ScanRegion* region = &regions[count];
+            memcpy(region->name, section->Name, IMAGE_SIZEOF_SHORT_NAME);
+            region->name[IMAGE_SIZEOF_SHORT_NAME] = '\0';
+            region->rva = (DWORD)overlapStart;
+            region->data = segment->data + (overlapStart - segment->rva);
+            region->length = (size_t)(overlapEnd - overlapStart);
+        }
+        count++;
+    }
+    return count;
+}
+
+Error CreateScanScope(const struct ImageView* pImage, LPCWSTR sectionNames, ScanLayout layout, struct ScanScope* pScope)
+{
+    memset(pScope, 0, sizeof(struct ScanScope));
+    pScope->layout = layout;
+
+    Error e = NewNoError();
+    do {
+        DWORD maxRegions = pImage->numSections;
+        if (pImage->layout == IMAGE_LAYOUT_LOADED) {
+            maxRegions = 0;
+            for (WORD i = 0; i < pImage->numSections; i++) {
+                if (IsSelectedSection(&pImage->sections[i], sectionNames))
+                    maxRegions += AddLoadedRegions(pImage, &pImage->sections[i], NULL);
+            }
+        }
+        pScope->regions = (struct ScanRegion*)calloc(maxRegions ? maxRegions : 1, sizeof(struct ScanRegion));
+        if (!pScope->regions) {
+            e = NewError(__FUNCTION__, -1, L"calloc failed; out of memory", 0);
+            break;
+        }
+
+        // sections that are longer in memory than in the file get a zero filled copy in the virtual layout
+        size_t virtualDataSize = 0;
+        for (WORD i = 0; i < pImage->numSections; i++) {
+            const IMAGE_SECTION_HEADER* section = &pImage->sections[i];
+            if (pImage->layout == IMAGE_LAYOUT_FILE && layout == SCAN_LAYOUT_VIRTUAL && IsSelectedSection(section, sectionNames) &&
+                GetVirtualLength(section) > GetSectionFileLength(pImage, section))
+                virtualDataSize += GetVirtualLength(section);
+        }
+        if (virtualDataSize) {
+            pScope->virtualData = (BYTE*)calloc(virtualDataSize, 1);
+            if (!pScope->virtualData) {
+                e = NewError(__FUNCTION__, -2, L"calloc failed; out of memory", 0);
+                break;
+            }
+        }
+
+        size_t virtualDataOffset = 0;
+        for (WORD i = 0; i < pImage->numSections; i++) {
+            const IMAGE_SECTION_HEADER* section = &pImage->sections[i];
+            if (!IsSelectedSection(section, sectionNames)) continue;
+
+            // a loaded image already is in the virtual layout, only with the pages missing from the input left out
+            if (pImage->layout == IMAGE_LAYOUT_LOADED) {
+                pScope->numRegions += AddLoadedRegions(pImage, section, &pScope->regions[pScope->numRegions]);
+                continue;
+            }
+
+            struct ScanRegion* region = &pScope->regions[pScope->numRegions];
+            memcpy(region->name, section->Name, IMAGE_SIZEOF_SHORT_NAME);
+            region->name[IMAGE_SIZEOF_SHORT_NAME] = '\0';
+            region->rva = section->VirtualAddress;
+
+            DWORD fileLength = GetSectionFileLength(pImage, section);
+            DWORD virtualLength = GetVirtualLength(section);
+            if (layout == SCAN_LAYOUT_VIRTUAL && virtualLength > fileLength) {
+                BYTE* sectionImage = pScope->virtualData + virtualDataOffset;
+                if (fileLength) memcpy(sectionImage, pImage->file.data + section->PointerToRawData, fileLength);
+                region->data = sectionImage;
+                region->length = virtualLength;
+                virtualDataOffset += virtualLength;
+            }
+            else {
+                region->data = pImage->file.data + section->PointerToRawData;
+                region->length = fileLength;
+            }
+            if (region->length) pScope->numRegions++;
+        }
+
+        if (pScope->numRegions == 0)
+            e = NewError(__FUNCTION__, -3, L"No section of the image is in the scan scope", 0);
+    } while (FALSE);
+
+    if (e.ContainsError) FreeScanScope(pScope);
+    return e;
+}
+
+void FreeScanScope(struct ScanScope* pScope)
+{
+    free(pScope->regions);
+    free(pScope->virtualData);
+    memset(pScope, 0, sizeof(struct ScanScope));
+}
+
+const struct ScanRegion* FindScanRegion(const struct ScanScope* pScope, DWORD rva)
+{
+    for (DWORD i = 0; i < pScope->numRegions; i++) {
+        const struct ScanRegion* region = &pScope->regions[i];
+        if (rva >= region->rva && rva - region->rva < region->length) return region;
+    }
+    return NULL;
+}
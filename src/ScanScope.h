@@ -0,0 +1,39 @@
+#pragma once
+#include "Image.h"
+#include "ThreadPool.h"
+
+// How section bytes are laid out for scanning
+typedef enum ScanLayout {
+    SCAN_LAYOUT_FILE,       // raw section data as stored in the file
+    SCAN_LAYOUT_VIRTUAL     // section images as mapped by the loader, zero filled up to the virtual size
+} ScanLayout;
+
+// One section of the image that uniqueness checks look at
+typedef struct ScanRegion {
+    CHAR name[IMAGE_SIZEOF_SHORT_NAME + 1];
+    DWORD rva;
+    const BYTE* data;
+    size_t length;
+    ULONGLONG bytesScanned;     // total bytes scanned in this region, over all scans
+    DWORD scans;
+} ScanRegion;
+
+/*
+ * The set of sections a signature has to be unique in. Matches never span two regions, like a scanner walking the
+ * sections of a loaded module one at a time.
+ */
+typedef struct ScanScope {
+    struct ScanRegion* regions;
+    DWORD numRegions;
+    ScanLayout layout;
+    BYTE* virtualData;          // backing store of the regions that are longer in memory than in the file
+    struct ThreadPool* pThreadPool; // scans are split over this pool, NULL scans on the calling thread only
+} ScanScope;
+
+// Selects the executable sections when `sectionNames` is NULL, or the sections named in the comma separated list,
+// e.g. L".text,PAGE". Free after use with FreeScanScope.
+Error CreateScanScope(const struct ImageView* pImage, LPCWSTR sectionNames, ScanLayout layout, struct ScanScope* pScope);
+void FreeScanScope(struct ScanScope* pScope);
+
+// Returns the region containing the RVA, or NULL if it is outside of the scope.
+const struct ScanRegion* FindScanRegion(const struct ScanScope* pScope, DWORD rva);
@@ -0,0 +1,597 @@
+#include "Server.h"
+#include <stdarg.h>
+
+#define SERVER_PIPE_BUFFER_SIZE (64 * 1024)
+
+// Another path the same build was requested under, so later requests on it skip mapping and parsing the file
+typedef struct ImageAlias {
+    WCHAR* path;
+    FILETIME lastWriteTime;
+    ULONGLONG fileSize;
+    struct ImageAlias* next;
+} ImageAlias;
+
+// An image with everything a signature request needs, shared by the requests on it
+typedef struct CachedImage {
+    WCHAR* path;
+    FILETIME lastWriteTime;     // the path only matches while the file is unchanged
+    ULONGLONG fileSize;
+    struct ImageAlias* aliases;
+    struct ImageView image;
+    struct ScanScope scope;     // requests scan a copy of the regions, so their byte counters do not race
+    struct PDBLookupContext ctx;
+    ULONGLONG memoryCost;
+    ULONGLONG lastUsed;
+    LONG references;
+    struct CachedImage* next;
+} CachedImage;
+
+typedef struct Server {
+    const struct ServerConfig* pConfig;
+    SRWLOCK lock;
+    struct CachedImage* images;
+    DWORD numImages;
+    ULONGLONG memoryUsed;
+    ULONGLONG tick;
+    volatile LONG64 requests;
+    volatile LONG64 hits;       // requests answered from an image already loaded
+    volatile LONG64 misses;     // requests that had to map an image and load its PDB
+    volatile LONG64 evictions;
+} Server;
+
+static void FreeCachedImage(struct CachedImage* entry)
+{
+    while (entry->aliases) {
+        struct ImageAlias* next = entry->aliases->next;
+        free(entry->aliases->path);
+        free(entry->aliases);
+        entry->aliases = next;
+    }
+    FreeScanScope(&entry->scope);
+    CleanupPDBLookupCtx(&entry->ctx);
+    UnmapImageView(&entry->image);
+    free(entry->path);
+    free(entry);
+}
+
+// What an entry keeps in memory: the mapped file, the zero filled section copies and the symbol index
+static ULONGLONG GetCachedImageCost(const struct CachedImage* entry)
+{
+    ULONGLONG cost = entry->image.file.size + sizeof(struct CachedImage);
+    if (entry->scope.virtualData)
+        for (DWORD i = 0; i < entry->scope.numRegions; i++) cost += entry->scope.regions[i].length;
+    const struct SymbolIndexHeader* header = entry->ctx.symbolIndex.header;
+    if (header) cost += sizeof(SymbolIndexHeader) + (ULONGLONG)header->numEntries * sizeof(SymbolIndexEntry) + header->stringsSize;
+    return cost;
+}
+
+// Drops the least recently used entries no request holds until the cache fits in the budget. Called under the lock.
+static void EvictCachedImages(struct Server* pServer)
+{
+    while (pServer->memoryUsed > pServer->pConfig->memoryBudget) {
+        struct CachedImage** victim = NULL;
+        for (struct CachedImage** link = &pServer->images; *link; link = &(*link)->next) {
+            if ((*link)->references == 0 && (!victim || (*link)->lastUsed < (*victim)->lastUsed))
+                victim = link;
+        }
+        if (!victim) break;
+
+        struct CachedImage* entry = *victim;
+        *victim = entry->next;
+        pServer->memoryUsed -= entry->memoryCost;
+        pServer->numImages--;
+        InterlockedExchangeAdd64(&pServer->evictions, 1);
+        fwprintf(stderr, L"[+] Evicted %s (%llu MB)\n", entry->path, entry->memoryCost / (1024 * 1024));
+        FreeCachedImage(entry);
+    }
+}
+
+static struct CachedImage* FindImageByPath(struct Server* pServer, LPCWSTR path, const FILETIME* lastWriteTime, ULONGLONG fileSize)
+{
+    for (struct CachedImage* entry = pServer->images; entry; entry = entry->next) {
+        if (entry->fileSize == fileSize && CompareFileTime(&entry->lastWriteTime, lastWriteTime) == 0 && _wcsicmp(entry->path, path) == 0)
+            return entry;
+        for (struct ImageAlias* alias = entry->aliases; alias; alias = alias->next) {
+            if (alias->fileSize == fileSize && CompareFileTime(&alias->lastWriteTime, lastWriteTime) == 0 && _wcsicmp(alias->path, path) == 0)
+                return entry;
+        }
+    }
+    return NULL;
+}
+
+static struct CachedImage* FindImageByBuild(struct Server* pServer, const GUID* guid, DWORD age)
+{
+    for (struct CachedImage* entry = pServer->images; entry; entry = entry->next) {
+        if (entry->ctx.pdbInfo.age == age && memcmp(&entry->ctx.pdbInfo.guid, guid, sizeof(GUID)) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+// Takes a reference on an entry found in the cache. Called under the lock.
+static struct CachedImage* UseCachedImage(struct Server* pServer, struct CachedImage* entry)
+{
+    entry->references++;
+    entry->lastUsed = ++pServer->tick;
+    InterlockedExchangeAdd64(&pServer->hits, 1);
+    return entry;
+}
+
+// Remembers the path of a copy of a cached build, taking over the copy's path. Called under the lock.
+static void AddImageAlias(struct Server* pServer, struct CachedImage* entry, struct CachedImage* copy)
+{
+    if (FindImageByPath(pServer, copy->path, &copy->lastWriteTime, copy->fileSize)) return;
+    struct ImageAlias* alias = (struct ImageAlias*)malloc(sizeof(struct ImageAlias));
+    // without the alias the path still works, it is only mapped again on each request
+    if (!alias) return;
+    alias->path = copy->path;
+    alias->lastWriteTime = copy->lastWriteTime;
+    alias->fileSize = copy->fileSize;
+    alias->next = entry->aliases;
+    entry->aliases = alias;
+    copy->path = NULL;
+}
+
+// Loads the image's symbol index, or fetches and parses its PDB, the same way a command line run does
+static Error LoadImageSymbols(const struct ServerConfig* pConfig, LPCWSTR pePath, struct PDBLookupContext* pCtx)
+{
+    WCHAR* cacheDir = NULL;
+    if (!pConfig->cacheDir) {
+        const WCHAR* lastSlash = wcsrchr(pePath, L'\\');
+        size_t folderLength = lastSlash ? lastSlash - pePath + 1 : 0;
+        size_t cacheDirLength = folderLength + 8;
+        cacheDir = (WCHAR*)malloc(cacheDirLength * sizeof(WCHAR));
+        if (!cacheDir)
+            return NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0);
+        swprintf_s(cacheDir, cacheDirLength, L"%.*ssymbols", (int)folderLength, pePath);
+    }
+
+    WCHAR* pdbPath = GetSymbolStorePath(cacheDir ? cacheDir : pConfig->cacheDir, pCtx->pdbInfo.pdbName, &pCtx->pdbInfo.guid, pCtx->pdbInfo.age);
+    free(cacheDir);
+    if (!pdbPath)
+        return NewError(__FUNCTION__, -2, L"malloc failed; out of memory", 0);
+
+    Error e = InitializePDBLookupFromIndex(pdbPath, pCtx);
+    if (e.ContainsError) {
+        Error_Free(&e);
+        struct DownloadStats stats;
+        e = FetchPDB(pCtx, pConfig->symbolServer ? pConfig->symbolServer : DEFAULT_SYMBOL_SERVER, pConfig->connections, pdbPath, &stats);
+        if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -3);
+        else {
+            e = InitializePDBLookup(pdbPath, pCtx);
+            if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -4);
+        }
+    }
+    free(pdbPath);
+    return e;
+}
+
+// Returns the cached entry of the image, loading it on a miss. Release it with ReleaseCachedImage.
+static Error AcquireCachedImage(struct Server* pServer, LPCWSTR pePath, struct CachedImage** ppEntry)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExW(pePath, GetFileExInfoStandard, &attributes))
+        return NewError(__FUNCTION__, -1, L"Image not found", GetLastError());
+    ULONGLONG fileSize = ((ULONGLONG)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+
+    AcquireSRWLockExclusive(&pServer->lock);
+    struct CachedImage* entry = FindImageByPath(pServer, pePath, &attributes.ftLastWriteTime, fileSize);
+    if (entry) *ppEntry = UseCachedImage(pServer, entry);
+    ReleaseSRWLockExclusive(&pServer->lock);
+    if (entry)
+        return NewNoError();
+
+    // the same build may already be loaded from another path, which is only known once its CodeView record is read
+    struct CachedImage* loaded = (struct CachedImage*)calloc(1, sizeof(struct CachedImage));
+    if (!loaded)
+        return NewError(__FUNCTION__, -2, L"calloc failed; out of memory", 0);
+    Error e = NewNoError();
+    do {
+        loaded->path = _wcsdup(pePath);
+        loaded->lastWriteTime = attributes.ftLastWriteTime;
+        loaded->fileSize = fileSize;
+        if (!loaded->path) {
+            e = NewError(__FUNCTION__, -3, L"_wcsdup failed; out of memory", 0);
+            break;
+        }
+        e = MapImageView(pePath, &loaded->image);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -4);
+            break;
+        }
+        e = GetPEInfo(&loaded->image, &loaded->ctx);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -5);
+            break;
+        }
+
+        AcquireSRWLockExclusive(&pServer->lock);
+        entry = FindImageByBuild(pServer, &loaded->ctx.pdbInfo.guid, loaded->ctx.pdbInfo.age);
+        if (entry) {
+            *ppEntry = UseCachedImage(pServer, entry);
+            AddImageAlias(pServer, entry, loaded);
+        }
+        ReleaseSRWLockExclusive(&pServer->lock);
+        if (entry) break;
+
+        e = CreateScanScope(&loaded->image, pServer->pConfig->sections, pServer->pConfig->virtualLayout ? SCAN_LAYOUT_VIRTUAL : SCAN_LAYOUT_FILE, &loaded->scope);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -6);
+            break;
+        }
+        e = LoadImageSymbols(pServer->pConfig, pePath, &loaded->ctx);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -7);
+            break;
+        }
+        loaded->memoryCost = GetCachedImageCost(loaded);
+
+        // another request may have loaded the same build meanwhile, then that copy wins
+        AcquireSRWLockExclusive(&pServer->lock);
+        entry = FindImageByBuild(pServer, &loaded->ctx.pdbInfo.guid, loaded->ctx.pdbInfo.age);
+        if (entry) {
+            *ppEntry = UseCachedImage(pServer, entry);
+            AddImageAlias(pServer, entry, loaded);
+        }
+        else {
+            loaded->references = 1;
+            loaded->lastUsed = ++pServer->tick;
+            loaded->next = pServer->images;
+            pServer->images = loaded;
+            pServer->numImages++;
+            pServer->memoryUsed += loaded->memoryCost;
+            InterlockedExchangeAdd64(&pServer->misses, 1);
+            EvictCachedImages(pServer);
+            *ppEntry = loaded;
+        }
+        ReleaseSRWLockExclusive(&pServer->lock);
+        if (!entry) {
+            fwprintf(stderr, L"[+] Loaded %s (%llu MB)\n", pePath, loaded->memoryCost / (1024 * 1024));
+            return NewNoError();
+        }
+    } while (FALSE);
+
+    FreeCachedImage(loaded);
+    return e;
+}
+
+static void ReleaseCachedImage(struct Server* pServer, struct CachedImage* entry)
+{
+    AcquireSRWLockExclusive(&pServer->lock);
+    entry->references--;
+    entry->lastUsed = ++pServer->tick;
+    EvictCachedImages(pServer);
+    ReleaseSRWLockExclusive(&pServer->lock);
+}
+
+// Appends printf style text to a reply, truncating at the end of the buffer. Returns FALSE if it was truncated.
+static BOOL AppendReply(char* reply, size_t replySize, const char* format, ...)
+{
+    size_t length = strlen(reply);
+    if (length + 1 >= replySize) return FALSE;
+    va_list args;
+    va_start(args, format);
+    int written = _vsnprintf_s(reply + length, replySize - length, _TRUNCATE, format, args);
+    va_end(args);
+    return written >= 0;
+}
+
+// Finds the unique signature of a function in the cached image. Scans run on the calling worker only.
+static void AnswerSignature(struct Server* pServer, char* pePath, char* functionName, DWORD signatureLength, BOOL wildcards, char* reply, size_t replySize)
+{
+    WCHAR* widePath = Utf8ToWide(pePath);
+    WCHAR* wideName = Utf8ToWide(functionName);
+    struct CachedImage* entry = NULL;
+    struct ScanRegion* regions = NULL;
+    BYTE* signature = NULL;
+    BYTE* mask = NULL;
+    BYTE* uniqueSignature = NULL;
+    BYTE* uniqueMask = NULL;
+    Error e = NewNoError();
+    do {
+        if (!widePath || !wideName) {
+            e = NewError(__FUNCTION__, -1, L"Utf8ToWide failed", 0);
+            break;
+        }
+        e = AcquireCachedImage(pServer, widePath, &entry);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -2);
+            break;
+        }
+
+        int functionRVA = GetFunctionRVA(wideName, &entry->ctx);
+        if (functionRVA < 0) {
+            e = NewError(__FUNCTION__, -3, L"Symbol not found in the PDB", 0);
+            break;
+        }
+        e = GetFunctionSignatureFromPE(&entry->image, signatureLength, functionRVA, &signature);
+        if (!e.ContainsError && wildcards)
+            e = GetFunctionSignatureMask(&entry->image, signatureLength, functionRVA, &mask);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -4);
+            break;
+        }
+
+        struct ScanScope scope = entry->scope;
+        regions = (struct ScanRegion*)malloc(scope.numRegions * sizeof(struct ScanRegion) + 1);
+        if (!regions) {
+            e = NewError(__FUNCTION__, -5, L"malloc failed; out of memory", 0);
+            break;
+        }
+        memcpy(regions, scope.regions, scope.numRegions * sizeof(struct ScanRegion));
+        scope.regions = regions;
+        scope.pThreadPool = NULL;
+
+        BOOL isUnique = TRUE;
+        DWORD uniqueLength = 0;
+        if (mask)
+            e = FindUniqueMaskedSignature(&entry->image, &scope, signature, mask, signatureLength, functionRVA, &isUnique, &uniqueSignature, &uniqueMask, &uniqueLength);
+        else
+            e = FindUniqueSignature(&entry->image, &scope, NULL, signature, signatureLength, functionRVA, &isUnique, &uniqueSignature, &uniqueLength);
+        if (e.ContainsError) {
+            e.AddFunctionToStack(&e, __FUNCTION__, -6);
+            break;
+        }
+
+        const BYTE* bytes = isUnique ? signature : uniqueSignature;
+        const BYTE* bytesMask = isUnique ? mask : uniqueMask;
+        DWORD length = isUnique ? signatureLength : uniqueLength;
+        sprintf_s(reply, replySize, "ok\t%s\t0x%08X\t%lu\t%s\t", functionName, functionRVA, length, isUnique ? "unique" : "extended");
+        BOOL fits = TRUE;
+        for (DWORD i = 0; fits && i < length; i++) {
+            if (!bytesMask) fits = AppendReply(reply, replySize, i + 1 < length ? "0x%02X, " : "0x%02X", bytes[i]);
+            else if (bytesMask[i]) fits = AppendReply(reply, replySize, i + 1 < length ? "%02X " : "%02X", bytes[i]);
+            else fits = AppendReply(reply, replySize, i + 1 < length ? "? " : "?");
+        }
+        // a cut off signature would look like a valid shorter one
+        if (!fits)
+            e = NewError(__FUNCTION__, -7, L"Signature is too long for a reply", 0);
+    } while (FALSE);
+
+    if (e.ContainsError) {
+        // the server runs for long, so the formatted message is freed unlike in one-shot runs
+        wchar_t* formatted = e.Format(&e);
+        char* message = formatted ? WideToUtf8(formatted) : NULL;
+        free(formatted);
+        sprintf_s(reply, replySize, "error\t%s", message ? message : "out of memory");
+        // the formatted error spans several lines, the reply has to stay on one
+        for (char* c = reply; *c; c++) if (*c == '\r' || *c == '\n') *c = ' ';
+        free(message);
+        Error_Free(&e);
+    }
+    if (entry) ReleaseCachedImage(pServer, entry);
+    free(uniqueMask);
+    free(uniqueSignature);
+    free(mask);
+    free(signature);
+    free(regions);
+    free(wideName);
+    free(widePath);
+}
+
+static void AnswerStats(struct Server* pServer, char* reply, size_t replySize)
+{
+    AcquireSRWLockShared(&pServer->lock);
+    DWORD numImages = pServer->numImages;
+    ULONGLONG memoryUsed = pServer->memoryUsed;
+    ReleaseSRWLockShared(&pServer->lock);
+
+    LONG64 hits = pServer->hits, misses = pServer->misses;
+    double hitRate = hits + misses ? 100.0 * (double)hits / (double)(hits + misses) : 0.0;
+    sprintf_s(reply, replySize, "ok\timages=%lu\tmemory-mb=%llu\trequests=%lld\thits=%lld\tmisses=%lld\thit-rate=%.1f\tevictions=%lld",
+        numImages, memoryUsed / (1024 * 1024), pServer->requests, hits, misses, hitRate, pServer->evictions);
+}
+
+// Answers one request line. Fields are separated by tabs, so paths and names may contain spaces.
+static void AnswerRequest(struct Server* pServer, char* request, char* reply, size_t replySize)
+{
+    InterlockedExchangeAdd64(&pServer->requests, 1);
+    char* fields[5] = { 0 };
+    DWORD numFields = 0;
+    char* context = NULL;
+    for (char* field = strtok_s(request, "\t", &context); field && numFields < _countof(fields); field = strtok_s(NULL, "\t", &context))
+        fields[numFields++] = field;
+
+    if (numFields == 1 && strcmp(fields[0], "stats") == 0) {
+        AnswerStats(pServer, reply, replySize);
+        return;
+    }
+    if (numFields >= 4 && strcmp(fields[0], "signature") == 0) {
+        DWORD signatureLength = (DWORD)atoi(fields[3]);
+        BOOL wildcards = numFields == 5 && strcmp(fields[4], "wildcards") == 0;
+        if (signatureLength > SERVER_MAX_SIGNATURE) {
+            sprintf_s(reply, replySize, "error\tsigLength is larger than %d", SERVER_MAX_SIGNATURE);
+            return;
+        }
+        if (signatureLength > 0 && (numFields == 4 || wildcards)) {
+            AnswerSignature(pServer, fields[1], fields[2], signatureLength, wildcards, reply, replySize);
+            return;
+        }
+    }
+    sprintf_s(reply, replySize, "error\tUnknown request, expected \"signature<TAB>pePath<TAB>functionName<TAB>sigLength[<TAB>wildcards]\" or \"stats\"");
+}
+
+static BOOL WritePipe(HANDLE hPipe, const char* data, DWORD length)
+{
+    DWORD written = 0;
+    return WriteFile(hPipe, data, length, &written, NULL) && written == length;
+}
+
+// Reads request lines from a connected client and answers each one, until the client disconnects
+static void ServeClient(struct Server* pServer, HANDLE hPipe, char* buffer, char* reply, size_t replySize)
+{
+    DWORD filled = 0, read = 0;
+    // after a line too long for the buffer the rest of it is dropped up to its newline, so it gets a single reply
+    BOOL discarding = FALSE;
+    while (ReadFile(hPipe, buffer + filled, SERVER_MAX_REQUEST - filled, &read, NULL) && read > 0) {
+        filled += read;
+        char* lineStart = buffer;
+        char* lineEnd;
+        while ((lineEnd = (char*)memchr(lineStart, '\n', filled - (lineStart - buffer))) != NULL) {
+            *lineEnd = '\0';
+            if (lineEnd > lineStart && lineEnd[-1] == '\r') lineEnd[-1] = '\0';
+            if (discarding) discarding = FALSE;
+            else if (*lineStart) {
+                // the client reads until the newline, so the answer leaves room for it
+                AnswerRequest(pServer, lineStart, reply, replySize - 1);
+                AppendReply(reply, replySize, "\n");
+                if (!WritePipe(hPipe, reply, (DWORD)strlen(reply))) return;
+            }
+            lineStart = lineEnd + 1;
+        }
+
+        filled -= (DWORD)(lineStart - buffer);
+        memmove(buffer, lineStart, filled);
+        if (filled == SERVER_MAX_REQUEST) {
+            const char* tooLong = "error\tRequest line too long\n";
+            if (!discarding && !WritePipe(hPipe, tooLong, (DWORD)strlen(tooLong))) return;
+            discarding = TRUE;
+            filled = 0;
+        }
+    }
+}
+
+// One worker: creates a pipe instance, serves the client that connects to it, and starts over
+static DWORD WINAPI ServerWorker(LPVOID parameter)
+{
+    struct Server* pServer = (struct Server*)parameter;
+    size_t replySize = SERVER_MAX_REQUEST + 3 * 64 * 1024;
+    char* buffer = (char*)malloc(SERVER_MAX_REQUEST);
+    char* reply = (char*)malloc(replySize);
+    if (!buffer || !reply) {
+        free(buffer);
+        free(reply);
+        return 1;
+    }
+
+    for (;;) {
+        HANDLE hPipe = CreateNamedPipeW(pServer->pConfig->pipeName, PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+            PIPE_UNLIMITED_INSTANCES, SERVER_PIPE_BUFFER_SIZE, SERVER_PIPE_BUFFER_SIZE, 0, NULL);
+        if (hPipe == INVALID_HANDLE_VALUE) {
+            fwprintf(stderr, L"[-] CreateNamedPipeW failed: %lu\n", GetLastError());
+            break;
+        }
+        if (ConnectNamedPipe(hPipe, NULL) || GetLastError() == ERROR_PIPE_CONNECTED) {
+            reply[0] = '\0';
+            ServeClient(pServer, hPipe, buffer, reply, replySize);
+            FlushFileBuffers(hPipe);
+            DisconnectNamedPipe(hPipe);
+        }
+        CloseHandle(hPipe);
+    }
+
+    free(reply);
+    free(buffer);
+    return 1;
+}
+
+Error RunServer(const struct ServerConfig* pConfig)
+{
+    struct Server server = { 0 };
+    server.pConfig = pConfig;
+    InitializeSRWLock(&server.lock);
+
+    DWORD numThreads = pConfig->threads ? pConfig->threads : GetProcessorCount();
+    HANDLE* threads = (HANDLE*)calloc(numThreads, sizeof(HANDLE));
+    if (!threads)
+        return NewError(__FUNCTION__, -1, L"calloc failed; out of memory", 0);
+
+    Error e = NewNoError();
+    DWORD started = 0;
+    for (; started < numThreads; started++) {
+        threads[started] = CreateThread(NULL, 0, ServerWorker, &server, 0, NULL);
+        if (!threads[started]) {
+            e = NewError(__FUNCTION__, -2, L"CreateThread failed", GetLastError());
+            break;
+        }
+    }
+    if (!e.ContainsError) {
+        fwprintf(stderr, L"[+] Serving on %s with %lu worker(s), %llu MB cache\n", pConfig->pipeName, numThreads, pConfig->memoryBudget / (1024 * 1024));
+        // workers only return when a pipe instance cannot be created
+        WaitForMultipleObjects(started, threads, TRUE, INFINITE);
+        e = NewError(__FUNCTION__, -3, L"All workers stopped", 0);
+    }
+
+    for (DWORD i = 0; i < started; i++) CloseHandle(threads[i]);
+    free(threads);
+    while (server.images) {
+        struct CachedImage* next = server.images->next;
+        FreeCachedImage(server.images);
+        server.images = next;
+    }
+    return e;
+}
+
+// Prints the UTF-8 text read so far. A character cut off by the end of the read is moved to the start of the text
+// and its length returned, for the next read to complete.
+static DWORD PrintUtf8(FILE* output, char* text, DWORD length, WCHAR* wide)
+{
+    DWORD complete = length;
+    DWORD lead = length;
+    while (lead > 0 && length - lead < 3 && ((BYTE)text[lead - 1] & 0xC0) == 0x80) lead--;
+    if (lead > 0) {
+        BYTE c = (BYTE)text[lead - 1];
+        DWORD needed = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        if (length - (lead - 1) < needed) complete = lead - 1;
+    }
+
+    int wideLength = complete ? MultiByteToWideChar(CP_UTF8, 0, text, (int)complete, wide, SERVER_PIPE_BUFFER_SIZE - 1) : 0;
+    wide[wideLength] = L'\0';
+    fputws(wide, output);
+    memmove(text, text + complete, length - complete);
+    return length - complete;
+}
+
+Error RunClient(LPCWSTR pipeName, FILE* input, FILE* output)
+{
+    HANDLE hPipe = INVALID_HANDLE_VALUE;
+    while (hPipe == INVALID_HANDLE_VALUE) {
+        hPipe = CreateFileW(pipeName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+        if (hPipe != INVALID_HANDLE_VALUE) break;
+        if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipeW(pipeName, 10000))
+            return NewError(__FUNCTION__, -1, L"Failed to connect to the server", GetLastError());
+    }
+
+    char* line = (char*)malloc(SERVER_MAX_REQUEST);
+    char* reply = (char*)malloc(SERVER_PIPE_BUFFER_SIZE);
+    WCHAR* wideReply = (WCHAR*)malloc(SERVER_PIPE_BUFFER_SIZE * sizeof(WCHAR));
+    Error e = NewNoError();
+    do {
+        if (!line || !reply || !wideReply) {
+            e = NewError(__FUNCTION__, -2, L"malloc failed; out of memory", 0);
+            break;
+        }
+        while (!e.ContainsError && fgets(line, SERVER_MAX_REQUEST, input)) {
+            size_t length = strlen(line);
+            while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) line[--length] = '\0';
+            if (length == 0) continue;
+            line[length++] = '\n';
+            if (!WritePipe(hPipe, line, (DWORD)length)) {
+                e = NewError(__FUNCTION__, -3, L"WriteFile failed", GetLastError());
+                break;
+            }
+
+            // every request gets exactly one reply line
+            // the reply is UTF-8, e.g. with a non-ASCII path in an error
+            BOOL complete = FALSE;
+            DWORD pending = 0;
+            while (!complete) {
+                DWORD read = 0;
+                if (!ReadFile(hPipe, reply + pending, SERVER_PIPE_BUFFER_SIZE - 1 - pending, &read, NULL) || read == 0) {
+                    e = NewError(__FUNCTION__, -4, L"The server closed the connection", GetLastError());
+                    break;
+                }
+                read += pending;
+                complete = reply[read - 1] == '\n';
+                pending = PrintUtf8(output, reply, read, wideReply);
+            }
+        }
+    } while (FALSE);
+
+    fflush(output);
+    free(wideReply);
+    free(reply);
+    free(line);
+    CloseHandle(hPipe);
+    return e;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "Pdb.h"
+#include "Signature.h"
+
+#define SERVER_DEFAULT_PIPE L"\\\\.\\pipe\\SigScanner"
+#define SERVER_DEFAULT_MEMORY_MB 2048
+// Longest request line, including the image path and function name
+#define SERVER_MAX_REQUEST (4 * MAX_PATH + MAX_SYM_NAME + 64)
+// Longest sigLength a request may ask for, so the bytes of the signature fit in one reply line
+#define SERVER_MAX_SIGNATURE 4096
+
+typedef struct ServerConfig {
+    LPCWSTR pipeName;
+    LPCWSTR symbolServer;
+    LPCWSTR cacheDir;           // symbol store, NULL for a symbols folder next to each image
+    DWORD connections;          // parallel range requests for large PDB downloads
+    DWORD threads;              // requests served at the same time, 0 for one per processor
+    ULONGLONG memoryBudget;     // bytes of images and symbol indexes kept loaded between requests
+    LPCWSTR sections;           // sections to check uniqueness in, NULL for the executable ones
+    BOOL virtualLayout;
+} ServerConfig;
+
+/*
+ * Serves signature requests on a named pipe until the process is stopped. Mapped images, their scan scopes and
+ * symbol indexes stay loaded between requests, keyed by path and by PDB GUID and age, with the other paths a build
+ * was requested under remembered as aliases. The least recently used ones are dropped once they take more than the
+ * memory budget. Each of `threads` workers serves one client at a time, so requests on different pipe instances run
+ * in parallel.
+ *
+ * The protocol is one UTF-8 line per request and one line per reply, fields separated by tabs:
+ *   signature <pePath> <functionName> <sigLength> [wildcards]
+ *      -> ok <functionName> <RVA> <length> unique|extended <signature bytes or pattern>
+ *   stats
+ *      -> ok images=<n> memory-mb=<n> requests=<n> hits=<n> misses=<n> hit-rate=<percent> evictions=<n>
+ * A request that fails is answered with "error <message>".
+ */
+Error RunServer(const struct ServerConfig* pConfig);
+
+// Sends every line of `input` to a running server and writes the replies to `output`.
+Error RunClient(LPCWSTR pipeName, FILE* input, FILE* output);
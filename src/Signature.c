@@ -1,162 +1,691 @@
 ﻿#include "Signature.h"
+#include "Scan.h"
+#include "Disasm.h"
+#include "Stats.h"
 
-Error GetFunctionSignatureFromPE(LPCWSTR pePath, DWORD signatureLength, int functionRVA, BYTE** signatureBuffer) {
-    HANDLE hFile = CreateFileW(pePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-    if (hFile == INVALID_HANDLE_VALUE)
-        return NewError(__FUNCTION__, -1, L"CreateFileW failed", GetLastError());
+Error GetFunctionSignatureFromPE(const struct ImageView* pImage, DWORD signatureLength, int functionRVA, BYTE** signatureBuffer) {
+    const BYTE* span = GetSpanByRva(pImage, (DWORD)functionRVA, signatureLength);
+    if (!span)
+        return NewError(__FUNCTION__, -1, L"Signature range is not backed by section data", 0);
 
-    Error e = NewNoError();
-    IMAGE_SECTION_HEADER* sectionHeader = NULL;
-    BYTE* buffer = NULL;
-    do {
-        IMAGE_DOS_HEADER dosHeader;
-        DWORD bytesRead;
-        if (!ReadFile(hFile, &dosHeader, sizeof(dosHeader), &bytesRead, NULL) || bytesRead != sizeof(dosHeader) || dosHeader.e_magic != IMAGE_DOS_SIGNATURE) {
-            e = NewError(__FUNCTION__, -2, L"ReadFile failed", GetLastError());
-            break;
-        }
+    BYTE* buffer = (BYTE*)malloc(signatureLength);
+    if (!buffer)
+        return NewError(__FUNCTION__, -2, L"malloc failed; out of memory", 0);
 
-        if (SetFilePointer(hFile, dosHeader.e_lfanew, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
-            e = NewError(__FUNCTION__, -2, L"ReadFile failed", GetLastError());
-            break;
-        }
+    memcpy(buffer, span, signatureLength);
+    *signatureBuffer = buffer;
+    return NewNoError();
+}
 
-        IMAGE_NT_HEADERS64 ntHeaders;
-        if (!ReadFile(hFile, &ntHeaders, sizeof(ntHeaders), &bytesRead, NULL) || bytesRead != sizeof(ntHeaders) || ntHeaders.Signature != IMAGE_NT_SIGNATURE) {
-            e = NewError(__FUNCTION__, -3, L"ReadFile failed", GetLastError());
-            break;
+static void ClearMaskBytes(BYTE* mask, DWORD maskLength, DWORD offset, DWORD count)
+{
+    for (DWORD i = offset; i < offset + count && i < maskLength; i++)
+        mask[i] = 0x00;
+}
+
+// Clears the mask of every byte in [rva, rva + length) that the loader patches through a base relocation.
+static void MaskRelocatedBytes(const struct ImageView* pImage, DWORD rva, DWORD length, BYTE* mask)
+{
+    const IMAGE_DATA_DIRECTORY* relocDirectory = GetDataDirectory(pImage, IMAGE_DIRECTORY_ENTRY_BASERELOC);
+    if (!relocDirectory) return;
+    const BYTE* blocks = GetSpanByRva(pImage, relocDirectory->VirtualAddress, relocDirectory->Size);
+    if (!blocks) return;
+
+    DWORD offset = 0;
+    while (offset + sizeof(IMAGE_BASE_RELOCATION) <= relocDirectory->Size) {
+        IMAGE_BASE_RELOCATION block;
+        memcpy(&block, blocks + offset, sizeof(block));
+        if (block.SizeOfBlock < sizeof(IMAGE_BASE_RELOCATION) || block.SizeOfBlock > relocDirectory->Size - offset) break;
+
+        // each block covers one page; a target at the end of the page may reach into the next one
+        if (block.VirtualAddress < rva + length && block.VirtualAddress + 0x1000 + sizeof(ULONGLONG) > rva) {
+            DWORD nEntries = (block.SizeOfBlock - sizeof(IMAGE_BASE_RELOCATION)) / sizeof(WORD);
+            for (DWORD i = 0; i < nEntries; i++) {
+                WORD entry;
+                memcpy(&entry, blocks + offset + sizeof(IMAGE_BASE_RELOCATION) + i * sizeof(WORD), sizeof(entry));
+                DWORD targetSize = (entry >> 12) == IMAGE_REL_BASED_DIR64 ? 8 : ((entry >> 12) == IMAGE_REL_BASED_HIGHLOW ? 4 : 0);
+                DWORD target = block.VirtualAddress + (entry & 0xFFF);
+                for (DWORD b = 0; b < targetSize; b++) {
+                    if (target + b >= rva && target + b < rva + length)
+                        mask[target + b - rva] = 0x00;
+                }
+            }
         }
+        offset += block.SizeOfBlock;
+    }
+}
 
-        WORD nSections = ntHeaders.FileHeader.NumberOfSections;
-        sectionHeader = (IMAGE_SECTION_HEADER*)malloc(nSections * sizeof(IMAGE_SECTION_HEADER));
-        if (!sectionHeader) {
-            e = NewError(__FUNCTION__, -4, L"malloc failed; out of memory", 0);
-            break;
+Error GetFunctionSignatureMask(const struct ImageView* pImage, DWORD signatureLength, int functionRVA, BYTE** maskBuffer) {
+    // decode a little past the end so an instruction the signature cuts through is still recognized
+    DWORD available = signatureLength + INSTRUCTION_MAX_LENGTH;
+    const BYTE* code = GetSpanByRva(pImage, (DWORD)functionRVA, available);
+    while (!code && available > signatureLength)
+        code = GetSpanByRva(pImage, (DWORD)functionRVA, --available);
+    if (!code)
+        return NewError(__FUNCTION__, -1, L"Signature range is not backed by section data", 0);
+
+    BYTE* mask = (BYTE*)malloc(signatureLength);
+    if (!mask)
+        return NewError(__FUNCTION__, -2, L"malloc failed; out of memory", 0);
+    memset(mask, 0xFF, signatureLength);
+
+    struct Instruction instruction;
+    for (DWORD offset = 0; offset < signatureLength; offset += instruction.length) {
+        // whatever does not decode (padding, jump tables) is compared as is
+        if (!DecodeInstruction(code + offset, available - offset, &instruction)) break;
+        if (instruction.ripRelative)
+            ClearMaskBytes(mask, signatureLength, offset + instruction.displacementOffset, instruction.displacementSize);
+        // rel8 branches stay inside the function, rel32 ones usually leave it
+        if (instruction.relativeBranch && instruction.immediateSize == 4)
+            ClearMaskBytes(mask, signatureLength, offset + instruction.immediateOffset, instruction.immediateSize);
+    }
+    MaskRelocatedBytes(pImage, (DWORD)functionRVA, signatureLength, mask);
+
+    *maskBuffer = mask;
+    return NewNoError();
+}
+
+// An occurrence of a signature and the number of bytes left in its region from there on
+typedef struct SignatureMatch {
+    const BYTE* data;
+    size_t available;
+} SignatureMatch;
+
+// Scans split each region into chunks of match start positions. A chunk reads signatureLength - 1 bytes past its
+// last start position, so a match that crosses into the next chunk is found exactly once.
+#define SCAN_CHUNK_MIN_SIZE (64 * 1024)
+#define SCAN_CHUNK_MAX_SIZE (4 * 1024 * 1024)
+#define SCAN_CHUNKS_PER_THREAD 8
+
+typedef struct ScanChunk {
+    DWORD scope;                // index of the scope the region belongs to
+    const struct ScanRegion* region;
+    size_t start;               // first start position, relative to the region
+    size_t end;                 // one past the last start position
+    struct SignatureMatch* matches;
+    size_t matchCount;
+    size_t matchCapacity;
+} ScanChunk;
+
+typedef struct ParallelScan {
+    const BYTE* signature;
+    const BYTE* mask;           // NULL for exact matching
+    DWORD signatureLength;
+    struct ScanChunk* chunks;
+    DWORD numChunks;
+    LONG maxMatches;            // stop after this many matches in total, 0 to find them all
+    volatile LONG matchCount;
+    volatile LONG stop;         // set once maxMatches is reached or a chunk ran out of memory
+    volatile LONG outOfMemory;
+} ParallelScan;
+
+// Splits the regions of all scopes into one list of chunks, so a single pool job scans them together
+static Error SplitScanScopes(struct ScanScope* const* scopes, DWORD numScopes, DWORD numThreads, DWORD signatureLength, struct ScanChunk** chunks, DWORD* numChunks)
+{
+    ULONGLONG totalLength = 0;
+    for (DWORD s = 0; s < numScopes; s++)
+        for (DWORD r = 0; r < scopes[s]->numRegions; r++) totalLength += scopes[s]->regions[r].length;
+
+    ULONGLONG chunkSize = totalLength / ((ULONGLONG)numThreads * SCAN_CHUNKS_PER_THREAD);
+    if (chunkSize < SCAN_CHUNK_MIN_SIZE) chunkSize = SCAN_CHUNK_MIN_SIZE;
+    if (chunkSize > SCAN_CHUNK_MAX_SIZE) chunkSize = SCAN_CHUNK_MAX_SIZE;
+
+    DWORD count = 0;
+    for (DWORD s = 0; s < numScopes; s++) {
+        for (DWORD r = 0; r < scopes[s]->numRegions; r++) {
+            size_t length = scopes[s]->regions[r].length;
+            if (length >= signatureLength) count += (DWORD)((length - signatureLength + chunkSize) / chunkSize);
         }
+    }
 
-        for (WORD i = 0; i < nSections; i++) {
-            if (!ReadFile(hFile, &sectionHeader[i], sizeof(sectionHeader[i]), &bytesRead, NULL) || bytesRead != sizeof(sectionHeader[i])) {
-                e = NewError(__FUNCTION__, -5, L"ReadFile failed", GetLastError());
-                break;
+    struct ScanChunk* result = (struct ScanChunk*)calloc(count ? count : 1, sizeof(struct ScanChunk));
+    if (!result)
+        return NewError(__FUNCTION__, -1, L"calloc failed; out of memory", 0);
+
+    DWORD chunkIndex = 0;
+    for (DWORD s = 0; s < numScopes; s++) {
+        for (DWORD r = 0; r < scopes[s]->numRegions; r++) {
+            const struct ScanRegion* region = &scopes[s]->regions[r];
+            if (region->length < signatureLength) continue;
+            size_t positions = region->length - signatureLength + 1;
+            for (size_t start = 0; start < positions; start += (size_t)chunkSize) {
+                result[chunkIndex].scope = s;
+                result[chunkIndex].region = region;
+                result[chunkIndex].start = start;
+                result[chunkIndex].end = start + (size_t)chunkSize < positions ? start + (size_t)chunkSize : positions;
+                chunkIndex++;
             }
         }
+    }
 
-        DWORD fileOffset = RvaToOffset((DWORD)functionRVA, sectionHeader, nSections);
-        free(sectionHeader);
-        sectionHeader = NULL;
+    *chunks = result;
+    *numChunks = count;
+    return NewNoError();
+}
 
-        if (fileOffset == 0) {
-            e = NewError(__FUNCTION__, -6, L"RvaToOffset failed", GetLastError());
-            break;
+static BOOL AddChunkMatch(struct ScanChunk* chunk, size_t position)
+{
+    if (chunk->matchCount == chunk->matchCapacity) {
+        size_t newCapacity = (chunk->matchCapacity == 0) ? 16 : chunk->matchCapacity * 2;
+        struct SignatureMatch* newMatches = (struct SignatureMatch*)realloc(chunk->matches, newCapacity * sizeof(struct SignatureMatch));
+        if (!newMatches) return FALSE;
+        chunk->matches = newMatches;
+        chunk->matchCapacity = newCapacity;
+    }
+    chunk->matches[chunk->matchCount].data = chunk->region->data + position;
+    chunk->matches[chunk->matchCount].available = chunk->region->length - position;
+    chunk->matchCount++;
+    return TRUE;
+}
+
+static void ScanChunkWork(void* context, DWORD itemIndex, DWORD workerIndex)
+{
+    (void)workerIndex;
+    struct ParallelScan* scan = (struct ParallelScan*)context;
+    struct ScanChunk* chunk = &scan->chunks[itemIndex];
+    if (scan->stop) return;
+
+    const BYTE* window = chunk->region->data + chunk->start;
+    size_t windowLength = chunk->end - chunk->start + scan->signatureLength - 1;
+    for (size_t i = 0;; i++) {
+        i = scan->mask ? ScanFindNextMasked(window, windowLength, scan->signature, scan->mask, scan->signatureLength, i)
+                       : ScanFindNext(window, windowLength, scan->signature, scan->signatureLength, i);
+        if (i == SCAN_NOT_FOUND) break;
+
+        if (!AddChunkMatch(chunk, chunk->start + i)) {
+            InterlockedExchange(&scan->outOfMemory, 1);
+            InterlockedExchange(&scan->stop, 1);
+            return;
+        }
+        // the other workers give up as soon as together they have found enough
+        if (scan->maxMatches && InterlockedIncrement(&scan->matchCount) >= scan->maxMatches) {
+            InterlockedExchange(&scan->stop, 1);
+            return;
         }
+        if (scan->stop) return;
+    }
+}
 
-        if (SetFilePointer(hFile, fileOffset, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
-            e = NewError(__FUNCTION__, -7, L"SetFilePointer failed", GetLastError());
-            break;
+// Collects the occurrences of the signature in the regions of each scope into one heap allocated array per scope,
+// in region order. A NULL mask matches every byte exactly. With `maxMatches` set, scanning stops early once that
+// many are found over all scopes. The chunks of all scopes are scanned as one job on the pool, if there is one.
+static Error FindSignatureMatchesInScopes(struct ScanScope* const* scopes, DWORD numScopes, struct ThreadPool* pPool, const BYTE* signature, const BYTE* mask, DWORD signatureLength, LONG maxMatches, struct SignatureMatch** matches, size_t* matchCounts)
+{
+    ULONGLONG start = StartStatsTimer();
+    struct ParallelScan scan = { 0 };
+    scan.signature = signature;
+    scan.mask = mask;
+    scan.signatureLength = signatureLength;
+    scan.maxMatches = maxMatches;
+
+    Error e = SplitScanScopes(scopes, numScopes, pPool ? pPool->numThreads : 1, signatureLength, &scan.chunks, &scan.numChunks);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+
+    if (pPool)
+        RunThreadPool(pPool, ScanChunkWork, &scan, scan.numChunks);
+    else
+        for (DWORD i = 0; i < scan.numChunks; i++) ScanChunkWork(&scan, i, 0);
+
+    ULONGLONG scopeBytes = 0;
+    for (DWORD s = 0; s < numScopes; s++) {
+        for (DWORD r = 0; r < scopes[s]->numRegions; r++) {
+            scopes[s]->regions[r].bytesScanned += scopes[s]->regions[r].length;
+            scopes[s]->regions[r].scans++;
+            scopeBytes += scopes[s]->regions[r].length;
         }
+    }
+    StopStatsTimer(STATS_TIMER_SCAN, start);
+    AddStatsCount(STATS_SCANS, numScopes);
+    AddStatsCount(STATS_BYTES_SCANNED, scopeBytes);
 
-        buffer = (BYTE*)malloc(signatureLength);
-        if (!buffer) {
-            e = NewError(__FUNCTION__, -8, L"malloc failed; out of memory", 0);
-            break;
+    BOOL failed = scan.outOfMemory;
+    for (DWORD s = 0; s < numScopes; s++) {
+        size_t count = 0;
+        for (DWORD i = 0; i < scan.numChunks; i++)
+            if (scan.chunks[i].scope == s) count += scan.chunks[i].matchCount;
+
+        struct SignatureMatch* found = NULL;
+        if (!failed && count > 0) {
+            found = (struct SignatureMatch*)malloc(count * sizeof(struct SignatureMatch));
+            if (found) {
+                size_t offset = 0;
+                for (DWORD i = 0; i < scan.numChunks; i++) {
+                    if (scan.chunks[i].scope != s || !scan.chunks[i].matchCount) continue;
+                    memcpy(found + offset, scan.chunks[i].matches, scan.chunks[i].matchCount * sizeof(struct SignatureMatch));
+                    offset += scan.chunks[i].matchCount;
+                }
+            } else {
+                failed = TRUE;
+            }
         }
+        matches[s] = found;
+        matchCounts[s] = count;
+    }
+    for (DWORD i = 0; i < scan.numChunks; i++) free(scan.chunks[i].matches);
+    free(scan.chunks);
 
-        if (!ReadFile(hFile, buffer, signatureLength, &bytesRead, NULL) || (int)bytesRead != signatureLength) {
-            free(buffer);
-            buffer = NULL;
-            e = NewError(__FUNCTION__, -9, L"ReadFile failed", GetLastError());
-            break;
+    if (failed) {
+        for (DWORD s = 0; s < numScopes; s++) {
+            free(matches[s]);
+            matches[s] = NULL;
         }
-    } while (FALSE);
+        return NewError(__FUNCTION__, -2, L"realloc failed; out of memory", 0);
+    }
+    return NewNoError();
+}
 
-    if (sectionHeader) free(sectionHeader);
-    if (hFile) CloseHandle(hFile);
-    if (buffer) *signatureBuffer = buffer;
+static Error FindSignatureMatches(struct ScanScope* pScope, const BYTE* signature, const BYTE* mask, DWORD signatureLength, LONG maxMatches, struct SignatureMatch** matches, size_t* matchCount)
+{
+    Error e = FindSignatureMatchesInScopes(&pScope, 1, pScope->pThreadPool, signature, mask, signatureLength, maxMatches, matches, matchCount);
+    if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -1);
     return e;
 }
 
-Error CheckForUniqueSignature(LPCWSTR pePath, BYTE* signature, DWORD signatureLength, BOOL* unique)
+Error FindSignatureRvas(struct ScanScope* pScope, const BYTE* signature, const BYTE* mask, DWORD signatureLength, DWORD** rvas, size_t* rvaCount)
+{
+    struct SignatureMatch* matches = NULL;
+    size_t matchCount = 0;
+    Error e = FindSignatureMatches(pScope, signature, mask, signatureLength, 0, &matches, &matchCount);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+
+    DWORD* result = (DWORD*)malloc((matchCount ? matchCount : 1) * sizeof(DWORD));
+    if (!result) {
+        free(matches);
+        return NewError(__FUNCTION__, -2, L"malloc failed; out of memory", 0);
+    }
+    // matches come in region order, so the region of the previous match is tried first
+    DWORD r = 0;
+    for (size_t i = 0; i < matchCount; i++) {
+        while (r < pScope->numRegions && (matches[i].data < pScope->regions[r].data || matches[i].data >= pScope->regions[r].data + pScope->regions[r].length)) r++;
+        if (r == pScope->numRegions) r = 0;
+        result[i] = pScope->regions[r].rva + (DWORD)(matches[i].data - pScope->regions[r].data);
+    }
+    free(matches);
+
+    *rvas = result;
+    *rvaCount = matchCount;
+    return NewNoError();
+}
+
+Error CheckForUniqueSignature(struct ScanScope* pScope, const BYTE* signature, DWORD signatureLength, BOOL* unique)
 {
-    HANDLE hFile = CreateFileW(pePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-    if (hFile == INVALID_HANDLE_VALUE)
-        return NewError(__FUNCTION__, -1, L"CreateFileW failed", GetLastError());
+    // the function itself is always one match, so a second one is enough to prove the signature is not unique
+    struct SignatureMatch* matches = NULL;
+    size_t matchCount = 0;
+    Error e = FindSignatureMatches(pScope, signature, NULL, signatureLength, 2, &matches, &matchCount);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+    free(matches);
+    // no match at all means the bytes are not in the scope, which is no proof of anything
+    *unique = matchCount == 1;
+    return NewNoError();
+}
 
-    BYTE* fileBuffer = NULL;
-    int count = 0;
-    *unique = TRUE;
-    Error e = NewNoError();
-    do {
-        DWORD fileSize = GetFileSize(hFile, NULL);
-        if (fileSize == INVALID_FILE_SIZE) {
-            e = NewError(__FUNCTION__, -2, L"GetFileSize failed", GetLastError());
-            break;
-        }
+// Keeps only the matches that agree with the signature's byte at `length - 1` as well
+static size_t FilterSignatureMatches(struct SignatureMatch* matches, size_t matchCount, DWORD length, BYTE nextByte)
+{
+    size_t remaining = 0;
+    for (size_t i = 0; i < matchCount; i++) {
+        if (matches[i].available >= length && matches[i].data[length - 1] == nextByte)
+            matches[remaining++] = matches[i];
+    }
+    return remaining;
+}
 
-        fileBuffer = (BYTE*)malloc(fileSize);
-        if (!fileBuffer) {
-            e = NewError(__FUNCTION__, -3, L"malloc failed; Out of memory", 0);
-            break;
-        }
+// Where the function's own bytes are in the scope, the one match a unique signature is allowed. NULL if the scope
+// leaves the function out, e.g. with other sections or in a dump that did not capture it.
+static const BYTE* GetFunctionDataInScope(const struct ScanScope* pScope, int functionRVA)
+{
+    const struct ScanRegion* region = FindScanRegion(pScope, (DWORD)functionRVA);
+    return region ? region->data + ((DWORD)functionRVA - region->rva) : NULL;
+}
+
+// A signature is unique when its only match is the function itself, not some other code
+static BOOL IsOnlyMatchAt(const struct SignatureMatch* matches, size_t matchCount, const BYTE* functionData)
+{
+    return matchCount == 1 && matches[0].data == functionData;
+}
+
+// Reads the minimal unique length straight from the suffix index instead of scanning the image.
+static Error FindUniqueSignatureFromIndex(const struct ImageView* pImage, const struct SuffixIndex* pIndex, DWORD signatureLength, int functionRVA, BOOL* isUnique, BYTE** uniqueSignature, DWORD* uniqueSignatureLength) {
+    DWORD minimalLength = GetMinimalUniqueLength(pIndex, (DWORD)functionRVA);
+    if (minimalLength == 0)
+        return NewError(__FUNCTION__, -1, L"No unique signature fits in the function's section", 0);
+
+    *isUnique = minimalLength <= signatureLength;
+    if (*isUnique)
+        return NewNoError();
+
+    Error e = GetFunctionSignatureFromPE(pImage, minimalLength, functionRVA, uniqueSignature);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -2);
+        return e;
+    }
+    *uniqueSignatureLength = minimalLength;
+    return NewNoError();
+}
 
-        DWORD bytesRead = 0;
-        SetFilePointer(hFile, 0, NULL, FILE_BEGIN);
-        if (!ReadFile(hFile, fileBuffer, fileSize, &bytesRead, NULL) || bytesRead != fileSize) {
-            e = NewError(__FUNCTION__, -4, L"ReadFile failed", 0);
+// The index covers the executable sections as stored in the file, so its answers only hold for a scope of exactly
+// those bytes. Sections the index holds with no bytes have no region in the scope.
+static BOOL IsScopeIndexed(const struct ScanScope* pScope, const struct SuffixIndex* pIndex)
+{
+    DWORD r = 0;
+    for (DWORD i = 0; i < pIndex->header->numSections; i++) {
+        const SuffixIndexSection* section = &pIndex->sections[i];
+        if (!section->length) continue;
+        if (r == pScope->numRegions || pScope->regions[r].rva != section->rva || pScope->regions[r].length != section->length) return FALSE;
+        r++;
+    }
+    return r == pScope->numRegions;
+}
+
+// Scans the scope once for the supplied signature and then grows it one byte at a time, only re-checking the
+// positions that still match, until the function itself is the single remaining occurrence. The function has to be
+// inside the scope, otherwise a single match elsewhere would pass for unique.
+// With a suffix index over the same bytes as the scope the answer is looked up instead; other scopes, such as other
+// sections or the virtual layout, are still scanned.
+Error FindUniqueSignature(const struct ImageView* pImage, struct ScanScope* pScope, const struct SuffixIndex* pIndex, BYTE* signature, DWORD signatureLength, int functionRVA, BOOL* isUnique, BYTE** uniqueSignature, DWORD* uniqueSignatureLength) {
+    if (pIndex && IsScopeIndexed(pScope, pIndex)) {
+        Error e = FindUniqueSignatureFromIndex(pImage, pIndex, signatureLength, functionRVA, isUnique, uniqueSignature, uniqueSignatureLength);
+        if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -4);
+        return e;
+    }
+
+    const BYTE* functionData = GetFunctionDataInScope(pScope, functionRVA);
+    if (!functionData)
+        return NewError(__FUNCTION__, -5, L"The function is outside of the scanned sections", 0);
+
+    struct SignatureMatch* matches = NULL;
+    size_t matchCount = 0;
+    Error e = FindSignatureMatches(pScope, signature, NULL, signatureLength, 0, &matches, &matchCount);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+    *isUnique = IsOnlyMatchAt(matches, matchCount, functionData);
+    if (*isUnique) {
+        free(matches);
+        return NewNoError();
+    }
+
+    // counted locally and reported once, the loop runs once per added byte
+    ULONGLONG trials = 0, candidates = 0;
+    for (DWORD trialSignatureLength = signatureLength + 1;; trialSignatureLength++) {
+        const BYTE* trialSignature = GetSpanByRva(pImage, (DWORD)functionRVA, trialSignatureLength);
+        if (!trialSignature) {
+            e = NewError(__FUNCTION__, -2, L"Reached the end of the section before the signature became unique", 0);
             break;
         }
 
-        for (DWORD i = 0; i + signatureLength <= fileSize; i++) {
-            if (memcmp(fileBuffer + i, signature, signatureLength) == 0) {
-                if (count == 0) { 
-                    count += 1;
-                    continue;
-                }
-                *unique = FALSE;
+        // keep only the occurrences that also match the newly added byte
+        trials++;
+        candidates += matchCount;
+        matchCount = FilterSignatureMatches(matches, matchCount, trialSignatureLength, trialSignature[trialSignatureLength - 1]);
+
+        if (matchCount <= 1) {
+            // the function's own match is gone when the signature runs past the end of its region
+            if (!IsOnlyMatchAt(matches, matchCount, functionData)) {
+                e = NewError(__FUNCTION__, -6, L"Reached the end of the scanned region before the signature became unique", 0);
                 break;
             }
+            BYTE* buffer = (BYTE*)malloc(trialSignatureLength);
+            if (!buffer) {
+                e = NewError(__FUNCTION__, -3, L"malloc failed; out of memory", 0);
+                break;
+            }
+            memcpy(buffer, trialSignature, trialSignatureLength);
+            *uniqueSignature = buffer;
+            *uniqueSignatureLength = trialSignatureLength;
+            break;
         }
-    } while (FALSE);
-    if (fileBuffer) free(fileBuffer);
-    if (hFile) CloseHandle(hFile);
+    }
+
+    AddStatsCount(STATS_TRIAL_LENGTHS, trials);
+    AddStatsCount(STATS_CANDIDATE_MATCHES, candidates);
+    free(matches);
     return e;
 }
 
-Error FindUniqueSignature(LPCWSTR pePath, BYTE* signature, DWORD signatureLength, int functionRVA, BOOL* isUnique, BYTE** uniqueSignature, DWORD* uniqueSignatureLength) {
-    BOOL unique = FALSE;
-    Error e = CheckForUniqueSignature(pePath, signature, signatureLength, &unique);
+Error FindUniqueMaskedSignature(const struct ImageView* pImage, struct ScanScope* pScope, const BYTE* signature, const BYTE* mask, DWORD signatureLength, int functionRVA, BOOL* isUnique, BYTE** uniqueSignature, BYTE** uniqueMask, DWORD* uniqueSignatureLength) {
+    const BYTE* functionData = GetFunctionDataInScope(pScope, functionRVA);
+    if (!functionData)
+        return NewError(__FUNCTION__, -5, L"The function is outside of the scanned sections", 0);
+
+    struct SignatureMatch* matches = NULL;
+    size_t matchCount = 0;
+    Error e = FindSignatureMatches(pScope, signature, mask, signatureLength, 0, &matches, &matchCount);
     if (e.ContainsError) {
         e.AddFunctionToStack(&e, __FUNCTION__, -1);
         return e;
     }
-    if (unique) {
-        *isUnique = TRUE;
+    *isUnique = IsOnlyMatchAt(matches, matchCount, functionData);
+    if (*isUnique) {
+        free(matches);
         return NewNoError();
     }
-    *isUnique = FALSE;
 
+    BYTE* trialMask = NULL;
+    DWORD trialMaskLength = 0;
+    ULONGLONG trials = 0, candidates = 0;
     for (DWORD trialSignatureLength = signatureLength + 1;; trialSignatureLength++) {
-        BYTE* trialSignature = NULL;
-        e = GetFunctionSignatureFromPE(pePath, trialSignatureLength, functionRVA, &trialSignature);
-        if (e.ContainsError || trialSignature == NULL) {
-            if (trialSignature) free(trialSignature);
-            e.AddFunctionToStack(&e, __FUNCTION__, -2);
+        const BYTE* trialSignature = GetSpanByRva(pImage, (DWORD)functionRVA, trialSignatureLength);
+        if (!trialSignature) {
+            e = NewError(__FUNCTION__, -2, L"Reached the end of the section before the signature became unique", 0);
             break;
         }
 
-        e = CheckForUniqueSignature(pePath, trialSignature, trialSignatureLength, &unique);
+        // the mask is decoded ahead in growing windows rather than once per added byte
+        if (trialSignatureLength > trialMaskLength) {
+            free(trialMask);
+            trialMask = NULL;
+            trialMaskLength = trialSignatureLength * 2;
+            e = GetFunctionSignatureMask(pImage, trialMaskLength, functionRVA, &trialMask);
+            if (e.ContainsError) {
+                Error_Free(&e);
+                trialMaskLength = trialSignatureLength;
+                e = GetFunctionSignatureMask(pImage, trialMaskLength, functionRVA, &trialMask);
+            }
+            if (e.ContainsError) {
+                e.AddFunctionToStack(&e, __FUNCTION__, -3);
+                break;
+            }
+        }
+
+        // a wildcard cannot tell occurrences apart, only a compared byte can drop some
+        if (trialMask[trialSignatureLength - 1] == 0x00)
+            continue;
+
+        trials++;
+        candidates += matchCount;
+        matchCount = FilterSignatureMatches(matches, matchCount, trialSignatureLength, trialSignature[trialSignatureLength - 1]);
+
+        if (matchCount <= 1) {
+            if (!IsOnlyMatchAt(matches, matchCount, functionData)) {
+                e = NewError(__FUNCTION__, -6, L"Reached the end of the scanned region before the signature became unique", 0);
+                break;
+            }
+            BYTE* buffer = (BYTE*)malloc(trialSignatureLength);
+            BYTE* maskBuffer = (BYTE*)malloc(trialSignatureLength);
+            if (!buffer || !maskBuffer) {
+                free(buffer);
+                free(maskBuffer);
+                e = NewError(__FUNCTION__, -4, L"malloc failed; out of memory", 0);
+                break;
+            }
+            memcpy(buffer, trialSignature, trialSignatureLength);
+            memcpy(maskBuffer, trialMask, trialSignatureLength);
+            *uniqueSignature = buffer;
+            *uniqueMask = maskBuffer;
+            *uniqueSignatureLength = trialSignatureLength;
+            break;
+        }
+    }
+
+    AddStatsCount(STATS_TRIAL_LENGTHS, trials);
+    AddStatsCount(STATS_CANDIDATE_MATCHES, candidates);
+    free(trialMask);
+    free(matches);
+    return e;
+}
+
+// Builds the first `length` bytes of the pattern shared by all builds: the bytes of the first build, with a
+// wildcard wherever another build differs and, with `wildcards`, wherever any build has a masked operand
+static Error GetCrossBuildPattern(const struct CrossBuildTarget* targets, DWORD numTargets, BOOL wildcards, DWORD length, BYTE** pattern, BYTE** mask)
+{
+    const BYTE* first = GetSpanByRva(targets[0].pImage, (DWORD)targets[0].functionRVA, length);
+    if (!first)
+        return NewError(__FUNCTION__, -1, L"Signature range is not backed by section data", 0);
+
+    BYTE* patternBuffer = (BYTE*)malloc(length);
+    BYTE* maskBuffer = (BYTE*)malloc(length);
+    if (!patternBuffer || !maskBuffer) {
+        free(patternBuffer);
+        free(maskBuffer);
+        return NewError(__FUNCTION__, -2, L"malloc failed; out of memory", 0);
+    }
+    memcpy(patternBuffer, first, length);
+    memset(maskBuffer, 0xFF, length);
+
+    Error e = NewNoError();
+    for (DWORD t = 0; t < numTargets; t++) {
+        const BYTE* bytes = GetSpanByRva(targets[t].pImage, (DWORD)targets[t].functionRVA, length);
+        if (!bytes) {
+            e = NewError(__FUNCTION__, -3, L"Signature range is not backed by section data in every build", 0);
+            break;
+        }
+        for (DWORD i = 0; i < length; i++)
+            if (bytes[i] != first[i]) maskBuffer[i] = 0x00;
+
+        if (!wildcards) continue;
+        BYTE* buildMask = NULL;
+        e = GetFunctionSignatureMask(targets[t].pImage, length, targets[t].functionRVA, &buildMask);
         if (e.ContainsError) {
-            if (trialSignature) free(trialSignature);
-            e.AddFunctionToStack(&e, __FUNCTION__, -3);
+            e.AddFunctionToStack(&e, __FUNCTION__, -4);
             break;
         }
+        for (DWORD i = 0; i < length; i++) maskBuffer[i] &= buildMask[i];
+        free(buildMask);
+    }
+
+    if (e.ContainsError) {
+        free(patternBuffer);
+        free(maskBuffer);
+        return e;
+    }
+    *pattern = patternBuffer;
+    *mask = maskBuffer;
+    return e;
+}
+
+Error FindCrossBuildSignature(const struct CrossBuildTarget* targets, DWORD numTargets, struct ThreadPool* pPool, DWORD signatureLength, BOOL wildcards, BYTE** uniqueSignature, BYTE** uniqueMask, DWORD* uniqueSignatureLength)
+{
+    if (numTargets == 0 || signatureLength == 0)
+        return NewError(__FUNCTION__, -1, L"No builds or an empty signature", 0);
+
+    BYTE* pattern = NULL;
+    BYTE* mask = NULL;
+    Error e = GetCrossBuildPattern(targets, numTargets, wildcards, signatureLength, &pattern, &mask);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -2);
+        return e;
+    }
+    DWORD patternLength = signatureLength;
+
+    // a pattern of wildcards only would match at every offset of every build
+    DWORD compared = 0;
+    for (DWORD i = 0; i < signatureLength; i++) compared += mask[i] != 0x00;
+    if (compared == 0) {
+        free(pattern);
+        free(mask);
+        return NewError(__FUNCTION__, -3, L"The builds have no byte in common at the start of the function", 0);
+    }
+
+    struct ScanScope** scopes = (struct ScanScope**)malloc(numTargets * sizeof(struct ScanScope*));
+    struct SignatureMatch** matches = (struct SignatureMatch**)calloc(numTargets, sizeof(struct SignatureMatch*));
+    size_t* matchCounts = (size_t*)calloc(numTargets, sizeof(size_t));
+    if (!scopes || !matches || !matchCounts) {
+        free(scopes);
+        free(matches);
+        free(matchCounts);
+        free(pattern);
+        free(mask);
+        return NewError(__FUNCTION__, -4, L"malloc failed; out of memory", 0);
+    }
+    for (DWORD t = 0; t < numTargets; t++) scopes[t] = targets[t].pScope;
 
+    // every build is scanned once, all of them in the same pool job
+    e = FindSignatureMatchesInScopes(scopes, numTargets, pPool, pattern, mask, signatureLength, 0, matches, matchCounts);
+    if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -5);
+
+    // the pattern then grows by one byte at a time for all builds at once; each compared byte drops the matches
+    // of every build that disagree with it, so the work per byte is the number of matches left over all builds
+    ULONGLONG trials = 0, candidates = 0;
+    for (DWORD trialLength = signatureLength; !e.ContainsError; trialLength++) {
+        BOOL unique = TRUE;
+        for (DWORD t = 0; t < numTargets && unique; t++) unique = matchCounts[t] <= 1;
         if (unique) {
-            *uniqueSignature = trialSignature;
-            *uniqueSignatureLength = trialSignatureLength;
-            return NewNoError();
+            BYTE* signatureBuffer = (BYTE*)malloc(trialLength);
+            BYTE* maskBuffer = (BYTE*)malloc(trialLength);
+            if (!signatureBuffer || !maskBuffer) {
+                free(signatureBuffer);
+                free(maskBuffer);
+                e = NewError(__FUNCTION__, -6, L"malloc failed; out of memory", 0);
+                break;
+            }
+            memcpy(signatureBuffer, pattern, trialLength);
+            memcpy(maskBuffer, mask, trialLength);
+            *uniqueSignature = signatureBuffer;
+            *uniqueMask = maskBuffer;
+            *uniqueSignatureLength = trialLength;
+            break;
+        }
+
+        // the pattern is built ahead in growing windows rather than once per added byte
+        DWORD nextLength = trialLength + 1;
+        if (nextLength > patternLength) {
+            free(pattern);
+            free(mask);
+            pattern = mask = NULL;
+            patternLength = nextLength * 2;
+            e = GetCrossBuildPattern(targets, numTargets, wildcards, patternLength, &pattern, &mask);
+            if (e.ContainsError) {
+                Error_Free(&e);
+                patternLength = nextLength;
+                e = GetCrossBuildPattern(targets, numTargets, wildcards, patternLength, &pattern, &mask);
+            }
+            if (e.ContainsError) {
+                Error_Free(&e);
+                e = NewError(__FUNCTION__, -7, L"Reached the end of the section before the signature became unique in every build", 0);
+                break;
+            }
+        }
+
+        // a wildcard cannot tell occurrences apart, only a compared byte can drop some
+        if (mask[nextLength - 1] == 0x00)
+            continue;
+
+        trials++;
+        for (DWORD t = 0; t < numTargets; t++) {
+            candidates += matchCounts[t];
+            matchCounts[t] = FilterSignatureMatches(matches[t], matchCounts[t], nextLength, pattern[nextLength - 1]);
         }
-        free(trialSignature);
     }
 
-    return NewNoError();
+    AddStatsCount(STATS_TRIAL_LENGTHS, trials);
+    AddStatsCount(STATS_CANDIDATE_MATCHES, candidates);
+    for (DWORD t = 0; t < numTargets; t++) free(matches[t]);
+    free(matchCounts);
+    free(matches);
+    free(scopes);
+    free(pattern);
+    free(mask);
+    return e;
 }
@@ -1,5 +1,34 @@
 #pragma once
-#include "Pdb.h"
+#include "Image.h"
+#include "SuffixIndex.h"
+#include "ScanScope.h"
 
-Error GetFunctionSignatureFromPE(LPCWSTR pePath, DWORD signatureLength, int functionRVA, BYTE** signatureBuffer);
-Error FindUniqueSignature(LPCWSTR pePath, BYTE* signature, DWORD signatureLength, int functionRVA, BOOL* isUnique, BYTE** uniqueSignature, DWORD* uniqueSignatureLength);
+Error GetFunctionSignatureFromPE(const struct ImageView* pImage, DWORD signatureLength, int functionRVA, BYTE** signatureBuffer);
+// Returns the RVA of every occurrence of the signature in the scope's regions, in region and address order, which
+// is the same whether the scan runs on the scope's pool or not. A NULL mask matches every byte exactly. Free `*rvas`
+// after use with free.
+Error FindSignatureRvas(struct ScanScope* pScope, const BYTE* signature, const BYTE* mask, DWORD signatureLength, DWORD** rvas, size_t* rvaCount);
+// Uniqueness is relative to the regions of the scan scope, whose byte counters are updated by every scan.
+Error CheckForUniqueSignature(struct ScanScope* pScope, const BYTE* signature, DWORD signatureLength, BOOL* unique);
+Error FindUniqueSignature(const struct ImageView* pImage, struct ScanScope* pScope, const struct SuffixIndex* pIndex, BYTE* signature, DWORD signatureLength, int functionRVA, BOOL* isUnique, BYTE** uniqueSignature, DWORD* uniqueSignatureLength);
+
+// Builds the wildcard mask of a signature: 0xFF for bytes to compare, 0x00 for rel32 branch targets, RIP-relative
+// displacements and base relocated addresses, which all change when the image is rebuilt or rebased.
+Error GetFunctionSignatureMask(const struct ImageView* pImage, DWORD signatureLength, int functionRVA, BYTE** maskBuffer);
+// FindUniqueSignature for a masked signature. The mask grows together with the signature; the suffix index only
+// knows exact bytes and is not used.
+Error FindUniqueMaskedSignature(const struct ImageView* pImage, struct ScanScope* pScope, const BYTE* signature, const BYTE* mask, DWORD signatureLength, int functionRVA, BOOL* isUnique, BYTE** uniqueSignature, BYTE** uniqueMask, DWORD* uniqueSignatureLength);
+
+// One build of an image for FindCrossBuildSignature: the function's RVA in it and the sections it has to be
+// unique in
+typedef struct CrossBuildTarget {
+    const struct ImageView* pImage;
+    struct ScanScope* pScope;
+    int functionRVA;
+} CrossBuildTarget;
+
+// Finds one pattern of at least `signatureLength` bytes that matches the function in every build and occurs only
+// once in each build's scope. Bytes that differ between the builds become wildcards, and with `wildcards` so do
+// the operands GetFunctionSignatureMask masks in any of them. All builds are scanned once in a single job on the
+// pool, after which the pattern grows while the matches left in every build are filtered together.
+Error FindCrossBuildSignature(const struct CrossBuildTarget* targets, DWORD numTargets, struct ThreadPool* pPool, DWORD signatureLength, BOOL wildcards, BYTE** uniqueSignature, BYTE** uniqueMask, DWORD* uniqueSignatureLength);
@@ -0,0 +1,287 @@
+#include "SignatureDb.h"
+
+// A signature collected before sorting. Offsets point into the builder's string table and blob.
+typedef struct PendingSignature {
+    const char* name;
+    DWORD nameOffset;
+    DWORD imageIndex;
+    DWORD rva;
+    DWORD offset;
+    DWORD length;
+    size_t patternOffset;
+    size_t sequence;        // insertion order, later additions win over earlier ones
+} PendingSignature;
+
+static BOOL AddString(struct SignatureDbBuilder* pBuilder, const char* value, DWORD* offset)
+{
+    size_t length = strlen(value) + 1;
+    if (!ReserveArray((void**)&pBuilder->strings, &pBuilder->stringsCapacity, pBuilder->stringsSize + length, 1, 65536)) return FALSE;
+    memcpy(pBuilder->strings + pBuilder->stringsSize, value, length);
+    *offset = (DWORD)pBuilder->stringsSize;
+    pBuilder->stringsSize += length;
+    return TRUE;
+}
+
+Error AddSignatureDbImage(struct SignatureDbBuilder* pBuilder, const GUID* guid, DWORD age, DWORD timeDateStamp, const char* imageName, DWORD* imageIndex)
+{
+    for (DWORD i = 0; i < pBuilder->numImages; i++) {
+        if (memcmp(&pBuilder->images[i].guid, guid, sizeof(GUID)) == 0 && pBuilder->images[i].age == age) {
+            *imageIndex = i;
+            return NewNoError();
+        }
+    }
+
+    size_t capacity = pBuilder->imagesCapacity;
+    if (!ReserveArray((void**)&pBuilder->images, &capacity, (size_t)pBuilder->numImages + 1, sizeof(struct SignatureDbImage), 16))
+        return NewError(__FUNCTION__, -1, L"realloc failed; out of memory", 0);
+    pBuilder->imagesCapacity = (DWORD)capacity;
+
+    struct SignatureDbImage* image = &pBuilder->images[pBuilder->numImages];
+    image->guid = *guid;
+    image->age = age;
+    image->timeDateStamp = timeDateStamp;
+    if (!AddString(pBuilder, imageName, &image->nameOffset))
+        return NewError(__FUNCTION__, -1, L"realloc failed; out of memory", 0);
+
+    *imageIndex = pBuilder->numImages++;
+    return NewNoError();
+}
+
+Error AddSignatureDbEntry(struct SignatureDbBuilder* pBuilder, DWORD imageIndex, const char* name, DWORD rva, DWORD offset, const BYTE* pattern, const BYTE* mask, DWORD length)
+{
+    if (imageIndex >= pBuilder->numImages)
+        return NewError(__FUNCTION__, -1, L"Unknown image index", 0);
+    if (!ReserveArray((void**)&pBuilder->entries, &pBuilder->entriesCapacity, pBuilder->numEntries + 1, sizeof(struct PendingSignature), 4096) ||
+        !ReserveArray((void**)&pBuilder->blob, &pBuilder->blobCapacity, pBuilder->blobSize + 2 * (size_t)length, 1, 65536))
+        return NewError(__FUNCTION__, -2, L"realloc failed; out of memory", 0);
+
+    struct PendingSignature* entry = &pBuilder->entries[pBuilder->numEntries];
+    if (!AddString(pBuilder, name, &entry->nameOffset))
+        return NewError(__FUNCTION__, -2, L"realloc failed; out of memory", 0);
+    entry->name = NULL;
+    entry->imageIndex = imageIndex;
+    entry->rva = rva;
+    entry->offset = offset;
+    entry->length = length;
+    entry->patternOffset = pBuilder->blobSize;
+    entry->sequence = pBuilder->numEntries;
+
+    memcpy(pBuilder->blob + pBuilder->blobSize, pattern, length);
+    if (mask) memcpy(pBuilder->blob + pBuilder->blobSize + length, mask, length);
+    else memset(pBuilder->blob + pBuilder->blobSize + length, 0xFF, length);
+    pBuilder->blobSize += 2 * (size_t)length;
+    pBuilder->numEntries++;
+    return NewNoError();
+}
+
+Error MergeSignatureDb(struct SignatureDbBuilder* pBuilder, const struct SignatureDb* pDb)
+{
+    const SignatureDbHeader* header = pDb->header;
+    DWORD* imageMap = (DWORD*)malloc((header->numImages ? header->numImages : 1) * sizeof(DWORD));
+    if (!imageMap)
+        return NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0);
+
+    Error e = NewNoError();
+    for (DWORD i = 0; i < header->numImages && !e.ContainsError; i++) {
+        const SignatureDbImage* image = &pDb->images[i];
+        e = AddSignatureDbImage(pBuilder, &image->guid, image->age, image->timeDateStamp, pDb->strings + image->nameOffset, &imageMap[i]);
+    }
+    for (DWORD i = 0; i < header->numEntries && !e.ContainsError; i++) {
+        const SignatureDbEntry* entry = &pDb->entries[i];
+        const BYTE* pattern = pDb->blob + entry->patternOffset;
+        e = AddSignatureDbEntry(pBuilder, imageMap[entry->imageIndex], pDb->strings + entry->nameOffset, entry->rva, entry->offset, pattern, pattern + entry->length, entry->length);
+    }
+
+    free(imageMap);
+    if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -2);
+    return e;
+}
+
+static int ComparePendingSignatures(const void* a, const void* b)
+{
+    const struct PendingSignature* left = (const struct PendingSignature*)a;
+    const struct PendingSignature* right = (const struct PendingSignature*)b;
+    int result = strcmp(left->name, right->name);
+    if (result != 0) return result;
+    if (left->imageIndex != right->imageIndex) return left->imageIndex < right->imageIndex ? -1 : 1;
+    // newest first, so it is the one kept
+    return left->sequence > right->sequence ? -1 : (left->sequence < right->sequence ? 1 : 0);
+}
+
+Error SaveSignatureDb(const struct SignatureDbBuilder* pBuilder, LPCWSTR dbPath)
+{
+    struct PendingSignature* sorted = NULL;
+    BYTE* buffer = NULL;
+    Error e = NewNoError();
+
+    do {
+        sorted = (struct PendingSignature*)malloc((pBuilder->numEntries ? pBuilder->numEntries : 1) * sizeof(struct PendingSignature));
+        if (!sorted) {
+            e = NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0);
+            break;
+        }
+        for (size_t i = 0; i < pBuilder->numEntries; i++) {
+            sorted[i] = pBuilder->entries[i];
+            sorted[i].name = pBuilder->strings + sorted[i].nameOffset;
+        }
+        qsort(sorted, pBuilder->numEntries, sizeof(struct PendingSignature), ComparePendingSignatures);
+
+        // keep one signature per name and image, and size the compacted string table and blob
+        size_t numEntries = 0, stringsSize = 0, blobSize = 0;
+        for (DWORD i = 0; i < pBuilder->numImages; i++) stringsSize += strlen(pBuilder->strings + pBuilder->images[i].nameOffset) + 1;
+        for (size_t i = 0; i < pBuilder->numEntries; i++) {
+            if (numEntries > 0 && sorted[numEntries - 1].imageIndex == sorted[i].imageIndex && strcmp(sorted[numEntries - 1].name, sorted[i].name) == 0)
+                continue;
+            sorted[numEntries++] = sorted[i];
+            stringsSize += strlen(sorted[i].name) + 1;
+            blobSize += 2 * (size_t)sorted[i].length;
+        }
+
+        size_t fileSize = sizeof(SignatureDbHeader) + pBuilder->numImages * sizeof(SignatureDbImage) + numEntries * sizeof(SignatureDbEntry) + stringsSize + blobSize;
+        if (fileSize >= 0xFFFFFFFF) {
+            e = NewError(__FUNCTION__, -2, L"Too many signatures for one database", 0);
+            break;
+        }
+        buffer = (BYTE*)calloc(1, fileSize);
+        if (!buffer) {
+            e = NewError(__FUNCTION__, -1, L"calloc failed; out of memory", 0);
+            break;
+        }
+
+        SignatureDbHeader* header = (SignatureDbHeader*)buffer;
+        header->magic = SIGNATURE_DB_MAGIC;
+        header->version = SIGNATURE_DB_VERSION;
+        header->numImages = pBuilder->numImages;
+        header->numEntries = (DWORD)numEntries;
+        header->stringsSize = (DWORD)stringsSize;
+        header->blobSize = (DWORD)blobSize;
+        SignatureDbImage* images = (SignatureDbImage*)(buffer + sizeof(SignatureDbHeader));
+        SignatureDbEntry* entries = (SignatureDbEntry*)(images + pBuilder->numImages);
+        char* strings = (char*)(entries + numEntries);
+        BYTE* blob = (BYTE*)strings + stringsSize;
+
+        size_t stringsOffset = 0, blobOffset = 0;
+        for (DWORD i = 0; i < pBuilder->numImages; i++) {
+            const char* name = pBuilder->strings + pBuilder->images[i].nameOffset;
+            size_t length = strlen(name) + 1;
+            images[i] = pBuilder->images[i];
+            images[i].nameOffset = (DWORD)stringsOffset;
+            memcpy(strings + stringsOffset, name, length);
+            stringsOffset += length;
+        }
+        for (size_t i = 0; i < numEntries; i++) {
+            size_t length = strlen(sorted[i].name) + 1;
+            entries[i].nameOffset = (DWORD)stringsOffset;
+            entries[i].imageIndex = sorted[i].imageIndex;
+            entries[i].rva = sorted[i].rva;
+            entries[i].offset = sorted[i].offset;
+            entries[i].length = sorted[i].length;
+            entries[i].patternOffset = (DWORD)blobOffset;
+            memcpy(strings + stringsOffset, sorted[i].name, length);
+            stringsOffset += length;
+            memcpy(blob + blobOffset, pBuilder->blob + sorted[i].patternOffset, 2 * (size_t)sorted[i].length);
+            blobOffset += 2 * (size_t)sorted[i].length;
+        }
+
+        if (!WriteFileAtomic(dbPath, buffer, fileSize)) {
+            e = NewError(__FUNCTION__, -3, L"Failed to write the signature database", GetLastError());
+            break;
+        }
+    } while (FALSE);
+
+    free(buffer);
+    free(sorted);
+    return e;
+}
+
+void FreeSignatureDbBuilder(struct SignatureDbBuilder* pBuilder)
+{
+    free(pBuilder->images);
+    free(pBuilder->entries);
+    free(pBuilder->strings);
+    free(pBuilder->blob);
+    memset(pBuilder, 0, sizeof(struct SignatureDbBuilder));
+}
+
+Error LoadSignatureDb(LPCWSTR dbPath, struct SignatureDb* pDb)
+{
+    memset(pDb, 0, sizeof(struct SignatureDb));
+    Error e = MapFileReadOnly(dbPath, &pDb->file);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+
+    const BYTE* base = pDb->file.data;
+    const SignatureDbHeader* header = (const SignatureDbHeader*)base;
+    do {
+        if (pDb->file.size < sizeof(SignatureDbHeader) || header->magic != SIGNATURE_DB_MAGIC) {
+            e = NewError(__FUNCTION__, -2, L"Not a signature database", 0);
+            break;
+        }
+        if (header->version != SIGNATURE_DB_VERSION) {
+            e = NewError(__FUNCTION__, -2, L"Signature database was written by another version; recreate it", 0);
+            break;
+        }
+        ULONGLONG expectedSize = sizeof(SignatureDbHeader) + (ULONGLONG)header->numImages * sizeof(SignatureDbImage) +
+            (ULONGLONG)header->numEntries * sizeof(SignatureDbEntry) + header->stringsSize + header->blobSize;
+        if (pDb->file.size != expectedSize) {
+            e = NewError(__FUNCTION__, -3, L"Signature database is truncated", 0);
+            break;
+        }
+
+        pDb->header = header;
+        pDb->images = (const SignatureDbImage*)(base + sizeof(SignatureDbHeader));
+        pDb->entries = (const SignatureDbEntry*)(pDb->images + header->numImages);
+        pDb->strings = (const char*)(pDb->entries + header->numEntries);
+        pDb->blob = (const BYTE*)pDb->strings + header->stringsSize;
+
+        // validate every offset once, so lookups can trust the file
+        BOOL valid = header->stringsSize > 0 && pDb->strings[header->stringsSize - 1] == '\0';
+        for (DWORD i = 0; valid && i < header->numImages; i++)
+            valid = pDb->images[i].nameOffset < header->stringsSize;
+        for (DWORD i = 0; valid && i < header->numEntries; i++) {
+            const SignatureDbEntry* entry = &pDb->entries[i];
+            valid = entry->nameOffset < header->stringsSize && entry->imageIndex < header->numImages &&
+                (ULONGLONG)entry->patternOffset + 2ULL * entry->length <= header->blobSize;
+        }
+        if (!valid && (header->numImages || header->numEntries)) {
+            e = NewError(__FUNCTION__, -4, L"Signature database is corrupted", 0);
+            break;
+        }
+
+        // lookups are binary searches, which silently miss entries of a file that is out of order
+        BOOL sorted = TRUE;
+        for (DWORD i = 1; sorted && i < header->numEntries; i++) {
+            int order = strcmp(pDb->strings + pDb->entries[i - 1].nameOffset, pDb->strings + pDb->entries[i].nameOffset);
+            sorted = order < 0 || (order == 0 && pDb->entries[i - 1].imageIndex < pDb->entries[i].imageIndex);
+        }
+        if (!sorted)
+            e = NewError(__FUNCTION__, -5, L"Signature database entries are not sorted by name and image", 0);
+    } while (FALSE);
+
+    if (e.ContainsError) FreeSignatureDb(pDb);
+    return e;
+}
+
+void FreeSignatureDb(struct SignatureDb* pDb)
+{
+    UnmapFile(&pDb->file);
+    memset(pDb, 0, sizeof(struct SignatureDb));
+}
+
+BOOL FindSignatureDbEntries(const struct SignatureDb* pDb, const char* name, DWORD* first, DWORD* count)
+{
+    DWORD low = 0, high = pDb->header->numEntries;
+    while (low < high) {
+        DWORD mid = low + (high - low) / 2;
+        if (strcmp(pDb->strings + pDb->entries[mid].nameOffset, name) < 0) low = mid + 1;
+        else high = mid;
+    }
+
+    DWORD end = low;
+    while (end < pDb->header->numEntries && strcmp(pDb->strings + pDb->entries[end].nameOffset, name) == 0) end++;
+    *first = low;
+    *count = end - low;
+    return end > low;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "Image.h"
+
+#define SIGNATURE_DB_MAGIC 0x42444753 // 'SGDB'
+#define SIGNATURE_DB_VERSION 2
+
+// An image the database has signatures for
+typedef struct SignatureDbImage {
+    GUID guid;              // CodeView GUID
+    DWORD age;              // CodeView age
+    DWORD timeDateStamp;    // from the PE file header
+    DWORD nameOffset;       // file name of the image in the string table
+} SignatureDbImage;
+
+// A function signature. Entries are sorted by name, then by image.
+typedef struct SignatureDbEntry {
+    DWORD nameOffset;       // offset of the null terminated function name in the string table
+    DWORD imageIndex;
+    DWORD rva;              // start of the function
+    DWORD offset;           // where the pattern starts, relative to `rva`
+    DWORD length;
+    DWORD patternOffset;    // `length` pattern bytes in the blob, followed by `length` mask bytes (0xFF compare, 0x00 wildcard)
+} SignatureDbEntry;
+
+// On-disk header of a signature database: header, images, entries, string table, then the pattern blob.
+typedef struct SignatureDbHeader {
+    DWORD magic;
+    DWORD version;
+    DWORD numImages;
+    DWORD numEntries;
+    DWORD stringsSize;
+    DWORD blobSize;
+    DWORD reserved[2];
+} SignatureDbHeader;
+
+/*
+ * A signature database mapped from disk and queried in place. Loading is a single mapping plus validation, and
+ * lookups by function name are a binary search over the entry table.
+ */
+typedef struct SignatureDb {
+    struct FileMapping file;
+    const SignatureDbHeader* header;
+    const SignatureDbImage* images;
+    const SignatureDbEntry* entries;
+    const char* strings;
+    const BYTE* blob;
+} SignatureDb;
+
+// A database being assembled in memory, e.g. from one run or by merging several files
+typedef struct SignatureDbBuilder {
+    struct SignatureDbImage* images;
+    DWORD numImages;
+    DWORD imagesCapacity;
+    struct PendingSignature* entries;
+    size_t numEntries;
+    size_t entriesCapacity;
+    char* strings;
+    size_t stringsSize;
+    size_t stringsCapacity;
+    BYTE* blob;
+    size_t blobSize;
+    size_t blobCapacity;
+} SignatureDbBuilder;
+
+// Adds an image, or returns the index of the image with the same GUID and age if it was added before.
+Error AddSignatureDbImage(struct SignatureDbBuilder* pBuilder, const GUID* guid, DWORD age, DWORD timeDateStamp, const char* imageName, DWORD* imageIndex);
+
+// Adds a signature of the function at `rva` that starts `offset` bytes into it. A NULL mask compares every byte.
+// A later signature for the same name and image replaces an earlier one.
+Error AddSignatureDbEntry(struct SignatureDbBuilder* pBuilder, DWORD imageIndex, const char* name, DWORD rva, DWORD offset, const BYTE* pattern, const BYTE* mask, DWORD length);
+
+// Adds all images and signatures of a loaded database.
+Error MergeSignatureDb(struct SignatureDbBuilder* pBuilder, const struct SignatureDb* pDb);
+
+// Sorts the signatures and writes them to a temporary file that is then moved over `dbPath`.
+Error SaveSignatureDb(const struct SignatureDbBuilder* pBuilder, LPCWSTR dbPath);
+
+void FreeSignatureDbBuilder(struct SignatureDbBuilder* pBuilder);
+
+// Maps and validates a database file. Free after use with FreeSignatureDb.
+Error LoadSignatureDb(LPCWSTR dbPath, struct SignatureDb* pDb);
+void FreeSignatureDb(struct SignatureDb* pDb);
+
+// Finds the signatures of a function, one per image that has it. Returns FALSE if there are none.
+BOOL FindSignatureDbEntries(const struct SignatureDb* pDb, const char* name, DWORD* first, DWORD* count);
@@ -0,0 +1,83 @@
+#include "Stats.h"
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+struct Stats g_Stats = { 0 };
+
+// JSON keys, in enum order
+static const wchar_t* const g_TimerNames[STATS_TIMER_COUNT] = {
+    L"total", L"map_image", L"scan_scope", L"pe_info", L"symbol_index", L"pdb_download", L"pdb_load", L"dbghelp_load",
+    L"type_layout", L"suffix_index", L"function_rva", L"signature", L"unique_signature", L"scan", L"signature_db"
+};
+
+static const wchar_t* const g_CounterNames[STATS_COUNTER_COUNT] = {
+    L"bytes_read", L"bytes_downloaded", L"file_opens", L"syscalls", L"trial_lengths", L"candidate_matches", L"scans",
+    L"bytes_scanned"
+};
+
+void EnableStats(void)
+{
+    g_Stats.enabled = TRUE;
+}
+
+ULONGLONG ReadStatsClock(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (ULONGLONG)counter.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ULONGLONG)now.tv_sec * 1000000000ull + (ULONGLONG)now.tv_nsec;
+#endif
+}
+
+ULONGLONG GetStatsClockFrequency(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return (ULONGLONG)frequency.QuadPart;
+#else
+    return 1000000000ull;
+#endif
+}
+
+void WriteStatsJson(FILE* out)
+{
+    double frequency = (double)GetStatsClockFrequency();
+    fwprintf(out, L"{\n  \"timers\": {\n");
+    for (int i = 0; i < STATS_TIMER_COUNT; i++) {
+        fwprintf(out, L"    \"%ls\": { \"seconds\": %.6f, \"calls\": %llu }%ls\n", g_TimerNames[i],
+            (double)g_Stats.timerTicks[i] / frequency, (ULONGLONG)g_Stats.timerCalls[i], i + 1 < STATS_TIMER_COUNT ? L"," : L"");
+    }
+    fwprintf(out, L"  },\n  \"counters\": {\n");
+    for (int i = 0; i < STATS_COUNTER_COUNT; i++) {
+        fwprintf(out, L"    \"%ls\": %llu%ls\n", g_CounterNames[i], (ULONGLONG)g_Stats.counters[i],
+            i + 1 < STATS_COUNTER_COUNT ? L"," : L"");
+    }
+
+    // only the time spent in scans counts, not the setup around them
+    double scanSeconds = (double)g_Stats.timerTicks[STATS_TIMER_SCAN] / frequency;
+    double scanRate = scanSeconds > 0 ? (double)g_Stats.counters[STATS_BYTES_SCANNED] / scanSeconds / 1e9 : 0.0;
+    fwprintf(out, L"  },\n  \"scan_gb_per_second\": %.3f\n}\n", scanRate);
+}
+
+Error SaveStatsReport(LPCWSTR path)
+{
+    if (!path) {
+        WriteStatsJson(stderr);
+        return NewNoError();
+    }
+
+    FILE* file = OpenFileW(path, "w");
+    if (!file)
+        return NewError(__FUNCTION__, -1, L"Failed to create the stats file", GetLastError());
+    WriteStatsJson(file);
+    BOOL failed = ferror(file) != 0;
+    if (fclose(file) != 0 || failed)
+        return NewError(__FUNCTION__, -2, L"Failed to write the stats file", GetLastError());
+    return NewNoError();
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "Platform.h"
+#include "Error.h"
+
+// Timed phases of a run. A phase may be entered many times (e.g. once per function in batch mode); its time and
+// number of calls add up. STATS_TIMER_SCAN runs inside the signature phases.
+typedef enum StatsTimer {
+    STATS_TIMER_TOTAL,
+    STATS_TIMER_MAP_IMAGE,
+    STATS_TIMER_SCAN_SCOPE,
+    STATS_TIMER_PE_INFO,
+    STATS_TIMER_SYMBOL_INDEX,   // loading a cached symbol index
+    STATS_TIMER_PDB_DOWNLOAD,
+    STATS_TIMER_PDB_LOAD,       // parsing the PDB and building its symbol index
+    STATS_TIMER_DBGHELP_LOAD,   // SymInitializeW and SymLoadModuleExW, for type queries
+    STATS_TIMER_TYPE_LAYOUT,    // enumerating the fields of a type
+    STATS_TIMER_SUFFIX_INDEX,
+    STATS_TIMER_FUNCTION_RVA,
+    STATS_TIMER_SIGNATURE,      // reading and masking the requested signature
+    STATS_TIMER_UNIQUE_SIGNATURE,
+    STATS_TIMER_SCAN,           // scans of the scan scope, or of a streamed file
+    STATS_TIMER_SIGNATURE_DB,
+    STATS_TIMER_COUNT
+} StatsTimer;
+
+typedef enum StatsCounter {
+    STATS_BYTES_READ,           // bytes mapped or read from files
+    STATS_BYTES_DOWNLOADED,
+    STATS_FILE_OPENS,
+    STATS_SYSCALLS,             // file and mapping calls issued directly, not the ones behind the CRT or DbgHelp
+    STATS_TRIAL_LENGTHS,        // signature lengths tried while growing a signature until it is unique
+    STATS_CANDIDATE_MATCHES,    // occurrences compared against a longer trial signature
+    STATS_SCANS,
+    STATS_BYTES_SCANNED,
+    STATS_COUNTER_COUNT
+} StatsCounter;
+
+/*
+ * Process wide counters and phase timers. Everything is a no-op behind a single flag until EnableStats, so the
+ * instrumentation can stay in the hot paths: callers add up counts locally and report them once per scan or
+ * per signature, not per byte. Counters are updated atomically and may be added to from scan threads.
+ */
+typedef struct Stats {
+    BOOL enabled;
+    volatile LONG64 counters[STATS_COUNTER_COUNT];
+    volatile LONG64 timerTicks[STATS_TIMER_COUNT];
+    volatile LONG64 timerCalls[STATS_TIMER_COUNT];
+} Stats;
+
+extern struct Stats g_Stats;
+
+void EnableStats(void);
+
+// Monotonic clock, in GetStatsClockFrequency ticks per second.
+ULONGLONG ReadStatsClock(void);
+ULONGLONG GetStatsClockFrequency(void);
+
+static inline void AddStatsCount(StatsCounter counter, ULONGLONG value) {
+    if (g_Stats.enabled) InterlockedExchangeAdd64(&g_Stats.counters[counter], (LONG64)value);
+}
+
+// Returns the start of a timed phase, to be passed to StopStatsTimer. Does not read the clock while disabled.
+static inline ULONGLONG StartStatsTimer(void) {
+    return g_Stats.enabled ? ReadStatsClock() : 0;
+}
+
+static inline void StopStatsTimer(StatsTimer timer, ULONGLONG start) {
+    if (!g_Stats.enabled) return;
+    InterlockedExchangeAdd64(&g_Stats.timerTicks[timer], (LONG64)(ReadStatsClock() - start));
+    InterlockedExchangeAdd64(&g_Stats.timerCalls[timer], 1);
+}
+
+// Writes every timer and counter, and the scan rate derived from them, as one JSON object.
+void WriteStatsJson(FILE* out);
+// Writes the JSON report to stderr when `path` is NULL, or to the file.
+Error SaveStatsReport(LPCWSTR path);
@@ -0,0 +1,301 @@
+#include "StreamScan.h"
+#include "Scan.h"
+#include "Stats.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+// The file and the ring of buffers of one streamed scan. Chunk i of the file is read into buffer i % STREAM_SCAN_BUFFERS.
+typedef struct ScanStream {
+#ifdef _WIN32
+    HANDLE hFile;
+    OVERLAPPED overlapped[STREAM_SCAN_BUFFERS];
+#else
+    int fd;
+#endif
+    ULONGLONG fileSize;
+    DWORD carrySpace;                                   // room in front of each chunk for the tail of the one before
+    BYTE* buffers[STREAM_SCAN_BUFFERS];
+    ULONGLONG chunkOffsets[STREAM_SCAN_BUFFERS];
+    DWORD chunkLengths[STREAM_SCAN_BUFFERS];
+    BOOL pending[STREAM_SCAN_BUFFERS];                  // a read was started and not waited for
+} ScanStream;
+
+static void CloseScanStream(struct ScanStream* pStream)
+{
+#ifdef _WIN32
+    for (DWORD i = 0; i < STREAM_SCAN_BUFFERS; i++) {
+        // the buffers may only be freed once the reads into them have stopped
+        if (pStream->pending[i]) {
+            DWORD read;
+            CancelIoEx(pStream->hFile, &pStream->overlapped[i]);
+            GetOverlappedResult(pStream->hFile, &pStream->overlapped[i], &read, TRUE);
+        }
+        if (pStream->overlapped[i].hEvent) CloseHandle(pStream->overlapped[i].hEvent);
+    }
+    if (pStream->hFile && pStream->hFile != INVALID_HANDLE_VALUE) CloseHandle(pStream->hFile);
+#else
+    if (pStream->fd >= 0) close(pStream->fd);
+#endif
+    for (DWORD i = 0; i < STREAM_SCAN_BUFFERS; i++) free(pStream->buffers[i]);
+    memset(pStream, 0, sizeof(struct ScanStream));
+}
+
+static Error OpenScanStream(LPCWSTR filePath, DWORD carrySpace, struct ScanStream* pStream)
+{
+    memset(pStream, 0, sizeof(struct ScanStream));
+#ifndef _WIN32
+    pStream->fd = -1;
+#endif
+    pStream->carrySpace = carrySpace;
+    Error e = NewNoError();
+    do {
+        for (DWORD i = 0; i < STREAM_SCAN_BUFFERS; i++) {
+            pStream->buffers[i] = (BYTE*)malloc((size_t)carrySpace + STREAM_SCAN_BUFFER_SIZE);
+            if (!pStream->buffers[i]) {
+                e = NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0);
+                break;
+            }
+        }
+        if (e.ContainsError) break;
+
+#ifdef _WIN32
+        // sequential scan lets the cache manager read ahead further and drop the pages behind early
+        pStream->hFile = CreateFileW(filePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (pStream->hFile == INVALID_HANDLE_VALUE) {
+            e = NewError(__FUNCTION__, -2, L"CreateFileW failed", GetLastError());
+            break;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(pStream->hFile, &fileSize)) {
+            e = NewError(__FUNCTION__, -3, L"GetFileSizeEx failed", GetLastError());
+            break;
+        }
+        pStream->fileSize = (ULONGLONG)fileSize.QuadPart;
+        for (DWORD i = 0; i < STREAM_SCAN_BUFFERS && !e.ContainsError; i++) {
+            pStream->overlapped[i].hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+            if (!pStream->overlapped[i].hEvent)
+                e = NewError(__FUNCTION__, -4, L"CreateEventW failed", GetLastError());
+        }
+        AddStatsCount(STATS_SYSCALLS, 2 + STREAM_SCAN_BUFFERS);
+#else
+        char* path = WideToUtf8(filePath);
+        if (!path) {
+            e = NewError(__FUNCTION__, -2, L"WideToUtf8 failed", 0);
+            break;
+        }
+        pStream->fd = open(path, O_RDONLY);
+        free(path);
+        if (pStream->fd < 0) {
+            e = NewError(__FUNCTION__, -2, L"open failed", GetLastError());
+            break;
+        }
+        struct stat st;
+        if (fstat(pStream->fd, &st) != 0) {
+            e = NewError(__FUNCTION__, -3, L"fstat failed", GetLastError());
+            break;
+        }
+        pStream->fileSize = (ULONGLONG)st.st_size;
+        posix_fadvise(pStream->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        AddStatsCount(STATS_SYSCALLS, 3);
+#endif
+        AddStatsCount(STATS_FILE_OPENS, 1);
+    } while (FALSE);
+
+    if (e.ContainsError) CloseScanStream(pStream);
+    return e;
+}
+
+// Starts reading a chunk into its buffer, without waiting for the data
+static Error BeginChunkRead(struct ScanStream* pStream, ULONGLONG chunk)
+{
+    DWORD slot = (DWORD)(chunk % STREAM_SCAN_BUFFERS);
+    ULONGLONG offset = chunk * STREAM_SCAN_BUFFER_SIZE;
+    ULONGLONG remaining = pStream->fileSize - offset;
+    DWORD length = remaining < STREAM_SCAN_BUFFER_SIZE ? (DWORD)remaining : STREAM_SCAN_BUFFER_SIZE;
+    pStream->chunkOffsets[slot] = offset;
+    pStream->chunkLengths[slot] = length;
+
+#ifdef _WIN32
+    OVERLAPPED* overlapped = &pStream->overlapped[slot];
+    overlapped->Offset = (DWORD)offset;
+    overlapped->OffsetHigh = (DWORD)(offset >> 32);
+    if (!ReadFile(pStream->hFile, pStream->buffers[slot] + pStream->carrySpace, length, NULL, overlapped) && GetLastError() != ERROR_IO_PENDING)
+        return NewError(__FUNCTION__, -1, L"ReadFile failed", GetLastError());
+#else
+    // the kernel reads the chunk into the page cache in the background, the pread later copies it out
+    posix_fadvise(pStream->fd, (off_t)offset, (off_t)length, POSIX_FADV_WILLNEED);
+#endif
+    pStream->pending[slot] = TRUE;
+    AddStatsCount(STATS_SYSCALLS, 1);
+    return NewNoError();
+}
+
+// Waits until a chunk is in its buffer
+static Error FinishChunkRead(struct ScanStream* pStream, DWORD slot)
+{
+    DWORD length = pStream->chunkLengths[slot];
+    pStream->pending[slot] = FALSE;
+#ifdef _WIN32
+    DWORD read = 0;
+    if (!GetOverlappedResult(pStream->hFile, &pStream->overlapped[slot], &read, TRUE))
+        return NewError(__FUNCTION__, -1, L"Reading the file failed", GetLastError());
+    AddStatsCount(STATS_SYSCALLS, 1);
+#else
+    BYTE* chunk = pStream->buffers[slot] + pStream->carrySpace;
+    DWORD read = 0;
+    while (read < length) {
+        ssize_t count = pread(pStream->fd, chunk + read, length - read, (off_t)(pStream->chunkOffsets[slot] + read));
+        if (count <= 0) break;
+        read += (DWORD)count;
+        AddStatsCount(STATS_SYSCALLS, 1);
+    }
+#endif
+    if (read != length)
+        return NewError(__FUNCTION__, -2, L"The file ended early; was it truncated during the scan?", GetLastError());
+    AddStatsCount(STATS_BYTES_READ, length);
+    return NewNoError();
+}
+
+Error StreamScanFile(LPCWSTR filePath, const BYTE* pattern, const BYTE* mask, DWORD patternLength, StreamScanMatch onMatch, void* context, struct StreamScanStats* pStats)
+{
+    memset(pStats, 0, sizeof(struct StreamScanStats));
+    if (patternLength == 0 || patternLength > STREAM_SCAN_MAX_PATTERN)
+        return NewError(__FUNCTION__, -1, L"Pattern length out of range", 0);
+
+    ULONGLONG clockStart = ReadStatsClock();
+    ULONGLONG statsStart = StartStatsTimer();
+    struct ScanStream stream;
+    Error e = OpenScanStream(filePath, patternLength - 1, &stream);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -2);
+        return e;
+    }
+    pStats->fileSize = stream.fileSize;
+
+    ULONGLONG numChunks = (stream.fileSize + STREAM_SCAN_BUFFER_SIZE - 1) / STREAM_SCAN_BUFFER_SIZE;
+    // every buffer but the one being scanned is being read
+    for (ULONGLONG chunk = 0; chunk + 1 < STREAM_SCAN_BUFFERS && chunk < numChunks && !e.ContainsError; chunk++)
+        e = BeginChunkRead(&stream, chunk);
+
+    BOOL stopped = FALSE;
+    for (ULONGLONG chunk = 0; chunk < numChunks && !e.ContainsError && !stopped; chunk++) {
+        DWORD slot = (DWORD)(chunk % STREAM_SCAN_BUFFERS);
+        e = FinishChunkRead(&stream, slot);
+        if (e.ContainsError) break;
+
+        // chunks before the last are longer than the carry, so it always comes from the previous chunk alone
+        DWORD carry = chunk > 0 ? stream.carrySpace : 0;
+        if (carry) {
+            DWORD previous = (slot + STREAM_SCAN_BUFFERS - 1) % STREAM_SCAN_BUFFERS;
+            memcpy(stream.buffers[slot] + stream.carrySpace - carry, stream.buffers[previous] + stream.carrySpace + stream.chunkLengths[previous] - carry, carry);
+        }
+        // the previous buffer is free now
+        if (chunk + STREAM_SCAN_BUFFERS - 1 < numChunks) {
+            e = BeginChunkRead(&stream, chunk + STREAM_SCAN_BUFFERS - 1);
+            if (e.ContainsError) break;
+        }
+
+        // a match starting in the carry runs into this chunk, so the previous scan could not have found it
+        const BYTE* data = stream.buffers[slot] + stream.carrySpace - carry;
+        size_t dataLength = (size_t)carry + stream.chunkLengths[slot];
+        ULONGLONG dataOffset = stream.chunkOffsets[slot] - carry;
+        for (size_t position = 0; !stopped; position++) {
+            position = mask ? ScanFindNextMasked(data, dataLength, pattern, mask, patternLength, position)
+                            : ScanFindNext(data, dataLength, pattern, patternLength, position);
+            if (position == SCAN_NOT_FOUND) break;
+            pStats->matches++;
+            stopped = !onMatch(context, dataOffset + position);
+        }
+        pStats->bytesScanned += stream.chunkLengths[slot];
+#ifndef _WIN32
+        // keep a multi-GB input from pushing everything else out of the page cache
+        posix_fadvise(stream.fd, (off_t)stream.chunkOffsets[slot], (off_t)stream.chunkLengths[slot], POSIX_FADV_DONTNEED);
+#endif
+    }
+
+    if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -3);
+    CloseScanStream(&stream);
+    StopStatsTimer(STATS_TIMER_SCAN, statsStart);
+    AddStatsCount(STATS_SCANS, 1);
+    AddStatsCount(STATS_BYTES_SCANNED, pStats->bytesScanned);
+    pStats->seconds = (double)(ReadStatsClock() - clockStart) / (double)GetStatsClockFrequency();
+    return e;
+}
+
+static int GetHexDigitValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static BOOL IsPatternSeparator(char c)
+{
+    return c == ' ' || c == ',' || c == '\t';
+}
+
+Error ParseScanPattern(const char* text, BYTE** pPattern, BYTE** pMask, DWORD* pLength)
+{
+    *pPattern = NULL;
+    *pMask = NULL;
+    *pLength = 0;
+
+    // every byte takes at least one character and a separator
+    size_t capacity = strlen(text) / 2 + 1;
+    BYTE* pattern = (BYTE*)malloc(capacity);
+    BYTE* mask = (BYTE*)malloc(capacity);
+    if (!pattern || !mask) {
+        free(pattern);
+        free(mask);
+        return NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0);
+    }
+
+    DWORD length = 0;
+    BOOL wildcards = FALSE;
+    Error e = NewNoError();
+    for (const char* c = text; *c && !e.ContainsError;) {
+        if (IsPatternSeparator(*c)) {
+            c++;
+            continue;
+        }
+
+        if (*c == '?') {
+            c += c[1] == '?' ? 2 : 1;
+            pattern[length] = 0;
+            mask[length++] = 0x00;
+            wildcards = TRUE;
+        } else {
+            if (c[0] == '0' && (c[1] == 'x' || c[1] == 'X')) c += 2;
+            int high = GetHexDigitValue(c[0]);
+            int low = high >= 0 ? GetHexDigitValue(c[1]) : -1;
+            if (low < 0) {
+                e = NewError(__FUNCTION__, -2, L"Pattern bytes are two hex digits or a ? wildcard", 0);
+                break;
+            }
+            c += 2;
+            pattern[length] = (BYTE)(high * 16 + low);
+            mask[length++] = 0xFF;
+        }
+        if (*c && !IsPatternSeparator(*c))
+            e = NewError(__FUNCTION__, -3, L"Pattern bytes have to be separated by spaces or commas", 0);
+    }
+    if (!e.ContainsError && length == 0)
+        e = NewError(__FUNCTION__, -4, L"The pattern is empty", 0);
+
+    if (e.ContainsError || !wildcards) {
+        free(mask);
+        mask = NULL;
+    }
+    if (e.ContainsError) {
+        free(pattern);
+        return e;
+    }
+    *pPattern = pattern;
+    *pMask = mask;
+    *pLength = length;
+    return NewNoError();
+}
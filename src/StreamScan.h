@@ -0,0 +1,32 @@
+#pragma once
+#include "Platform.h"
+#include "Error.h"
+
+#define STREAM_SCAN_BUFFER_SIZE (8 * 1024 * 1024)
+#define STREAM_SCAN_BUFFERS 2
+// Longest pattern, as the carry over between buffers is at most one byte shorter
+#define STREAM_SCAN_MAX_PATTERN 4096
+
+// Called for every match in file order. Returning FALSE stops the scan.
+typedef BOOL (*StreamScanMatch)(void* context, ULONGLONG offset);
+
+typedef struct StreamScanStats {
+    ULONGLONG fileSize;
+    ULONGLONG bytesScanned;
+    ULONGLONG matches;
+    double seconds;
+} StreamScanStats;
+
+/*
+ * Finds a pattern in a file of any size, such as a full memory dump or a firmware blob, through a ring of
+ * STREAM_SCAN_BUFFERS buffers of STREAM_SCAN_BUFFER_SIZE bytes, so memory use stays the same however large the
+ * file is. The last patternLength - 1 bytes of a buffer are carried over in front of the next one, so a match
+ * across a buffer boundary is found exactly once. The next buffer is read while the current one is scanned:
+ * with overlapped reads on Windows, and with read-ahead hints to the kernel elsewhere. A NULL mask compares every
+ * byte, otherwise 0x00 mask bytes are wildcards.
+ */
+Error StreamScanFile(LPCWSTR filePath, const BYTE* pattern, const BYTE* mask, DWORD patternLength, StreamScanMatch onMatch, void* context, struct StreamScanStats* pStats);
+
+// Parses an IDA style pattern, e.g. "48 8B 05 ? ? ? ?", or the "0x48, 0x8B" form signatures are printed in.
+// `*pMask` is NULL when the pattern has no wildcards. Free both buffers after use.
+Error ParseScanPattern(const char* text, BYTE** pPattern, BYTE** pMask, DWORD* pLength);
@@ -0,0 +1,453 @@
+#include "SuffixIndex.h"
+
+static size_t AlignUp4(size_t value) { return (value + 3) & ~(size_t)3; }
+
+// Total size of the serialized index for the given text and section count
+static size_t GetIndexSize(DWORD numSections, DWORD textLength)
+{
+    return sizeof(SuffixIndexHeader) + numSections * sizeof(SuffixIndexSection) + AlignUp4(textLength) + 3 * (size_t)textLength * sizeof(DWORD);
+}
+
+// Points the index members into a buffer laid out as described in SuffixIndexHeader
+static void AttachSuffixIndex(struct SuffixIndex* pIndex, const BYTE* base)
+{
+    const SuffixIndexHeader* header = (const SuffixIndexHeader*)base;
+    DWORD n = header->textLength;
+    const BYTE* cursor = base + sizeof(SuffixIndexHeader);
+
+    pIndex->header = header;
+    pIndex->sections = (const SuffixIndexSection*)cursor;
+    cursor += header->numSections * sizeof(SuffixIndexSection);
+    pIndex->text = cursor;
+    cursor += AlignUp4(n);
+    pIndex->suffixArray = (const DWORD*)cursor;
+    pIndex->lcp = pIndex->suffixArray + n;
+    pIndex->rank = pIndex->lcp + n;
+}
+
+static BOOL IsIndexedSection(const IMAGE_SECTION_HEADER* section)
+{
+    return (section->Characteristics & IMAGE_SCN_MEM_EXECUTE) != 0;
+}
+
+#define SAIS_EMPTY 0xFFFFFFFF
+
+// S-type suffixes are smaller than the suffix after them, L-type ones larger; one bit per position
+static BOOL IsSType(const BYTE* types, DWORD i) { return (types[i >> 3] >> (i & 7)) & 1; }
+
+// A leftmost S-type position: S-type with an L-type position before it
+static BOOL IsLmsPosition(const BYTE* types, DWORD i) { return i > 0 && IsSType(types, i) && !IsSType(types, i - 1); }
+
+// Start (or with `end`, one past the end) of the bucket of every character in the suffix array
+static void GetSaisBuckets(const DWORD* s, DWORD n, DWORD k, DWORD* buckets, BOOL end)
+{
+    memset(buckets, 0, (size_t)k * sizeof(DWORD));
+    for (DWORD i = 0; i < n; i++) buckets[s[i]]++;
+    DWORD sum = 0;
+    for (DWORD c = 0; c < k; c++) {
+        DWORD count = buckets[c];
+        sum += count;
+        buckets[c] = end ? sum : sum - count;
+    }
+}
+
+// Sorts the L-type suffixes from the sorted ones left of them, then the S-type suffixes from those right of them
+static void InduceSais(const DWORD* s, DWORD n, DWORD k, const BYTE* types, DWORD* sa, DWORD* buckets)
+{
+    GetSaisBuckets(s, n, k, buckets, FALSE);
+    for (DWORD i = 0; i < n; i++) {
+        if (sa[i] == SAIS_EMPTY || sa[i] == 0) continue;
+        DWORD j = sa[i] - 1;
+        if (!IsSType(types, j)) sa[buckets[s[j]]++] = j;
+    }
+    GetSaisBuckets(s, n, k, buckets, TRUE);
+    for (DWORD i = n; i-- > 0;) {
+        if (sa[i] == SAIS_EMPTY || sa[i] == 0) continue;
+        DWORD j = sa[i] - 1;
+        if (IsSType(types, j)) sa[--buckets[s[j]]] = j;
+    }
+}
+
+/*
+ * SA-IS (Nong, Zhang and Chan): sorts the LMS substrings by induced sorting, names them, sorts the suffixes of the
+ * string of names recursively, and induces the order of all suffixes from the sorted LMS suffixes. `s` has `n`
+ * characters below `k` and ends with a unique smallest one. The recursion works in `sa`, so the extra memory is
+ * the type bits and the buckets of each level, and the construction is O(n).
+ */
+static BOOL SortSais(const DWORD* s, DWORD n, DWORD k, DWORD* sa)
+{
+    BYTE* types = (BYTE*)calloc(((size_t)n + 7) / 8, 1);
+    DWORD* buckets = (DWORD*)malloc((size_t)k * sizeof(DWORD));
+    if (!types || !buckets) {
+        free(types);
+        free(buckets);
+        return FALSE;
+    }
+
+    types[(n - 1) >> 3] |= 1 << ((n - 1) & 7);
+    for (DWORD i = n - 1; i-- > 0;) {
+        if (s[i] < s[i + 1] || (s[i] == s[i + 1] && IsSType(types, i + 1))) types[i >> 3] |= 1 << (i & 7);
+    }
+
+    // sort the LMS substrings: place the LMS positions at their bucket ends and induce
+    GetSaisBuckets(s, n, k, buckets, TRUE);
+    for (DWORD i = 0; i < n; i++) sa[i] = SAIS_EMPTY;
+    for (DWORD i = 1; i < n; i++) {
+        if (IsLmsPosition(types, i)) sa[--buckets[s[i]]] = i;
+    }
+    InduceSais(s, n, k, types, sa, buckets);
+
+    // gather the sorted LMS substrings and name them, equal substrings getting equal names
+    DWORD n1 = 0;
+    for (DWORD i = 0; i < n; i++) {
+        if (IsLmsPosition(types, sa[i])) sa[n1++] = sa[i];
+    }
+    for (DWORD i = n1; i < n; i++) sa[i] = SAIS_EMPTY;
+    DWORD numNames = 0, previous = SAIS_EMPTY;
+    for (DWORD i = 0; i < n1; i++) {
+        DWORD position = sa[i];
+        BOOL differs = FALSE;
+        for (DWORD d = 0;; d++) {
+            if (previous == SAIS_EMPTY || s[position + d] != s[previous + d] || IsSType(types, position + d) != IsSType(types, previous + d)) {
+                differs = TRUE;
+                break;
+            }
+            if (d > 0 && (IsLmsPosition(types, position + d) || IsLmsPosition(types, previous + d))) break;
+        }
+        if (differs) {
+            numNames++;
+            previous = position;
+        }
+        // LMS positions are at least two apart, so halving them gives distinct slots behind the first n1
+        sa[n1 + position / 2] = numNames - 1;
+    }
+    for (DWORD i = n, j = n; i-- > n1;) {
+        if (sa[i] != SAIS_EMPTY) sa[--j] = sa[i];
+    }
+
+    // sort the suffixes of the string of names, directly when every name is unique
+    DWORD* s1 = sa + n - n1;
+    if (numNames < n1) {
+        if (!SortSais(s1, n1, numNames, sa)) {
+            free(types);
+            free(buckets);
+            return FALSE;
+        }
+    } else {
+        for (DWORD i = 0; i < n1; i++) sa[s1[i]] = i;
+    }
+
+    // place the sorted LMS suffixes at their bucket ends, from the last one, and induce all the others
+    for (DWORD i = 1, j = 0; i < n; i++) {
+        if (IsLmsPosition(types, i)) s1[j++] = i;
+    }
+    for (DWORD i = 0; i < n1; i++) sa[i] = s1[sa[i]];
+    for (DWORD i = n1; i < n; i++) sa[i] = SAIS_EMPTY;
+    GetSaisBuckets(s, n, k, buckets, TRUE);
+    for (DWORD i = n1; i-- > 0;) {
+        DWORD j = sa[i];
+        sa[i] = SAIS_EMPTY;
+        sa[--buckets[s[j]]] = j;
+    }
+    InduceSais(s, n, k, types, sa, buckets);
+
+    free(types);
+    free(buckets);
+    return TRUE;
+}
+
+// Sorts the suffixes of the text with SA-IS and fills the rank array, the inverse of the suffix array
+static BOOL BuildSuffixArray(const BYTE* text, DWORD n, DWORD* sa, DWORD* rank)
+{
+    // bytes shifted up by one, followed by a zero that sorts below every byte, as the end of the text does
+    DWORD* s = (DWORD*)malloc(((size_t)n + 1) * sizeof(DWORD));
+    DWORD* fullSa = (DWORD*)malloc(((size_t)n + 1) * sizeof(DWORD));
+    BOOL sorted = s && fullSa;
+    if (sorted) {
+        for (DWORD i = 0; i < n; i++) s[i] = (DWORD)text[i] + 1;
+        s[n] = 0;
+        sorted = SortSais(s, n + 1, 257, fullSa);
+    }
+    if (sorted) {
+        // the first suffix is the lone terminator
+        for (DWORD i = 0; i < n; i++) {
+            sa[i] = fullSa[i + 1];
+            rank[sa[i]] = i;
+        }
+    }
+
+    free(s);
+    free(fullSa);
+    return sorted;
+}
+
+// Kasai's algorithm: LCP of every suffix with its predecessor in suffix array order, in O(n)
+static void BuildLcpArray(const BYTE* text, DWORD n, const DWORD* sa, const DWORD* rank, DWORD* lcp)
+{
+    DWORD h = 0;
+    for (DWORD i = 0; i < n; i++) {
+        DWORD r = rank[i];
+        if (r == 0) {
+            lcp[0] = 0;
+            h = 0;
+            continue;
+        }
+        DWORD j = sa[r - 1];
+        while (i + h < n && j + h < n && text[i + h] == text[j + h]) h++;
+        lcp[r] = h;
+        if (h > 0) h--;
+    }
+}
+
+Error BuildSuffixIndex(const struct ImageView* pImage, const GUID* guid, DWORD age, struct SuffixIndex* pIndex)
+{
+    memset(pIndex, 0, sizeof(struct SuffixIndex));
+    if (pImage->layout != IMAGE_LAYOUT_FILE)
+        return NewError(__FUNCTION__, -5, L"Suffix indexes are only built for image files, not loaded images", 0);
+
+    DWORD numSections = 0;
+    ULONGLONG textLength = 0;
+    for (WORD i = 0; i < pImage->numSections; i++) {
+        if (!IsIndexedSection(&pImage->sections[i])) continue;
+        numSections++;
+        textLength += GetSectionFileLength(pImage, &pImage->sections[i]);
+    }
+    if (textLength == 0)
+        return NewError(__FUNCTION__, -1, L"Image has no executable section data", 0);
+    if (textLength >= 0xFFFFFFFF / sizeof(DWORD))
+        return NewError(__FUNCTION__, -2, L"Executable sections are too large to index", 0);
+
+    DWORD n = (DWORD)textLength;
+    BYTE* buffer = (BYTE*)calloc(1, GetIndexSize(numSections, n));
+    if (!buffer)
+        return NewError(__FUNCTION__, -3, L"calloc failed; out of memory", 0);
+
+    SuffixIndexHeader* header = (SuffixIndexHeader*)buffer;
+    header->magic = SUFFIX_INDEX_MAGIC;
+    header->version = SUFFIX_INDEX_VERSION;
+    header->guid = *guid;
+    header->age = age;
+    header->numSections = numSections;
+    header->textLength = n;
+    AttachSuffixIndex(pIndex, buffer);
+    pIndex->buffer = buffer;
+
+    SuffixIndexSection* sections = (SuffixIndexSection*)pIndex->sections;
+    BYTE* text = (BYTE*)pIndex->text;
+    DWORD textOffset = 0, sectionIndex = 0;
+    for (WORD i = 0; i < pImage->numSections; i++) {
+        const IMAGE_SECTION_HEADER* section = &pImage->sections[i];
+        if (!IsIndexedSection(section)) continue;
+        DWORD length = GetSectionFileLength(pImage, section);
+        sections[sectionIndex].rva = section->VirtualAddress;
+        sections[sectionIndex].textOffset = textOffset;
+        sections[sectionIndex].length = length;
+        memcpy(text + textOffset, pImage->file.data + section->PointerToRawData, length);
+        textOffset += length;
+        sectionIndex++;
+    }
+
+    DWORD* sa = (DWORD*)pIndex->suffixArray;
+    DWORD* lcp = (DWORD*)pIndex->lcp;
+    DWORD* rank = (DWORD*)pIndex->rank;
+    if (!BuildSuffixArray(text, n, sa, rank)) {
+        FreeSuffixIndex(pIndex);
+        return NewError(__FUNCTION__, -4, L"malloc failed; out of memory", 0);
+    }
+    BuildLcpArray(text, n, sa, rank, lcp);
+    return NewNoError();
+}
+
+Error SaveSuffixIndex(const struct SuffixIndex* pIndex, LPCWSTR indexPath)
+{
+    const BYTE* base = pIndex->buffer ? pIndex->buffer : pIndex->file.data;
+    if (!WriteFileAtomic(indexPath, base, GetIndexSize(pIndex->header->numSections, pIndex->header->textLength)))
+        return NewError(__FUNCTION__, -1, L"Failed to write the index file", GetLastError());
+    return NewNoError();
+}
+
+// Every section has to lie in the text; the section table is short, so this is checked on every load
+static BOOL AreIndexSectionsInText(const struct SuffixIndex* pIndex)
+{
+    DWORD n = pIndex->header->textLength;
+    for (DWORD i = 0; i < pIndex->header->numSections; i++) {
+        const SuffixIndexSection* section = &pIndex->sections[i];
+        if ((ULONGLONG)section->textOffset + section->length > n) return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL VerifySuffixIndex(const struct SuffixIndex* pIndex)
+{
+    DWORD n = pIndex->header->textLength;
+    if (!AreIndexSectionsInText(pIndex)) return FALSE;
+
+    // a rank that points back at every entry also rules out duplicate entries, so all of them are in range
+    for (DWORD i = 0; i < n; i++) {
+        DWORD position = pIndex->suffixArray[i];
+        if (position >= n || pIndex->rank[position] != i) return FALSE;
+        DWORD longest = n - position;
+        if (i > 0 && n - pIndex->suffixArray[i - 1] < longest) longest = n - pIndex->suffixArray[i - 1];
+        if (pIndex->lcp[i] > (i > 0 ? longest : 0)) return FALSE;
+    }
+    return TRUE;
+}
+
+Error LoadSuffixIndex(LPCWSTR indexPath, const GUID* guid, DWORD age, struct SuffixIndex* pIndex)
+{
+    memset(pIndex, 0, sizeof(struct SuffixIndex));
+    Error e = MapFileReadOnly(indexPath, &pIndex->file);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+
+    const SuffixIndexHeader* header = (const SuffixIndexHeader*)pIndex->file.data;
+    if (pIndex->file.size < sizeof(SuffixIndexHeader) || header->magic != SUFFIX_INDEX_MAGIC || header->version != SUFFIX_INDEX_VERSION) {
+        FreeSuffixIndex(pIndex);
+        return NewError(__FUNCTION__, -2, L"Not a suffix index file", 0);
+    }
+    if (memcmp(&header->guid, guid, sizeof(GUID)) != 0 || header->age != age) {
+        FreeSuffixIndex(pIndex);
+        return NewError(__FUNCTION__, -3, L"Suffix index belongs to a different image", 0);
+    }
+    if (pIndex->file.size != GetIndexSize(header->numSections, header->textLength)) {
+        FreeSuffixIndex(pIndex);
+        return NewError(__FUNCTION__, -4, L"Suffix index file is truncated", 0);
+    }
+
+    AttachSuffixIndex(pIndex, pIndex->file.data);
+    // the arrays are only checked in a SUFFIX_INDEX_VERIFY build, that is O(n) over the whole file on every load
+#ifdef SUFFIX_INDEX_VERIFY
+    BOOL consistent = VerifySuffixIndex(pIndex);
+#else
+    BOOL consistent = AreIndexSectionsInText(pIndex);
+#endif
+    if (!consistent) {
+        FreeSuffixIndex(pIndex);
+        return NewError(__FUNCTION__, -5, L"Suffix index file is corrupt", 0);
+    }
+    return NewNoError();
+}
+
+Error OpenSuffixIndex(LPCWSTR indexPath, const struct ImageView* pImage, const GUID* guid, DWORD age, struct SuffixIndex* pIndex)
+{
+    // the cache file describes the bytes of the image file, which loaded bytes differ from by their relocations
+    if (pImage->layout != IMAGE_LAYOUT_FILE)
+        return NewError(__FUNCTION__, -2, L"Suffix indexes are only built for image files, not loaded images", 0);
+
+    Error e = LoadSuffixIndex(indexPath, guid, age, pIndex);
+    if (!e.ContainsError) return e;
+    Error_Free(&e);
+
+    e = BuildSuffixIndex(pImage, guid, age, pIndex);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+
+    // a failure to persist the cache is not fatal, the in-memory index is still usable
+    e = SaveSuffixIndex(pIndex, indexPath);
+    Error_Free(&e);
+    return NewNoError();
+}
+
+void FreeSuffixIndex(struct SuffixIndex* pIndex)
+{
+    free(pIndex->buffer);
+    UnmapFile(&pIndex->file);
+    memset(pIndex, 0, sizeof(struct SuffixIndex));
+}
+
+// Finds the indexed section containing the RVA
+static const SuffixIndexSection* FindIndexSection(const struct SuffixIndex* pIndex, DWORD rva)
+{
+    for (DWORD i = 0; i < pIndex->header->numSections; i++) {
+        const SuffixIndexSection* section = &pIndex->sections[i];
+        if (rva >= section->rva && rva - section->rva < section->length) return section;
+    }
+    return NULL;
+}
+
+// Length of the shortest unique prefix of the suffix at a text position, which may run past its section
+static DWORD GetUniqueLengthAt(const struct SuffixIndex* pIndex, DWORD position)
+{
+    DWORD r = pIndex->rank[position];
+    DWORD longestRepeat = pIndex->lcp[r];
+    if (r + 1 < pIndex->header->textLength && pIndex->lcp[r + 1] > longestRepeat) longestRepeat = pIndex->lcp[r + 1];
+
+    // one byte more than the longest prefix shared with a neighbouring suffix is unique
+    return longestRepeat + 1;
+}
+
+DWORD GetMinimalUniqueLength(const struct SuffixIndex* pIndex, DWORD rva)
+{
+    const SuffixIndexSection* section = FindIndexSection(pIndex, rva);
+    if (!section) return 0;
+
+    DWORD length = GetUniqueLengthAt(pIndex, section->textOffset + (rva - section->rva));
+    if (rva - section->rva + (ULONGLONG)length > section->length) return 0;
+    return length;
+}
+
+DWORD GetShortestUniqueWindow(const struct SuffixIndex* pIndex, DWORD rva, DWORD size, DWORD* pOffset)
+{
+    *pOffset = 0;
+    const SuffixIndexSection* section = FindIndexSection(pIndex, rva);
+    if (!section) return 0;
+
+    // a function of unknown size is only anchored at its start
+    DWORD start = rva - section->rva;
+    DWORD functionEnd = size && size <= section->length - start ? start + size : section->length;
+    DWORD lastStart = size ? functionEnd : start + 1;
+
+    // the rank and LCP arrays answer every start offset in constant time, so the whole search is linear in the size
+    DWORD bestLength = 0, bestOffset = 0;
+    BOOL bestInside = FALSE;
+    for (DWORD offset = start; offset < lastStart; offset++) {
+        DWORD length = GetUniqueLengthAt(pIndex, section->textOffset + offset);
+        if ((ULONGLONG)offset + length > section->length) continue;
+
+        BOOL inside = offset + length <= functionEnd;
+        if (bestLength && (bestInside > inside || (bestInside == inside && bestLength <= length))) continue;
+        bestLength = length;
+        bestOffset = offset - start;
+        bestInside = inside;
+    }
+    *pOffset = bestOffset;
+    return bestLength;
+}
+
+// Compares the suffix at `position` with the pattern, looking at most at `patternLength` bytes
+static int CompareSuffix(const struct SuffixIndex* pIndex, DWORD position, const BYTE* pattern, DWORD patternLength)
+{
+    DWORD available = pIndex->header->textLength - position;
+    DWORD length = available < patternLength ? available : patternLength;
+    int result = memcmp(pIndex->text + position, pattern, length);
+    if (result != 0) return result;
+    return length < patternLength ? -1 : 0;
+}
+
+size_t CountPatternOccurrences(const struct SuffixIndex* pIndex, const BYTE* pattern, DWORD patternLength)
+{
+    DWORD n = pIndex->header->textLength;
+    if (patternLength == 0) return n;
+
+    // first suffix that is not smaller than the pattern
+    DWORD low = 0, high = n;
+    while (low < high) {
+        DWORD mid = low + (high - low) / 2;
+        if (CompareSuffix(pIndex, pIndex->suffixArray[mid], pattern, patternLength) < 0) low = mid + 1;
+        else high = mid;
+    }
+    DWORD first = low;
+
+    // first suffix that is greater than the pattern
+    high = n;
+    while (low < high) {
+        DWORD mid = low + (high - low) / 2;
+        if (CompareSuffix(pIndex, pIndex->suffixArray[mid], pattern, patternLength) <= 0) low = mid + 1;
+        else high = mid;
+    }
+    return low - first;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "Image.h"
+
+#define SUFFIX_INDEX_MAGIC 0x49415353 // 'SSAI'
+#define SUFFIX_INDEX_VERSION 1
+
+// An executable section as it appears in the index text
+typedef struct SuffixIndexSection {
+    DWORD rva;          // RVA of the section's first byte
+    DWORD textOffset;   // where the section's bytes start in the index text
+    DWORD length;       // number of indexed bytes
+    DWORD reserved;
+} SuffixIndexSection;
+
+// On-disk header of a suffix index cache file. The file is laid out exactly like the in-memory index:
+// header, section table, text (padded to 4 bytes), suffix array, LCP array and rank array.
+typedef struct SuffixIndexHeader {
+    DWORD magic;
+    DWORD version;
+    GUID guid;          // CodeView GUID of the indexed image
+    DWORD age;          // CodeView age of the indexed image
+    DWORD numSections;
+    DWORD textLength;
+    DWORD reserved;
+} SuffixIndexHeader;
+
+/*
+ * A suffix array with LCP and rank arrays built over the concatenated raw bytes of the executable sections.
+ * Matches that straddle two sections in the concatenated text are counted as well, so the answers are
+ * conservative: a length reported as unique is always unique within the executable sections.
+ */
+typedef struct SuffixIndex {
+    struct FileMapping file;            // backing cache file when loaded from disk
+    BYTE* buffer;                       // backing allocation when built in memory
+    const SuffixIndexHeader* header;
+    const SuffixIndexSection* sections;
+    const BYTE* text;
+    const DWORD* suffixArray;
+    const DWORD* lcp;                   // lcp[i] is the common prefix length of suffixArray[i - 1] and suffixArray[i]
+    const DWORD* rank;                  // inverse of suffixArray
+} SuffixIndex;
+
+// Builds the index in memory over the image's executable sections. Free after use with FreeSuffixIndex.
+Error BuildSuffixIndex(const struct ImageView* pImage, const GUID* guid, DWORD age, struct SuffixIndex* pIndex);
+
+// Writes the index to a temporary file and then moves it over `indexPath`.
+Error SaveSuffixIndex(const struct SuffixIndex* pIndex, LPCWSTR indexPath);
+
+// Maps a cache file and validates it against the image's GUID and age. Only the header, the file size and the
+// section table are checked, unless built with SUFFIX_INDEX_VERIFY. Free after use with FreeSuffixIndex.
+Error LoadSuffixIndex(LPCWSTR indexPath, const GUID* guid, DWORD age, struct SuffixIndex* pIndex);
+
+// Loads the cache file if it matches the image, otherwise builds the index and saves it to `indexPath`.
+Error OpenSuffixIndex(LPCWSTR indexPath, const struct ImageView* pImage, const GUID* guid, DWORD age, struct SuffixIndex* pIndex);
+
+void FreeSuffixIndex(struct SuffixIndex* pIndex);
+
+// Checks everything the lookups index with, in O(n): every section lies in the text, the suffix array is a
+// permutation of the text positions with the rank array as its inverse, and no LCP runs past the end of the text.
+BOOL VerifySuffixIndex(const struct SuffixIndex* pIndex);
+
+// Returns the length of the shortest signature starting at `rva` that occurs only once in the indexed sections,
+// or 0 if the RVA is not indexed or no such signature fits in its section.
+DWORD GetMinimalUniqueLength(const struct SuffixIndex* pIndex, DWORD rva);
+
+// Returns the length of the shortest unique signature starting anywhere in the function at `rva`, and its distance
+// from `rva` in `*pOffset`. Signatures that end inside the function are preferred over ones that run past its end,
+// and among equally short ones the one closest to the start wins. A `size` of 0 only tries the start. Returns 0 if
+// no start offset has a unique signature that fits in the section.
+DWORD GetShortestUniqueWindow(const struct SuffixIndex* pIndex, DWORD rva, DWORD size, DWORD* pOffset);
+
+// Counts the occurrences of a pattern in the indexed sections in O(m log n).
+size_t CountPatternOccurrences(const struct SuffixIndex* pIndex, const BYTE* pattern, DWORD patternLength);
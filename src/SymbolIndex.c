@@ -0,0 +1,301 @@
+#include "SymbolIndex.h"
+#include "ImageSymbols.h"
+#include <ctype.h>
+
+// A symbol collected from the PDB before sorting. `nameOffset` points into the builder's string blob.
+typedef struct PendingEntry {
+    const char* name;
+    DWORD nameOffset;
+    struct PdbSymbol symbol;
+} PendingEntry;
+
+typedef struct SymbolIndexBuilder {
+    struct PendingEntry* entries;
+    size_t numEntries;
+    size_t entriesCapacity;
+    char* strings;
+    size_t stringsSize;
+    size_t stringsCapacity;
+    BOOL outOfMemory;
+} SymbolIndexBuilder;
+
+static BOOL AddPendingEntry(struct SymbolIndexBuilder* pBuilder, const char* name, const struct PdbSymbol* pSymbol)
+{
+    size_t nameLength = strlen(name) + 1;
+    if (pBuilder->numEntries == pBuilder->entriesCapacity) {
+        size_t capacity = pBuilder->entriesCapacity ? pBuilder->entriesCapacity * 2 : 4096;
+        struct PendingEntry* entries = (struct PendingEntry*)realloc(pBuilder->entries, capacity * sizeof(struct PendingEntry));
+        if (!entries) {
+            pBuilder->outOfMemory = TRUE;
+            return FALSE;
+        }
+        pBuilder->entries = entries;
+        pBuilder->entriesCapacity = capacity;
+    }
+    if (pBuilder->stringsSize + nameLength > pBuilder->stringsCapacity) {
+        size_t capacity = pBuilder->stringsCapacity ? pBuilder->stringsCapacity * 2 : 65536;
+        while (capacity < pBuilder->stringsSize + nameLength) capacity *= 2;
+        char* strings = (char*)realloc(pBuilder->strings, capacity);
+        if (!strings) {
+            pBuilder->outOfMemory = TRUE;
+            return FALSE;
+        }
+        pBuilder->strings = strings;
+        pBuilder->stringsCapacity = capacity;
+    }
+
+    struct PendingEntry* entry = &pBuilder->entries[pBuilder->numEntries++];
+    entry->name = NULL;
+    entry->nameOffset = (DWORD)pBuilder->stringsSize;
+    entry->symbol = *pSymbol;
+    memcpy(pBuilder->strings + pBuilder->stringsSize, name, nameLength);
+    pBuilder->stringsSize += nameLength;
+    return TRUE;
+}
+
+static BOOL CollectSymbol(void* context, const char* name, const struct PdbSymbol* pSymbol)
+{
+    return AddPendingEntry((struct SymbolIndexBuilder*)context, name, pSymbol);
+}
+
+static BOOL CollectType(void* context, const char* name, DWORD size)
+{
+    struct PdbSymbol symbol = { 0, size, PDB_SYMBOL_TYPE };
+    return AddPendingEntry((struct SymbolIndexBuilder*)context, name, &symbol);
+}
+
+// Lookup preference among entries sharing a name: procedures, then data, then publics. Types are looked up separately.
+static int GetKindRank(DWORD kind)
+{
+    switch (kind) {
+    case PDB_SYMBOL_FUNCTION: return 0;
+    case PDB_SYMBOL_DATA: return 1;
+    case PDB_SYMBOL_PUBLIC: return 2;
+    default: return 3;
+    }
+}
+
+static int ComparePendingEntries(const void* a, const void* b)
+{
+    const struct PendingEntry* left = (const struct PendingEntry*)a;
+    const struct PendingEntry* right = (const struct PendingEntry*)b;
+    int result = strcmp(left->name, right->name);
+    if (result != 0) return result;
+    result = GetKindRank(left->symbol.kind) - GetKindRank(right->symbol.kind);
+    if (result != 0) return result;
+    // keep the definition with a known size first
+    return (left->symbol.size == 0) - (right->symbol.size == 0);
+}
+
+// Points the index members into a buffer laid out as described in SymbolIndexHeader
+static void AttachSymbolIndex(struct SymbolIndex* pIndex, const BYTE* base)
+{
+    pIndex->header = (const SymbolIndexHeader*)base;
+    pIndex->entries = (const SymbolIndexEntry*)(base + sizeof(SymbolIndexHeader));
+    pIndex->strings = (const char*)(pIndex->entries + pIndex->header->numEntries);
+}
+
+static size_t GetIndexSize(const SymbolIndexHeader* header)
+{
+    return sizeof(SymbolIndexHeader) + (size_t)header->numEntries * sizeof(SymbolIndexEntry) + header->stringsSize;
+}
+
+// Sorts the collected entries, drops repeated ones and lays them out as an index. Frees the builder.
+static Error FinishSymbolIndex(struct SymbolIndexBuilder* pBuilder, const GUID* guid, DWORD age, struct SymbolIndex* pIndex)
+{
+    Error e = NewNoError();
+
+    do {
+        if (pBuilder->outOfMemory) {
+            e = NewError(__FUNCTION__, -1, L"realloc failed; out of memory", 0);
+            break;
+        }
+        if (pBuilder->stringsSize >= 0xFFFFFFFF) {
+            e = NewError(__FUNCTION__, -2, L"Too many symbols to index", 0);
+            break;
+        }
+
+        for (size_t i = 0; i < pBuilder->numEntries; i++) pBuilder->entries[i].name = pBuilder->strings + pBuilder->entries[i].nameOffset;
+        qsort(pBuilder->entries, pBuilder->numEntries, sizeof(struct PendingEntry), ComparePendingEntries);
+
+        // drop repeated name and kind pairs, the first one is the preferred definition
+        size_t numEntries = 0, stringsSize = 0;
+        for (size_t i = 0; i < pBuilder->numEntries; i++) {
+            const struct PendingEntry* entry = &pBuilder->entries[i];
+            if (numEntries > 0) {
+                const struct PendingEntry* kept = &pBuilder->entries[numEntries - 1];
+                if (kept->symbol.kind == entry->symbol.kind && strcmp(kept->name, entry->name) == 0) continue;
+            }
+            pBuilder->entries[numEntries++] = *entry;
+            stringsSize += strlen(entry->name) + 1;
+        }
+
+        SymbolIndexHeader header = { SYMBOL_INDEX_MAGIC, SYMBOL_INDEX_VERSION, *guid, age, (DWORD)numEntries, (DWORD)stringsSize, 0 };
+        BYTE* buffer = (BYTE*)malloc(GetIndexSize(&header));
+        if (!buffer) {
+            e = NewError(__FUNCTION__, -3, L"malloc failed; out of memory", 0);
+            break;
+        }
+        memcpy(buffer, &header, sizeof(header));
+        AttachSymbolIndex(pIndex, buffer);
+        pIndex->buffer = buffer;
+
+        SymbolIndexEntry* entries = (SymbolIndexEntry*)pIndex->entries;
+        char* strings = (char*)pIndex->strings;
+        DWORD stringsOffset = 0;
+        for (size_t i = 0; i < numEntries; i++) {
+            const struct PendingEntry* entry = &pBuilder->entries[i];
+            size_t nameLength = strlen(entry->name) + 1;
+            memcpy(strings + stringsOffset, entry->name, nameLength);
+            entries[i].nameOffset = stringsOffset;
+            entries[i].rva = entry->symbol.rva;
+            entries[i].size = entry->symbol.size;
+            entries[i].kind = entry->symbol.kind;
+            stringsOffset += (DWORD)nameLength;
+        }
+    } while (FALSE);
+
+    free(pBuilder->entries);
+    free(pBuilder->strings);
+    return e;
+}
+
+Error BuildSymbolIndex(const struct PdbFile* pPdb, const GUID* guid, DWORD age, struct SymbolIndex* pIndex)
+{
+    memset(pIndex, 0, sizeof(struct SymbolIndex));
+    struct SymbolIndexBuilder builder = { 0 };
+    PdbEnumerateSymbols(pPdb, CollectSymbol, &builder);
+    if (!builder.outOfMemory) {
+        // a PDB without type information still gives a usable symbol table
+        Error e = PdbEnumerateTypes(pPdb, CollectType, &builder);
+        Error_Free(&e);
+    }
+
+    Error e = FinishSymbolIndex(&builder, guid, age, pIndex);
+    if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -1);
+    return e;
+}
+
+Error BuildImageSymbolIndex(const struct ImageView* pImage, const GUID* guid, DWORD age, struct SymbolIndex* pIndex)
+{
+    memset(pIndex, 0, sizeof(struct SymbolIndex));
+    struct SymbolIndexBuilder builder = { 0 };
+    EnumerateImageSymbols(pImage, CollectSymbol, &builder);
+
+    Error e = FinishSymbolIndex(&builder, guid, age, pIndex);
+    if (e.ContainsError) e.AddFunctionToStack(&e, __FUNCTION__, -1);
+    return e;
+}
+
+Error SaveSymbolIndex(const struct SymbolIndex* pIndex, LPCWSTR indexPath)
+{
+    if (!WriteFileAtomic(indexPath, pIndex->header, GetIndexSize(pIndex->header)))
+        return NewError(__FUNCTION__, -1, L"Failed to write the index file", GetLastError());
+    return NewNoError();
+}
+
+Error LoadSymbolIndex(LPCWSTR indexPath, const GUID* guid, DWORD age, struct SymbolIndex* pIndex)
+{
+    memset(pIndex, 0, sizeof(struct SymbolIndex));
+    Error e = MapFileReadOnly(indexPath, &pIndex->file);
+    if (e.ContainsError) {
+        e.AddFunctionToStack(&e, __FUNCTION__, -1);
+        return e;
+    }
+
+    const SymbolIndexHeader* header = (const SymbolIndexHeader*)pIndex->file.data;
+    if (pIndex->file.size < sizeof(SymbolIndexHeader) || header->magic != SYMBOL_INDEX_MAGIC || header->version != SYMBOL_INDEX_VERSION) {
+        FreeSymbolIndex(pIndex);
+        return NewError(__FUNCTION__, -2, L"Not a symbol index file", 0);
+    }
+    if (memcmp(&header->guid, guid, sizeof(GUID)) != 0 || header->age != age) {
+        FreeSymbolIndex(pIndex);
+        return NewError(__FUNCTION__, -3, L"Symbol index belongs to a different image", 0);
+    }
+    if (pIndex->file.size != GetIndexSize(header)) {
+        FreeSymbolIndex(pIndex);
+        return NewError(__FUNCTION__, -4, L"Symbol index file is truncated", 0);
+    }
+
+    AttachSymbolIndex(pIndex, pIndex->file.data);
+    if (header->stringsSize == 0 || pIndex->strings[header->stringsSize - 1] != '\0') {
+        FreeSymbolIndex(pIndex);
+        return NewError(__FUNCTION__, -5, L"Symbol index string table is corrupted", 0);
+    }
+    for (DWORD i = 0; i < header->numEntries; i++) {
+        if (pIndex->entries[i].nameOffset >= header->stringsSize) {
+            FreeSymbolIndex(pIndex);
+            return NewError(__FUNCTION__, -5, L"Symbol index string table is corrupted", 0);
+        }
+    }
+    return NewNoError();
+}
+
+void FreeSymbolIndex(struct SymbolIndex* pIndex)
+{
+    free(pIndex->buffer);
+    UnmapFile(&pIndex->file);
+    memset(pIndex, 0, sizeof(struct SymbolIndex));
+}
+
+// Returns the index of the first entry whose name is not smaller than `name`
+static DWORD LowerBound(const struct SymbolIndex* pIndex, const char* name)
+{
+    DWORD low = 0, high = pIndex->header->numEntries;
+    while (low < high) {
+        DWORD mid = low + (high - low) / 2;
+        if (strcmp(pIndex->strings + pIndex->entries[mid].nameOffset, name) < 0) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+static BOOL EqualsIgnoreCase(const char* left, const char* right)
+{
+    while (*left && tolower((unsigned char)*left) == tolower((unsigned char)*right)) {
+        left++;
+        right++;
+    }
+    return *left == *right;
+}
+
+static void CopyEntryToSymbol(const SymbolIndexEntry* entry, struct PdbSymbol* pSymbol)
+{
+    pSymbol->rva = entry->rva;
+    pSymbol->size = entry->size;
+    pSymbol->kind = (PdbSymbolKind)entry->kind;
+}
+
+BOOL FindIndexedSymbol(const struct SymbolIndex* pIndex, const char* name, struct PdbSymbol* pSymbol)
+{
+    memset(pSymbol, 0, sizeof(struct PdbSymbol));
+    const SymbolIndexHeader* header = pIndex->header;
+    for (DWORD i = LowerBound(pIndex, name); i < header->numEntries; i++) {
+        const SymbolIndexEntry* entry = &pIndex->entries[i];
+        if (strcmp(pIndex->strings + entry->nameOffset, name) != 0) break;
+        if (entry->kind == PDB_SYMBOL_TYPE) continue;
+        CopyEntryToSymbol(entry, pSymbol);
+        return TRUE;
+    }
+
+    // rare path, a linear scan is fine
+    for (DWORD i = 0; i < header->numEntries; i++) {
+        const SymbolIndexEntry* entry = &pIndex->entries[i];
+        if (entry->kind == PDB_SYMBOL_TYPE || !EqualsIgnoreCase(pIndex->strings + entry->nameOffset, name)) continue;
+        CopyEntryToSymbol(entry, pSymbol);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+BOOL FindIndexedTypeSize(const struct SymbolIndex* pIndex, const char* name, DWORD* size)
+{
+    for (DWORD i = LowerBound(pIndex, name); i < pIndex->header->numEntries; i++) {
+        const SymbolIndexEntry* entry = &pIndex->entries[i];
+        if (strcmp(pIndex->strings + entry->nameOffset, name) != 0) break;
+        if (entry->kind != PDB_SYMBOL_TYPE) continue;
+        *size = entry->size;
+        return TRUE;
+    }
+    return FALSE;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "PdbFile.h"
+
+#define SYMBOL_INDEX_MAGIC 0x58444953 // 'SIDX'
+#define SYMBOL_INDEX_VERSION 1
+
+// A named symbol or type. Entries are sorted by name, then by kind in lookup preference order.
+typedef struct SymbolIndexEntry {
+    DWORD nameOffset;   // offset of the null terminated name in the string blob
+    DWORD rva;
+    DWORD size;
+    DWORD kind;         // PdbSymbolKind
+} SymbolIndexEntry;
+
+// On-disk header of a symbol index file: header, entries, then the string blob.
+typedef struct SymbolIndexHeader {
+    DWORD magic;
+    DWORD version;
+    GUID guid;          // CodeView GUID of the image the PDB belongs to
+    DWORD age;          // CodeView age of the image the PDB belongs to
+    DWORD numEntries;
+    DWORD stringsSize;
+    DWORD reserved;
+} SymbolIndexHeader;
+
+/*
+ * A compact name -> RVA, size and kind table extracted from a PDB, together with the sizes of its structs, classes
+ * and unions. Once saved it answers symbol and type size queries without opening the PDB again.
+ */
+typedef struct SymbolIndex {
+    struct FileMapping file;            // backing cache file when loaded from disk
+    BYTE* buffer;                       // backing allocation when built in memory
+    const SymbolIndexHeader* header;
+    const SymbolIndexEntry* entries;
+    const char* strings;
+} SymbolIndex;
+
+// Extracts the symbols and type sizes of a PDB. Free after use with FreeSymbolIndex.
+Error BuildSymbolIndex(const struct PdbFile* pPdb, const GUID* guid, DWORD age, struct SymbolIndex* pIndex);
+
+// Builds the same table from the image's exports and .pdata functions instead of a PDB (see ImageSymbols.h).
+// It has no types. Free after use with FreeSymbolIndex.
+Error BuildImageSymbolIndex(const struct ImageView* pImage, const GUID* guid, DWORD age, struct SymbolIndex* pIndex);
+
+// Writes the index to a temporary file and then moves it over `indexPath`.
+Error SaveSymbolIndex(const struct SymbolIndex* pIndex, LPCWSTR indexPath);
+
+// Maps an index file and validates it against the image's GUID and age. Free after use with FreeSymbolIndex.
+Error LoadSymbolIndex(LPCWSTR indexPath, const GUID* guid, DWORD age, struct SymbolIndex* pIndex);
+
+void FreeSymbolIndex(struct SymbolIndex* pIndex);
+
+// Finds a procedure, data or public symbol by name. Falls back to a case-insensitive match like PdbFindSymbol.
+BOOL FindIndexedSymbol(const struct SymbolIndex* pIndex, const char* name, struct PdbSymbol* pSymbol);
+
+// Finds the size of a struct, class or union by name.
+BOOL FindIndexedTypeSize(const struct SymbolIndex* pIndex, const char* name, DWORD* size);
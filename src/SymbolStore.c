@@ -0,0 +1,140 @@
+#include "SymbolStore.h"
+#include "PdbFile.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#endif
+
+const char* GetPdbFileName(const char* pdbName)
+{
+    const char* fileName = pdbName;
+    for (const char* p = pdbName; *p; p++) {
+        if (*p == '\\' || *p == '/') fileName = p + 1;
+    }
+    return fileName;
+}
+
+void FormatSymbolStoreKey(const GUID* guid, DWORD age, WCHAR* buffer, size_t bufferLength)
+{
+    // guid format: {Data1}{Data2}{Data3}{Data4}{age}
+    swprintf_s(
+        buffer, bufferLength,
+        L"%08X%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X%X",
+        (unsigned int)guid->Data1, guid->Data2, guid->Data3,
+        guid->Data4[0], guid->Data4[1], guid->Data4[2], guid->Data4[3],
+        guid->Data4[4], guid->Data4[5], guid->Data4[6], guid->Data4[7],
+        (unsigned int)age);
+}
+
+WCHAR* GetSymbolStorePath(LPCWSTR cacheDir, const char* pdbName, const GUID* guid, DWORD age)
+{
+    WCHAR key[64];
+    FormatSymbolStoreKey(guid, age, key, _countof(key));
+
+    const char* fileName = GetPdbFileName(pdbName);
+    size_t cacheDirLength = wcslen(cacheDir);
+    BOOL hasSeparator = cacheDirLength > 0 && (cacheDir[cacheDirLength - 1] == L'\\' || cacheDir[cacheDirLength - 1] == L'/');
+    size_t pathLength = cacheDirLength + 2 * strlen(fileName) + wcslen(key) + 4;
+    WCHAR* path = (WCHAR*)malloc(pathLength * sizeof(WCHAR));
+    if (!path) return NULL;
+
+#ifdef _WIN32
+    swprintf_s(path, pathLength, L"%s%s%S\\%s\\%S", cacheDir, hasSeparator ? L"" : L"\\", fileName, key, fileName);
+#else
+    swprintf_s(path, pathLength, L"%ls%ls%s/%ls/%s", cacheDir, hasSeparator ? L"" : L"/", fileName, key, fileName);
+#endif
+    return path;
+}
+
+BOOL IsValidSymbolStoreEntry(LPCWSTR pdbPath, const GUID* guid, DWORD age)
+{
+    GUID pdbGuid;
+    DWORD pdbAge, dbiAge;
+    Error e = ReadPdbIdentity(pdbPath, &pdbGuid, &pdbAge, &dbiAge);
+    if (e.ContainsError) {
+        Error_Free(&e);
+        return FALSE;
+    }
+    return memcmp(&pdbGuid, guid, sizeof(GUID)) == 0 && (pdbAge == age || dbiAge == age);
+}
+
+// Returns <pdbPath>.lock, or the entry's directory when `directoryOnly` is set. Free after use with free.
+static WCHAR* GetEntryRelatedPath(LPCWSTR pdbPath, BOOL directoryOnly)
+{
+    size_t pathLength = wcslen(pdbPath) + 6;
+    WCHAR* path = (WCHAR*)malloc(pathLength * sizeof(WCHAR));
+    if (!path) return NULL;
+
+    if (!directoryOnly) {
+        swprintf_s(path, pathLength, L"%ls.lock", pdbPath);
+        return path;
+    }
+    memcpy(path, pdbPath, (wcslen(pdbPath) + 1) * sizeof(WCHAR));
+    WCHAR* lastSeparator = NULL;
+    for (WCHAR* p = path; *p; p++) {
+        if (*p == L'\\' || *p == L'/') lastSeparator = p;
+    }
+    if (lastSeparator) *lastSeparator = L'\0';
+    else swprintf_s(path, pathLength, L".");
+    return path;
+}
+
+Error LockSymbolStoreEntry(LPCWSTR pdbPath, struct SymbolStoreLock* pLock)
+{
+    WCHAR* directory = GetEntryRelatedPath(pdbPath, TRUE);
+    WCHAR* lockPath = GetEntryRelatedPath(pdbPath, FALSE);
+    Error e = NewNoError();
+    do {
+        if (!directory || !lockPath) {
+            e = NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0);
+            break;
+        }
+        if (!CreateDirectoryTree(directory)) {
+            e = NewError(__FUNCTION__, -2, L"Failed to create the symbol store directory", GetLastError());
+            break;
+        }
+
+#ifdef _WIN32
+        // the lock file is opened without sharing and disappears with its last handle, even if the holder crashes
+        DWORD waited = 0;
+        for (;;) {
+            pLock->hFile = CreateFileW(lockPath, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+            if (pLock->hFile != INVALID_HANDLE_VALUE) break;
+
+            DWORD lastError = GetLastError();
+            if ((lastError != ERROR_SHARING_VIOLATION && lastError != ERROR_ACCESS_DENIED) || waited >= SYMBOL_STORE_LOCK_TIMEOUT_MS) {
+                e = NewError(__FUNCTION__, -3, L"Failed to lock the symbol store entry", lastError);
+                break;
+            }
+            Sleep(100);
+            waited += 100;
+        }
+#else
+        char* narrowPath = WideToUtf8(lockPath);
+        pLock->fd = narrowPath ? open(narrowPath, O_RDWR | O_CREAT, 0644) : -1;
+        free(narrowPath);
+        if (pLock->fd < 0 || flock(pLock->fd, LOCK_EX) != 0) {
+            if (pLock->fd >= 0) close(pLock->fd);
+            pLock->fd = -1;
+            e = NewError(__FUNCTION__, -3, L"Failed to lock the symbol store entry", GetLastError());
+            break;
+        }
+#endif
+    } while (FALSE);
+
+    free(directory);
+    free(lockPath);
+    return e;
+}
+
+void UnlockSymbolStoreEntry(struct SymbolStoreLock* pLock)
+{
+#ifdef _WIN32
+    if (pLock->hFile && pLock->hFile != INVALID_HANDLE_VALUE) CloseHandle(pLock->hFile);
+    pLock->hFile = INVALID_HANDLE_VALUE;
+#else
+    if (pLock->fd >= 0) close(pLock->fd);
+    pLock->fd = -1;
+#endif
+}
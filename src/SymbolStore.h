@@ -0,0 +1,33 @@
+#pragma once
+#include "Platform.h"
+#include "Error.h"
+
+#define DEFAULT_SYMBOL_SERVER L"https://msdl.microsoft.com/download/symbols"
+
+// How long to wait for another process that is downloading the same PDB
+#define SYMBOL_STORE_LOCK_TIMEOUT_MS (10 * 60 * 1000)
+
+// An exclusive per-entry lock, held while the entry is downloaded and moved into place
+typedef struct SymbolStoreLock {
+#ifdef _WIN32
+    HANDLE hFile;
+#else
+    int fd;
+#endif
+} SymbolStoreLock;
+
+// Strips any directory from the PDB name recorded in the CodeView entry.
+const char* GetPdbFileName(const char* pdbName);
+
+// Formats the <GUID><age> key used in symbol store paths and URLs.
+void FormatSymbolStoreKey(const GUID* guid, DWORD age, WCHAR* buffer, size_t bufferLength);
+
+// Returns <cacheDir>/<pdbName>/<GUIDAGE>/<pdbName>. Free after use with free.
+WCHAR* GetSymbolStorePath(LPCWSTR cacheDir, const char* pdbName, const GUID* guid, DWORD age);
+
+// Checks that a file exists and is a PDB with the given GUID and age.
+BOOL IsValidSymbolStoreEntry(LPCWSTR pdbPath, const GUID* guid, DWORD age);
+
+// Creates the entry's directories and takes its lock, waiting while another process holds it.
+Error LockSymbolStoreEntry(LPCWSTR pdbPath, struct SymbolStoreLock* pLock);
+void UnlockSymbolStoreEntry(struct SymbolStoreLock* pLock);
@@ -0,0 +1,244 @@
+#include "TaskPool.h"
+#include "ThreadPool.h"
+
+#ifdef _WIN32
+#define LockPool(pPool) AcquireSRWLockExclusive(&(pPool)->lock)
+#define UnlockPool(pPool) ReleaseSRWLockExclusive(&(pPool)->lock)
+#define WaitPool(pPool, condition) SleepConditionVariableSRW(&(pPool)->condition, &(pPool)->lock, INFINITE, 0)
+#define SignalPool(pPool, condition) WakeAllConditionVariable(&(pPool)->condition)
+#define SignalOneWorker(pPool, condition) WakeConditionVariable(&(pPool)->condition)
+#else
+#define LockPool(pPool) pthread_mutex_lock(&(pPool)->lock)
+#define UnlockPool(pPool) pthread_mutex_unlock(&(pPool)->lock)
+#define WaitPool(pPool, condition) pthread_cond_wait(&(pPool)->condition, &(pPool)->lock)
+#define SignalPool(pPool, condition) pthread_cond_broadcast(&(pPool)->condition)
+#define SignalOneWorker(pPool, condition) pthread_cond_signal(&(pPool)->condition)
+#endif
+
+// Queues have the same lock type as the pool
+#define LockQueue LockPool
+#define UnlockQueue UnlockPool
+
+// Takes the newest task of the worker's own queue, or else the oldest task of another worker's queue
+static BOOL TakeTask(struct TaskPool* pPool, DWORD workerIndex, struct PendingTask* pTask)
+{
+    for (DWORD i = 0; i < pPool->numThreads; i++) {
+        struct TaskQueue* queue = &pPool->queues[(workerIndex + i) % pPool->numThreads];
+        BOOL found = FALSE;
+        LockQueue(queue);
+        if (queue->count > 0) {
+            queue->count--;
+            if (i == 0) {
+                *pTask = queue->tasks[(queue->head + queue->count) & (queue->capacity - 1)];
+            } else {
+                *pTask = queue->tasks[queue->head];
+                queue->head = (queue->head + 1) & (queue->capacity - 1);
+            }
+            found = TRUE;
+        }
+        UnlockQueue(queue);
+
+        if (found) {
+            InterlockedDecrement(&pPool->queuedTasks);
+            if (i > 0) InterlockedExchangeAdd64(&pPool->steals, 1);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void FinishTask(struct TaskPool* pPool)
+{
+    if (InterlockedDecrement(&pPool->pendingTasks) != 0) return;
+    LockPool(pPool);
+    SignalPool(pPool, allDone);
+    UnlockPool(pPool);
+}
+
+typedef struct TaskWorkerStart {
+    struct TaskPool* pPool;
+    DWORD workerIndex;
+} TaskWorkerStart;
+
+static void TaskWorkerLoop(struct TaskPool* pPool, DWORD workerIndex)
+{
+    for (;;) {
+        struct PendingTask task;
+        if (TakeTask(pPool, workerIndex, &task)) {
+            task.task(pPool, task.context, workerIndex);
+            FinishTask(pPool);
+            continue;
+        }
+
+        // pushers count the task before taking the pool lock to signal, so checking under the lock misses no wakeup
+        LockPool(pPool);
+        while (!pPool->shutdown && pPool->queuedTasks == 0)
+            WaitPool(pPool, taskReady);
+        BOOL shutdown = pPool->shutdown;
+        UnlockPool(pPool);
+        if (shutdown) return;
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI TaskWorkerThread(LPVOID parameter)
+#else
+static void* TaskWorkerThread(void* parameter)
+#endif
+{
+    struct TaskWorkerStart* start = (struct TaskWorkerStart*)parameter;
+    struct TaskPool* pPool = start->pPool;
+    DWORD workerIndex = start->workerIndex;
+    free(start);
+    TaskWorkerLoop(pPool, workerIndex);
+    return 0;
+}
+
+Error CreateTaskPool(DWORD numThreads, struct TaskPool* pPool)
+{
+    memset(pPool, 0, sizeof(struct TaskPool));
+    pPool->numThreads = numThreads ? numThreads : GetProcessorCount();
+
+#ifdef _WIN32
+    InitializeSRWLock(&pPool->lock);
+    InitializeConditionVariable(&pPool->taskReady);
+    InitializeConditionVariable(&pPool->allDone);
+    pPool->threads = (HANDLE*)calloc(pPool->numThreads, sizeof(HANDLE));
+#else
+    pthread_mutex_init(&pPool->lock, NULL);
+    pthread_cond_init(&pPool->taskReady, NULL);
+    pthread_cond_init(&pPool->allDone, NULL);
+    pPool->threads = (pthread_t*)calloc(pPool->numThreads, sizeof(pthread_t));
+#endif
+    pPool->queues = (struct TaskQueue*)calloc(pPool->numThreads, sizeof(struct TaskQueue));
+    if (!pPool->threads || !pPool->queues) {
+        FreeTaskPool(pPool);
+        return NewError(__FUNCTION__, -1, L"calloc failed; out of memory", 0);
+    }
+    for (DWORD i = 0; i < pPool->numThreads; i++) {
+#ifdef _WIN32
+        InitializeSRWLock(&pPool->queues[i].lock);
+#else
+        pthread_mutex_init(&pPool->queues[i].lock, NULL);
+#endif
+    }
+
+    Error e = NewNoError();
+    for (DWORD i = 0; i < pPool->numThreads; i++) {
+        struct TaskWorkerStart* start = (struct TaskWorkerStart*)malloc(sizeof(struct TaskWorkerStart));
+        if (!start) {
+            e = NewError(__FUNCTION__, -2, L"malloc failed; out of memory", 0);
+            break;
+        }
+        start->pPool = pPool;
+        start->workerIndex = i;
+#ifdef _WIN32
+        HANDLE hThread = CreateThread(NULL, 0, TaskWorkerThread, start, 0, NULL);
+        if (!hThread) {
+            e = NewError(__FUNCTION__, -3, L"CreateThread failed", GetLastError());
+            free(start);
+            break;
+        }
+        pPool->threads[pPool->numStarted++] = hThread;
+#else
+        int status = pthread_create(&pPool->threads[pPool->numStarted], NULL, TaskWorkerThread, start);
+        if (status != 0) {
+            e = NewError(__FUNCTION__, -3, L"pthread_create failed", (DWORD)status);
+            free(start);
+            break;
+        }
+        pPool->numStarted++;
+#endif
+    }
+
+    if (e.ContainsError) FreeTaskPool(pPool);
+    return e;
+}
+
+void FreeTaskPool(struct TaskPool* pPool)
+{
+    if (pPool->threads) {
+        LockPool(pPool);
+        pPool->shutdown = TRUE;
+        SignalPool(pPool, taskReady);
+        UnlockPool(pPool);
+
+        for (DWORD i = 0; i < pPool->numStarted; i++) {
+#ifdef _WIN32
+            WaitForSingleObject(pPool->threads[i], INFINITE);
+            CloseHandle(pPool->threads[i]);
+#else
+            pthread_join(pPool->threads[i], NULL);
+#endif
+        }
+    }
+
+    if (pPool->queues) {
+        for (DWORD i = 0; i < pPool->numThreads; i++) {
+            free(pPool->queues[i].tasks);
+#ifndef _WIN32
+            pthread_mutex_destroy(&pPool->queues[i].lock);
+#endif
+        }
+    }
+#ifndef _WIN32
+    pthread_cond_destroy(&pPool->allDone);
+    pthread_cond_destroy(&pPool->taskReady);
+    pthread_mutex_destroy(&pPool->lock);
+#endif
+    free(pPool->queues);
+    free(pPool->threads);
+    memset(pPool, 0, sizeof(struct TaskPool));
+}
+
+Error PushTask(struct TaskPool* pPool, DWORD workerIndex, TaskPoolTask task, void* context)
+{
+    if (workerIndex == TASK_POOL_EXTERNAL)
+        workerIndex = (DWORD)(InterlockedIncrement(&pPool->nextQueue) - 1) % pPool->numThreads;
+
+    // counted before it is queued, so WaitTaskPool cannot return while the task is on its way
+    InterlockedIncrement(&pPool->pendingTasks);
+
+    struct TaskQueue* queue = &pPool->queues[workerIndex];
+    BOOL queued = FALSE;
+    LockQueue(queue);
+    if (queue->count == queue->capacity) {
+        // unwrap the ring into the new buffer, oldest task first
+        DWORD capacity = queue->capacity ? queue->capacity * 2 : 64;
+        struct PendingTask* tasks = (struct PendingTask*)malloc(capacity * sizeof(struct PendingTask));
+        if (tasks) {
+            for (DWORD i = 0; i < queue->count; i++)
+                tasks[i] = queue->tasks[(queue->head + i) & (queue->capacity - 1)];
+            free(queue->tasks);
+            queue->tasks = tasks;
+            queue->capacity = capacity;
+            queue->head = 0;
+        }
+    }
+    if (queue->count < queue->capacity) {
+        queue->tasks[(queue->head + queue->count) & (queue->capacity - 1)].task = task;
+        queue->tasks[(queue->head + queue->count) & (queue->capacity - 1)].context = context;
+        queue->count++;
+        queued = TRUE;
+    }
+    UnlockQueue(queue);
+
+    if (!queued) {
+        FinishTask(pPool);
+        return NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0);
+    }
+
+    InterlockedIncrement(&pPool->queuedTasks);
+    LockPool(pPool);
+    SignalOneWorker(pPool, taskReady);
+    UnlockPool(pPool);
+    return NewNoError();
+}
+
+void WaitTaskPool(struct TaskPool* pPool)
+{
+    LockPool(pPool);
+    while (pPool->pendingTasks > 0)
+        WaitPool(pPool, allDone);
+    UnlockPool(pPool);
+}
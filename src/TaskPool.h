@@ -0,0 +1,72 @@
+#pragma once
+#include "Platform.h"
+#include "Error.h"
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+// Worker index of tasks pushed from outside the pool; they are spread over the queues round robin
+#define TASK_POOL_EXTERNAL ((DWORD)-1)
+
+struct TaskPool;
+
+// Runs one task. Tasks pushed with the given `workerIndex` go to the queue of the same worker.
+typedef void (*TaskPoolTask)(struct TaskPool* pPool, void* context, DWORD workerIndex);
+
+typedef struct PendingTask {
+    TaskPoolTask task;
+    void* context;
+} PendingTask;
+
+// A worker's queue: a ring buffer its owner pushes to and pops from at the back, while others steal from the front
+typedef struct TaskQueue {
+    struct PendingTask* tasks;
+    DWORD capacity;             // power of two
+    DWORD head;                 // oldest task
+    DWORD count;
+#ifdef _WIN32
+    SRWLOCK lock;
+#else
+    pthread_mutex_t lock;
+#endif
+} TaskQueue;
+
+/*
+ * Worker threads with a task queue each. A worker runs the newest task of its own queue first, so the tasks a task
+ * pushes run right after it on the same thread, and only steals the oldest task of another queue once its own is
+ * empty. Unlike a ThreadPool job, tasks can be pushed while others run, which suits pipelines whose stages wait
+ * on different things, such as downloads next to scans. The calling thread only waits.
+ */
+typedef struct TaskPool {
+    DWORD numThreads;
+    DWORD numStarted;
+    struct TaskQueue* queues;
+    volatile LONG queuedTasks;  // tasks waiting in any queue
+    volatile LONG pendingTasks; // tasks pushed and not finished yet
+    volatile LONG nextQueue;    // queue of the next task pushed from outside the pool
+    volatile LONG64 steals;     // tasks taken from another worker's queue
+    BOOL shutdown;
+#ifdef _WIN32
+    HANDLE* threads;
+    SRWLOCK lock;
+    CONDITION_VARIABLE taskReady;
+    CONDITION_VARIABLE allDone;
+#else
+    pthread_t* threads;
+    pthread_mutex_t lock;
+    pthread_cond_t taskReady;
+    pthread_cond_t allDone;
+#endif
+} TaskPool;
+
+// Starts `numThreads` workers, or one per processor when it is 0. Free after use with FreeTaskPool.
+Error CreateTaskPool(DWORD numThreads, struct TaskPool* pPool);
+// Stops the workers. Tasks still queued are dropped, so call WaitTaskPool first.
+void FreeTaskPool(struct TaskPool* pPool);
+
+// Queues a task. Pass the `workerIndex` a task was called with to keep its follow-up tasks on the same worker,
+// or TASK_POOL_EXTERNAL from any other thread.
+Error PushTask(struct TaskPool* pPool, DWORD workerIndex, TaskPoolTask task, void* context);
+
+// Returns once every task pushed so far, and every task they pushed in turn, has finished.
+void WaitTaskPool(struct TaskPool* pPool);
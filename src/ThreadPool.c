@@ -0,0 +1,185 @@
+#include "ThreadPool.h"
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+#define LockPool(pPool) AcquireSRWLockExclusive(&(pPool)->lock)
+#define UnlockPool(pPool) ReleaseSRWLockExclusive(&(pPool)->lock)
+#define WaitPool(pPool, condition) SleepConditionVariableSRW(&(pPool)->condition, &(pPool)->lock, INFINITE, 0)
+#define SignalPool(pPool, condition) WakeAllConditionVariable(&(pPool)->condition)
+#else
+#define LockPool(pPool) pthread_mutex_lock(&(pPool)->lock)
+#define UnlockPool(pPool) pthread_mutex_unlock(&(pPool)->lock)
+#define WaitPool(pPool, condition) pthread_cond_wait(&(pPool)->condition, &(pPool)->lock)
+#define SignalPool(pPool, condition) pthread_cond_broadcast(&(pPool)->condition)
+#endif
+
+DWORD GetProcessorCount(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    return systemInfo.dwNumberOfProcessors ? systemInfo.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (DWORD)count : 1;
+#endif
+}
+
+// Items are handed out one at a time, so threads that finish early keep taking work from slower ones
+static void RunItems(struct ThreadPool* pPool, DWORD workerIndex)
+{
+    for (;;) {
+        DWORD item = (DWORD)(InterlockedIncrement(&pPool->nextItem) - 1);
+        if (item >= pPool->numItems) break;
+        pPool->work(pPool->context, item, workerIndex);
+    }
+}
+
+typedef struct WorkerStart {
+    struct ThreadPool* pPool;
+    DWORD workerIndex;
+} WorkerStart;
+
+static void WorkerLoop(struct ThreadPool* pPool, DWORD workerIndex)
+{
+    ULONGLONG seenGeneration = 0;
+    for (;;) {
+        LockPool(pPool);
+        while (!pPool->shutdown && pPool->generation == seenGeneration)
+            WaitPool(pPool, jobReady);
+        if (pPool->shutdown) {
+            UnlockPool(pPool);
+            return;
+        }
+        seenGeneration = pPool->generation;
+        UnlockPool(pPool);
+
+        RunItems(pPool, workerIndex);
+
+        LockPool(pPool);
+        if (--pPool->activeWorkers == 0) SignalPool(pPool, jobDone);
+        UnlockPool(pPool);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI WorkerThread(LPVOID parameter)
+#else
+static void* WorkerThread(void* parameter)
+#endif
+{
+    struct WorkerStart* start = (struct WorkerStart*)parameter;
+    struct ThreadPool* pPool = start->pPool;
+    DWORD workerIndex = start->workerIndex;
+    free(start);
+    WorkerLoop(pPool, workerIndex);
+    return 0;
+}
+
+Error CreateThreadPool(DWORD numThreads, struct ThreadPool* pPool)
+{
+    memset(pPool, 0, sizeof(struct ThreadPool));
+    pPool->numThreads = numThreads ? numThreads : GetProcessorCount();
+    if (pPool->numThreads == 1)
+        return NewNoError();
+
+#ifdef _WIN32
+    InitializeSRWLock(&pPool->lock);
+    InitializeConditionVariable(&pPool->jobReady);
+    InitializeConditionVariable(&pPool->jobDone);
+    pPool->threads = (HANDLE*)calloc(pPool->numThreads - 1, sizeof(HANDLE));
+#else
+    pthread_mutex_init(&pPool->lock, NULL);
+    pthread_cond_init(&pPool->jobReady, NULL);
+    pthread_cond_init(&pPool->jobDone, NULL);
+    pPool->threads = (pthread_t*)calloc(pPool->numThreads - 1, sizeof(pthread_t));
+#endif
+    if (!pPool->threads) {
+        FreeThreadPool(pPool);
+        return NewError(__FUNCTION__, -1, L"calloc failed; out of memory", 0);
+    }
+
+    Error e = NewNoError();
+    for (DWORD i = 1; i < pPool->numThreads; i++) {
+        struct WorkerStart* start = (struct WorkerStart*)malloc(sizeof(struct WorkerStart));
+        if (!start) {
+            e = NewError(__FUNCTION__, -2, L"malloc failed; out of memory", 0);
+            break;
+        }
+        start->pPool = pPool;
+        start->workerIndex = i;
+#ifdef _WIN32
+        HANDLE hThread = CreateThread(NULL, 0, WorkerThread, start, 0, NULL);
+        if (!hThread) {
+            e = NewError(__FUNCTION__, -3, L"CreateThread failed", GetLastError());
+            free(start);
+            break;
+        }
+        pPool->threads[pPool->numWorkers++] = hThread;
+#else
+        int status = pthread_create(&pPool->threads[pPool->numWorkers], NULL, WorkerThread, start);
+        if (status != 0) {
+            e = NewError(__FUNCTION__, -3, L"pthread_create failed", (DWORD)status);
+            free(start);
+            break;
+        }
+        pPool->numWorkers++;
+#endif
+    }
+
+    if (e.ContainsError) FreeThreadPool(pPool);
+    return e;
+}
+
+void FreeThreadPool(struct ThreadPool* pPool)
+{
+    if (pPool->numThreads > 1) {
+        LockPool(pPool);
+        pPool->shutdown = TRUE;
+        SignalPool(pPool, jobReady);
+        UnlockPool(pPool);
+
+        for (DWORD i = 0; i < pPool->numWorkers; i++) {
+#ifdef _WIN32
+            WaitForSingleObject(pPool->threads[i], INFINITE);
+            CloseHandle(pPool->threads[i]);
+#else
+            pthread_join(pPool->threads[i], NULL);
+#endif
+        }
+#ifndef _WIN32
+        pthread_cond_destroy(&pPool->jobDone);
+        pthread_cond_destroy(&pPool->jobReady);
+        pthread_mutex_destroy(&pPool->lock);
+#endif
+    }
+    free(pPool->threads);
+    memset(pPool, 0, sizeof(struct ThreadPool));
+}
+
+void RunThreadPool(struct ThreadPool* pPool, ThreadPoolWork work, void* context, DWORD numItems)
+{
+    if (pPool->numWorkers == 0 || numItems <= 1) {
+        for (DWORD i = 0; i < numItems; i++) work(context, i, 0);
+        return;
+    }
+
+    LockPool(pPool);
+    pPool->work = work;
+    pPool->context = context;
+    pPool->numItems = numItems;
+    pPool->nextItem = 0;
+    pPool->activeWorkers = pPool->numWorkers;
+    pPool->generation++;
+    SignalPool(pPool, jobReady);
+    UnlockPool(pPool);
+
+    RunItems(pPool, 0);
+
+    LockPool(pPool);
+    while (pPool->activeWorkers > 0)
+        WaitPool(pPool, jobDone);
+    UnlockPool(pPool);
+}
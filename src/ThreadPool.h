@@ -0,0 +1,46 @@
+#pragma once
+#include "Platform.h"
+#include "Error.h"
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+// Processes item `itemIndex` of a job. `workerIndex` is below the pool's thread count and identifies the thread,
+// e.g. to pick per-thread scratch space.
+typedef void (*ThreadPoolWork)(void* context, DWORD itemIndex, DWORD workerIndex);
+
+/*
+ * A fixed set of worker threads that run one job at a time. The calling thread works on the job too, so a pool
+ * of one thread starts no threads and runs everything inline.
+ */
+typedef struct ThreadPool {
+    DWORD numThreads;
+    DWORD numWorkers;               // background threads, numThreads - 1 once started
+    ThreadPoolWork work;
+    void* context;
+    DWORD numItems;
+    volatile LONG nextItem;
+    DWORD activeWorkers;            // background threads still working on the current job
+    ULONGLONG generation;           // bumped for every job, so workers know a new one is ready
+    BOOL shutdown;
+#ifdef _WIN32
+    HANDLE* threads;
+    SRWLOCK lock;
+    CONDITION_VARIABLE jobReady;
+    CONDITION_VARIABLE jobDone;
+#else
+    pthread_t* threads;
+    pthread_mutex_t lock;
+    pthread_cond_t jobReady;
+    pthread_cond_t jobDone;
+#endif
+} ThreadPool;
+
+DWORD GetProcessorCount(void);
+
+// Starts a pool of `numThreads` threads, or one per processor when it is 0. Free after use with FreeThreadPool.
+Error CreateThreadPool(DWORD numThreads, struct ThreadPool* pPool);
+void FreeThreadPool(struct ThreadPool* pPool);
+
+// Calls `work` for every item in [0, numItems) across the pool and returns once all items are done.
+void RunThreadPool(struct ThreadPool* pPool, ThreadPoolWork work, void* context, DWORD numItems);
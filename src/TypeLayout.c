@@ -0,0 +1,175 @@
+#include "TypeLayout.h"
+
+// FNV-1a
+static DWORD HashName(const char* name)
+{
+    DWORD hash = 2166136261u;
+    for (; *name; name++) {
+        hash ^= (BYTE)*name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static char* DuplicateString(const char* s)
+{
+    size_t length = strlen(s) + 1;
+    char* copy = (char*)malloc(length);
+    if (copy) memcpy(copy, s, length);
+    return copy;
+}
+
+// Smallest power of two table that keeps the load factor at or below one half
+static DWORD GetBucketCount(DWORD numItems)
+{
+    DWORD numBuckets = 8;
+    while (numBuckets < numItems * 2) numBuckets *= 2;
+    return numBuckets;
+}
+
+Error InitTypeLayout(const char* name, DWORD size, struct TypeLayout* pLayout)
+{
+    memset(pLayout, 0, sizeof(struct TypeLayout));
+    pLayout->name = DuplicateString(name);
+    if (!pLayout->name)
+        return NewError(__FUNCTION__, -1, L"malloc failed; out of memory", 0);
+    pLayout->size = size;
+    return NewNoError();
+}
+
+Error AddTypeField(struct TypeLayout* pLayout, const char* name, const char* typeName, DWORD offset, DWORD size, DWORD bitPosition, DWORD bitLength)
+{
+    if (pLayout->numFields == pLayout->fieldsCapacity) {
+        DWORD capacity = pLayout->fieldsCapacity ? pLayout->fieldsCapacity * 2 : 16;
+        struct TypeField* fields = (struct TypeField*)realloc(pLayout->fields, capacity * sizeof(struct TypeField));
+        if (!fields)
+            return NewError(__FUNCTION__, -1, L"realloc failed; out of memory", 0);
+        pLayout->fields = fields;
+        pLayout->fieldsCapacity = capacity;
+    }
+
+    struct TypeField* field = &pLayout->fields[pLayout->numFields];
+    field->name = DuplicateString(name);
+    field->typeName = DuplicateString(typeName);
+    if (!field->name || !field->typeName) {
+        free(field->name);
+        free(field->typeName);
+        return NewError(__FUNCTION__, -2, L"malloc failed; out of memory", 0);
+    }
+    field->offset = offset;
+    field->size = size;
+    field->bitPosition = bitPosition;
+    field->bitLength = bitLength;
+    pLayout->numFields++;
+    return NewNoError();
+}
+
+Error FinishTypeLayout(struct TypeLayout* pLayout)
+{
+    DWORD numBuckets = GetBucketCount(pLayout->numFields);
+    DWORD* buckets = (DWORD*)calloc(numBuckets, sizeof(DWORD));
+    if (!buckets)
+        return NewError(__FUNCTION__, -1, L"calloc failed; out of memory", 0);
+
+    for (DWORD i = 0; i < pLayout->numFields; i++) {
+        DWORD bucket = HashName(pLayout->fields[i].name) & (numBuckets - 1);
+        BOOL duplicate = FALSE;
+        while (buckets[bucket] && !duplicate) {
+            duplicate = strcmp(pLayout->fields[buckets[bucket] - 1].name, pLayout->fields[i].name) == 0;
+            bucket = (bucket + 1) & (numBuckets - 1);
+        }
+        if (!duplicate) buckets[bucket] = i + 1;
+    }
+
+    free(pLayout->buckets);
+    pLayout->buckets = buckets;
+    pLayout->numBuckets = numBuckets;
+    return NewNoError();
+}
+
+void FreeTypeLayout(struct TypeLayout* pLayout)
+{
+    for (DWORD i = 0; i < pLayout->numFields; i++) {
+        free(pLayout->fields[i].name);
+        free(pLayout->fields[i].typeName);
+    }
+    free(pLayout->fields);
+    free(pLayout->buckets);
+    free(pLayout->name);
+    memset(pLayout, 0, sizeof(struct TypeLayout));
+}
+
+const struct TypeField* FindTypeField(const struct TypeLayout* pLayout, const char* name)
+{
+    if (!pLayout->numBuckets) return NULL;
+    for (DWORD bucket = HashName(name) & (pLayout->numBuckets - 1); pLayout->buckets[bucket]; bucket = (bucket + 1) & (pLayout->numBuckets - 1)) {
+        const struct TypeField* field = &pLayout->fields[pLayout->buckets[bucket] - 1];
+        if (strcmp(field->name, name) == 0) return field;
+    }
+    return NULL;
+}
+
+const struct TypeLayout* FindCachedTypeLayout(const struct TypeLayoutCache* pCache, const char* name)
+{
+    if (!pCache->numBuckets) return NULL;
+    for (DWORD bucket = HashName(name) & (pCache->numBuckets - 1); pCache->buckets[bucket]; bucket = (bucket + 1) & (pCache->numBuckets - 1)) {
+        const struct TypeLayout* layout = pCache->layouts[pCache->buckets[bucket] - 1];
+        if (strcmp(layout->name, name) == 0) return layout;
+    }
+    return NULL;
+}
+
+static void InsertCachedLayout(DWORD* buckets, DWORD numBuckets, const char* name, DWORD index)
+{
+    DWORD bucket = HashName(name) & (numBuckets - 1);
+    while (buckets[bucket]) bucket = (bucket + 1) & (numBuckets - 1);
+    buckets[bucket] = index + 1;
+}
+
+Error AddCachedTypeLayout(struct TypeLayoutCache* pCache, struct TypeLayout* pLayout, const struct TypeLayout** ppCached)
+{
+    if (pCache->numLayouts == pCache->layoutsCapacity) {
+        DWORD capacity = pCache->layoutsCapacity ? pCache->layoutsCapacity * 2 : 32;
+        struct TypeLayout** layouts = (struct TypeLayout**)realloc(pCache->layouts, capacity * sizeof(struct TypeLayout*));
+        if (!layouts)
+            return NewError(__FUNCTION__, -1, L"realloc failed; out of memory", 0);
+        pCache->layouts = layouts;
+        pCache->layoutsCapacity = capacity;
+    }
+
+    // grow the table before it gets more than half full
+    if ((pCache->numLayouts + 1) * 2 > pCache->numBuckets) {
+        DWORD numBuckets = GetBucketCount(pCache->numLayouts + 1);
+        DWORD* buckets = (DWORD*)calloc(numBuckets, sizeof(DWORD));
+        if (!buckets)
+            return NewError(__FUNCTION__, -2, L"calloc failed; out of memory", 0);
+        for (DWORD i = 0; i < pCache->numLayouts; i++)
+            InsertCachedLayout(buckets, numBuckets, pCache->layouts[i]->name, i);
+        free(pCache->buckets);
+        pCache->buckets = buckets;
+        pCache->numBuckets = numBuckets;
+    }
+
+    struct TypeLayout* cached = (struct TypeLayout*)malloc(sizeof(struct TypeLayout));
+    if (!cached)
+        return NewError(__FUNCTION__, -3, L"malloc failed; out of memory", 0);
+    *cached = *pLayout;
+    memset(pLayout, 0, sizeof(struct TypeLayout));
+
+    pCache->layouts[pCache->numLayouts] = cached;
+    InsertCachedLayout(pCache->buckets, pCache->numBuckets, cached->name, pCache->numLayouts);
+    pCache->numLayouts++;
+    *ppCached = cached;
+    return NewNoError();
+}
+
+void FreeTypeLayoutCache(struct TypeLayoutCache* pCache)
+{
+    for (DWORD i = 0; i < pCache->numLayouts; i++) {
+        FreeTypeLayout(pCache->layouts[i]);
+        free(pCache->layouts[i]);
+    }
+    free(pCache->layouts);
+    free(pCache->buckets);
+    memset(pCache, 0, sizeof(struct TypeLayoutCache));
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "Platform.h"
+#include "Error.h"
+
+// A data member of a struct, class or union
+typedef struct TypeField {
+    char* name;
+    char* typeName;     // C-like spelling, e.g. "_LIST_ENTRY", "unsigned long*" or "unsigned char[16]"
+    DWORD offset;
+    DWORD size;         // bytes of the member's type
+    DWORD bitPosition;  // first bit of a bit field within its storage unit
+    DWORD bitLength;    // bits of a bit field, 0 for other members
+} TypeField;
+
+/*
+ * The layout of one struct, class or union, with its fields in declaration order and an open addressing hash table
+ * over the field names, so looking up a field costs one hash instead of a walk over the children of the type.
+ */
+typedef struct TypeLayout {
+    char* name;
+    DWORD size;
+    struct TypeField* fields;
+    DWORD numFields;
+    DWORD fieldsCapacity;
+    DWORD* buckets;     // field index + 1, 0 for an empty bucket
+    DWORD numBuckets;   // power of two
+} TypeLayout;
+
+// Layouts looked up so far, by type name. Each type is enumerated once per PDB.
+typedef struct TypeLayoutCache {
+    struct TypeLayout** layouts;
+    DWORD numLayouts;
+    DWORD layoutsCapacity;
+    DWORD* buckets;     // layout index + 1, 0 for an empty bucket
+    DWORD numBuckets;
+} TypeLayoutCache;
+
+// Starts an empty layout. Add its fields with AddTypeField, then call FinishTypeLayout.
+Error InitTypeLayout(const char* name, DWORD size, struct TypeLayout* pLayout);
+Error AddTypeField(struct TypeLayout* pLayout, const char* name, const char* typeName, DWORD offset, DWORD size, DWORD bitPosition, DWORD bitLength);
+// Builds the field name table. Of two fields with the same name (anonymous unions), the first one is found.
+Error FinishTypeLayout(struct TypeLayout* pLayout);
+void FreeTypeLayout(struct TypeLayout* pLayout);
+
+// Returns the field, or NULL if the type has no field of that name.
+const struct TypeField* FindTypeField(const struct TypeLayout* pLayout, const char* name);
+
+// Returns the cached layout of the type, or NULL if it has not been added yet.
+const struct TypeLayout* FindCachedTypeLayout(const struct TypeLayoutCache* pCache, const char* name);
+// Moves a finished layout into the cache, which frees it in FreeTypeLayoutCache. `*ppCached` points to the copy.
+Error AddCachedTypeLayout(struct TypeLayoutCache* pCache, struct TypeLayout* pLayout, const struct TypeLayout** ppCached);
+void FreeTypeLayoutCache(struct TypeLayoutCache* pCache);